@@ -145,6 +145,8 @@ MANLINKS+=AG_Object.3:AG_LockVFS.3
 CATLINKS+=AG_Object.cat3:AG_LockVFS.cat3
 MANLINKS+=AG_Object.3:AG_UnlockVFS.3
 CATLINKS+=AG_Object.cat3:AG_UnlockVFS.cat3
+MANLINKS+=AG_Object.3:AG_RLockVFS.3
+CATLINKS+=AG_Object.cat3:AG_RLockVFS.cat3
 MANLINKS+=AG_Object.3:AG_ObjectSetName.3
 CATLINKS+=AG_Object.cat3:AG_ObjectSetName.cat3
 MANLINKS+=AG_Object.3:AG_ObjectSetNameS.3
@@ -271,6 +273,8 @@ MANLINKS+=AG_Timer.3:AG_TimerIsRunning.3
 CATLINKS+=AG_Timer.cat3:AG_TimerIsRunning.cat3
 MANLINKS+=AG_Timer.3:AG_ProcessTimeouts.3
 CATLINKS+=AG_Timer.cat3:AG_ProcessTimeouts.cat3
+MANLINKS+=AG_Timer.3:AG_ProcessTimeoutsNS.3
+CATLINKS+=AG_Timer.cat3:AG_ProcessTimeoutsNS.cat3
 MANLINKS+=AG_Config.3:AG_ConfigObject.3
 CATLINKS+=AG_Config.cat3:AG_ConfigObject.cat3
 MANLINKS+=AG_Config.3:AG_ConfigLoad.3
@@ -557,6 +561,78 @@ MANLINKS+=AG_Threads.3:AG_ThreadEqual.3
 CATLINKS+=AG_Threads.cat3:AG_ThreadEqual.cat3
 MANLINKS+=AG_Threads.3:AG_ThreadKey.3
 CATLINKS+=AG_Threads.cat3:AG_ThreadKey.cat3
+MANLINKS+=AG_Threads.3:AG_RWLock.3
+CATLINKS+=AG_Threads.cat3:AG_RWLock.cat3
+MANLINKS+=AG_Threads.3:AG_RWLockInit.3
+CATLINKS+=AG_Threads.cat3:AG_RWLockInit.cat3
+MANLINKS+=AG_Threads.3:AG_RWLockTryInit.3
+CATLINKS+=AG_Threads.cat3:AG_RWLockTryInit.cat3
+MANLINKS+=AG_Threads.3:AG_RWLockDestroy.3
+CATLINKS+=AG_Threads.cat3:AG_RWLockDestroy.cat3
+MANLINKS+=AG_Threads.3:AG_RWLockRdLock.3
+CATLINKS+=AG_Threads.cat3:AG_RWLockRdLock.cat3
+MANLINKS+=AG_Threads.3:AG_RWLockWrLock.3
+CATLINKS+=AG_Threads.cat3:AG_RWLockWrLock.cat3
+MANLINKS+=AG_Threads.3:AG_RWLockUnlock.3
+CATLINKS+=AG_Threads.cat3:AG_RWLockUnlock.cat3
+MANLINKS+=AG_Threads.3:AG_AtomicInt.3
+CATLINKS+=AG_Threads.cat3:AG_AtomicInt.cat3
+MANLINKS+=AG_Threads.3:AG_AtomicPtr.3
+CATLINKS+=AG_Threads.cat3:AG_AtomicPtr.cat3
+MANLINKS+=AG_Threads.3:AG_AtomicGet.3
+CATLINKS+=AG_Threads.cat3:AG_AtomicGet.cat3
+MANLINKS+=AG_Threads.3:AG_AtomicSet.3
+CATLINKS+=AG_Threads.cat3:AG_AtomicSet.cat3
+MANLINKS+=AG_Threads.3:AG_AtomicAdd.3
+CATLINKS+=AG_Threads.cat3:AG_AtomicAdd.cat3
+MANLINKS+=AG_Threads.3:AG_AtomicInc.3
+CATLINKS+=AG_Threads.cat3:AG_AtomicInc.cat3
+MANLINKS+=AG_Threads.3:AG_AtomicDec.3
+CATLINKS+=AG_Threads.cat3:AG_AtomicDec.cat3
+MANLINKS+=AG_Threads.3:AG_AtomicCAS.3
+CATLINKS+=AG_Threads.cat3:AG_AtomicCAS.cat3
+MANLINKS+=AG_Threads.3:AG_AtomicGetPtr.3
+CATLINKS+=AG_Threads.cat3:AG_AtomicGetPtr.cat3
+MANLINKS+=AG_Threads.3:AG_AtomicSetPtr.3
+CATLINKS+=AG_Threads.cat3:AG_AtomicSetPtr.cat3
+MANLINKS+=AG_Threads.3:AG_AtomicCASPtr.3
+CATLINKS+=AG_Threads.cat3:AG_AtomicCASPtr.cat3
+MANLINKS+=AG_Threads.3:AG_Once.3
+CATLINKS+=AG_Threads.cat3:AG_Once.cat3
+MANLINKS+=AG_Threads.3:AG_ThreadOnce.3
+CATLINKS+=AG_Threads.cat3:AG_ThreadOnce.cat3
+MANLINKS+=AG_Threads.3:AG_LockStat.3
+CATLINKS+=AG_Threads.cat3:AG_LockStat.cat3
+MANLINKS+=AG_Threads.3:AG_LockProfEnable.3
+CATLINKS+=AG_Threads.cat3:AG_LockProfEnable.cat3
+MANLINKS+=AG_Threads.3:AG_LockProfReset.3
+CATLINKS+=AG_Threads.cat3:AG_LockProfReset.cat3
+MANLINKS+=AG_Threads.3:AG_LockProfSetName.3
+CATLINKS+=AG_Threads.cat3:AG_LockProfSetName.cat3
+MANLINKS+=AG_Threads.3:AG_LockProfGetStats.3
+CATLINKS+=AG_Threads.cat3:AG_LockProfGetStats.cat3
+MANLINKS+=AG_Threads.3:AG_LockProfPercentile.3
+CATLINKS+=AG_Threads.cat3:AG_LockProfPercentile.cat3
+MANLINKS+=AG_Threads.3:AG_LockProfReport.3
+CATLINKS+=AG_Threads.cat3:AG_LockProfReport.cat3
+MANLINKS+=AG_Threads.3:AG_TaskGroup.3
+CATLINKS+=AG_Threads.cat3:AG_TaskGroup.cat3
+MANLINKS+=AG_Threads.3:AG_TaskInit.3
+CATLINKS+=AG_Threads.cat3:AG_TaskInit.cat3
+MANLINKS+=AG_Threads.3:AG_TaskDestroy.3
+CATLINKS+=AG_Threads.cat3:AG_TaskDestroy.cat3
+MANLINKS+=AG_Threads.3:AG_TaskWorkerCount.3
+CATLINKS+=AG_Threads.cat3:AG_TaskWorkerCount.cat3
+MANLINKS+=AG_Threads.3:AG_TaskGroupInit.3
+CATLINKS+=AG_Threads.cat3:AG_TaskGroupInit.cat3
+MANLINKS+=AG_Threads.3:AG_TaskGroupDestroy.3
+CATLINKS+=AG_Threads.cat3:AG_TaskGroupDestroy.cat3
+MANLINKS+=AG_Threads.3:AG_TaskRun.3
+CATLINKS+=AG_Threads.cat3:AG_TaskRun.cat3
+MANLINKS+=AG_Threads.3:AG_TaskWait.3
+CATLINKS+=AG_Threads.cat3:AG_TaskWait.cat3
+MANLINKS+=AG_Threads.3:AG_TaskParallelFor.3
+CATLINKS+=AG_Threads.cat3:AG_TaskParallelFor.cat3
 MANLINKS+=AG_Threads.3:AG_ThreadKeyCreate.3
 CATLINKS+=AG_Threads.cat3:AG_ThreadKeyCreate.cat3
 MANLINKS+=AG_Threads.3:AG_ThreadKeyTryCreate.3
@@ -1099,6 +1175,12 @@ MANLINKS+=AG_Time.3:AG_Delay.3
 CATLINKS+=AG_Time.cat3:AG_Delay.cat3
 MANLINKS+=AG_Time.3:AG_SetTimeOps.3
 CATLINKS+=AG_Time.cat3:AG_SetTimeOps.cat3
+MANLINKS+=AG_Time.3:AG_GetTimeNS.3
+CATLINKS+=AG_Time.cat3:AG_GetTimeNS.cat3
+MANLINKS+=AG_Time.3:AG_DelayNS.3
+CATLINKS+=AG_Time.cat3:AG_DelayNS.cat3
+MANLINKS+=AG_Time.3:AG_DelayUntilNS.3
+CATLINKS+=AG_Time.cat3:AG_DelayUntilNS.cat3
 MANLINKS+=AG_Tbl.3:AG_TblNew.3
 CATLINKS+=AG_Tbl.cat3:AG_TblNew.cat3
 MANLINKS+=AG_Tbl.3:AG_TblInit.3
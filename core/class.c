@@ -41,7 +41,7 @@ AG_Namespace    *agNamespaceTbl = NULL;		/* Registered namespaces */
 int              agNamespaceCount = 0;
 char           **agModuleDirs = NULL;		/* Module search directories */
 int              agModuleDirCount = 0;
-AG_Mutex	 agClassLock;			/* Lock on class table */
+AG_RWLock	 agClassLock;			/* Lock on class table */
 
 static void
 InitClass(AG_ObjectClass *cl, const char *hier, const char *libs)
@@ -86,7 +86,7 @@ AG_InitClassTbl(void)
 	if (AG_TblInsert(agClassTbl, "AG_Object", &V) == -1)
 		AG_FatalError(NULL);
 
-	AG_MutexInitRecursive(&agClassLock);
+	AG_RWLockInit(&agClassLock);
 }
 
 /*
@@ -111,7 +111,7 @@ AG_DestroyClassTbl(void)
 	AG_TblDestroy(agClassTbl);
 	free(agClassTbl); agClassTbl = NULL;
 	
-	AG_MutexDestroy(&agClassLock);
+	AG_RWLockDestroy(&agClassLock);
 }
 
 /* Convert a class specification in "Namespace1(Class1:Class2)[@lib]" format. */
@@ -233,7 +233,7 @@ AG_RegisterClass(void *p)
 	    cs.libs);
 #endif
 
-	AG_MutexLock(&agClassLock);
+	AG_RWLockWrLock(&agClassLock);
 
 	/* Insert into the class tree. */
 	if ((s = strrchr(cs.hier, ':')) != NULL) {
@@ -250,7 +250,7 @@ AG_RegisterClass(void *p)
 	if (AG_TblInsert(agClassTbl, cl->hier, &V) == -1)
 		AG_FatalError(NULL);
 
-	AG_MutexUnlock(&agClassLock);
+	AG_RWLockUnlock(&agClassLock);
 }
 
 /* Unregister an object class. */
@@ -261,7 +261,7 @@ AG_UnregisterClass(void *p)
 	AG_ObjectClass *clSuper = cl->super;
 	Uint h = AG_TblHash(agClassTbl, cl->hier);
 
-	AG_MutexLock(&agClassLock);
+	AG_RWLockWrLock(&agClassLock);
 	if (AG_TblExistsHash(agClassTbl, h, cl->hier)) {
 #ifdef AG_DEBUG_CORE
 		Debug(NULL, "Unregistering class: %s\n", cl->name);
@@ -273,7 +273,7 @@ AG_UnregisterClass(void *p)
 		/* Remove from the class table. */
 		AG_TblDeleteHash(agClassTbl, h, cl->hier);
 	}
-	AG_MutexUnlock(&agClassLock);
+	AG_RWLockUnlock(&agClassLock);
 }
 
 /*
@@ -295,12 +295,12 @@ AG_LookupClass(const char *inSpec)
 		return (NULL);
 
 	/* Look up the class table. */
-	AG_MutexLock(&agClassLock);
+	AG_RWLockRdLock(&agClassLock);
 	if ((V = AG_TblLookup(agClassTbl, cs.hier)) != NULL) {
-		AG_MutexUnlock(&agClassLock);
+		AG_RWLockUnlock(&agClassLock);
 		return ((AG_ObjectClass *)V->data.p);
 	}
-	AG_MutexUnlock(&agClassLock);
+	AG_RWLockUnlock(&agClassLock);
 
 	AG_SetError("No such class: %s", inSpec);
 	return (NULL);
@@ -363,10 +363,10 @@ AG_LoadClass(const char *classSpec)
 		return (NULL);
 	}
 	
-	AG_MutexLock(&agClassLock);
+	AG_RWLockWrLock(&agClassLock);
 
 	if ((cl = AG_LookupClass(cs.hier)) != NULL) {
-		AG_MutexUnlock(&agClassLock);
+		AG_RWLockUnlock(&agClassLock);
 		return (cl);
 	}
 	if (cs.libs[0] == '\0') {
@@ -407,13 +407,13 @@ AG_LoadClass(const char *classSpec)
 	}
 	AG_RegisterClass(pClass);
 
-	AG_MutexUnlock(&agClassLock);
+	AG_RWLockUnlock(&agClassLock);
 	return (pClass);
 fail:
 #ifdef AG_DEBUG_CORE
 	Debug(NULL, "%s\n", AG_GetError());
 #endif
-	AG_MutexUnlock(&agClassLock);
+	AG_RWLockUnlock(&agClassLock);
 	return (pClass);
 }
 
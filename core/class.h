@@ -59,7 +59,7 @@ extern AG_Namespace   *agNamespaceTbl;		/* Registered namespaces */
 extern int             agNamespaceCount;
 extern char           **agModuleDirs;		/* Module search directories */
 extern int              agModuleDirCount;
-extern AG_Mutex	        agClassLock;		/* Lock on class table */
+extern AG_RWLock	        agClassLock;		/* Lock on class table */
 
 void            AG_InitClassTbl(void);
 void            AG_DestroyClassTbl(void);
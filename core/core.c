@@ -38,6 +38,8 @@
 #include <agar/config/have_gettimeofday.h>
 #include <agar/config/have_select.h>
 #include <agar/config/have_db4.h>
+#include <agar/config/have_mysql.h>
+#include <agar/config/have_sys_mman_h.h>
 #include <agar/config/have_getpwuid.h>
 #include <agar/config/have_getuid.h>
 #include <agar/config/have_getaddrinfo.h>
@@ -63,6 +65,10 @@
 #ifdef AG_THREADS
 pthread_mutexattr_t agRecursiveMutexAttr;	/* Recursive mutex attributes */
 AG_Thread agEventThread;			/* Event-processing thread */
+AG_ThreadKey agThreadTokenKey;			/* For AG_ThreadToken() */
+# ifdef AG_ATOMICS_MUTEX
+AG_Mutex agAtomicLock = AG_MUTEX_INITIALIZER;	/* For atomic operations */
+# endif
 #endif
 
 AG_Config *agConfig = NULL;			/* Global Agar config data */
@@ -100,6 +106,7 @@ AG_InitCore(const char *progname, Uint flags)
 
 	if (AG_InitErrorSubsystem() == -1 ||
 	    AG_InitStringSubsystem() == -1 ||
+	    AG_InitObjectSubsystem() == -1 ||
 	    AG_InitEventSubsystem(flags) == -1) {
 		return (-1);
 	}
@@ -119,17 +126,28 @@ AG_InitCore(const char *progname, Uint flags)
 	pthread_mutexattr_settype(&agRecursiveMutexAttr,
 	    PTHREAD_MUTEX_RECURSIVE);
 # endif
+	AG_ThreadKeyCreate(&agThreadTokenKey, free);
 	AG_MutexInitRecursive(&agDSOLock);
+# ifdef AG_LOCKPROF
+	AG_LockProfSetName(&agDSOLock, "agDSOLock");
+# endif
 #endif /* AG_THREADS */
 
 	/* Register the object classes from ag_core. */
 	AG_InitClassTbl();
 	AG_RegisterClass(&agConfigClass);
 	AG_RegisterClass(&agDbClass);
+	AG_RegisterClass(&agDbObjectClass);
 #ifdef HAVE_DB4
 	AG_RegisterClass(&agDbHashClass);
 	AG_RegisterClass(&agDbBtreeClass);
 #endif
+#ifdef HAVE_MYSQL
+	AG_RegisterClass(&agDbMySQLClass);
+#endif
+#ifdef HAVE_SYS_MMAN_H
+	AG_RegisterClass(&agDbLogClass);
+#endif
 
 	/* Select the default AG_Time(3) backend. */
 #if defined(_WIN32)
@@ -219,10 +237,15 @@ AG_Destroy(void)
 	AG_ObjectDestroy(agConfig);
 	agConfig = NULL;
 
+	AG_TaskDestroy();
+#ifdef HAVE_MYSQL
+	AG_DbMySQLDestroy();
+#endif
 	AG_DataSourceDestroySubsystem();
 	AG_DestroyTimers();
 
 #ifdef AG_NETWORK
+	AG_NetResolverDestroy();
 	if (agNetOps != NULL && agNetOps->destroy != NULL) {
 		agNetOps->destroy();
 	}
@@ -236,11 +259,32 @@ AG_Destroy(void)
 	AG_MutexDestroy(&agDSOLock);
 #endif
 	AG_DestroyEventSubsystem();
+	AG_DestroyObjectSubsystem();
+#ifdef AG_THREADS
+	free(AG_ThreadKeyGet(agThreadTokenKey));
+	AG_ThreadKeyDelete(agThreadTokenKey);
+#endif
 	AG_DestroyStringSubsystem();
 	AG_DestroyErrorSubsystem();
 	Free(agProgName); agProgName = NULL;
 }
 
+#ifdef AG_THREADS
+/*
+ * Allocate the token returned by AG_ThreadToken() for the calling thread.
+ * It is released when the thread exits (or by AG_Destroy()).
+ */
+void *
+AG_ThreadTokenNew(void)
+{
+	void *tok;
+
+	tok = Malloc(1);
+	AG_ThreadKeySet(agThreadTokenKey, tok);
+	return (tok);
+}
+#endif /* AG_THREADS */
+
 void
 AG_GetVersion(AG_AgarVersion *ver)
 {
@@ -30,7 +30,10 @@
 #include <agar/core/dir.h>
 #include <agar/core/dso.h>
 #include <agar/core/db.h>
+#include <agar/core/dbobject.h>
 #include <agar/core/getopt.h>
+#include <agar/core/task.h>
+#include <agar/core/lockprof.h>
 #include <agar/core/exec.h>
 #include <agar/core/user.h>
 #include <agar/core/net.h>
@@ -24,8 +24,34 @@
  */
 
 #include <agar/config/have_db4.h>
+#include <agar/config/have_mysql.h>
+#include <agar/config/have_sys_mman_h.h>
 #include <agar/core/core.h>
 
+/* Release a buffered transaction operation. */
+static void
+FreeTxnOp(AG_DbTxnOp *op)
+{
+	Free(op->key.data);
+	Free(op->val.data);
+	free(op);
+}
+
+/* Discard all operations buffered by an emulated transaction. */
+static void
+ClearTxnOps(AG_Db *db)
+{
+	AG_DbTxnOp *op, *opNext;
+
+	for (op = TAILQ_FIRST(&db->txnOps);
+	     op != TAILQ_END(&db->txnOps);
+	     op = opNext) {
+		opNext = TAILQ_NEXT(op, ops);
+		FreeTxnOp(op);
+	}
+	TAILQ_INIT(&db->txnOps);
+}
+
 /* Create a new database handle for the given database backend. */
 AG_Db *
 AG_DbNew(const char *backend)
@@ -34,18 +60,25 @@ AG_DbNew(const char *backend)
 	AG_DbClass *dbc = NULL;
 
 #ifdef HAVE_DB4
-	/* XXX */
-	if (strcmp(backend, "hash")) {
+	if (strcmp(backend, "hash") == 0) {
 		dbc = &agDbHashClass;
-	} else if (strcmp(backend, "btree")) {
+	} else if (strcmp(backend, "btree") == 0) {
 		dbc = &agDbBtreeClass;
 	}
+#endif
+#ifdef HAVE_MYSQL
+	if (strcmp(backend, "mysql") == 0)
+		dbc = &agDbMySQLClass;
+#endif
+#ifdef HAVE_SYS_MMAN_H
+	if (strcmp(backend, "log") == 0)
+		dbc = &agDbLogClass;
 #endif
 	if (dbc == NULL) {
 		AG_SetError("No such database backend: %s", backend);
 		return (NULL);
 	}
-	if ((db = TryMalloc(sizeof(AG_Db))) == NULL) {
+	if ((db = TryMalloc(AGCLASS(dbc)->size)) == NULL) {
 		return (NULL);
 	}
 	AG_ObjectInit(db, dbc);
@@ -83,6 +116,17 @@ AG_DbClose(AG_Db *db)
 	AG_DbClass *dbc = AGDB_CLASS(db);
 	
 	AG_ObjectLock(db);
+	if (db->flags & AG_DB_TXN) {
+		if (db->flags & AG_DB_TXN_EMUL) {
+			ClearTxnOps(db);
+		} else {
+			(void)dbc->abort(db);
+		}
+		db->flags &= ~(AG_DB_TXN|AG_DB_TXN_EMUL);
+	}
+	if (db->objCache != NULL) {
+		AG_DbObjectCacheDestroy(db);		/* Flushes queued writes */
+	}
 	if (db->flags & AG_DB_OPEN) {
 		if (dbc->close != NULL) {
 			dbc->close(db);
@@ -105,12 +149,320 @@ AG_DbSync(AG_Db *db)
 	return (rv);
 }
 
+/*
+ * Begin a transaction. Uses the backend's native transactions if
+ * available. Otherwise, writes are buffered in memory until
+ * AG_DbCommit() and discarded by AG_DbAbort().
+ */
+int
+AG_DbBegin(AG_Db *db)
+{
+	AG_DbClass *dbc = AGDB_CLASS(db);
+	int rv;
+
+	AG_ObjectLock(db);
+	if (db->flags & AG_DB_TXN) {
+		AG_SetError(_("Transaction already in progress"));
+		goto fail;
+	}
+	if (dbc->begin != NULL) {
+		/* Returns 1 if unsupported in the current configuration. */
+		if ((rv = dbc->begin(db)) == -1) {
+			goto fail;
+		}
+		if (rv == 0) {
+			db->flags |= AG_DB_TXN;
+			goto out;
+		}
+	}
+	TAILQ_INIT(&db->txnOps);
+	db->flags |= (AG_DB_TXN|AG_DB_TXN_EMUL);
+out:
+	AG_ObjectUnlock(db);
+	return (0);
+fail:
+	AG_ObjectUnlock(db);
+	return (-1);
+}
+
+/* Apply a batch of puts or deletes through the backend. */
+static int
+ApplyBatch(AG_Db *db, enum ag_db_txn_op_type type, const AG_Dbt *keys,
+    const AG_Dbt *vals, Uint n)
+{
+	AG_DbClass *dbc = AGDB_CLASS(db);
+	Uint i;
+
+	if (type == AG_DB_TXN_PUT) {
+		if (dbc->putBatch != NULL) {
+			return dbc->putBatch(db, keys, vals, n);
+		}
+		for (i = 0; i < n; i++) {
+			if (dbc->put(db, &keys[i], &vals[i]) == -1)
+				return (-1);
+		}
+	} else {
+		if (dbc->delBatch != NULL) {
+			return dbc->delBatch(db, keys, n);
+		}
+		for (i = 0; i < n; i++) {
+			if (dbc->del(db, &keys[i]) == -1)
+				return (-1);
+		}
+	}
+	return (0);
+}
+
+/*
+ * Apply the operations buffered by an emulated transaction in order,
+ * grouping runs of consecutive puts or deletes into batches.
+ */
+static int
+CommitTxnOps(AG_Db *db)
+{
+	AG_Dbt keys[AG_DB_BATCH_MAX], vals[AG_DB_BATCH_MAX];
+	enum ag_db_txn_op_type type;
+	AG_DbTxnOp *op;
+	Uint n;
+
+	for (op = TAILQ_FIRST(&db->txnOps); op != NULL; ) {
+		type = op->type;
+		for (n = 0;
+		     op != NULL && op->type == type && n < AG_DB_BATCH_MAX;
+		     op = TAILQ_NEXT(op, ops), n++) {
+			keys[n] = op->key;
+			vals[n] = op->val;
+		}
+		if (ApplyBatch(db, type, keys, vals, n) == -1)
+			return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Commit the current transaction. If an emulated transaction fails
+ * part way through, the operations already applied are not undone.
+ */
+int
+AG_DbCommit(AG_Db *db)
+{
+	AG_DbClass *dbc = AGDB_CLASS(db);
+	int rv;
+
+	AG_ObjectLock(db);
+	if (!(db->flags & AG_DB_TXN)) {
+		AG_SetError(_("No transaction in progress"));
+		AG_ObjectUnlock(db);
+		return (-1);
+	}
+	if (db->flags & AG_DB_TXN_EMUL) {
+		rv = CommitTxnOps(db);
+		ClearTxnOps(db);
+	} else {
+		rv = dbc->commit(db);
+	}
+	db->flags &= ~(AG_DB_TXN|AG_DB_TXN_EMUL);
+	AG_ObjectUnlock(db);
+	return (rv);
+}
+
+/* Abort the current transaction, discarding its changes. */
+int
+AG_DbAbort(AG_Db *db)
+{
+	AG_DbClass *dbc = AGDB_CLASS(db);
+	int rv = 0;
+
+	AG_ObjectLock(db);
+	if (!(db->flags & AG_DB_TXN)) {
+		AG_SetError(_("No transaction in progress"));
+		AG_ObjectUnlock(db);
+		return (-1);
+	}
+	if (db->flags & AG_DB_TXN_EMUL) {
+		ClearTxnOps(db);
+	} else {
+		rv = dbc->abort(db);
+	}
+	db->flags &= ~(AG_DB_TXN|AG_DB_TXN_EMUL);
+	AG_ObjectUnlock(db);
+	return (rv);
+}
+
+/* Return the most recent buffered operation on the given key. */
+static AG_DbTxnOp *
+FindTxnOp(AG_Db *db, const AG_Dbt *key)
+{
+	AG_DbTxnOp *op;
+
+	TAILQ_FOREACH_REVERSE(op, &db->txnOps, ag_db_txn_opq, ops) {
+		if (op->key.size == key->size &&
+		    memcmp(op->key.data, key->data, key->size) == 0)
+			return (op);
+	}
+	return (NULL);
+}
+
+/* Buffer an operation in an emulated transaction. */
+static int
+AddTxnOp(AG_Db *db, enum ag_db_txn_op_type type, const AG_Dbt *key,
+    const AG_Dbt *val)
+{
+	AG_DbTxnOp *op;
+
+	if ((op = TryMalloc(sizeof(AG_DbTxnOp))) == NULL) {
+		return (-1);
+	}
+	op->type = type;
+	op->val.data = NULL;
+	op->val.size = 0;
+	if ((op->key.data = TryMalloc(key->size)) == NULL) {
+		free(op);
+		return (-1);
+	}
+	memcpy(op->key.data, key->data, key->size);
+	op->key.size = key->size;
+	if (val != NULL) {
+		if ((op->val.data = TryMalloc(val->size)) == NULL) {
+			FreeTxnOp(op);
+			return (-1);
+		}
+		memcpy(op->val.data, val->data, val->size);
+		op->val.size = val->size;
+	}
+	TAILQ_INSERT_TAIL(&db->txnOps, op, ops);
+	return (0);
+}
+
+/*
+ * Access routines used by AG_DbExists(), AG_DbGet(), AG_DbPut() and
+ * AG_DbDel() while an emulated transaction is in progress. Reads see
+ * the transaction's own uncommitted writes.
+ */
+int
+AG_DbTxnExists(AG_Db *db, const AG_Dbt *key)
+{
+	AG_DbTxnOp *op;
+
+	if ((op = FindTxnOp(db, key)) != NULL) {
+		return (op->type == AG_DB_TXN_PUT);
+	}
+	return AGDB_CLASS(db)->exists(db, key);
+}
+int
+AG_DbTxnGet(AG_Db *db, const AG_Dbt *key, AG_Dbt *val)
+{
+	AG_DbTxnOp *op;
+
+	if ((op = FindTxnOp(db, key)) == NULL) {
+		return AGDB_CLASS(db)->get(db, key, val);
+	}
+	if (op->type == AG_DB_TXN_DEL) {
+		AG_SetError(_("No such key"));
+		return (-1);
+	}
+	if ((val->data = TryMalloc(op->val.size)) == NULL) {
+		return (-1);
+	}
+	memcpy(val->data, op->val.data, op->val.size);
+	val->size = op->val.size;
+	return (0);
+}
+int
+AG_DbTxnPut(AG_Db *db, const AG_Dbt *key, const AG_Dbt *val)
+{
+	return AddTxnOp(db, AG_DB_TXN_PUT, key, val);
+}
+int
+AG_DbTxnDel(AG_Db *db, const AG_Dbt *key)
+{
+	return AddTxnOp(db, AG_DB_TXN_DEL, key, NULL);
+}
+
+/*
+ * Retrieve multiple entries. Keys which are not found are returned with
+ * a NULL data pointer and a size of 0.
+ */
+int
+AG_DbGetBatch(AG_Db *db, const AG_Dbt *keys, AG_Dbt *vals, Uint n)
+{
+	AG_DbClass *dbc = AGDB_CLASS(db);
+	Uint i;
+	int rv = 0;
+
+	AG_ObjectLock(db);
+	if (dbc->getBatch != NULL && !(db->flags & AG_DB_TXN_EMUL)) {
+		rv = dbc->getBatch(db, keys, vals, n);
+		goto out;
+	}
+	for (i = 0; i < n; i++) {
+		if (!((db->flags & AG_DB_TXN_EMUL) ?
+		    AG_DbTxnExists(db, &keys[i]) :
+		    dbc->exists(db, &keys[i]))) {
+			vals[i].data = NULL;
+			vals[i].size = 0;
+			continue;
+		}
+		if (((db->flags & AG_DB_TXN_EMUL) ?
+		    AG_DbTxnGet(db, &keys[i], &vals[i]) :
+		    dbc->get(db, &keys[i], &vals[i])) == -1) {
+			rv = -1;
+			break;
+		}
+	}
+out:
+	AG_ObjectUnlock(db);
+	return (rv);
+}
+
+/* Write multiple entries. */
+int
+AG_DbPutBatch(AG_Db *db, const AG_Dbt *keys, const AG_Dbt *vals, Uint n)
+{
+	Uint i;
+	int rv = 0;
+
+	AG_ObjectLock(db);
+	if (db->flags & AG_DB_TXN_EMUL) {
+		for (i = 0; i < n; i++) {
+			if ((rv = AG_DbTxnPut(db, &keys[i], &vals[i])) == -1)
+				break;
+		}
+	} else {
+		rv = ApplyBatch(db, AG_DB_TXN_PUT, keys, vals, n);
+	}
+	AG_ObjectUnlock(db);
+	return (rv);
+}
+
+/* Delete multiple entries. */
+int
+AG_DbDelBatch(AG_Db *db, const AG_Dbt *keys, Uint n)
+{
+	Uint i;
+	int rv = 0;
+
+	AG_ObjectLock(db);
+	if (db->flags & AG_DB_TXN_EMUL) {
+		for (i = 0; i < n; i++) {
+			if ((rv = AG_DbTxnDel(db, &keys[i])) == -1)
+				break;
+		}
+	} else {
+		rv = ApplyBatch(db, AG_DB_TXN_DEL, keys, NULL, n);
+	}
+	AG_ObjectUnlock(db);
+	return (rv);
+}
+
 static void
 Init(void *obj)
 {
 	AG_Db *db = obj;
 
 	db->flags = 0;
+	TAILQ_INIT(&db->txnOps);
+	db->objCache = NULL;
 }
 
 AG_DbClass agDbClass = {
@@ -135,5 +487,12 @@ AG_DbClass agDbClass = {
 	NULL,			/* exists */
 	NULL,			/* get */
 	NULL,			/* put */
-	NULL			/* del */
+	NULL,			/* del */
+	NULL,			/* iterate */
+	NULL,			/* begin */
+	NULL,			/* commit */
+	NULL,			/* abort */
+	NULL,			/* getBatch */
+	NULL,			/* putBatch */
+	NULL			/* delBatch */
 };
@@ -5,6 +5,9 @@
 #include <agar/core/begin.h>
 
 struct ag_db;
+struct ag_dbobject_cache;
+
+#define AG_DB_BATCH_MAX	256		/* Records per backend batch call */
 
 /* Database data item (e.g., key or value) */
 typedef struct ag_dbt {
@@ -35,15 +38,36 @@ typedef struct ag_db_class {
 	int  (*put)(void *, const AG_Dbt *, const AG_Dbt *);
 	int  (*del)(void *, const AG_Dbt *);
 	int  (*iterate)(void *, AG_DbIterateFn, void *);
+	int  (*begin)(void *);
+	int  (*commit)(void *);
+	int  (*abort)(void *);
+	int  (*getBatch)(void *, const AG_Dbt *, AG_Dbt *, Uint);
+	int  (*putBatch)(void *, const AG_Dbt *, const AG_Dbt *, Uint);
+	int  (*delBatch)(void *, const AG_Dbt *, Uint);
 } AG_DbClass;
 
 #define AGDB_CLASS(db) ((AG_DbClass *)AGOBJECT(db)->cls)
 
+/* Operation buffered by an emulated transaction. */
+typedef struct ag_db_txn_op {
+	enum ag_db_txn_op_type {
+		AG_DB_TXN_PUT,
+		AG_DB_TXN_DEL
+	} type;
+	AG_Dbt key;
+	AG_Dbt val;
+	AG_TAILQ_ENTRY(ag_db_txn_op) ops;
+} AG_DbTxnOp;
+
 typedef struct ag_db {
 	struct ag_object _inherit;
 	Uint flags;
 #define AG_DB_OPEN	0x01		/* Database is open */
 #define AG_DB_READONLY	0x02		/* Open in read-only mode */
+#define AG_DB_TXN	0x04		/* Transaction in progress */
+#define AG_DB_TXN_EMUL	0x08		/* Transaction is emulated */
+	AG_TAILQ_HEAD(ag_db_txn_opq, ag_db_txn_op) txnOps; /* Buffered ops */
+	struct ag_dbobject_cache *objCache;	/* AG_DbObject cache (or NULL) */
 } AG_Db;
 
 #define AGDB(p) ((AG_Db *)(p))
@@ -53,12 +77,26 @@ extern AG_DbClass agDbClass;
 extern AG_DbClass agDbHashClass;
 extern AG_DbClass agDbBtreeClass;
 extern AG_DbClass agDbMySQLClass;
+extern AG_DbClass agDbLogClass;
 
 AG_Db       *AG_DbNew(const char *);
 int          AG_DbOpen(AG_Db *, const char *, Uint);
 void         AG_DbClose(AG_Db *);
 int          AG_DbSync(AG_Db *);
 
+int          AG_DbBegin(AG_Db *);
+int          AG_DbCommit(AG_Db *);
+int          AG_DbAbort(AG_Db *);
+int          AG_DbGetBatch(AG_Db *, const AG_Dbt *, AG_Dbt *, Uint);
+int          AG_DbPutBatch(AG_Db *, const AG_Dbt *, const AG_Dbt *, Uint);
+int          AG_DbDelBatch(AG_Db *, const AG_Dbt *, Uint);
+void         AG_DbMySQLDestroy(void);
+
+int          AG_DbTxnExists(AG_Db *, const AG_Dbt *);
+int          AG_DbTxnGet(AG_Db *, const AG_Dbt *, AG_Dbt *);
+int          AG_DbTxnPut(AG_Db *, const AG_Dbt *, const AG_Dbt *);
+int          AG_DbTxnDel(AG_Db *, const AG_Dbt *);
+
 /* Test for existence of a key. */
 static __inline__ int
 AG_DbExists(AG_Db *db, AG_Dbt *key)
@@ -67,7 +105,8 @@ AG_DbExists(AG_Db *db, AG_Dbt *key)
 	int rv;
 
 	AG_ObjectLock(db);
-	rv = dbc->exists(db, key);
+	rv = (db->flags & AG_DB_TXN_EMUL) ? AG_DbTxnExists(db, key) :
+	                                    dbc->exists(db, key);
 	AG_ObjectUnlock(db);
 	return (rv);
 }
@@ -80,7 +119,8 @@ AG_DbGet(AG_Db *db, const AG_Dbt *key, AG_Dbt *val)
 	int rv;
 
 	AG_ObjectLock(db);
-	rv = dbc->get(db, key, val);
+	rv = (db->flags & AG_DB_TXN_EMUL) ? AG_DbTxnGet(db, key, val) :
+	                                    dbc->get(db, key, val);
 	AG_ObjectUnlock(db);
 	return (rv);
 }
@@ -93,7 +133,8 @@ AG_DbPut(AG_Db *db, const AG_Dbt *key, const AG_Dbt *val)
 	int rv;
 
 	AG_ObjectLock(db);
-	rv = dbc->put(db, key, val);
+	rv = (db->flags & AG_DB_TXN_EMUL) ? AG_DbTxnPut(db, key, val) :
+	                                    dbc->put(db, key, val);
 	AG_ObjectUnlock(db);
 	return (rv);
 }
@@ -106,7 +147,8 @@ AG_DbDel(AG_Db *db, const AG_Dbt *key)
 	int rv;
 
 	AG_ObjectLock(db);
-	rv = dbc->del(db, key);
+	rv = (db->flags & AG_DB_TXN_EMUL) ? AG_DbTxnDel(db, key) :
+	                                    dbc->del(db, key);
 	AG_ObjectUnlock(db);
 	return (rv);
 }
@@ -31,9 +31,16 @@
 
 #include <db.h>
 
+/* Bulk put and delete (DB_MULTIPLE, DB_MULTIPLE_KEY) appeared in 4.8. */
+#if (DB_VERSION_MAJOR > 4) || (DB_VERSION_MAJOR == 4 && DB_VERSION_MINOR >= 8)
+# define AG_DB_BDB_BULK
+#endif
+
 typedef struct ag_db_hash_bt {
 	struct ag_db _inherit;
 	DB *pDB;
+	DB_ENV *pEnv;			/* Transactional environment (or NULL) */
+	DB_TXN *pTxn;			/* Current transaction (or NULL) */
 } AG_DbHashBT;
 
 static const struct {
@@ -63,16 +70,65 @@ Init(void *obj)
 	AG_DbHashBT *db = obj;
 	int i;
 
+	db->pDB = NULL;
+	db->pEnv = NULL;
+	db->pTxn = NULL;
+
 	for (i = 0; i < bdbOptionCount; i++)
 		AG_SetInt(db, bdbOptions[i].name, 0);
 	
 	AG_SetInt(db, "db-create", 1);
+	AG_SetInt(db, "db-txn", 0);
+	AG_SetString(db, "db-home", NULL);
+}
+
+/*
+ * Create a transactional environment. Unless "db-home" is set, the
+ * environment lives in the directory containing the database file, and
+ * *file is updated to the path relative to it.
+ */
+static int
+OpenEnv(AG_DbHashBT *db, const char *path, const char **file)
+{
+	char home[AG_PATHNAME_MAX], *s;
+	Uint32 envFlags = DB_CREATE | DB_INIT_TXN | DB_INIT_LOCK |
+	                  DB_INIT_LOG | DB_INIT_MPOOL | DB_RECOVER;
+	int rv;
+
+	if ((s = AG_GetStringP(db, "db-home")) != NULL) {
+		Strlcpy(home, s, sizeof(home));
+	} else if ((s = strrchr(path, '/')) != NULL) {
+		if (s == path) {
+			Strlcpy(home, "/", sizeof(home));
+		} else {
+			Strlcpy(home, path, sizeof(home));
+			home[s - path] = '\0';
+		}
+		*file = &s[1];
+	} else {
+		Strlcpy(home, ".", sizeof(home));
+	}
+	if (AG_GetInt(db, "db-threaded")) {
+		envFlags |= DB_THREAD;
+	}
+	if ((rv = db_env_create(&db->pEnv, 0)) != 0) {
+		AG_SetError("db_env_create: %s", db_strerror(rv));
+		return (-1);
+	}
+	if ((rv = db->pEnv->open(db->pEnv, home, envFlags, 0)) != 0) {
+		AG_SetError("db_env_open %s: %s", home, db_strerror(rv));
+		db->pEnv->close(db->pEnv, 0);
+		db->pEnv = NULL;
+		return (-1);
+	}
+	return (0);
 }
 
 static int
 Open(void *obj, const char *path, Uint flags)
 {
 	AG_DbHashBT *db = obj;
+	const char *file = path;
 	Uint32 dbFlags = 0;
 	int i, rv;
 	DBTYPE dbtype;
@@ -82,9 +138,15 @@ Open(void *obj, const char *path, Uint flags)
 	} else {
 		dbtype = DB_BTREE;
 	}
-	if ((rv = db_create(&db->pDB, NULL, 0)) != 0) {
+	if (AG_GetInt(db, "db-txn")) {
+		if (OpenEnv(db, path, &file) == -1) {
+			return (-1);
+		}
+		dbFlags |= DB_AUTO_COMMIT;
+	}
+	if ((rv = db_create(&db->pDB, db->pEnv, 0)) != 0) {
 		AG_SetError("db_create: %s", db_strerror(rv));
-		return (-1);
+		goto fail_env;
 	}
 	for (i = 0; i < bdbOptionCount; i++) {
 		if (AG_GetInt(db, bdbOptions[i].name))
@@ -93,12 +155,20 @@ Open(void *obj, const char *path, Uint flags)
 	if (flags & AG_DB_READONLY) {
 		dbFlags |= DB_RDONLY;
 	}
-	rv = db->pDB->open(db->pDB, NULL, path, NULL, dbtype, dbFlags, 0);
+	rv = db->pDB->open(db->pDB, NULL, file, NULL, dbtype, dbFlags, 0);
 	if (rv != 0) {
 		AG_SetError("db_open %s: %s", path, db_strerror(rv));
-		return (-1);
+		db->pDB->close(db->pDB, 0);
+		db->pDB = NULL;
+		goto fail_env;
 	}
 	return (0);
+fail_env:
+	if (db->pEnv != NULL) {
+		db->pEnv->close(db->pEnv, 0);
+		db->pEnv = NULL;
+	}
+	return (-1);
 }
 
 static void
@@ -107,8 +177,21 @@ Close(void *obj)
 	AG_DbHashBT *db = obj;
 	int rv;
 	
-	if ((rv = db->pDB->close(db->pDB, 0)) != 0)
+	if (db->pTxn != NULL) {
+		db->pTxn->abort(db->pTxn);
+		db->pTxn = NULL;
+	}
+	if ((rv = db->pDB->close(db->pDB, 0)) != 0) {
 		AG_Verbose("db_close: %s; ignoring\n", db_strerror(rv));
+	}
+	db->pDB = NULL;
+	if (db->pEnv != NULL) {
+		if ((rv = db->pEnv->close(db->pEnv, 0)) != 0) {
+			AG_Verbose("db_env_close: %s; ignoring\n",
+			    db_strerror(rv));
+		}
+		db->pEnv = NULL;
+	}
 }
 
 static int
@@ -137,13 +220,13 @@ Exists(void *obj, const AG_Dbt *key)
 	dbKey.size = key->size;
 
 #if (DB_VERSION_MAJOR == 4) && (DB_VERSION_MINOR >= 6)
-	rv = db->pDB->exists(db->pDB, NULL, &dbKey, 0);
+	rv = db->pDB->exists(db->pDB, db->pTxn, &dbKey, 0);
 #else
 	{
 		DBT dbVal;
 	
 		memset(&dbVal, 0, sizeof(DBT));
-		rv = db->pDB->get(db->pDB, NULL, &dbKey, &dbVal, 0);
+		rv = db->pDB->get(db->pDB, db->pTxn, &dbKey, &dbVal, 0);
 		Free(dbVal.data);
 	}
 #endif
@@ -166,7 +249,7 @@ Get(void *obj, const AG_Dbt *key, AG_Dbt *val)
 	dbKey.size = key->size;
 	
 	memset(&dbVal, 0, sizeof(DBT));
-	if ((rv = db->pDB->get(db->pDB, NULL, &dbKey, &dbVal, 0)) != 0) {
+	if ((rv = db->pDB->get(db->pDB, db->pTxn, &dbKey, &dbVal, 0)) != 0) {
 		AG_SetError("db_get: %s", db_strerror(rv));
 	}
 	Free(dbKey.data);
@@ -197,7 +280,7 @@ Put(void *obj, const AG_Dbt *key, const AG_Dbt *val)
 	memcpy(dbVal.data, val->data, val->size);
 	dbVal.size = val->size;
 
-	if ((rv = db->pDB->put(db->pDB, NULL, &dbKey, &dbVal, 0)) != 0)
+	if ((rv = db->pDB->put(db->pDB, db->pTxn, &dbKey, &dbVal, 0)) != 0)
 		AG_SetError("db_put: %s", db_strerror(rv));
 
 	Free(dbKey.data);
@@ -219,7 +302,7 @@ Del(void *obj, const AG_Dbt *key)
 	memcpy(dbKey.data, key->data, key->size);
 	dbKey.size = key->size;
 
-	if ((rv = db->pDB->del(db->pDB, NULL, &dbKey, 0)) != 0) {
+	if ((rv = db->pDB->del(db->pDB, db->pTxn, &dbKey, 0)) != 0) {
 		AG_SetError("DB Delete: %s", db_strerror(rv));
 	}
 	Free(dbKey.data);
@@ -234,7 +317,7 @@ Iterate(void *obj, AG_DbIterateFn fn, void *arg)
 	DBT dbk, dbv;
 	int rv;
 
-	db->pDB->cursor(db->pDB, NULL, &c, 0);
+	db->pDB->cursor(db->pDB, db->pTxn, &c, 0);
 	memset(&dbk, 0, sizeof(DBT));
 	memset(&dbv, 0, sizeof(DBT));
 	while ((rv = c->c_get(c, &dbk, &dbv, DB_NEXT)) == 0) {
@@ -260,6 +343,193 @@ Iterate(void *obj, AG_DbIterateFn fn, void *arg)
 	}
 }
 
+static int
+Begin(void *obj)
+{
+	AG_DbHashBT *db = obj;
+	int rv;
+
+	if (db->pEnv == NULL) {
+		return (1);			/* Not transactional; emulate */
+	}
+	if ((rv = db->pEnv->txn_begin(db->pEnv, NULL, &db->pTxn, 0)) != 0) {
+		AG_SetError("txn_begin: %s", db_strerror(rv));
+		db->pTxn = NULL;
+		return (-1);
+	}
+	return (0);
+}
+
+static int
+Commit(void *obj)
+{
+	AG_DbHashBT *db = obj;
+	int rv;
+
+	rv = db->pTxn->commit(db->pTxn, 0);
+	db->pTxn = NULL;
+	if (rv != 0) {
+		AG_SetError("txn_commit: %s", db_strerror(rv));
+		return (-1);
+	}
+	return (0);
+}
+
+static int
+Abort(void *obj)
+{
+	AG_DbHashBT *db = obj;
+	int rv;
+
+	rv = db->pTxn->abort(db->pTxn);
+	db->pTxn = NULL;
+	if (rv != 0) {
+		AG_SetError("txn_abort: %s", db_strerror(rv));
+		return (-1);
+	}
+	return (0);
+}
+
+static int
+GetBatch(void *obj, const AG_Dbt *keys, AG_Dbt *vals, Uint n)
+{
+	AG_DbHashBT *db = obj;
+	DBT dbKey, dbVal;
+	Uint i;
+	int rv;
+
+	for (i = 0; i < n; i++) {
+		memset(&dbKey, 0, sizeof(DBT));
+		dbKey.data = keys[i].data;
+		dbKey.size = keys[i].size;
+		memset(&dbVal, 0, sizeof(DBT));
+		dbVal.flags = DB_DBT_MALLOC;
+
+		rv = db->pDB->get(db->pDB, db->pTxn, &dbKey, &dbVal, 0);
+		if (rv == DB_NOTFOUND) {
+			vals[i].data = NULL;
+			vals[i].size = 0;
+			continue;
+		} else if (rv != 0) {
+			AG_SetError("db_get: %s", db_strerror(rv));
+			return (-1);
+		}
+		vals[i].data = dbVal.data;
+		vals[i].size = dbVal.size;
+	}
+	return (0);
+}
+
+#ifdef AG_DB_BDB_BULK
+/*
+ * Allocate a bulk buffer for n items of the given total size, including
+ * room for the per-item offset table.
+ */
+static int
+InitBulkDBT(DBT *dbt, size_t size, Uint n)
+{
+	memset(dbt, 0, sizeof(DBT));
+	dbt->ulen = (u_int32_t)(size + (n+1)*4*sizeof(u_int32_t) + 1024);
+	dbt->ulen = (dbt->ulen + 1023) & ~1023;
+	if ((dbt->data = TryMalloc(dbt->ulen)) == NULL) {
+		return (-1);
+	}
+	dbt->flags = DB_DBT_USERMEM | DB_DBT_BULK;
+	return (0);
+}
+#endif /* AG_DB_BDB_BULK */
+
+static int
+PutBatch(void *obj, const AG_Dbt *keys, const AG_Dbt *vals, Uint n)
+{
+	AG_DbHashBT *db = obj;
+#ifdef AG_DB_BDB_BULK
+	DBT dbKey, dbVal;
+	size_t size = 0;
+	void *p;
+	Uint i;
+	int rv;
+
+	for (i = 0; i < n; i++) {
+		size += keys[i].size + vals[i].size;
+	}
+	if (InitBulkDBT(&dbKey, size, 2*n) == -1) {
+		return (-1);
+	}
+	DB_MULTIPLE_WRITE_INIT(p, &dbKey);
+	for (i = 0; i < n; i++) {
+		DB_MULTIPLE_KEY_WRITE_NEXT(p, &dbKey,
+		    keys[i].data, keys[i].size,
+		    vals[i].data, vals[i].size);
+		if (p == NULL) {
+			AG_SetError("Bulk buffer overflow");
+			Free(dbKey.data);
+			return (-1);
+		}
+	}
+	memset(&dbVal, 0, sizeof(DBT));
+	rv = db->pDB->put(db->pDB, db->pTxn, &dbKey, &dbVal, DB_MULTIPLE_KEY);
+	Free(dbKey.data);
+	if (rv != 0) {
+		AG_SetError("db_put: %s", db_strerror(rv));
+		return (-1);
+	}
+	return (0);
+#else
+	Uint i;
+
+	for (i = 0; i < n; i++) {
+		if (Put(db, &keys[i], &vals[i]) == -1)
+			return (-1);
+	}
+	return (0);
+#endif /* AG_DB_BDB_BULK */
+}
+
+static int
+DelBatch(void *obj, const AG_Dbt *keys, Uint n)
+{
+	AG_DbHashBT *db = obj;
+#ifdef AG_DB_BDB_BULK
+	DBT dbKey;
+	size_t size = 0;
+	void *p;
+	Uint i;
+	int rv;
+
+	for (i = 0; i < n; i++) {
+		size += keys[i].size;
+	}
+	if (InitBulkDBT(&dbKey, size, n) == -1) {
+		return (-1);
+	}
+	DB_MULTIPLE_WRITE_INIT(p, &dbKey);
+	for (i = 0; i < n; i++) {
+		DB_MULTIPLE_WRITE_NEXT(p, &dbKey, keys[i].data, keys[i].size);
+		if (p == NULL) {
+			AG_SetError("Bulk buffer overflow");
+			Free(dbKey.data);
+			return (-1);
+		}
+	}
+	rv = db->pDB->del(db->pDB, db->pTxn, &dbKey, DB_MULTIPLE);
+	Free(dbKey.data);
+	if (rv != 0) {
+		AG_SetError("db_del: %s", db_strerror(rv));
+		return (-1);
+	}
+	return (0);
+#else
+	Uint i;
+
+	for (i = 0; i < n; i++) {
+		if (Del(db, &keys[i]) == -1)
+			return (-1);
+	}
+	return (0);
+#endif /* AG_DB_BDB_BULK */
+}
+
 AG_DbClass agDbHashClass = {
 	{
 		"Agar(Db:DbHash)",
@@ -283,7 +553,13 @@ AG_DbClass agDbHashClass = {
 	Get,
 	Put,
 	Del,
-	Iterate
+	Iterate,
+	Begin,
+	Commit,
+	Abort,
+	GetBatch,
+	PutBatch,
+	DelBatch
 };
 AG_DbClass agDbBtreeClass = {
 	{
@@ -308,5 +584,11 @@ AG_DbClass agDbBtreeClass = {
 	Get,
 	Put,
 	Del,
-	Iterate
+	Iterate,
+	Begin,
+	Commit,
+	Abort,
+	GetBatch,
+	PutBatch,
+	DelBatch
 };
@@ -0,0 +1,1667 @@
+/*
+ * Copyright (c) 2026 Hypertriton, Inc. <http://hypertriton.com/>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Embedded log-structured key-value store.
+ *
+ * All writes are appended to a single log file, and an in-memory hash
+ * index maps each key to its most recent record. Reads are served from a
+ * read-only mapping of the log (or from the write buffers for records not
+ * yet written out). Writes are buffered and written out by a background
+ * thread, which issues a single fsync() for all writes accumulated over the
+ * "commit-interval" (group commit); writers wait for the fsync covering
+ * their records before returning. The same thread rewrites the log without
+ * its stale records once they exceed "compact-ratio" percent of the file.
+ *
+ * Each record consists of a 16-byte header (CRC-32, type, key length and
+ * value length, little-endian) followed by the key and the value. Records
+ * written by a transaction or a batch operation are preceded by a BATCH
+ * record giving their count; on open, a batch is only replayed if all of
+ * its records are intact, and the log is truncated after the last valid
+ * record.
+ */
+
+#include <agar/core/core.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define AG_DBLOG_MAGIC		"AGDBLOG1"
+#define AG_DBLOG_MAGIC_LEN	8
+#define AG_DBLOG_HDR_SIZE	16		/* Record header size */
+#define AG_DBLOG_BUCKETS_INIT	256		/* Initial index size */
+
+enum ag_dblog_rec_type {
+	AG_DBLOG_PUT	= 1,			/* Key and value */
+	AG_DBLOG_DEL	= 2,			/* Key only (tombstone) */
+	AG_DBLOG_BATCH	= 3			/* Count of following records */
+};
+
+enum ag_dblog_sync_mode {
+	AG_DBLOG_SYNC_NONE,			/* Leave syncing to the OS */
+	AG_DBLOG_SYNC_GROUP,			/* Sync every commit-interval */
+	AG_DBLOG_SYNC_ALWAYS			/* Sync before returning */
+};
+
+/* Index entry. */
+typedef struct ag_dblog_ent {
+	Uint32 hash;
+	Uint32 keyLen;
+	Uint32 valLen;
+	off_t off;				/* Record offset in log */
+	Uint8 *key;
+	struct ag_dblog_ent *next;		/* In hash bucket */
+} AG_DbLogEnt;
+
+/* Index state saved by a transaction, for AG_DbAbort(). */
+typedef struct ag_dblog_undo {
+	Uint8 *key;
+	Uint32 keyLen;
+	int had;				/* Key was present */
+	off_t off;				/* Previous record offset */
+	Uint32 valLen;				/* Previous value length */
+	struct ag_dblog_undo *next;
+} AG_DbLogUndo;
+
+/* Live record relocated by compaction. */
+typedef struct ag_dblog_move {
+	off_t off;				/* Offset in old log */
+	off_t newOff;				/* Offset in new log */
+	size_t len;
+} AG_DbLogMove;
+
+typedef struct ag_db_log {
+	struct ag_db _inherit;
+	Uint flags;
+#define AG_DBLOG_READONLY	0x01		/* Opened read-only */
+#define AG_DBLOG_FLUSHING	0x02		/* Write-out in progress */
+#define AG_DBLOG_SYNCED		0x04		/* File contents are synced */
+#define AG_DBLOG_TXN		0x08		/* Transaction in progress */
+#define AG_DBLOG_STOP		0x10		/* Terminate background thread */
+#define AG_DBLOG_COMPACTING	0x20		/* Compaction in progress */
+	AG_Mutex lock;
+	int fd;					/* Log file */
+	char *path;
+	enum ag_dblog_sync_mode syncMode;
+	size_t bufMax;				/* Write-out threshold */
+	Uint interval;				/* Commit interval (ms) */
+	Uint compactRatio;			/* Compaction threshold (%) */
+	off_t compactMin;			/* Minimum log size to compact */
+
+	AG_DbLogEnt **buckets;			/* Hash index */
+	Uint nBuckets;
+	Uint nEnts;
+	off_t liveBytes;			/* Size of live records */
+
+	Uint8 *map;				/* Mapping of the log file */
+	size_t mapLen;
+	off_t flushedLen;			/* Bytes written to log file */
+	off_t logEnd;				/* End of log (incl. buffers) */
+	Uint8 *wrBuf;				/* Records awaiting write-out */
+	size_t wrBufLen, wrBufSize;
+	Uint8 *flBuf;				/* Records being written out */
+	size_t flBufLen, flBufSize;
+	Uint8 *txBuf;				/* Records of open transaction */
+	size_t txBufLen, txBufSize;
+	Uint txCount;
+	AG_DbLogUndo *undo;
+	Ulong seqEnd;				/* Last record (or batch) appended */
+	Ulong seqWritten;			/* Last record written out */
+	Ulong seqSynced;			/* Last record synced */
+	Uint syncErrs;				/* Failed write-outs */
+#ifdef AG_THREADS
+	AG_Cond flushCond;			/* Write-out completed */
+	AG_Cond thCond;				/* Wake background thread */
+	AG_Thread th;
+	int thRunning;
+#endif
+} AG_DbLog;
+
+/* CRC-32 (IEEE 802.3), computed 4 bits at a time. */
+static const Uint32 crcTbl[16] = {
+	0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+	0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+	0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+	0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+};
+
+static Uint32
+Crc32(Uint32 crc, const Uint8 *p, size_t len)
+{
+	crc = ~crc;
+	while (len-- > 0) {
+		crc ^= *p++;
+		crc = (crc >> 4) ^ crcTbl[crc & 0x0f];
+		crc = (crc >> 4) ^ crcTbl[crc & 0x0f];
+	}
+	return (~crc);
+}
+
+static __inline__ void
+Enc32(Uint8 *p, Uint32 v)
+{
+	p[0] = (Uint8)(v);
+	p[1] = (Uint8)(v >> 8);
+	p[2] = (Uint8)(v >> 16);
+	p[3] = (Uint8)(v >> 24);
+}
+
+static __inline__ Uint32
+Dec32(const Uint8 *p)
+{
+	return ((Uint32)p[0] | ((Uint32)p[1] << 8) |
+	        ((Uint32)p[2] << 16) | ((Uint32)p[3] << 24));
+}
+
+/* FNV-1a hash of a key. */
+static __inline__ Uint32
+HashKey(const Uint8 *p, size_t len)
+{
+	Uint32 h = 2166136261U;
+
+	while (len-- > 0) {
+		h ^= *p++;
+		h *= 16777619U;
+	}
+	return (h);
+}
+
+static __inline__ off_t
+RecLen(Uint32 keyLen, Uint32 valLen)
+{
+	return (off_t)AG_DBLOG_HDR_SIZE + keyLen + valLen;
+}
+
+/*
+ * Index operations.
+ */
+
+static AG_DbLogEnt *
+FindEnt(AG_DbLog *db, const void *key, size_t keyLen, Uint32 *pHash)
+{
+	AG_DbLogEnt *ent;
+	Uint32 h;
+
+	h = HashKey(key, keyLen);
+	if (pHash != NULL) {
+		*pHash = h;
+	}
+	for (ent = db->buckets[h & (db->nBuckets-1)];
+	     ent != NULL;
+	     ent = ent->next) {
+		if (ent->hash == h && ent->keyLen == keyLen &&
+		    memcmp(ent->key, key, keyLen) == 0)
+			return (ent);
+	}
+	return (NULL);
+}
+
+static void
+GrowIndex(AG_DbLog *db)
+{
+	AG_DbLogEnt **bucketsNew, *ent, *entNext;
+	Uint nBucketsNew = db->nBuckets*2, i;
+
+	if ((bucketsNew = TryMalloc(nBucketsNew*sizeof(AG_DbLogEnt *)))
+	    == NULL) {
+		return;				/* Keep the current size */
+	}
+	memset(bucketsNew, 0, nBucketsNew*sizeof(AG_DbLogEnt *));
+	for (i = 0; i < db->nBuckets; i++) {
+		for (ent = db->buckets[i]; ent != NULL; ent = entNext) {
+			entNext = ent->next;
+			ent->next = bucketsNew[ent->hash & (nBucketsNew-1)];
+			bucketsNew[ent->hash & (nBucketsNew-1)] = ent;
+		}
+	}
+	free(db->buckets);
+	db->buckets = bucketsNew;
+	db->nBuckets = nBucketsNew;
+}
+
+/* Save the index state of a key for rollback. */
+static int
+SaveUndo(AG_DbLog *db, const void *key, size_t keyLen, AG_DbLogEnt *ent)
+{
+	AG_DbLogUndo *u;
+
+	if ((u = TryMalloc(sizeof(AG_DbLogUndo))) == NULL) {
+		return (-1);
+	}
+	if ((u->key = TryMalloc(keyLen+1)) == NULL) {
+		free(u);
+		return (-1);
+	}
+	memcpy(u->key, key, keyLen);
+	u->keyLen = (Uint32)keyLen;
+	if (ent != NULL) {
+		u->had = 1;
+		u->off = ent->off;
+		u->valLen = ent->valLen;
+	} else {
+		u->had = 0;
+		u->off = 0;
+		u->valLen = 0;
+	}
+	u->next = db->undo;
+	db->undo = u;
+	return (0);
+}
+
+/* Point a key at a new PUT record. */
+static int
+IndexPut(AG_DbLog *db, const void *key, size_t keyLen, off_t off,
+    Uint32 valLen)
+{
+	AG_DbLogEnt *ent;
+	Uint32 h;
+
+	ent = FindEnt(db, key, keyLen, &h);
+	if ((db->flags & AG_DBLOG_TXN) &&
+	    SaveUndo(db, key, keyLen, ent) == -1) {
+		return (-1);
+	}
+	if (ent != NULL) {
+		db->liveBytes -= RecLen(ent->keyLen, ent->valLen);
+	} else {
+		if ((ent = TryMalloc(sizeof(AG_DbLogEnt))) == NULL) {
+			return (-1);
+		}
+		if ((ent->key = TryMalloc(keyLen+1)) == NULL) {
+			free(ent);
+			return (-1);
+		}
+		memcpy(ent->key, key, keyLen);
+		ent->keyLen = (Uint32)keyLen;
+		ent->hash = h;
+		ent->next = db->buckets[h & (db->nBuckets-1)];
+		db->buckets[h & (db->nBuckets-1)] = ent;
+		if (++db->nEnts > db->nBuckets)
+			GrowIndex(db);
+	}
+	ent->off = off;
+	ent->valLen = valLen;
+	db->liveBytes += RecLen(ent->keyLen, valLen);
+	return (0);
+}
+
+/* Remove a key from the index. */
+static int
+IndexDel(AG_DbLog *db, const void *key, size_t keyLen)
+{
+	AG_DbLogEnt *ent, **pEnt;
+	Uint32 h;
+
+	if ((ent = FindEnt(db, key, keyLen, &h)) == NULL) {
+		return (0);
+	}
+	if ((db->flags & AG_DBLOG_TXN) &&
+	    SaveUndo(db, key, keyLen, ent) == -1) {
+		return (-1);
+	}
+	for (pEnt = &db->buckets[h & (db->nBuckets-1)];
+	     *pEnt != ent;
+	     pEnt = &(*pEnt)->next)
+		;;
+	*pEnt = ent->next;
+	db->liveBytes -= RecLen(ent->keyLen, ent->valLen);
+	db->nEnts--;
+	free(ent->key);
+	free(ent);
+	return (0);
+}
+
+static void
+FreeIndex(AG_DbLog *db)
+{
+	AG_DbLogEnt *ent, *entNext;
+	Uint i;
+
+	for (i = 0; i < db->nBuckets; i++) {
+		for (ent = db->buckets[i]; ent != NULL; ent = entNext) {
+			entNext = ent->next;
+			free(ent->key);
+			free(ent);
+		}
+	}
+	Free(db->buckets);
+	db->buckets = NULL;
+	db->nBuckets = 0;
+	db->nEnts = 0;
+	db->liveBytes = 0;
+}
+
+static void
+FreeUndo(AG_DbLog *db)
+{
+	AG_DbLogUndo *u, *uNext;
+
+	for (u = db->undo; u != NULL; u = uNext) {
+		uNext = u->next;
+		free(u->key);
+		free(u);
+	}
+	db->undo = NULL;
+}
+
+/*
+ * Log access.
+ */
+
+/* Map the written portion of the log file. */
+static int
+MapLog(AG_DbLog *db)
+{
+	void *p;
+
+	if (db->map != NULL) {
+		munmap(db->map, db->mapLen);
+		db->map = NULL;
+		db->mapLen = 0;
+	}
+	p = mmap(NULL, (size_t)db->flushedLen, PROT_READ, MAP_SHARED,
+	    db->fd, 0);
+	if (p == MAP_FAILED) {
+		AG_SetError("mmap(%s): %s", db->path, strerror(errno));
+		return (-1);
+	}
+	db->map = p;
+	db->mapLen = (size_t)db->flushedLen;
+	return (0);
+}
+
+/* Return a pointer to len bytes of the log at off. */
+static const Uint8 *
+LogData(AG_DbLog *db, off_t off, size_t len)
+{
+	off_t wrBase = db->flushedLen + (off_t)db->flBufLen;
+
+	if (off >= db->logEnd) {
+		return &db->txBuf[off - db->logEnd];
+	} else if (off >= wrBase) {
+		return &db->wrBuf[off - wrBase];
+	} else if (off >= db->flushedLen) {
+		return &db->flBuf[off - db->flushedLen];
+	}
+	if ((size_t)off + len > db->mapLen && MapLog(db) == -1) {
+		return (NULL);
+	}
+	return &db->map[off];
+}
+
+static int
+WriteAll(int fd, const Uint8 *p, size_t len, off_t off)
+{
+	ssize_t rv;
+
+	while (len > 0) {
+		if ((rv = pwrite(fd, p, len, off)) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			AG_SetError("write: %s", strerror(errno));
+			return (-1);
+		}
+		p += rv;
+		off += rv;
+		len -= (size_t)rv;
+	}
+	return (0);
+}
+
+static int
+SyncFile(int fd)
+{
+#if defined(_POSIX_SYNCHRONIZED_IO) && _POSIX_SYNCHRONIZED_IO > 0
+	if (fdatasync(fd) == -1) {
+#else
+	if (fsync(fd) == -1) {
+#endif
+		AG_SetError("fsync: %s", strerror(errno));
+		return (-1);
+	}
+	return (0);
+}
+
+/* Grow a buffer to hold at least len more bytes. */
+static int
+GrowBuf(Uint8 **buf, size_t *bufSize, size_t bufLen, size_t len)
+{
+	Uint8 *bufNew;
+	size_t sizeNew;
+
+	if (bufLen+len <= *bufSize) {
+		return (0);
+	}
+	for (sizeNew = (*bufSize > 0) ? *bufSize : 4096;
+	     sizeNew < bufLen+len;
+	     sizeNew *= 2)
+		;;
+	if ((bufNew = TryRealloc(*buf, sizeNew)) == NULL) {
+		return (-1);
+	}
+	*buf = bufNew;
+	*bufSize = sizeNew;
+	return (0);
+}
+
+/*
+ * Write out buffered records and optionally sync the log file. The lock
+ * is released during I/O, so records may be appended (and read from the
+ * in-flight buffer) concurrently.
+ */
+static int
+FlushLog(AG_DbLog *db, int doSync)
+{
+	Uint8 *buf;
+	size_t len, size;
+	off_t off;
+	Ulong seq;
+	int rv = 0;
+
+#ifdef AG_THREADS
+	while (db->flags & AG_DBLOG_FLUSHING)
+		AG_CondWait(&db->flushCond, &db->lock);
+#endif
+	if (db->wrBufLen == 0 &&
+	    (!doSync || (db->flags & AG_DBLOG_SYNCED))) {
+		return (0);
+	}
+
+	/* Swap the write and in-flight buffers. */
+	buf = db->wrBuf;
+	len = db->wrBufLen;
+	size = db->wrBufSize;
+	off = db->flushedLen;
+	seq = db->seqEnd;
+	db->wrBuf = db->flBuf;
+	db->wrBufSize = db->flBufSize;
+	db->wrBufLen = 0;
+	db->flBuf = buf;
+	db->flBufSize = size;
+	db->flBufLen = len;
+	db->flags |= AG_DBLOG_FLUSHING;
+
+	AG_MutexUnlock(&db->lock);
+	if (len > 0) {
+		rv = WriteAll(db->fd, buf, len, off);
+	}
+	if (rv == 0 && doSync) {
+		rv = SyncFile(db->fd);
+	}
+	AG_MutexLock(&db->lock);
+
+	if (rv == 0) {
+		db->flushedLen += (off_t)len;
+		db->seqWritten = seq;
+		if (doSync) {
+			db->flags |= AG_DBLOG_SYNCED;
+			db->seqSynced = seq;
+		} else if (len > 0) {
+			db->flags &= ~(AG_DBLOG_SYNCED);
+		}
+	} else {
+		db->syncErrs++;
+
+		/* Put the records back in front of the write buffer. */
+		if (GrowBuf(&db->flBuf, &db->flBufSize, len,
+		    db->wrBufLen) == 0) {
+			memcpy(&db->flBuf[len], db->wrBuf, db->wrBufLen);
+			buf = db->wrBuf;
+			size = db->wrBufSize;
+			db->wrBuf = db->flBuf;
+			db->wrBufSize = db->flBufSize;
+			db->wrBufLen = len + db->wrBufLen;
+			db->flBuf = buf;
+			db->flBufSize = size;
+		} else {
+			AG_Verbose("%s: Lost %lu bytes of log\n", db->path,
+			    (Ulong)len);
+		}
+	}
+	db->flBufLen = 0;
+	db->flags &= ~(AG_DBLOG_FLUSHING);
+#ifdef AG_THREADS
+	AG_CondBroadcast(&db->flushCond);
+#endif
+	return (rv);
+}
+
+/*
+ * Append a record to the log (or to the open transaction) and return its
+ * offset.
+ */
+static off_t
+AppendRecord(AG_DbLog *db, enum ag_dblog_rec_type type, const void *key,
+    Uint32 keyLen, const void *val, Uint32 valLen)
+{
+	Uint8 **buf, *p;
+	size_t *bufLen, *bufSize;
+	size_t len = AG_DBLOG_HDR_SIZE + keyLen + valLen;
+	off_t off;
+
+	if (db->flags & AG_DBLOG_TXN) {
+		buf = &db->txBuf;
+		bufLen = &db->txBufLen;
+		bufSize = &db->txBufSize;
+		off = db->logEnd + (off_t)db->txBufLen;
+	} else {
+		buf = &db->wrBuf;
+		bufLen = &db->wrBufLen;
+		bufSize = &db->wrBufSize;
+		off = db->logEnd;
+	}
+	if (GrowBuf(buf, bufSize, *bufLen, len) == -1) {
+		return (-1);
+	}
+	p = &(*buf)[*bufLen];
+	p[4] = (Uint8)type;
+	p[5] = 0;
+	p[6] = 0;
+	p[7] = 0;
+	Enc32(&p[8], keyLen);
+	Enc32(&p[12], valLen);
+	if (keyLen > 0) {
+		memcpy(&p[AG_DBLOG_HDR_SIZE], key, keyLen);
+	}
+	if (valLen > 0 && val != NULL) {
+		memcpy(&p[AG_DBLOG_HDR_SIZE+keyLen], val, valLen);
+	}
+	Enc32(&p[0], Crc32(0, &p[4], len-4));
+	*bufLen += len;
+
+	if (db->flags & AG_DBLOG_TXN) {
+		db->txCount++;
+	} else {
+		db->logEnd += (off_t)len;
+		db->seqEnd++;
+	}
+	return (off);
+}
+
+#ifdef AG_THREADS
+/*
+ * Wait until the background thread has synced the records up to seq
+ * (group commit). Fails if a write-out fails in the meantime.
+ */
+static int
+WaitSync(AG_DbLog *db, Ulong seq)
+{
+	Uint syncErrs = db->syncErrs;
+
+	if (db->wrBufLen >= db->bufMax) {
+		AG_CondSignal(&db->thCond);
+	}
+	while ((long)(db->seqSynced - seq) < 0) {
+		if (db->syncErrs != syncErrs) {
+			AG_SetError("%s: Failed to sync the log", db->path);
+			return (-1);
+		}
+		AG_CondWait(&db->flushCond, &db->lock);
+	}
+	return (0);
+}
+#endif /* AG_THREADS */
+
+/*
+ * Write out according to the sync mode after a modification. In "group"
+ * mode, return once the background thread's next fsync covers the write.
+ */
+static int
+AfterWrite(AG_DbLog *db)
+{
+	if (db->flags & AG_DBLOG_TXN) {
+		return (0);
+	}
+	if (db->syncMode == AG_DBLOG_SYNC_GROUP) {
+#ifdef AG_THREADS
+		if (db->thRunning)
+			return WaitSync(db, db->seqEnd);
+#endif
+		return FlushLog(db, 1);
+	}
+	if (db->syncMode == AG_DBLOG_SYNC_ALWAYS) {
+		return FlushLog(db, 1);
+	}
+	if (db->wrBufLen >= db->bufMax) {
+		return FlushLog(db, 0);
+	}
+	return (0);
+}
+
+/*
+ * Recovery.
+ */
+
+/* Validate the record at off; return its type or -1. */
+static int
+ParseRecord(const Uint8 *log, size_t size, size_t off, Uint32 *keyLen,
+    Uint32 *valLen)
+{
+	const Uint8 *p = &log[off];
+	size_t len;
+	int type;
+
+	if (size - off < AG_DBLOG_HDR_SIZE) {
+		return (-1);
+	}
+	type = (int)p[4];
+	*keyLen = Dec32(&p[8]);
+	*valLen = Dec32(&p[12]);
+	if (type == AG_DBLOG_BATCH) {
+		len = AG_DBLOG_HDR_SIZE;
+	} else if (type == AG_DBLOG_PUT || type == AG_DBLOG_DEL) {
+		if (*keyLen > size - off - AG_DBLOG_HDR_SIZE ||
+		    *valLen > size - off - AG_DBLOG_HDR_SIZE - *keyLen) {
+			return (-1);
+		}
+		len = AG_DBLOG_HDR_SIZE + *keyLen + *valLen;
+	} else {
+		return (-1);
+	}
+	if (Crc32(0, &p[4], len-4) != Dec32(&p[0])) {
+		return (-1);
+	}
+	return (type);
+}
+
+static int
+ReplayRecord(AG_DbLog *db, const Uint8 *log, size_t off, int type,
+    Uint32 keyLen, Uint32 valLen)
+{
+	const Uint8 *key = &log[off + AG_DBLOG_HDR_SIZE];
+
+	if (type == AG_DBLOG_PUT) {
+		return IndexPut(db, key, keyLen, (off_t)off, valLen);
+	} else {
+		return IndexDel(db, key, keyLen);
+	}
+}
+
+/*
+ * Rebuild the index from the log and return the offset following the last
+ * valid record (or batch).
+ */
+static int
+ReplayLog(AG_DbLog *db, size_t *end)
+{
+	const Uint8 *log = db->map;
+	size_t size = db->mapLen;
+	size_t off = AG_DBLOG_MAGIC_LEN, o;
+	Uint32 keyLen, valLen, n, i;
+	int type;
+
+	while (off < size) {
+		if ((type = ParseRecord(log, size, off, &keyLen, &valLen))
+		    == -1) {
+			break;
+		}
+		if (type != AG_DBLOG_BATCH) {
+			if (ReplayRecord(db, log, off, type, keyLen, valLen)
+			    == -1) {
+				return (-1);
+			}
+			off += AG_DBLOG_HDR_SIZE + keyLen + valLen;
+			continue;
+		}
+		/* Validate the entire batch before applying any of it. */
+		n = valLen;
+		for (i = 0, o = off + AG_DBLOG_HDR_SIZE; i < n; i++) {
+			type = ParseRecord(log, size, o, &keyLen, &valLen);
+			if (type == -1 || type == AG_DBLOG_BATCH) {
+				break;
+			}
+			o += AG_DBLOG_HDR_SIZE + keyLen + valLen;
+		}
+		if (i < n) {
+			break;
+		}
+		for (i = 0, o = off + AG_DBLOG_HDR_SIZE; i < n; i++) {
+			type = ParseRecord(log, size, o, &keyLen, &valLen);
+			if (ReplayRecord(db, log, o, type, keyLen, valLen)
+			    == -1) {
+				return (-1);
+			}
+			o += AG_DBLOG_HDR_SIZE + keyLen + valLen;
+		}
+		off = o;
+	}
+	*end = off;
+	return (0);
+}
+
+/*
+ * Compaction.
+ */
+
+static int
+CompareMoves(const void *p1, const void *p2)
+{
+	const AG_DbLogMove *m1 = p1, *m2 = p2;
+
+	return (m1->off < m2->off) ? -1 : (m1->off > m2->off) ? 1 : 0;
+}
+
+static AG_DbLogMove *
+FindMove(AG_DbLogMove *mv, Uint n, off_t off)
+{
+	Uint lo = 0, hi = n, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo)/2;
+		if (mv[mid].off < off) {
+			lo = mid+1;
+		} else if (mv[mid].off > off) {
+			hi = mid;
+		} else {
+			return (&mv[mid]);
+		}
+	}
+	return (NULL);
+}
+
+/* Copy the range [off, end) of the old log to the new one at newOff. */
+static int
+CopyRange(int fdFrom, int fdTo, off_t off, off_t end, off_t newOff)
+{
+	Uint8 buf[16384];
+	ssize_t rv;
+	size_t len;
+
+	while (off < end) {
+		len = (end - off > (off_t)sizeof(buf)) ? sizeof(buf) :
+		                                         (size_t)(end - off);
+		if ((rv = pread(fdFrom, buf, len, off)) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			AG_SetError("read: %s", strerror(errno));
+			return (-1);
+		} else if (rv == 0) {
+			AG_SetError("Log is truncated");
+			return (-1);
+		}
+		if (WriteAll(fdTo, buf, (size_t)rv, newOff) == -1) {
+			return (-1);
+		}
+		off += rv;
+		newOff += rv;
+	}
+	return (0);
+}
+
+/* Sync the directory containing path (to persist a rename). */
+static void
+SyncDir(const char *path)
+{
+	char dir[AG_PATHNAME_MAX], *s;
+	int fd;
+
+	Strlcpy(dir, path, sizeof(dir));
+	if ((s = strrchr(dir, '/')) == NULL) {
+		Strlcpy(dir, ".", sizeof(dir));
+	} else if (s == dir) {
+		s[1] = '\0';
+	} else {
+		*s = '\0';
+	}
+	if ((fd = open(dir, O_RDONLY)) != -1) {
+		(void)fsync(fd);
+		close(fd);
+	}
+}
+
+/* Return 1 if the proportion of stale records warrants compaction. */
+static int
+NeedCompact(AG_DbLog *db)
+{
+	off_t total = db->logEnd - AG_DBLOG_MAGIC_LEN;
+
+	if (db->flags & (AG_DBLOG_READONLY|AG_DBLOG_TXN|AG_DBLOG_COMPACTING)) {
+		return (0);
+	}
+	if (db->compactRatio == 0 || db->logEnd < db->compactMin) {
+		return (0);
+	}
+	return ((total - db->liveBytes)*100 >= total*(off_t)db->compactRatio);
+}
+
+/*
+ * Rewrite the log with only the live records. Records present when
+ * compaction starts are copied with the lock released; records appended
+ * in the meantime are then copied verbatim with the lock held, after which
+ * the new log replaces the old one.
+ */
+static int
+Compact(AG_DbLog *db)
+{
+	char pathTmp[AG_PATHNAME_MAX];
+	AG_DbLogMove *mv = NULL, *m;
+	AG_DbLogEnt *ent;
+	struct stat sb;
+	Uint8 *oldMap = NULL;
+	off_t end, newOff, delta;
+	Uint i, n = 0;
+	int fdNew = -1, pass;
+
+	if (FlushLog(db, 0) == -1) {
+		return (-1);
+	}
+	if (!NeedCompact(db)) {
+		return (0);
+	}
+	end = db->flushedLen;
+	if (db->nEnts > 0 &&
+	    (mv = TryMalloc(db->nEnts*sizeof(AG_DbLogMove))) == NULL) {
+		return (-1);
+	}
+	for (i = 0; i < db->nBuckets; i++) {
+		for (ent = db->buckets[i]; ent != NULL; ent = ent->next) {
+			if (ent->off < end) {
+				mv[n].off = ent->off;
+				mv[n].len = (size_t)RecLen(ent->keyLen,
+				                           ent->valLen);
+				n++;
+			}
+		}
+	}
+	db->flags |= AG_DBLOG_COMPACTING;
+	AG_MutexUnlock(&db->lock);
+
+	/* Copy the live records without holding the lock. */
+	qsort(mv, n, sizeof(AG_DbLogMove), CompareMoves);
+	Strlcpy(pathTmp, db->path, sizeof(pathTmp));
+	Strlcat(pathTmp, ".compact", sizeof(pathTmp));
+	if (fstat(db->fd, &sb) == -1 ||
+	    (fdNew = open(pathTmp, O_RDWR|O_CREAT|O_TRUNC, sb.st_mode & 0777))
+	    == -1) {
+		AG_SetError("%s: %s", pathTmp, strerror(errno));
+		goto fail_unlocked;
+	}
+	oldMap = mmap(NULL, (size_t)end, PROT_READ, MAP_SHARED, db->fd, 0);
+	if (oldMap == MAP_FAILED) {
+		AG_SetError("mmap(%s): %s", db->path, strerror(errno));
+		oldMap = NULL;
+		goto fail_unlocked;
+	}
+	if (WriteAll(fdNew, (const Uint8 *)AG_DBLOG_MAGIC,
+	    AG_DBLOG_MAGIC_LEN, 0) == -1) {
+		goto fail_unlocked;
+	}
+	newOff = AG_DBLOG_MAGIC_LEN;
+	for (i = 0; i < n; i++) {
+		if (WriteAll(fdNew, &oldMap[mv[i].off], mv[i].len, newOff)
+		    == -1) {
+			goto fail_unlocked;
+		}
+		mv[i].newOff = newOff;
+		newOff += (off_t)mv[i].len;
+	}
+	munmap(oldMap, (size_t)end);
+	oldMap = NULL;
+
+	AG_MutexLock(&db->lock);
+	if (FlushLog(db, 0) == -1) {
+		goto fail;
+	}
+	if (db->flags & AG_DBLOG_TXN) {
+		AG_SetError("Transaction in progress");
+		goto fail;
+	}
+
+	/* Copy the records appended since, and switch to the new log. */
+	if (CopyRange(db->fd, fdNew, end, db->flushedLen, newOff) == -1 ||
+	    SyncFile(fdNew) == -1) {
+		goto fail;
+	}
+	delta = newOff - end;
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < db->nBuckets; i++) {
+			for (ent = db->buckets[i]; ent != NULL;
+			     ent = ent->next) {
+				if (ent->off >= end) {
+					if (pass == 1) {
+						ent->off += delta;
+					}
+					continue;
+				}
+				if ((m = FindMove(mv, n, ent->off)) == NULL) {
+					AG_SetError("Index changed");
+					goto fail;
+				}
+				if (pass == 1)
+					ent->off = m->newOff;
+			}
+		}
+		if (pass == 0 && rename(pathTmp, db->path) == -1) {
+			AG_SetError("rename(%s): %s", pathTmp,
+			    strerror(errno));
+			goto fail;
+		}
+	}
+	SyncDir(db->path);
+	if (db->map != NULL) {
+		munmap(db->map, db->mapLen);
+		db->map = NULL;
+		db->mapLen = 0;
+	}
+	close(db->fd);
+	db->fd = fdNew;
+	db->flushedLen += delta;
+	db->logEnd += delta;
+	db->flags |= AG_DBLOG_SYNCED;
+	db->flags &= ~(AG_DBLOG_COMPACTING);
+	db->seqSynced = db->seqWritten;
+#ifdef AG_THREADS
+	AG_CondBroadcast(&db->flushCond);
+#endif
+	Free(mv);
+	return (0);
+fail_unlocked:
+	AG_MutexLock(&db->lock);
+fail:
+	if (oldMap != NULL) {
+		munmap(oldMap, (size_t)end);
+	}
+	if (fdNew != -1) {
+		close(fdNew);
+		unlink(pathTmp);
+	}
+	db->flags &= ~(AG_DBLOG_COMPACTING);
+	Free(mv);
+	return (-1);
+}
+
+#ifdef AG_THREADS
+/* Background write-out, group commit and compaction. */
+static void *
+LogThread(void *arg)
+{
+	AG_DbLog *db = arg;
+	struct timespec ts;
+	struct timeval tv;
+
+	AG_MutexLock(&db->lock);
+	while ((db->flags & AG_DBLOG_STOP) == 0) {
+		gettimeofday(&tv, NULL);
+		ts.tv_sec = tv.tv_sec + db->interval/1000;
+		ts.tv_nsec = tv.tv_usec*1000 + (db->interval % 1000)*1000000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		AG_CondTimedWait(&db->thCond, &db->lock, &ts);
+		if (db->flags & AG_DBLOG_STOP) {
+			break;
+		}
+		if (FlushLog(db, (db->syncMode == AG_DBLOG_SYNC_GROUP)) == -1) {
+			AG_Verbose("%s: %s\n", db->path, AG_GetError());
+		}
+		if (NeedCompact(db) && Compact(db) == -1) {
+			AG_Verbose("%s: compaction failed: %s\n", db->path,
+			    AG_GetError());
+		}
+	}
+	AG_MutexUnlock(&db->lock);
+	return (NULL);
+}
+#endif /* AG_THREADS */
+
+/*
+ * AG_Db interface.
+ */
+
+static void
+Init(void *obj)
+{
+	AG_DbLog *db = obj;
+
+	db->flags = 0;
+	db->fd = -1;
+	db->path = NULL;
+	db->buckets = NULL;
+	db->nBuckets = 0;
+	db->nEnts = 0;
+	db->liveBytes = 0;
+	db->map = NULL;
+	db->mapLen = 0;
+	db->flushedLen = 0;
+	db->logEnd = 0;
+	db->wrBuf = NULL;
+	db->wrBufLen = 0;
+	db->wrBufSize = 0;
+	db->flBuf = NULL;
+	db->flBufLen = 0;
+	db->flBufSize = 0;
+	db->txBuf = NULL;
+	db->txBufLen = 0;
+	db->txBufSize = 0;
+	db->txCount = 0;
+	db->undo = NULL;
+	db->seqEnd = 0;
+	db->seqWritten = 0;
+	db->seqSynced = 0;
+	db->syncErrs = 0;
+	AG_MutexInit(&db->lock);
+#ifdef AG_THREADS
+	AG_CondInit(&db->flushCond);
+	AG_CondInit(&db->thCond);
+	db->thRunning = 0;
+#endif
+	AG_SetString(db, "sync",		"group");
+	AG_SetUint(db,   "commit-interval",	10);
+	AG_SetUint(db,   "buffer-size",		65536);
+	AG_SetUint(db,   "compact-ratio",	50);
+	AG_SetUint(db,   "compact-min",		1048576);
+}
+
+static void
+Destroy(void *obj)
+{
+	AG_DbLog *db = obj;
+
+#ifdef AG_THREADS
+	AG_CondDestroy(&db->thCond);
+	AG_CondDestroy(&db->flushCond);
+#endif
+	AG_MutexDestroy(&db->lock);
+}
+
+static void
+CloseLog(AG_DbLog *db)
+{
+	if (db->map != NULL) {
+		munmap(db->map, db->mapLen);
+		db->map = NULL;
+		db->mapLen = 0;
+	}
+	if (db->fd != -1) {
+		close(db->fd);
+		db->fd = -1;
+	}
+	FreeIndex(db);
+	FreeUndo(db);
+	Free(db->wrBuf);
+	Free(db->flBuf);
+	Free(db->txBuf);
+	db->wrBuf = NULL;
+	db->flBuf = NULL;
+	db->txBuf = NULL;
+	db->wrBufLen = db->wrBufSize = 0;
+	db->flBufLen = db->flBufSize = 0;
+	db->txBufLen = db->txBufSize = 0;
+	db->seqEnd = db->seqWritten = db->seqSynced = 0;
+	Free(db->path);
+	db->path = NULL;
+	db->flags = 0;
+}
+
+static int
+Open(void *obj, const char *path, Uint flags)
+{
+	AG_DbLog *db = obj;
+	char magic[AG_DBLOG_MAGIC_LEN];
+	struct stat sb;
+	size_t end;
+	char *s;
+
+	if (path == NULL) {
+		AG_SetError("No log file specified");
+		return (-1);
+	}
+	if ((db->path = TryStrdup(path)) == NULL) {
+		return (-1);
+	}
+	if (flags & AG_DB_READONLY) {
+		db->flags |= AG_DBLOG_READONLY;
+		db->fd = open(path, O_RDONLY);
+	} else {
+		db->fd = open(path, O_RDWR|O_CREAT, 0644);
+	}
+	if (db->fd == -1) {
+		AG_SetError("%s: %s", path, strerror(errno));
+		goto fail;
+	}
+	if (fstat(db->fd, &sb) == -1) {
+		AG_SetError("%s: %s", path, strerror(errno));
+		goto fail;
+	}
+	if (sb.st_size == 0 && !(db->flags & AG_DBLOG_READONLY)) {
+		if (WriteAll(db->fd, (const Uint8 *)AG_DBLOG_MAGIC,
+		    AG_DBLOG_MAGIC_LEN, 0) == -1 ||
+		    SyncFile(db->fd) == -1) {
+			goto fail;
+		}
+		sb.st_size = AG_DBLOG_MAGIC_LEN;
+	}
+	if (sb.st_size < AG_DBLOG_MAGIC_LEN ||
+	    pread(db->fd, magic, sizeof(magic), 0) != sizeof(magic) ||
+	    memcmp(magic, AG_DBLOG_MAGIC, AG_DBLOG_MAGIC_LEN) != 0) {
+		AG_SetError("%s: Not a log database", path);
+		goto fail;
+	}
+
+	if ((s = AG_GetStringP(db,"sync")) != NULL && strcmp(s,"none") == 0) {
+		db->syncMode = AG_DBLOG_SYNC_NONE;
+	} else if (s != NULL && strcmp(s,"always") == 0) {
+		db->syncMode = AG_DBLOG_SYNC_ALWAYS;
+	} else {
+		db->syncMode = AG_DBLOG_SYNC_GROUP;
+	}
+	if ((db->interval = AG_GetUint(db,"commit-interval")) == 0) {
+		db->interval = 1;
+	}
+	db->bufMax = (size_t)AG_GetUint(db,"buffer-size");
+	db->compactRatio = AG_GetUint(db,"compact-ratio");
+	db->compactMin = (off_t)AG_GetUint(db,"compact-min");
+
+	/* Rebuild the index. */
+	if ((db->buckets = TryMalloc(AG_DBLOG_BUCKETS_INIT *
+	                             sizeof(AG_DbLogEnt *))) == NULL) {
+		goto fail;
+	}
+	memset(db->buckets, 0, AG_DBLOG_BUCKETS_INIT*sizeof(AG_DbLogEnt *));
+	db->nBuckets = AG_DBLOG_BUCKETS_INIT;
+	db->flushedLen = (off_t)sb.st_size;
+	if (MapLog(db) == -1 ||
+	    ReplayLog(db, &end) == -1) {
+		goto fail;
+	}
+	if (end < db->mapLen) {
+		AG_Verbose("%s: Discarding %lu bytes of incomplete log\n",
+		    path, (Ulong)(db->mapLen - end));
+		if (!(db->flags & AG_DBLOG_READONLY)) {
+			if (ftruncate(db->fd, (off_t)end) == -1) {
+				AG_SetError("%s: %s", path, strerror(errno));
+				goto fail;
+			}
+			munmap(db->map, db->mapLen);
+			db->map = NULL;
+			db->mapLen = 0;
+		}
+		db->flushedLen = (off_t)end;
+	}
+	db->logEnd = db->flushedLen;
+	db->flags |= AG_DBLOG_SYNCED;
+
+#ifdef AG_THREADS
+	if (!(db->flags & AG_DBLOG_READONLY)) {
+		if (AG_ThreadTryCreate(&db->th, LogThread, db) == -1) {
+			goto fail;
+		}
+		db->thRunning = 1;
+	}
+#endif
+	return (0);
+fail:
+	CloseLog(db);
+	return (-1);
+}
+
+static void
+Close(void *obj)
+{
+	AG_DbLog *db = obj;
+
+#ifdef AG_THREADS
+	if (db->thRunning) {
+		AG_MutexLock(&db->lock);
+		db->flags |= AG_DBLOG_STOP;
+		AG_CondSignal(&db->thCond);
+		AG_MutexUnlock(&db->lock);
+		AG_ThreadJoin(db->th, NULL);
+		db->thRunning = 0;
+	}
+#endif
+	AG_MutexLock(&db->lock);
+	if (!(db->flags & AG_DBLOG_READONLY) &&
+	    FlushLog(db, 1) == -1) {
+		AG_Verbose("%s: %s; ignoring\n", db->path, AG_GetError());
+	}
+	CloseLog(db);
+	AG_MutexUnlock(&db->lock);
+}
+
+static int
+Sync(void *obj)
+{
+	AG_DbLog *db = obj;
+	int rv = 0;
+
+	AG_MutexLock(&db->lock);
+	if (!(db->flags & AG_DBLOG_READONLY)) {
+		rv = FlushLog(db, 1);
+#ifndef AG_THREADS
+		if (rv == 0 && NeedCompact(db))
+			rv = Compact(db);
+#endif
+	}
+	AG_MutexUnlock(&db->lock);
+	return (rv);
+}
+
+static int
+Exists(void *obj, const AG_Dbt *key)
+{
+	AG_DbLog *db = obj;
+	int rv;
+
+	AG_MutexLock(&db->lock);
+	rv = (FindEnt(db, key->data, key->size, NULL) != NULL);
+	AG_MutexUnlock(&db->lock);
+	return (rv);
+}
+
+/* Return a copy of the value of ent (lock held). */
+static int
+GetValue(AG_DbLog *db, const AG_DbLogEnt *ent, AG_Dbt *val)
+{
+	const Uint8 *p;
+
+	if ((p = LogData(db, ent->off, (size_t)RecLen(ent->keyLen,
+	    ent->valLen))) == NULL) {
+		return (-1);
+	}
+	if ((val->data = TryMalloc(ent->valLen+1)) == NULL) {
+		return (-1);
+	}
+	memcpy(val->data, &p[AG_DBLOG_HDR_SIZE + ent->keyLen], ent->valLen);
+	val->size = ent->valLen;
+	return (0);
+}
+
+static int
+Get(void *obj, const AG_Dbt *key, AG_Dbt *val)
+{
+	AG_DbLog *db = obj;
+	AG_DbLogEnt *ent;
+	int rv;
+
+	AG_MutexLock(&db->lock);
+	if ((ent = FindEnt(db, key->data, key->size, NULL)) == NULL) {
+		AG_SetError("No such key");
+		rv = -1;
+	} else {
+		rv = GetValue(db, ent, val);
+	}
+	AG_MutexUnlock(&db->lock);
+	return (rv);
+}
+
+/* Append a PUT record and update the index (lock held). */
+static int
+PutRecord(AG_DbLog *db, const AG_Dbt *key, const AG_Dbt *val)
+{
+	off_t off;
+
+	if (db->flags & AG_DBLOG_READONLY) {
+		AG_SetError("Database is read-only");
+		return (-1);
+	}
+	if (key->size > 0xffffffffUL || val->size > 0xffffffffUL) {
+		AG_SetError("Record too large");
+		return (-1);
+	}
+	off = AppendRecord(db, AG_DBLOG_PUT, key->data, (Uint32)key->size,
+	    val->data, (Uint32)val->size);
+	if (off == -1) {
+		return (-1);
+	}
+	return IndexPut(db, key->data, key->size, off, (Uint32)val->size);
+}
+
+/* Append a DEL record and update the index (lock held). */
+static int
+DelRecord(AG_DbLog *db, const AG_Dbt *key)
+{
+	if (db->flags & AG_DBLOG_READONLY) {
+		AG_SetError("Database is read-only");
+		return (-1);
+	}
+	if (FindEnt(db, key->data, key->size, NULL) == NULL) {
+		return (0);
+	}
+	if (AppendRecord(db, AG_DBLOG_DEL, key->data, (Uint32)key->size,
+	    NULL, 0) == -1) {
+		return (-1);
+	}
+	return IndexDel(db, key->data, key->size);
+}
+
+static int
+Put(void *obj, const AG_Dbt *key, const AG_Dbt *val)
+{
+	AG_DbLog *db = obj;
+	int rv;
+
+	AG_MutexLock(&db->lock);
+	if ((rv = PutRecord(db, key, val)) == 0) {
+		rv = AfterWrite(db);
+	}
+	AG_MutexUnlock(&db->lock);
+	return (rv);
+}
+
+static int
+Del(void *obj, const AG_Dbt *key)
+{
+	AG_DbLog *db = obj;
+	int rv;
+
+	AG_MutexLock(&db->lock);
+	if ((rv = DelRecord(db, key)) == 0) {
+		rv = AfterWrite(db);
+	}
+	AG_MutexUnlock(&db->lock);
+	return (rv);
+}
+
+/* Iterate over a snapshot of the keys; fn may modify the database. */
+static int
+Iterate(void *obj, AG_DbIterateFn fn, void *arg)
+{
+	AG_DbLog *db = obj;
+	AG_DbLogEnt *ent;
+	AG_Dbt *keys, val;
+	Uint i, n = 0;
+	int rv = 0;
+
+	AG_MutexLock(&db->lock);
+	if ((keys = TryMalloc((db->nEnts+1)*sizeof(AG_Dbt))) == NULL) {
+		AG_MutexUnlock(&db->lock);
+		return (-1);
+	}
+	for (i = 0; i < db->nBuckets; i++) {
+		for (ent = db->buckets[i]; ent != NULL; ent = ent->next) {
+			if ((keys[n].data = TryMalloc(ent->keyLen+1)) == NULL) {
+				AG_MutexUnlock(&db->lock);
+				rv = -1;
+				goto out;
+			}
+			memcpy(keys[n].data, ent->key, ent->keyLen);
+			keys[n].size = ent->keyLen;
+			n++;
+		}
+	}
+	AG_MutexUnlock(&db->lock);
+
+	for (i = 0; i < n; i++) {
+		AG_MutexLock(&db->lock);
+		if ((ent = FindEnt(db, keys[i].data, keys[i].size, NULL))
+		    == NULL) {
+			AG_MutexUnlock(&db->lock);
+			continue;
+		}
+		rv = GetValue(db, ent, &val);
+		AG_MutexUnlock(&db->lock);
+		if (rv == -1) {
+			break;
+		}
+		rv = fn(&keys[i], &val, arg);
+		free(val.data);
+		if (rv == -1)
+			break;
+	}
+out:
+	for (i = 0; i < n; i++) {
+		free(keys[i].data);
+	}
+	free(keys);
+	return (rv);
+}
+
+/* Start buffering records as a batch (lock held). */
+static int
+BeginBatch(AG_DbLog *db)
+{
+	if (db->flags & AG_DBLOG_READONLY) {
+		AG_SetError("Database is read-only");
+		return (-1);
+	}
+	if (GrowBuf(&db->txBuf, &db->txBufSize, 0, AG_DBLOG_HDR_SIZE) == -1) {
+		return (-1);
+	}
+	db->txBufLen = AG_DBLOG_HDR_SIZE;	/* Reserve the BATCH record */
+	db->txCount = 0;
+	db->flags |= AG_DBLOG_TXN;
+	return (0);
+}
+
+/* Append a buffered batch to the log as a unit (lock held). */
+static int
+CommitBatch(AG_DbLog *db)
+{
+	Uint8 *p = db->txBuf;
+
+	if (db->txCount > 0) {
+		p[4] = (Uint8)AG_DBLOG_BATCH;
+		p[5] = 0;
+		p[6] = 0;
+		p[7] = 0;
+		Enc32(&p[8], 0);
+		Enc32(&p[12], db->txCount);
+		Enc32(&p[0], Crc32(0, &p[4], AG_DBLOG_HDR_SIZE-4));
+
+		if (GrowBuf(&db->wrBuf, &db->wrBufSize, db->wrBufLen,
+		    db->txBufLen) == -1) {
+			return (-1);
+		}
+		memcpy(&db->wrBuf[db->wrBufLen], db->txBuf, db->txBufLen);
+		db->wrBufLen += db->txBufLen;
+		db->logEnd += (off_t)db->txBufLen;
+		db->seqEnd++;
+	}
+	db->txBufLen = 0;
+	db->txCount = 0;
+	db->flags &= ~(AG_DBLOG_TXN);
+	FreeUndo(db);
+	return AfterWrite(db);
+}
+
+/* Discard a buffered batch and restore the index (lock held). */
+static void
+AbortBatch(AG_DbLog *db)
+{
+	AG_DbLogUndo *u;
+
+	db->flags &= ~(AG_DBLOG_TXN);
+	for (u = db->undo; u != NULL; u = u->next) {
+		if (u->had) {
+			(void)IndexPut(db, u->key, u->keyLen, u->off,
+			    u->valLen);
+		} else {
+			(void)IndexDel(db, u->key, u->keyLen);
+		}
+	}
+	FreeUndo(db);
+	db->txBufLen = 0;
+	db->txCount = 0;
+}
+
+static int
+Begin(void *obj)
+{
+	AG_DbLog *db = obj;
+	int rv;
+
+	AG_MutexLock(&db->lock);
+	rv = BeginBatch(db);
+	AG_MutexUnlock(&db->lock);
+	return (rv);
+}
+
+static int
+Commit(void *obj)
+{
+	AG_DbLog *db = obj;
+	int rv;
+
+	AG_MutexLock(&db->lock);
+	if ((rv = CommitBatch(db)) == -1) {
+		AbortBatch(db);
+	}
+	AG_MutexUnlock(&db->lock);
+	return (rv);
+}
+
+static int
+Abort(void *obj)
+{
+	AG_DbLog *db = obj;
+
+	AG_MutexLock(&db->lock);
+	AbortBatch(db);
+	AG_MutexUnlock(&db->lock);
+	return (0);
+}
+
+static int
+GetBatch(void *obj, const AG_Dbt *keys, AG_Dbt *vals, Uint n)
+{
+	AG_DbLog *db = obj;
+	AG_DbLogEnt *ent;
+	Uint i;
+
+	AG_MutexLock(&db->lock);
+	for (i = 0; i < n; i++) {
+		if ((ent = FindEnt(db, keys[i].data, keys[i].size, NULL))
+		    == NULL) {
+			vals[i].data = NULL;
+			vals[i].size = 0;
+			continue;
+		}
+		if (GetValue(db, ent, &vals[i]) == -1)
+			goto fail;
+	}
+	AG_MutexUnlock(&db->lock);
+	return (0);
+fail:
+	while (i-- > 0) {
+		Free(vals[i].data);
+		vals[i].data = NULL;
+		vals[i].size = 0;
+	}
+	AG_MutexUnlock(&db->lock);
+	return (-1);
+}
+
+/*
+ * Batches are written atomically. Within an open transaction, the records
+ * simply become part of it.
+ */
+static int
+PutBatch(void *obj, const AG_Dbt *keys, const AG_Dbt *vals, Uint n)
+{
+	AG_DbLog *db = obj;
+	int inTxn, rv = 0;
+	Uint i;
+
+	AG_MutexLock(&db->lock);
+	if (!(inTxn = (db->flags & AG_DBLOG_TXN)) && BeginBatch(db) == -1) {
+		AG_MutexUnlock(&db->lock);
+		return (-1);
+	}
+	for (i = 0; i < n; i++) {
+		if ((rv = PutRecord(db, &keys[i], &vals[i])) == -1)
+			break;
+	}
+	if (!inTxn) {
+		if (rv == 0) {
+			rv = CommitBatch(db);
+		} else {
+			AbortBatch(db);
+		}
+	}
+	AG_MutexUnlock(&db->lock);
+	return (rv);
+}
+
+static int
+DelBatch(void *obj, const AG_Dbt *keys, Uint n)
+{
+	AG_DbLog *db = obj;
+	int inTxn, rv = 0;
+	Uint i;
+
+	AG_MutexLock(&db->lock);
+	if (!(inTxn = (db->flags & AG_DBLOG_TXN)) && BeginBatch(db) == -1) {
+		AG_MutexUnlock(&db->lock);
+		return (-1);
+	}
+	for (i = 0; i < n; i++) {
+		if ((rv = DelRecord(db, &keys[i])) == -1)
+			break;
+	}
+	if (!inTxn) {
+		if (rv == 0) {
+			rv = CommitBatch(db);
+		} else {
+			AbortBatch(db);
+		}
+	}
+	AG_MutexUnlock(&db->lock);
+	return (rv);
+}
+
+AG_DbClass agDbLogClass = {
+	{
+		"Agar(Db:DbLog)",
+		sizeof(AG_DbLog),
+		{ 0,0 },
+		Init,
+		NULL,		/* free */
+		Destroy,
+		NULL,		/* load */
+		NULL,		/* save */
+		NULL		/* edit */
+	},
+	"log",
+	N_("Log-structured key-value store"),
+	AG_DB_KEY_DATA,		/* Key is variable data */
+	AG_DB_REC_VARIABLE,	/* Variable-sized records */
+	Open,
+	Close,
+	Sync,
+	Exists,
+	Get,
+	Put,
+	Del,
+	Iterate,
+	Begin,
+	Commit,
+	Abort,
+	GetBatch,
+	PutBatch,
+	DelBatch
+};
@@ -25,23 +25,112 @@
 
 /*
  * MySQL database access.
+ *
+ * Single-key operations use server-side prepared statements (cached per
+ * connection) and the binary protocol; batches use multi-row statements.
+ * Connections are returned to a pool on close and reused by subsequent
+ * opens with the same connection parameters and options, along with their
+ * prepared statements. Idle connections are closed by AG_Destroy().
  */
 
 #include <agar/core/core.h>
 
 #include <ctype.h>
+#include <string.h>
 #include <mysql.h>
+#include <errmsg.h>
+#include <mysqld_error.h>
+
+/* Prepared statements cached per connection. */
+enum ag_db_mysql_stmt {
+	AG_DB_MYSQL_EXISTS,
+	AG_DB_MYSQL_GET,
+	AG_DB_MYSQL_PUT,
+	AG_DB_MYSQL_DEL,
+	AG_DB_MYSQL_STMT_LAST
+};
+
+/* Server connection. */
+typedef struct ag_db_mysql_conn {
+	MYSQL *my;
+	char *params;				/* Connection parameters */
+	MYSQL_STMT *stmt[AG_DB_MYSQL_STMT_LAST];
+	struct ag_db_mysql_conn *next;		/* In pool */
+} AG_DbMySQLConn;
 
 typedef struct ag_db_mysql {
 	struct ag_db _inherit;
 	MYSQL *my;
+	AG_DbMySQLConn *conn;
 } AG_DbMySQL;
 
+/* Idle connections available for reuse. */
+static AG_Mutex agDbMySQLPoolLock = AG_MUTEX_INITIALIZER;
+static AG_DbMySQLConn *agDbMySQLPool = NULL;
+static Uint agDbMySQLPoolCount = 0;
+static AG_Once agDbMySQLInitOnce = AG_ONCE_INIT;
+static int agDbMySQLInitFailed = 0;
+#ifdef AG_THREADS
+static AG_ThreadKey agDbMySQLThreadKey;	/* Set once thread is initialized */
+#endif
+
+#ifdef AG_THREADS
+static void
+ThreadEnd(void *arg)
+{
+	mysql_thread_end();
+}
+#endif
+
+static void
+InitLibrary(void)
+{
+	if (mysql_library_init(0, NULL, NULL) != 0) {
+		agDbMySQLInitFailed = 1;
+		return;
+	}
+#ifdef AG_THREADS
+	if (AG_ThreadKeyTryCreate(&agDbMySQLThreadKey, ThreadEnd) == -1)
+		agDbMySQLInitFailed = 1;
+#endif
+}
+
+/*
+ * Initialize the library for the calling thread, arranging for
+ * mysql_thread_end() to be called when the thread exits.
+ */
+static int
+InitThread(void)
+{
+	AG_ThreadOnce(&agDbMySQLInitOnce, InitLibrary);  /* Not MT-safe */
+	if (agDbMySQLInitFailed) {
+		AG_SetError("mysql_library_init failed");
+		return (-1);
+	}
+#ifdef AG_THREADS
+	if (AG_ThreadKeyGet(agDbMySQLThreadKey) != NULL) {
+		return (0);
+	}
+	if (mysql_thread_init() != 0) {
+		AG_SetError("mysql_thread_init failed");
+		return (-1);
+	}
+	if (AG_ThreadKeyTrySet(agDbMySQLThreadKey, &agDbMySQLThreadKey) == -1) {
+		mysql_thread_end();
+		return (-1);
+	}
+#endif
+	return (0);
+}
+
 static void
 Init(void *obj)
 {
 	AG_DbMySQL *db = obj;
 
+	db->my = NULL;
+	db->conn = NULL;
+
 	AG_SetString(db, "host",		NULL);
 	AG_SetInt(db,    "port",		0);
 	AG_SetString(db, "database",		NULL);
@@ -66,6 +155,220 @@ Init(void *obj)
 	AG_SetString(db, "get-cmd", "SELECT my_field FROM my_table "
                                     "WHERE my_field = '%s'");
 	AG_SetString(db, "put-cmd", "INSERT INTO my_table VALUES('%s')");
+
+	AG_SetString(db, "table",		"agar_db");
+	AG_SetString(db, "key-field",		"k");
+	AG_SetString(db, "value-field",		"v");
+	AG_SetUint(db,   "batch-max",		1048576);
+	AG_SetUint(db,   "pool-max",		4);
+}
+
+/* Dynamically-sized SQL statement. */
+typedef struct ag_db_mysql_query {
+	char *s;
+	size_t len, size;
+} AG_DbMySQLQuery;
+
+static int
+QueryAppend(AG_DbMySQLQuery *q, const char *s, size_t len)
+{
+	char *sNew;
+	size_t sizeNew;
+
+	if (q->len+len+1 > q->size) {
+		for (sizeNew = (q->size > 0) ? q->size : 256;
+		     sizeNew < q->len+len+1;
+		     sizeNew *= 2)
+			;;
+		if ((sNew = TryRealloc(q->s, sizeNew)) == NULL) {
+			return (-1);
+		}
+		q->s = sNew;
+		q->size = sizeNew;
+	}
+	memcpy(&q->s[q->len], s, len);
+	q->len += len;
+	q->s[q->len] = '\0';
+	return (0);
+}
+
+static __inline__ int
+QueryAppendS(AG_DbMySQLQuery *q, const char *s)
+{
+	return QueryAppend(q, s, strlen(s));
+}
+
+/* Append binary data as a hexadecimal literal. */
+static int
+QueryAppendHex(AG_DbMySQLQuery *q, const AG_Dbt *d)
+{
+	char *hex;
+	unsigned long len;
+
+	if (d->size == 0) {
+		return QueryAppend(q, "''", 2);
+	}
+	if ((hex = TryMalloc(d->size*2 + 1)) == NULL) {
+		return (-1);
+	}
+	len = mysql_hex_string(hex, d->data, (unsigned long)d->size);
+	if (QueryAppend(q, "X'", 2) == -1 ||
+	    QueryAppend(q, hex, (size_t)len) == -1 ||
+	    QueryAppend(q, "'", 1) == -1) {
+		free(hex);
+		return (-1);
+	}
+	free(hex);
+	return (0);
+}
+
+/* Append a "(k1,k2,...)" list for keys [i,n), up to the "batch-max" limit. */
+static int
+QueryAppendKeys(AG_DbMySQL *db, AG_DbMySQLQuery *q, const AG_Dbt *keys,
+    Uint i, Uint n, Uint *end)
+{
+	size_t batchMax = (size_t)AG_GetUint(db,"batch-max");
+	Uint j;
+
+	if (QueryAppend(q, "(", 1) == -1) {
+		return (-1);
+	}
+	for (j = i; j < n; j++) {
+		if (j > i) {
+			if (q->len + keys[j].size*2 + 8 > batchMax) {
+				break;
+			}
+			if (QueryAppend(q, ",", 1) == -1)
+				return (-1);
+		}
+		if (QueryAppendHex(q, &keys[j]) == -1)
+			return (-1);
+	}
+	*end = j;
+	return QueryAppend(q, ")", 1);
+}
+
+static int
+Query(AG_DbMySQL *db, const AG_DbMySQLQuery *q)
+{
+	if (mysql_real_query(db->my, q->s, (unsigned long)q->len) != 0) {
+		AG_SetError("MySQL: %s", mysql_error(db->my));
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Return a string identifying the server, credentials, connection options
+ * and table used by a database, for matching pooled connections.
+ */
+static char *
+ConnParams(AG_DbMySQL *db, const char *dbName)
+{
+	const char *names[] = {
+		"host", "user", "password", "unix-socket",
+		"cnf-file", "cnf-group", "protocol", "init-cmd",
+		"charset", "charset-dir",
+		"table", "key-field", "value-field"
+	};
+	const char *numNames[] = {
+		"port", "compress", "local-files", "ssl", "ssl-verify-cert",
+		"secure-auth", "read-timeout", "write-timeout", "reconnect"
+	};
+	AG_DbMySQLQuery q = { NULL, 0, 0 };
+	AG_Variable *V;
+	const char *s;
+	char num[32];
+	Uint i;
+
+	if (QueryAppendS(&q, dbName) == -1) {
+		goto fail;
+	}
+	for (i = 0; i < sizeof(names)/sizeof(names[0]); i++) {
+		s = AG_GetStringP(db, names[i]);
+		if (QueryAppend(&q, "\n", 1) == -1 ||
+		    (s != NULL && QueryAppendS(&q, s) == -1))
+			goto fail;
+	}
+	for (i = 0; i < sizeof(numNames)/sizeof(numNames[0]); i++) {
+		AG_ObjectLock(db);
+		if ((V = AG_GetVariableLocked(db, numNames[i])) != NULL) {
+			AG_PrintVariable(num, sizeof(num), V);
+			AG_UnlockVariable(V);
+		} else {
+			num[0] = '\0';
+		}
+		AG_ObjectUnlock(db);
+		if (QueryAppend(&q, "\n", 1) == -1 ||
+		    QueryAppendS(&q, num) == -1)
+			goto fail;
+	}
+	return (q.s);
+fail:
+	Free(q.s);
+	return (NULL);
+}
+
+static void
+CloseStmts(AG_DbMySQLConn *conn)
+{
+	int i;
+
+	for (i = 0; i < AG_DB_MYSQL_STMT_LAST; i++) {
+		if (conn->stmt[i] != NULL) {
+			mysql_stmt_close(conn->stmt[i]);
+			conn->stmt[i] = NULL;
+		}
+	}
+}
+
+static void
+CloseConn(AG_DbMySQLConn *conn)
+{
+	CloseStmts(conn);
+	mysql_close(conn->my);
+	Free(conn->params);
+	free(conn);
+}
+
+/* Take an idle connection matching params from the pool. */
+static AG_DbMySQLConn *
+PoolGet(const char *params)
+{
+	AG_DbMySQLConn *conn, **pConn;
+
+	AG_MutexLock(&agDbMySQLPoolLock);
+	for (pConn = &agDbMySQLPool;
+	     (conn = *pConn) != NULL;
+	     pConn = &conn->next) {
+		if (strcmp(conn->params, params) == 0) {
+			*pConn = conn->next;
+			agDbMySQLPoolCount--;
+			break;
+		}
+	}
+	AG_MutexUnlock(&agDbMySQLPoolLock);
+	return (conn);
+}
+
+/*
+ * Return a connection to the pool, unless the pool already holds max
+ * idle connections.
+ */
+static void
+PoolPut(AG_DbMySQLConn *conn, Uint max)
+{
+	AG_MutexLock(&agDbMySQLPoolLock);
+	if (agDbMySQLPoolCount < max) {
+		conn->next = agDbMySQLPool;
+		agDbMySQLPool = conn;
+		agDbMySQLPoolCount++;
+		conn = NULL;
+	}
+	AG_MutexUnlock(&agDbMySQLPoolLock);
+
+	if (conn != NULL)
+		CloseConn(conn);
 }
 
 static int
@@ -73,21 +376,40 @@ Open(void *obj, const char *path, Uint flags)
 {
 	char dbName[128];
 	AG_DbMySQL *db = obj;
+	AG_DbMySQLConn *conn;
 	MYSQL *my;
 	unsigned long myFlags = CLIENT_REMEMBER_OPTIONS;
-	char *s;
+	char *params, *s;
 	Uint i;
 	my_bool b = 1;
 	
-	if ((my = mysql_init(NULL)) == NULL) {
-		AG_SetError("mysql_init failed");
-		return (-1);
-	}
 	if (path != NULL) {
 		Strlcpy(dbName, path, sizeof(dbName));
 	} else {
 		AG_GetString(db, "database", dbName, sizeof(dbName));
 	}
+	if (InitThread() == -1 ||
+	    (params = ConnParams(db, dbName)) == NULL) {
+		return (-1);
+	}
+	if ((conn = PoolGet(params)) != NULL) {
+		Free(params);
+		db->conn = conn;
+		db->my = conn->my;
+		return (0);
+	}
+	if ((conn = TryMalloc(sizeof(AG_DbMySQLConn))) == NULL) {
+		Free(params);
+		return (-1);
+	}
+	conn->params = params;
+	for (i = 0; i < AG_DB_MYSQL_STMT_LAST; i++)
+		conn->stmt[i] = NULL;
+
+	if ((my = mysql_init(NULL)) == NULL) {
+		AG_SetError("mysql_init failed");
+		goto fail;
+	}
 	if (AG_GetInt(db,"compress") == 1)	{ myFlags |= CLIENT_COMPRESS; }
 	if (AG_GetInt(db,"local-files") == 1)	{ myFlags |= CLIENT_LOCAL_FILES; }
 	if (AG_GetInt(db,"ssl") == 1)		{ myFlags |= CLIENT_SSL; }
@@ -115,20 +437,26 @@ Open(void *obj, const char *path, Uint flags)
 	if ((s = AG_GetStringP(db,"charset")) != NULL)	 { mysql_options(my, MYSQL_SET_CHARSET_NAME, s); }
 	if ((s = AG_GetStringP(db,"charset-dir")) != NULL) { mysql_options(my, MYSQL_SET_CHARSET_DIR, s); }
 
-	db->my = mysql_real_connect(my,
-	    AG_GetStringP(my,"host"),
-	    AG_GetStringP(my,"user"),
-	    AG_GetStringP(my,"pass"),
+	conn->my = mysql_real_connect(my,
+	    AG_GetStringP(db,"host"),
+	    AG_GetStringP(db,"user"),
+	    AG_GetStringP(db,"password"),
 	    dbName,
-	    AG_GetInt(my,"port"),
-	    AG_GetStringP(my,"unix-socket"),
+	    AG_GetInt(db,"port"),
+	    AG_GetStringP(db,"unix-socket"),
 	    myFlags);
-	if (db->my == NULL) {
+	if (conn->my == NULL) {
 		AG_SetError("MySQL: %s", mysql_error(my));
 		mysql_close(my);
-		return (-1);
+		goto fail;
 	}
+	db->conn = conn;
+	db->my = conn->my;
 	return (0);
+fail:
+	Free(conn->params);
+	free(conn);
+	return (-1);
 }
 
 static void
@@ -136,50 +464,434 @@ Close(void *obj)
 {
 	AG_DbMySQL *db = obj;
 
-	mysql_close(db->my);
+	PoolPut(db->conn, AG_GetUint(db,"pool-max"));
+	db->conn = NULL;
 	db->my = NULL;
 }
 
-static __inline__ char *
-EncodeKey(const AG_Dbt *key)
+/*
+ * Close the idle connections in the pool, and release the library's
+ * state for the calling thread. Called from AG_Destroy().
+ */
+void
+AG_DbMySQLDestroy(void)
 {
-	/* XXX: TODO */
-	return Strdup(key->data);
+	AG_DbMySQLConn *conn, *connNext;
+
+	AG_MutexLock(&agDbMySQLPoolLock);
+	conn = agDbMySQLPool;
+	agDbMySQLPool = NULL;
+	agDbMySQLPoolCount = 0;
+	AG_MutexUnlock(&agDbMySQLPoolLock);
+
+	for (; conn != NULL; conn = connNext) {
+		connNext = conn->next;
+		CloseConn(conn);
+	}
+#ifdef AG_THREADS
+	if (!agDbMySQLInitFailed &&
+	    AG_ThreadKeyGet(agDbMySQLThreadKey) != NULL) {
+		mysql_thread_end();
+		AG_ThreadKeySet(agDbMySQLThreadKey, NULL);
+	}
+#endif
+}
+
+/* Return the given prepared statement, preparing it on first use. */
+static MYSQL_STMT *
+GetStmt(AG_DbMySQL *db, enum ag_db_mysql_stmt which)
+{
+	AG_DbMySQLConn *conn = db->conn;
+	AG_DbMySQLQuery q = { NULL, 0, 0 };
+	const char *table = AG_GetStringP(db,"table");
+	const char *kf = AG_GetStringP(db,"key-field");
+	const char *vf = AG_GetStringP(db,"value-field");
+	MYSQL_STMT *stmt;
+	int rv = -1;
+
+	if (conn->stmt[which] != NULL) {
+		return (conn->stmt[which]);
+	}
+	switch (which) {
+	case AG_DB_MYSQL_EXISTS:
+		rv = (QueryAppendS(&q, "SELECT 1 FROM ") == -1 ||
+		      QueryAppendS(&q, table) == -1 ||
+		      QueryAppendS(&q, " WHERE ") == -1 ||
+		      QueryAppendS(&q, kf) == -1 ||
+		      QueryAppendS(&q, "=?") == -1) ? -1 : 0;
+		break;
+	case AG_DB_MYSQL_GET:
+		rv = (QueryAppendS(&q, "SELECT ") == -1 ||
+		      QueryAppendS(&q, vf) == -1 ||
+		      QueryAppendS(&q, " FROM ") == -1 ||
+		      QueryAppendS(&q, table) == -1 ||
+		      QueryAppendS(&q, " WHERE ") == -1 ||
+		      QueryAppendS(&q, kf) == -1 ||
+		      QueryAppendS(&q, "=?") == -1) ? -1 : 0;
+		break;
+	case AG_DB_MYSQL_PUT:
+		rv = (QueryAppendS(&q, "INSERT INTO ") == -1 ||
+		      QueryAppendS(&q, table) == -1 ||
+		      QueryAppend(&q, " (", 2) == -1 ||
+		      QueryAppendS(&q, kf) == -1 ||
+		      QueryAppend(&q, ",", 1) == -1 ||
+		      QueryAppendS(&q, vf) == -1 ||
+		      QueryAppendS(&q, ") VALUES (?,?) "
+		                       "ON DUPLICATE KEY UPDATE ") == -1 ||
+		      QueryAppendS(&q, vf) == -1 ||
+		      QueryAppendS(&q, "=VALUES(") == -1 ||
+		      QueryAppendS(&q, vf) == -1 ||
+		      QueryAppend(&q, ")", 1) == -1) ? -1 : 0;
+		break;
+	case AG_DB_MYSQL_DEL:
+		rv = (QueryAppendS(&q, "DELETE FROM ") == -1 ||
+		      QueryAppendS(&q, table) == -1 ||
+		      QueryAppendS(&q, " WHERE ") == -1 ||
+		      QueryAppendS(&q, kf) == -1 ||
+		      QueryAppendS(&q, "=?") == -1) ? -1 : 0;
+		break;
+	default:
+		AG_SetError("Bad statement");
+		break;
+	}
+	if (rv == -1) {
+		goto fail;
+	}
+	if ((stmt = mysql_stmt_init(db->my)) == NULL) {
+		AG_SetError("MySQL: %s", mysql_error(db->my));
+		goto fail;
+	}
+	if (mysql_stmt_prepare(stmt, q.s, (unsigned long)q.len) != 0) {
+		AG_SetError("MySQL: %s", mysql_stmt_error(stmt));
+		mysql_stmt_close(stmt);
+		goto fail;
+	}
+	Free(q.s);
+	conn->stmt[which] = stmt;
+	return (stmt);
+fail:
+	Free(q.s);
+	return (NULL);
+}
+
+/*
+ * Execute a prepared statement with the given key (and value) parameters.
+ * If the statement was invalidated by a reconnection, prepare it again
+ * and retry once.
+ */
+static MYSQL_STMT *
+ExecStmt(AG_DbMySQL *db, enum ag_db_mysql_stmt which, const AG_Dbt *key,
+    const AG_Dbt *val)
+{
+	MYSQL_STMT *stmt;
+	MYSQL_BIND bind[2];
+	unsigned long len[2];
+	int retry;
+
+	for (retry = 1; ; retry--) {
+		if ((stmt = GetStmt(db, which)) == NULL) {
+			return (NULL);
+		}
+		memset(bind, 0, sizeof(bind));
+		len[0] = (unsigned long)key->size;
+		bind[0].buffer_type = MYSQL_TYPE_BLOB;
+		bind[0].buffer = key->data;
+		bind[0].buffer_length = len[0];
+		bind[0].length = &len[0];
+		if (val != NULL) {
+			len[1] = (unsigned long)val->size;
+			bind[1].buffer_type = MYSQL_TYPE_BLOB;
+			bind[1].buffer = val->data;
+			bind[1].buffer_length = len[1];
+			bind[1].length = &len[1];
+		}
+		if (mysql_stmt_bind_param(stmt, bind) == 0 &&
+		    mysql_stmt_execute(stmt) == 0) {
+			return (stmt);
+		}
+		AG_SetError("MySQL: %s", mysql_stmt_error(stmt));
+		switch (mysql_stmt_errno(stmt)) {
+		case CR_SERVER_GONE_ERROR:
+		case CR_SERVER_LOST:
+		case ER_UNKNOWN_STMT_HANDLER:
+			if (retry) {
+				break;
+			}
+			/* FALLTHROUGH */
+		default:
+			return (NULL);
+		}
+		CloseStmts(db->conn);
+		if (mysql_ping(db->my) != 0)	/* Reconnect */
+			return (NULL);
+	}
 }
 
 static int
 Exists(void *obj, const AG_Dbt *key)
 {
 	AG_DbMySQL *db = obj;
-	char *ks, *q;
+	MYSQL_STMT *stmt;
+	int rv;
 
-	ks = EncodeKey(key);
-	Asprintf(&q, AG_GetStringP(db,"get-cmd"), ks);
-	Free(ks);
-	if (mysql_query(db->my, q) != 0) {
-		AG_SetError("Get: %s", mysql_error(db->my));
+	if ((stmt = ExecStmt(db, AG_DB_MYSQL_EXISTS, key, NULL)) == NULL) {
+		return (-1);
+	}
+	if (mysql_stmt_store_result(stmt) != 0) {
+		AG_SetError("MySQL: %s", mysql_stmt_error(stmt));
 		return (-1);
 	}
-	Free(q);
-	return (mysql_field_count(db->my) > 0) ? 1 : 0;
+	rv = (mysql_stmt_num_rows(stmt) > 0) ? 1 : 0;
+	mysql_stmt_free_result(stmt);
+	return (rv);
+}
+
+/*
+ * Fetch multiple records with "SELECT k,v ... WHERE k IN (...)" statements,
+ * matching the returned rows back to the requested keys.
+ */
+static int
+GetBatch(void *obj, const AG_Dbt *keys, AG_Dbt *vals, Uint n)
+{
+	AG_DbMySQL *db = obj;
+	AG_DbMySQLQuery q = { NULL, 0, 0 };
+	MYSQL_RES *res;
+	MYSQL_ROW row;
+	unsigned long *lens;
+	Uint i, j, k;
+
+	for (i = 0; i < n; i++) {
+		vals[i].data = NULL;
+		vals[i].size = 0;
+	}
+	for (i = 0; i < n; i = j) {
+		q.len = 0;
+		if (QueryAppendS(&q, "SELECT ") == -1 ||
+		    QueryAppendS(&q, AG_GetStringP(db,"key-field")) == -1 ||
+		    QueryAppend(&q, ",", 1) == -1 ||
+		    QueryAppendS(&q, AG_GetStringP(db,"value-field")) == -1 ||
+		    QueryAppendS(&q, " FROM ") == -1 ||
+		    QueryAppendS(&q, AG_GetStringP(db,"table")) == -1 ||
+		    QueryAppendS(&q, " WHERE ") == -1 ||
+		    QueryAppendS(&q, AG_GetStringP(db,"key-field")) == -1 ||
+		    QueryAppendS(&q, " IN ") == -1 ||
+		    QueryAppendKeys(db, &q, keys, i, n, &j) == -1 ||
+		    Query(db, &q) == -1) {
+			goto fail;
+		}
+		if ((res = mysql_store_result(db->my)) == NULL) {
+			AG_SetError("MySQL: %s", mysql_error(db->my));
+			goto fail;
+		}
+		while ((row = mysql_fetch_row(res)) != NULL) {
+			lens = mysql_fetch_lengths(res);
+			for (k = i; k < j; k++) {
+				if (vals[k].data == NULL &&
+				    keys[k].size == lens[0] &&
+				    memcmp(keys[k].data, row[0], lens[0]) == 0)
+					break;
+			}
+			if (k == j) {
+				continue;
+			}
+			if ((vals[k].data = TryMalloc(lens[1]+1)) == NULL) {
+				mysql_free_result(res);
+				goto fail;
+			}
+			memcpy(vals[k].data, row[1], lens[1]);
+			vals[k].size = (size_t)lens[1];
+		}
+		mysql_free_result(res);
+	}
+	Free(q.s);
+	return (0);
+fail:
+	for (i = 0; i < n; i++) {
+		Free(vals[i].data);
+		vals[i].data = NULL;
+		vals[i].size = 0;
+	}
+	Free(q.s);
+	return (-1);
+}
+
+/*
+ * Write multiple records with multi-row "INSERT ... ON DUPLICATE KEY UPDATE"
+ * statements of at most "batch-max" bytes.
+ */
+static int
+PutBatch(void *obj, const AG_Dbt *keys, const AG_Dbt *vals, Uint n)
+{
+	AG_DbMySQL *db = obj;
+	AG_DbMySQLQuery q = { NULL, 0, 0 };
+	size_t batchMax = (size_t)AG_GetUint(db,"batch-max");
+	const char *vf = AG_GetStringP(db,"value-field");
+	Uint i, j;
+
+	for (i = 0; i < n; i = j) {
+		q.len = 0;
+		if (QueryAppendS(&q, "INSERT INTO ") == -1 ||
+		    QueryAppendS(&q, AG_GetStringP(db,"table")) == -1 ||
+		    QueryAppend(&q, " (", 2) == -1 ||
+		    QueryAppendS(&q, AG_GetStringP(db,"key-field")) == -1 ||
+		    QueryAppend(&q, ",", 1) == -1 ||
+		    QueryAppendS(&q, vf) == -1 ||
+		    QueryAppendS(&q, ") VALUES ") == -1) {
+			goto fail;
+		}
+		for (j = i; j < n; j++) {
+			if (j > i) {
+				if (q.len + (keys[j].size+vals[j].size)*2 + 16 >
+				    batchMax) {
+					break;
+				}
+				if (QueryAppend(&q, ",", 1) == -1)
+					goto fail;
+			}
+			if (QueryAppend(&q, "(", 1) == -1 ||
+			    QueryAppendHex(&q, &keys[j]) == -1 ||
+			    QueryAppend(&q, ",", 1) == -1 ||
+			    QueryAppendHex(&q, &vals[j]) == -1 ||
+			    QueryAppend(&q, ")", 1) == -1)
+				goto fail;
+		}
+		if (QueryAppendS(&q, " ON DUPLICATE KEY UPDATE ") == -1 ||
+		    QueryAppendS(&q, vf) == -1 ||
+		    QueryAppendS(&q, "=VALUES(") == -1 ||
+		    QueryAppendS(&q, vf) == -1 ||
+		    QueryAppend(&q, ")", 1) == -1 ||
+		    Query(db, &q) == -1)
+			goto fail;
+	}
+	Free(q.s);
+	return (0);
+fail:
+	Free(q.s);
+	return (-1);
 }
 
+/* Delete multiple records with "DELETE ... WHERE k IN (...)" statements. */
+static int
+DelBatch(void *obj, const AG_Dbt *keys, Uint n)
+{
+	AG_DbMySQL *db = obj;
+	AG_DbMySQLQuery q = { NULL, 0, 0 };
+	Uint i, j;
+
+	for (i = 0; i < n; i = j) {
+		q.len = 0;
+		if (QueryAppendS(&q, "DELETE FROM ") == -1 ||
+		    QueryAppendS(&q, AG_GetStringP(db,"table")) == -1 ||
+		    QueryAppendS(&q, " WHERE ") == -1 ||
+		    QueryAppendS(&q, AG_GetStringP(db,"key-field")) == -1 ||
+		    QueryAppendS(&q, " IN ") == -1 ||
+		    QueryAppendKeys(db, &q, keys, i, n, &j) == -1 ||
+		    Query(db, &q) == -1) {
+			Free(q.s);
+			return (-1);
+		}
+	}
+	Free(q.s);
+	return (0);
+}
+
+/* Fetch a record, retrieving the value as binary data. */
 static int
 Get(void *obj, const AG_Dbt *key, AG_Dbt *val)
 {
+	AG_DbMySQL *db = obj;
+	MYSQL_STMT *stmt;
+	MYSQL_BIND res;
+	unsigned long len = 0;
+	my_bool isNull = 0;
+
+	if ((stmt = ExecStmt(db, AG_DB_MYSQL_GET, key, NULL)) == NULL) {
+		return (-1);
+	}
+	memset(&res, 0, sizeof(res));
+	res.buffer_type = MYSQL_TYPE_BLOB;
+	res.length = &len;
+	res.is_null = &isNull;
+	if (mysql_stmt_bind_result(stmt, &res) != 0) {
+		goto fail_stmt;
+	}
+	switch (mysql_stmt_fetch(stmt)) {
+	case 0:
+	case MYSQL_DATA_TRUNCATED:		/* Length is now known */
+		break;
+	case MYSQL_NO_DATA:
+		AG_SetError("No such key");
+		goto fail;
+	default:
+		goto fail_stmt;
+	}
+	if ((val->data = TryMalloc(len+1)) == NULL) {
+		goto fail;
+	}
+	if (len > 0) {
+		res.buffer = val->data;
+		res.buffer_length = len;
+		if (mysql_stmt_fetch_column(stmt, &res, 0, 0) != 0) {
+			Free(val->data);
+			goto fail_stmt;
+		}
+	}
+	val->size = (size_t)len;
+	mysql_stmt_free_result(stmt);
+	return (0);
+fail_stmt:
+	AG_SetError("MySQL: %s", mysql_stmt_error(stmt));
+fail:
+	mysql_stmt_free_result(stmt);
 	return (-1);
 }
 		
 static int
 Put(void *obj, const AG_Dbt *key, const AG_Dbt *val)
 {
-	return (-1);
+	return (ExecStmt(obj, AG_DB_MYSQL_PUT, key, val) != NULL) ? 0 : -1;
 }
 
 static int
 Del(void *obj, const AG_Dbt *key)
 {
-	return (-1);
+	return (ExecStmt(obj, AG_DB_MYSQL_DEL, key, NULL) != NULL) ? 0 : -1;
+}
+
+static int
+Begin(void *obj)
+{
+	AG_DbMySQL *db = obj;
+
+	if (mysql_query(db->my, "START TRANSACTION") != 0) {
+		AG_SetError("MySQL: %s", mysql_error(db->my));
+		return (-1);
+	}
+	return (0);
+}
+
+static int
+Commit(void *obj)
+{
+	AG_DbMySQL *db = obj;
+
+	if (mysql_commit(db->my) != 0) {
+		AG_SetError("MySQL: %s", mysql_error(db->my));
+		return (-1);
+	}
+	return (0);
+}
+
+static int
+Abort(void *obj)
+{
+	AG_DbMySQL *db = obj;
+
+	if (mysql_rollback(db->my) != 0) {
+		AG_SetError("MySQL: %s", mysql_error(db->my));
+		return (-1);
+	}
+	return (0);
 }
 
 static int
@@ -211,5 +923,11 @@ AG_DbClass agDbMySQLClass = {
 	Get,
 	Put,
 	Del,
-	Iterate
+	Iterate,
+	Begin,
+	Commit,
+	Abort,
+	GetBatch,
+	PutBatch,
+	DelBatch
 };
@@ -10,7 +10,7 @@
  * 2. Redistributions in binary form must reproduce the above copyright
  *    notice, this list of conditions and the following disclaimer in the
  *    documentation and/or other materials provided with the distribution.
- * 
+ *
  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
@@ -25,9 +25,308 @@
 
 /*
  * Database-bound object class.
+ *
+ * With AG_DbObjectCacheInit(), records are cached in memory along with the
+ * objects decoded from them by AG_DbObjectGet(), up to a memory bound
+ * (least recently used entries are evicted first). Saves and deletes are
+ * queued and written out later by AG_DbObjectFlush(); repeated updates to
+ * the same key are coalesced into a single write. A flush writes the queued
+ * updates in the order they were last made, within a single transaction,
+ * and syncs the database before returning.
  */
 
 #include <agar/core/core.h>
+#include <agar/core/dbobject.h>
+
+#include <string.h>
+
+#define AG_DBOBJECT_BUCKETS	256		/* Cache hash buckets */
+
+/* Cache entry. */
+typedef struct ag_dbobject_ent {
+	char *key;
+	size_t keySize;				/* Key size (incl. NUL) */
+	Uint32 hash;
+	Uint flags;
+#define AG_DBOBJECT_ENT_DIRTY	0x01		/* In write-behind queue */
+#define AG_DBOBJECT_ENT_DELETED	0x02		/* Pending deletion */
+	Uint8 *data;				/* Serialized record */
+	size_t size;
+	AG_DbObject *obj;			/* Decoded object (or NULL) */
+	struct ag_dbobject_ent *next;		/* In hash bucket */
+	AG_TAILQ_ENTRY(ag_dbobject_ent) lru;
+	AG_TAILQ_ENTRY(ag_dbobject_ent) pending;
+} AG_DbObjectEnt;
+
+static __inline__ Uint32
+HashKey(const char *key)
+{
+	Uint32 h = 2166136261U;
+
+	while (*key != '\0') {
+		h ^= (Uint8)*key++;
+		h *= 16777619U;
+	}
+	return (h);
+}
+
+/* Memory attributed to an entry. */
+static __inline__ size_t
+EntCost(const AG_DbObjectEnt *ent)
+{
+	return (sizeof(AG_DbObjectEnt) + ent->keySize + ent->size +
+	        (ent->obj != NULL ? AGOBJECT(ent->obj)->cls->size : 0));
+}
+
+static AG_DbObjectEnt *
+FindEnt(AG_DbObjectCache *oc, const char *key)
+{
+	AG_DbObjectEnt *ent;
+	Uint32 h = HashKey(key);
+
+	for (ent = oc->buckets[h % oc->nBuckets];
+	     ent != NULL;
+	     ent = ent->next) {
+		if (ent->hash == h && strcmp(ent->key, key) == 0)
+			return (ent);
+	}
+	return (NULL);
+}
+
+static AG_DbObjectEnt *
+CreateEnt(AG_DbObjectCache *oc, const char *key)
+{
+	AG_DbObjectEnt *ent;
+	Uint b;
+
+	if ((ent = TryMalloc(sizeof(AG_DbObjectEnt))) == NULL) {
+		return (NULL);
+	}
+	if ((ent->key = TryStrdup(key)) == NULL) {
+		free(ent);
+		return (NULL);
+	}
+	ent->keySize = strlen(key)+1;
+	ent->hash = HashKey(key);
+	ent->flags = 0;
+	ent->data = NULL;
+	ent->size = 0;
+	ent->obj = NULL;
+	b = ent->hash % oc->nBuckets;
+	ent->next = oc->buckets[b];
+	oc->buckets[b] = ent;
+	TAILQ_INSERT_TAIL(&oc->lru, ent, lru);
+	oc->nBytes += EntCost(ent);
+	oc->nEnts++;
+	return (ent);
+}
+
+/*
+ * Drop the decoded object of an entry. If it is still referenced, it
+ * remains valid until its last AG_DbObjectRelease().
+ */
+static void
+DetachObject(AG_DbObjectCache *oc, AG_DbObjectEnt *ent)
+{
+	AG_DbObject *dbo = ent->obj;
+
+	if (dbo == NULL) {
+		return;
+	}
+	oc->nBytes -= EntCost(ent);
+	ent->obj = NULL;
+	oc->nBytes += EntCost(ent);
+	dbo->ent = NULL;
+	if (dbo->nRefs == 0)
+		AG_ObjectDestroy(dbo);
+}
+
+/* Replace the record of an entry (taking ownership of data). */
+static void
+SetEntData(AG_DbObjectCache *oc, AG_DbObjectEnt *ent, Uint8 *data,
+    size_t size)
+{
+	oc->nBytes -= EntCost(ent);
+	if (ent->flags & AG_DBOBJECT_ENT_DIRTY) {
+		oc->nPendingBytes -= ent->size;
+		oc->nPendingBytes += size;
+	}
+	Free(ent->data);
+	ent->data = data;
+	ent->size = size;
+	oc->nBytes += EntCost(ent);
+}
+
+static void
+FreeEnt(AG_DbObjectCache *oc, AG_DbObjectEnt *ent)
+{
+	AG_DbObjectEnt **pEnt;
+
+	for (pEnt = &oc->buckets[ent->hash % oc->nBuckets];
+	     *pEnt != ent;
+	     pEnt = &(*pEnt)->next)
+		;;
+	*pEnt = ent->next;
+	TAILQ_REMOVE(&oc->lru, ent, lru);
+	if (ent->flags & AG_DBOBJECT_ENT_DIRTY) {
+		TAILQ_REMOVE(&oc->pending, ent, pending);
+		oc->nPendingBytes -= ent->size;
+		oc->nPending--;
+	}
+	DetachObject(oc, ent);
+	oc->nBytes -= EntCost(ent);
+	oc->nEnts--;
+	Free(ent->data);
+	free(ent->key);
+	free(ent);
+}
+
+/*
+ * Evict least recently used entries until the cache fits its bound with
+ * room for need more bytes. Entries with queued writes or referenced
+ * objects are kept. Entries about to be added or attached to are accounted
+ * for with need, so that they are never freed before they are returned.
+ */
+static void
+Evict(AG_DbObjectCache *oc, size_t need)
+{
+	AG_DbObjectEnt *ent, *entNext;
+
+	for (ent = TAILQ_FIRST(&oc->lru);
+	     ent != TAILQ_END(&oc->lru) && oc->nBytes+need > oc->maxBytes;
+	     ent = entNext) {
+		entNext = TAILQ_NEXT(ent, lru);
+		if ((ent->flags & AG_DBOBJECT_ENT_DIRTY) ||
+		    (ent->obj != NULL && ent->obj->nRefs > 0)) {
+			continue;
+		}
+		FreeEnt(oc, ent);
+		oc->nEvictions++;
+	}
+}
+
+static __inline__ void
+TouchEnt(AG_DbObjectCache *oc, AG_DbObjectEnt *ent)
+{
+	TAILQ_REMOVE(&oc->lru, ent, lru);
+	TAILQ_INSERT_TAIL(&oc->lru, ent, lru);
+}
+
+static Uint32
+FlushTimeout(AG_Timer *to, AG_Event *event)
+{
+	AG_Db *db = AG_SELF();
+
+	if (AG_DbObjectFlush(db) == -1) {
+		AG_Verbose("AG_DbObjectFlush: %s\n", AG_GetError());
+		return (to->ival);			/* Retry */
+	}
+	return (0);
+}
+
+/*
+ * Queue an entry for writing. A key already in the queue moves to its
+ * tail, so that the queue remains ordered by the time of last update.
+ * The write is queued even if the flush it triggers fails (or must wait
+ * for the transaction in progress), in which case the flush is retried
+ * later.
+ */
+static int
+QueueWrite(AG_Db *db, AG_DbObjectEnt *ent)
+{
+	AG_DbObjectCache *oc = db->objCache;
+
+	if (ent->flags & AG_DBOBJECT_ENT_DIRTY) {
+		TAILQ_REMOVE(&oc->pending, ent, pending);
+		oc->nCoalesced++;
+	} else {
+		ent->flags |= AG_DBOBJECT_ENT_DIRTY;
+		oc->nPendingBytes += ent->size;
+		oc->nPending++;
+	}
+	TAILQ_INSERT_TAIL(&oc->pending, ent, pending);
+	if (oc->nPendingBytes >= oc->maxPending &&
+	    !(db->flags & AG_DB_TXN)) {
+		if (AG_DbObjectFlush(db) == 0) {
+			return (0);
+		}
+		AG_Verbose("AG_DbObjectFlush: %s; will retry\n",
+		    AG_GetError());
+	}
+	if (oc->delay > 0 && oc->toFlush.obj == NULL) {
+		AG_AddTimer(db, &oc->toFlush, oc->delay, FlushTimeout, NULL);
+	}
+	return (0);
+}
+
+/* Look up the record for key, fetching it from the database if needed. */
+static AG_DbObjectEnt *
+FetchEnt(AG_Db *db, const char *key)
+{
+	AG_DbObjectCache *oc = db->objCache;
+	AG_DbObjectEnt *ent;
+	AG_Dbt dbKey, dbVal;
+
+	if ((ent = FindEnt(oc, key)) != NULL) {
+		if (ent->flags & AG_DBOBJECT_ENT_DELETED) {
+			AG_SetError("No such object: %s", key);
+			return (NULL);
+		}
+		TouchEnt(oc, ent);
+		oc->nHits++;
+		return (ent);
+	}
+	oc->nMisses++;
+	dbKey.data = (void *)key;
+	dbKey.size = strlen(key)+1;
+	if (AG_DbGet(db, &dbKey, &dbVal) == -1) {
+		return (NULL);
+	}
+	Evict(oc, sizeof(AG_DbObjectEnt) + dbKey.size + dbVal.size);
+	if ((ent = CreateEnt(oc, key)) == NULL) {
+		Free(dbVal.data);
+		return (NULL);
+	}
+	SetEntData(oc, ent, dbVal.data, dbVal.size);
+	return (ent);
+}
+
+/* Decode an object from a serialized record. */
+static int
+DecodeObject(void *obj, const Uint8 *data, size_t size)
+{
+	AG_DataSource *ds;
+	int rv;
+
+	if ((ds = AG_OpenConstCore(data, size)) == NULL) {
+		return (-1);
+	}
+	rv = AG_ObjectUnserialize(obj, ds);
+	AG_CloseConstCore(ds);
+	return (rv);
+}
+
+/* Serialize an object into a newly-allocated buffer. */
+static Uint8 *
+EncodeObject(void *obj, size_t *size)
+{
+	AG_DataSource *ds;
+	Uint8 *data;
+
+	if ((ds = AG_OpenAutoCore()) == NULL) {
+		return (NULL);
+	}
+	if (AG_ObjectSerialize(obj, ds) == -1) {
+		AG_CloseAutoCore(ds);
+		return (NULL);
+	}
+	*size = AG_CORE_SOURCE(ds)->size;
+	if ((data = TryMalloc(*size + 1)) != NULL) {
+		memcpy(data, AG_CORE_SOURCE(ds)->data, *size);
+	}
+	AG_CloseAutoCore(ds);
+	return (data);
+}
 
 /* Create a new database-bound object. */
 AG_DbObject *
@@ -47,8 +346,9 @@ int
 AG_DbObjectLoad(void *obj, AG_Db *db, const char *key)
 {
 	AG_DbObject *dbo = obj;
-	AG_DataSource *ds;
-	AG_DbEntry dbe;
+	AG_DbObjectEnt *ent;
+	AG_Dbt dbKey, dbVal;
+	int rv;
 
 #ifdef AG_DEBUG
 	if (!AG_OfClass(dbo, "AG_DbObject:*")) {
@@ -56,46 +356,80 @@ AG_DbObjectLoad(void *obj, AG_Db *db, const char *key)
 		return (-1);
 	}
 #endif
-	if (AG_DbLookup(db, &dbe, key) == -1) {
-		return (-1);
+	AG_ObjectLock(db);
+	if (db->objCache != NULL) {
+		if ((ent = FetchEnt(db, key)) == NULL) {
+			goto fail;
+		}
+		rv = DecodeObject(dbo, ent->data, ent->size);
+	} else {
+		dbKey.data = (void *)key;
+		dbKey.size = strlen(key)+1;
+		if (AG_DbGet(db, &dbKey, &dbVal) == -1) {
+			goto fail;
+		}
+		rv = DecodeObject(dbo, dbVal.data, dbVal.size);
+		Free(dbVal.data);
 	}
-	if ((ds = AG_OpenCore(dbe.data, dbe.dataSize)) == NULL) {
-		return (-1);
-	}
-	if (AG_ObjectUnserialize(dbo, ds) == -1) {
-		AG_CloseCore(ds);
-		return (-1);
-	}
-	AG_CloseCore(ds);
-	return (0);
+	AG_ObjectUnlock(db);
+	return (rv);
+fail:
+	AG_ObjectUnlock(db);
+	return (-1);
 }
 
-/* Save a database-bound object's state. Overwrite data if it exists. */
+/*
+ * Save a database-bound object's state. Overwrite data if it exists.
+ * With a write-behind cache, the object is serialized immediately but
+ * written to the database by the next flush.
+ */
 int
 AG_DbObjectSave(void *pDbo, AG_Db *db)
 {
 	AG_DbObject *dbo = pDbo;
-	AG_DataSource *ds;
-	AG_DbEntry dbe;
+	AG_DbObjectCache *oc;
+	AG_DbObjectEnt *ent;
+	AG_Dbt dbKey, dbVal;
+	Uint8 *data;
+	size_t size;
+	int rv;
 
-	if ((ds = AG_OpenAutoCore()) == NULL)
+	if ((data = EncodeObject(dbo, &size)) == NULL) {
 		return (-1);
-	if (AG_ObjectSerialize(dbo, ds) == -1)
-		goto fail;
-
-	dbe.key = AGOBJECT(dbo)->name;
-	dbe.keySize = strlen(AGOBJECT(dbo)->name)+1;
-	dbe.data = AG_CORE_SOURCE(ds)->data;
-	dbe.dataSize = AG_CORE_SOURCE(ds)->size;
-
-	if (AG_DbPut(db, &dbe) == -1 ||
-	    AG_DbSync(db) == -1) {
+	}
+	AG_ObjectLock(db);
+	if ((oc = db->objCache) == NULL || oc->maxPending == 0) {
+		dbKey.data = AGOBJECT(dbo)->name;
+		dbKey.size = strlen(AGOBJECT(dbo)->name)+1;
+		dbVal.data = data;
+		dbVal.size = size;
+		if (AG_DbPut(db, &dbKey, &dbVal) == -1 ||
+		    AG_DbSync(db) == -1) {
+			goto fail;
+		}
+		if (oc == NULL) {
+			Free(data);
+			AG_ObjectUnlock(db);
+			return (0);
+		}
+	}
+	if ((ent = FindEnt(oc, AGOBJECT(dbo)->name)) == NULL &&
+	    (ent = CreateEnt(oc, AGOBJECT(dbo)->name)) == NULL) {
 		goto fail;
 	}
-	AG_CloseAutoCore(ds);
-	return (0);
+	if (ent->obj != dbo) {
+		DetachObject(oc, ent);		/* Decoded copy is stale */
+	}
+	ent->flags &= ~(AG_DBOBJECT_ENT_DELETED);
+	SetEntData(oc, ent, data, size);
+	TouchEnt(oc, ent);
+	rv = (oc->maxPending > 0) ? QueueWrite(db, ent) : 0;
+	Evict(oc, 0);
+	AG_ObjectUnlock(db);
+	return (rv);
 fail:
-	AG_CloseAutoCore(ds);
+	AG_ObjectUnlock(db);
+	Free(data);
 	return (-1);
 }
 
@@ -104,33 +438,317 @@ int
 AG_DbObjectInsert(AG_Db *db, void *pDbo)
 {
 	AG_DbObject *dbo = pDbo;
+	AG_DbObjectEnt *ent;
+	AG_Dbt dbKey;
+	int exists;
 
-	if (AG_DbExists(db, AGOBJECT(dbo)->name)) {
+	AG_ObjectLock(db);
+	if (db->objCache != NULL &&
+	    (ent = FindEnt(db->objCache, AGOBJECT(dbo)->name)) != NULL) {
+		exists = !(ent->flags & AG_DBOBJECT_ENT_DELETED);
+	} else {
+		dbKey.data = AGOBJECT(dbo)->name;
+		dbKey.size = strlen(AGOBJECT(dbo)->name)+1;
+		exists = AG_DbExists(db, &dbKey);
+	}
+	if (exists) {
 		AG_SetError("Existing db object: %s", AGOBJECT(dbo)->name);
+		AG_ObjectUnlock(db);
 		return (-1);
 	}
-	return AG_DbObjectSave(dbo, db);
+	exists = AG_DbObjectSave(dbo, db);
+	AG_ObjectUnlock(db);
+	return (exists);
 }
 
 /* Remove a database object the database by name. */
 int
 AG_DbObjectDelete(AG_Db *db, const char *name)
 {
-	if (AG_DbDelete(db, name) == -1 ||
+	AG_DbObjectCache *oc;
+	AG_DbObjectEnt *ent;
+	AG_Dbt dbKey;
+	int rv = 0;
+
+	AG_ObjectLock(db);
+	if ((oc = db->objCache) != NULL && oc->maxPending > 0) {
+		if ((ent = FindEnt(oc, name)) == NULL &&
+		    (ent = CreateEnt(oc, name)) == NULL) {
+			goto fail;
+		}
+		DetachObject(oc, ent);
+		SetEntData(oc, ent, NULL, 0);
+		ent->flags |= AG_DBOBJECT_ENT_DELETED;
+		rv = QueueWrite(db, ent);
+		AG_ObjectUnlock(db);
+		return (rv);
+	}
+	dbKey.data = (void *)name;
+	dbKey.size = strlen(name)+1;
+	if (AG_DbDel(db, &dbKey) == -1 ||
 	    AG_DbSync(db) == -1) {
+		goto fail;
+	}
+	if (oc != NULL && (ent = FindEnt(oc, name)) != NULL) {
+		FreeEnt(oc, ent);
+	}
+	AG_ObjectUnlock(db);
+	return (0);
+fail:
+	AG_ObjectUnlock(db);
+	return (-1);
+}
+
+/*
+ * Return an instance of the object stored under key, decoding it only if
+ * it is not already cached. The instance is shared and must be released
+ * with AG_DbObjectRelease(). Without a cache, a new instance is decoded
+ * on every call.
+ */
+void *
+AG_DbObjectGet(AG_Db *db, const char *key, AG_ObjectClass *cls)
+{
+	AG_DbObjectCache *oc;
+	AG_DbObjectEnt *ent = NULL;
+	AG_DbObject *dbo;
+	AG_Dbt dbKey, dbVal;
+	int rv;
+
+	AG_ObjectLock(db);
+	if ((oc = db->objCache) != NULL) {
+		if ((ent = FetchEnt(db, key)) == NULL) {
+			goto fail;
+		}
+		if ((dbo = ent->obj) != NULL) {
+			if (AGOBJECT(dbo)->cls != cls) {
+				AG_SetError("%s: Cached as %s", key,
+				    AGOBJECT(dbo)->cls->name);
+				goto fail;
+			}
+			dbo->nRefs++;
+			AG_ObjectUnlock(db);
+			return (dbo);
+		}
+	}
+	if ((dbo = TryMalloc(cls->size)) == NULL) {
+		goto fail;
+	}
+	AG_ObjectInit(dbo, cls);
+	AG_ObjectSetNameS(dbo, key);
+	if (ent != NULL) {
+		rv = DecodeObject(dbo, ent->data, ent->size);
+	} else {
+		dbKey.data = (void *)key;
+		dbKey.size = strlen(key)+1;
+		if ((rv = AG_DbGet(db, &dbKey, &dbVal)) == 0) {
+			rv = DecodeObject(dbo, dbVal.data, dbVal.size);
+			Free(dbVal.data);
+		}
+	}
+	if (rv == -1) {
+		AG_ObjectDestroy(dbo);
+		goto fail;
+	}
+	dbo->flags |= AG_DBOBJECT_CACHED;
+	dbo->nRefs = 1;
+	dbo->db = db;
+	if (ent != NULL) {
+		TAILQ_REMOVE(&oc->lru, ent, lru);	/* Keep while evicting */
+		Evict(oc, cls->size);
+		TAILQ_INSERT_TAIL(&oc->lru, ent, lru);
+		oc->nBytes -= EntCost(ent);
+		ent->obj = dbo;
+		dbo->ent = ent;
+		oc->nBytes += EntCost(ent);
+	}
+	AG_ObjectUnlock(db);
+	return (dbo);
+fail:
+	AG_ObjectUnlock(db);
+	return (NULL);
+}
+
+/*
+ * Release an instance returned by AG_DbObjectGet(). Instances which are
+ * no longer cached are freed with their last reference.
+ */
+void
+AG_DbObjectRelease(void *obj)
+{
+	AG_DbObject *dbo = obj;
+	AG_Db *db = dbo->db;
+
+#ifdef AG_DEBUG
+	if (!(dbo->flags & AG_DBOBJECT_CACHED) || dbo->nRefs == 0)
+		AG_FatalError("AG_DbObjectRelease: Not a referenced instance");
+#endif
+	AG_ObjectLock(db);
+	if (--dbo->nRefs == 0) {
+		if (dbo->ent == NULL) {
+			AG_ObjectDestroy(dbo);
+		} else {
+			Evict(db->objCache, 0);
+		}
+	}
+	AG_ObjectUnlock(db);
+}
+
+/*
+ * Enable caching of records and decoded objects for the given database.
+ * The cache is bounded by maxBytes of memory. If maxPending is nonzero,
+ * writes are queued until their total size reaches maxPending bytes,
+ * AG_DbObjectFlush() is called or (if delay is nonzero) delay ms have
+ * passed since the first queued write.
+ */
+int
+AG_DbObjectCacheInit(AG_Db *db, size_t maxBytes, size_t maxPending,
+    Uint32 delay)
+{
+	AG_DbObjectCache *oc;
+
+	if ((oc = TryMalloc(sizeof(AG_DbObjectCache))) == NULL) {
 		return (-1);
 	}
+	memset(oc, 0, sizeof(AG_DbObjectCache));
+	if ((oc->buckets = TryMalloc(AG_DBOBJECT_BUCKETS *
+	                             sizeof(AG_DbObjectEnt *))) == NULL) {
+		free(oc);
+		return (-1);
+	}
+	memset(oc->buckets, 0, AG_DBOBJECT_BUCKETS*sizeof(AG_DbObjectEnt *));
+	oc->nBuckets = AG_DBOBJECT_BUCKETS;
+	oc->maxBytes = maxBytes;
+	oc->maxPending = maxPending;
+	oc->delay = delay;
+	TAILQ_INIT(&oc->lru);
+	TAILQ_INIT(&oc->pending);
+	AG_InitTimer(&oc->toFlush, "dbobject-flush", 0);
+
+	AG_ObjectLock(db);
+	if (db->objCache != NULL) {
+		AG_SetError("Cache already enabled");
+		AG_ObjectUnlock(db);
+		free(oc->buckets);
+		free(oc);
+		return (-1);
+	}
+	db->objCache = oc;
+	AG_ObjectUnlock(db);
+	return (0);
+}
+
+/*
+ * Flush queued writes and disable the cache. Instances still referenced
+ * remain valid until released.
+ */
+void
+AG_DbObjectCacheDestroy(AG_Db *db)
+{
+	AG_DbObjectCache *oc;
+	AG_DbObjectEnt *ent;
+
+	AG_ObjectLock(db);
+	if ((oc = db->objCache) == NULL) {
+		AG_ObjectUnlock(db);
+		return;
+	}
+	if ((db->flags & AG_DB_OPEN) && AG_DbObjectFlush(db) == -1) {
+		AG_Verbose("AG_DbObjectFlush: %s; discarding %u writes\n",
+		    AG_GetError(), oc->nPending);
+	}
+	AG_DelTimer(db, &oc->toFlush);
+	while ((ent = TAILQ_FIRST(&oc->lru)) != NULL) {
+		FreeEnt(oc, ent);
+	}
+	db->objCache = NULL;
+	AG_ObjectUnlock(db);
+
+	free(oc->buckets);
+	free(oc);
+}
+
+/*
+ * Write out all queued writes, in the order of their last update, as a
+ * single transaction, and sync the database. Fails if a transaction is in
+ * progress, since the writes could not be marked clean before it commits.
+ */
+int
+AG_DbObjectFlush(AG_Db *db)
+{
+	AG_DbObjectCache *oc;
+	AG_DbObjectEnt *ent, *entNext;
+	AG_Dbt dbKey, dbVal;
+
+	AG_ObjectLock(db);
+	if ((oc = db->objCache) == NULL || TAILQ_EMPTY(&oc->pending)) {
+		AG_ObjectUnlock(db);
+		return (0);
+	}
+	if (db->flags & AG_DB_TXN) {
+		AG_SetError("Cannot flush during a transaction");
+		goto fail;
+	}
+	if (AG_DbBegin(db) == -1) {
+		goto fail;
+	}
+	TAILQ_FOREACH(ent, &oc->pending, pending) {
+		dbKey.data = ent->key;
+		dbKey.size = ent->keySize;
+		if (ent->flags & AG_DBOBJECT_ENT_DELETED) {
+			if (AG_DbExists(db, &dbKey) &&
+			    AG_DbDel(db, &dbKey) == -1)
+				goto fail_txn;
+		} else {
+			dbVal.data = ent->data;
+			dbVal.size = ent->size;
+			if (AG_DbPut(db, &dbKey, &dbVal) == -1)
+				goto fail_txn;
+		}
+	}
+	if (AG_DbCommit(db) == -1) {
+		goto fail;
+	}
+	if (AG_DbSync(db) == -1) {
+		goto fail;
+	}
+	for (ent = TAILQ_FIRST(&oc->pending);
+	     ent != TAILQ_END(&oc->pending);
+	     ent = entNext) {
+		entNext = TAILQ_NEXT(ent, pending);
+		if (ent->flags & AG_DBOBJECT_ENT_DELETED) {
+			FreeEnt(oc, ent);
+		} else {
+			ent->flags &= ~(AG_DBOBJECT_ENT_DIRTY);
+		}
+	}
+	TAILQ_INIT(&oc->pending);
+	oc->nPending = 0;
+	oc->nPendingBytes = 0;
+	oc->nFlushes++;
+	AG_DelTimer(db, &oc->toFlush);
+	Evict(oc, 0);
+	AG_ObjectUnlock(db);
 	return (0);
+fail_txn:
+	AG_DbAbort(db);
+fail:
+	AG_ObjectUnlock(db);
+	return (-1);
 }
 
 static void
 Init(void *obj)
 {
-	/* Nothing to do */
+	AG_DbObject *dbo = obj;
+
+	dbo->flags = 0;
+	dbo->nRefs = 0;
+	dbo->db = NULL;
+	dbo->ent = NULL;
 }
 
 AG_ObjectClass agDbObjectClass = {
-	"AG_DbObject",
+	"Agar(DbObject)",
 	sizeof(AG_DbObject),
 	{ 0, 0 },
 	Init,
@@ -4,10 +4,37 @@
 #define _AGAR_CORE_DBOBJECT_H_
 #include <agar/core/begin.h>
 
+struct ag_dbobject_ent;
+
 typedef struct ag_dbobject {
 	struct ag_object obj;
+	Uint flags;
+#define AG_DBOBJECT_CACHED	0x01	/* Instance from AG_DbObjectGet() */
+	Uint nRefs;			/* References from AG_DbObjectGet() */
+	struct ag_db *db;		/* Database (cached instances) */
+	struct ag_dbobject_ent *ent;	/* Cache entry (or NULL) */
 } AG_DbObject;
 
+/* Cache of records and decoded objects, with write-behind queue. */
+typedef struct ag_dbobject_cache {
+	size_t maxBytes;		/* Memory bound on cached records */
+	size_t maxPending;		/* Queued bytes forcing a flush */
+	Uint32 delay;			/* Write-behind delay (ms, 0 = none) */
+	size_t nBytes;			/* Memory used by cache entries */
+	size_t nPendingBytes;		/* Size of queued writes */
+	Uint nEnts;			/* Cached records */
+	Uint nPending;			/* Queued writes */
+	Ulong nHits, nMisses;		/* Lookup statistics */
+	Ulong nEvictions;		/* Entries evicted */
+	Ulong nCoalesced;		/* Writes merged into queued writes */
+	Ulong nFlushes;			/* Write-behind flushes */
+	struct ag_dbobject_ent **buckets;
+	Uint nBuckets;
+	AG_TAILQ_HEAD_(ag_dbobject_ent) lru;	 /* Least recently used first */
+	AG_TAILQ_HEAD_(ag_dbobject_ent) pending; /* Queued writes, in order */
+	AG_Timer toFlush;		/* Write-behind timer */
+} AG_DbObjectCache;
+
 #define AGDBOBJECT(p) ((AG_DbObject *)(p))
 
 __BEGIN_DECLS
@@ -19,6 +46,12 @@ int          AG_DbObjectLoad(void *, AG_Db *, const char *);
 int          AG_DbObjectSave(void *, AG_Db *);
 int          AG_DbObjectInsert(AG_Db *, void *);
 int          AG_DbObjectDelete(AG_Db *, const char *);
+
+int          AG_DbObjectCacheInit(AG_Db *, size_t, size_t, Uint32);
+void         AG_DbObjectCacheDestroy(AG_Db *);
+int          AG_DbObjectFlush(AG_Db *);
+void        *AG_DbObjectGet(AG_Db *, const char *, AG_ObjectClass *);
+void         AG_DbObjectRelease(void *);
 __END_DECLS
 
 #include <agar/core/close.h>
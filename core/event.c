@@ -36,7 +36,10 @@
 #include <agar/config/have_kqueue.h>
 #include <agar/config/have_timerfd.h>
 #include <agar/config/have_select.h>
+#include <agar/config/have_sys_inotify_h.h>
 #include <agar/config/ag_debug_core.h>
+#include <agar/config/have_clock_gettime.h>
+#include <agar/config/have_gettimeofday.h>
 
 #if defined(HAVE_KQUEUE)
 # ifdef __NetBSD__
@@ -58,10 +61,30 @@
 # include <unistd.h>
 # include <errno.h>
 #endif
+#if defined(HAVE_SYS_INOTIFY_H) && defined(HAVE_SELECT) && !defined(HAVE_KQUEUE)
+# define HAVE_INOTIFY
+# include <sys/inotify.h>
+#endif
+#if defined(AG_THREADS) && defined(HAVE_SELECT)
+# include <fcntl.h>
+#endif
+#if defined(HAVE_CLOCK_GETTIME) || defined(HAVE_GETTIMEOFDAY)
+# include <time.h>
+# include <sys/time.h>
+#endif
 
 AG_EventSource *agEventSource = NULL;	/* Event source (thread-local) */
 #ifdef AG_THREADS
 AG_ThreadKey    agEventSourceKey;
+
+/* For waking up threads sleeping until a timer deadline. */
+static AG_AtomicInt agTimerSleepers = 0;	/* Sleeping threads */
+static AG_Mutex     agTimerWakeLock;
+static AG_Cond      agTimerWakeCond;
+static Uint         agTimerWakeGen = 0;		/* Wakeup generation */
+# ifdef HAVE_SELECT
+static int          agTimerWakeFd[2] = { -1, -1 };  /* Interrupts select() */
+# endif
 #endif
 
 #ifdef HAVE_KQUEUE
@@ -76,6 +99,31 @@ typedef struct ag_event_source_kqueue {
 } AG_EventSourceKQUEUE;
 #endif /* HAVE_KQUEUE */
 
+#ifdef HAVE_INOTIFY
+#define INOTIFY_BUCKETS	256		/* Watch hash table size */
+#define INOTIFY_BUFSIZE	16384		/* Input event buffer (bytes) */
+
+/*
+ * An inotify(7) watch. Watches are per-inode, so sinks referencing the
+ * same file share a single watch, whose mask is the union of theirs.
+ */
+typedef struct ag_inotify_watch {
+	int wd;					/* Watch descriptor */
+	int removed;				/* Removed by kernel */
+	char *path;				/* Resolved path of file */
+	Uint32 mask;				/* Union of sink masks */
+	AG_EventSink **sinks;			/* Sinks using this watch */
+	Uint          nSinks;
+	AG_TAILQ_ENTRY(ag_inotify_watch) watches;
+} AG_InotifyWatch;
+
+typedef struct ag_event_source_inotify {
+	struct ag_event_source _inherit;
+	int fd;					/* inotify fd (or -1) */
+	AG_TAILQ_HEAD_(ag_inotify_watch) watches[INOTIFY_BUCKETS];
+} AG_EventSourceINOTIFY;
+#endif /* HAVE_INOTIFY */
+
 /* #define DEBUG_TIMERS */
 
 #ifdef __NetBSD__
@@ -654,6 +702,10 @@ CreateEventSource(void)
 #ifdef HAVE_KQUEUE
 	AG_EventSourceKQUEUE *kq = TryMalloc(sizeof(AG_EventSourceKQUEUE));
 	AG_EventSource *src = (AG_EventSource *)kq;
+#elif defined(HAVE_INOTIFY)
+	AG_EventSourceINOTIFY *in = TryMalloc(sizeof(AG_EventSourceINOTIFY));
+	AG_EventSource *src = (AG_EventSource *)in;
+	int i;
 #else
 	AG_EventSource *src = TryMalloc(sizeof(AG_EventSource));
 #endif
@@ -706,6 +758,13 @@ CreateEventSource(void)
 	src->caps[AG_SINK_WRITE] = 1;
 #else
 	src->sinkFn = AG_EventSinkSPINNER;
+#endif
+#ifdef HAVE_INOTIFY
+	in->fd = -1;				/* Created on demand */
+	for (i = 0; i < INOTIFY_BUCKETS; i++) {
+		TAILQ_INIT(&in->watches[i]);
+	}
+	src->caps[AG_SINK_FSEVENT] = 1;
 #endif
 	if (agSoftTimers) {			/* Force soft timers */
 		src->addTimerFn = NULL;
@@ -733,6 +792,26 @@ DestroyEventSource(void *pEventSource)
 		}
 		Free(kq->changes);
 	}
+#endif
+#ifdef HAVE_INOTIFY
+	{
+		AG_EventSourceINOTIFY *in = pEventSource;
+		AG_InotifyWatch *w, *wNext;
+		int i;
+
+		for (i = 0; i < INOTIFY_BUCKETS; i++) {
+			for (w = TAILQ_FIRST(&in->watches[i]);
+			     w != TAILQ_END(&in->watches[i]);
+			     w = wNext) {
+				wNext = TAILQ_NEXT(w, watches);
+				Free(w->sinks);
+				free(w->path);
+				free(w);
+			}
+		}
+		if (in->fd != -1)
+			close(in->fd);
+	}
 #endif
 	for (es = TAILQ_FIRST(&src->prologues); es != TAILQ_END(&src->prologues); es = esNext) {
 		esNext = TAILQ_NEXT(es, sinks);
@@ -784,10 +863,22 @@ AG_InitEventSubsystem(Uint flags)
 #ifdef AG_THREADS
 	if (AG_ThreadKeyTryCreate(&agEventSourceKey, DestroyEventSource) == -1)
 		return (-1);
+	AG_MutexInit(&agTimerWakeLock);
+	AG_CondInit(&agTimerWakeCond);
 #endif
 	if ((agEventSource = AG_GetEventSource()) == NULL) {
 		return (-1);
 	}
+#if defined(AG_THREADS) && defined(HAVE_SELECT)
+	if (agEventSource->sinkFn == AG_EventSinkSELECT) {
+		if (pipe(agTimerWakeFd) == -1) {
+			AG_SetError("pipe: %s", AG_Strerror(errno));
+			return (-1);
+		}
+		fcntl(agTimerWakeFd[0], F_SETFL, O_NONBLOCK);
+		fcntl(agTimerWakeFd[1], F_SETFL, O_NONBLOCK);
+	}
+#endif
 	return (0);
 }
 
@@ -798,6 +889,18 @@ AG_DestroyEventSubsystem(void)
 		DestroyEventSource(agEventSource);
 		agEventSource = NULL;
 	}
+#ifdef AG_THREADS
+# ifdef HAVE_SELECT
+	if (agTimerWakeFd[0] != -1) {
+		close(agTimerWakeFd[0]);
+		close(agTimerWakeFd[1]);
+		agTimerWakeFd[0] = -1;
+		agTimerWakeFd[1] = -1;
+	}
+# endif
+	AG_CondDestroy(&agTimerWakeCond);
+	AG_MutexDestroy(&agTimerWakeLock);
+#endif
 }
 
 #ifdef HAVE_KQUEUE
@@ -836,20 +939,298 @@ static Uint
 GetSinkFlags(Uint fflags)
 {
 	Uint flags = 0;
-	if (fflags & NOTE_DELETE) { fflags |= AG_FSEVENT_DELETE; }
-	if (fflags & NOTE_WRITE)  { fflags |= AG_FSEVENT_WRITE;  }
-	if (fflags & NOTE_EXTEND) { fflags |= AG_FSEVENT_EXTEND; }
-	if (fflags & NOTE_ATTRIB) { fflags |= AG_FSEVENT_ATTRIB; }
-	if (fflags & NOTE_LINK)   { fflags |= AG_FSEVENT_LINK;   }
-	if (fflags & NOTE_RENAME) { fflags |= AG_FSEVENT_RENAME; }
-	if (fflags & NOTE_REVOKE) { fflags |= AG_FSEVENT_REVOKE; }
-	if (fflags & NOTE_EXIT) { fflags |= AG_PROCEVENT_EXIT; }
-	if (fflags & NOTE_FORK) { fflags |= AG_PROCEVENT_FORK; }
-	if (fflags & NOTE_EXEC) { fflags |= AG_PROCEVENT_EXEC; }
+	if (fflags & NOTE_DELETE) { flags |= AG_FSEVENT_DELETE; }
+	if (fflags & NOTE_WRITE)  { flags |= AG_FSEVENT_WRITE;  }
+	if (fflags & NOTE_EXTEND) { flags |= AG_FSEVENT_EXTEND; }
+	if (fflags & NOTE_ATTRIB) { flags |= AG_FSEVENT_ATTRIB; }
+	if (fflags & NOTE_LINK)   { flags |= AG_FSEVENT_LINK;   }
+	if (fflags & NOTE_RENAME) { flags |= AG_FSEVENT_RENAME; }
+	if (fflags & NOTE_REVOKE) { flags |= AG_FSEVENT_REVOKE; }
+	if (fflags & NOTE_EXIT) { flags |= AG_PROCEVENT_EXIT; }
+	if (fflags & NOTE_FORK) { flags |= AG_PROCEVENT_FORK; }
+	if (fflags & NOTE_EXEC) { flags |= AG_PROCEVENT_EXEC; }
 	return (flags);
 }
 #endif /* HAVE_KQUEUE */
 
+#ifdef HAVE_INOTIFY
+/*
+ * Routines for translating between AG_EventSink and inotify flags.
+ * As with kqueue, directory entry changes are reported as WRITE (and LINK
+ * for subdirectories). inotify does not distinguish extension from other
+ * writes, nor link count changes from other attribute changes.
+ */
+#define INOTIFY_DIRENT_MASK (IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO)
+
+static Uint32
+GetInotifyMask(Uint flags)
+{
+	Uint32 mask = 0;
+	if (flags & AG_FSEVENT_DELETE) { mask |= IN_DELETE_SELF; }
+	if (flags & AG_FSEVENT_WRITE)  { mask |= IN_MODIFY|INOTIFY_DIRENT_MASK; }
+	if (flags & AG_FSEVENT_EXTEND) { mask |= IN_MODIFY; }
+	if (flags & AG_FSEVENT_ATTRIB) { mask |= IN_ATTRIB; }
+	if (flags & AG_FSEVENT_LINK)   { mask |= IN_ATTRIB|INOTIFY_DIRENT_MASK; }
+	if (flags & AG_FSEVENT_RENAME) { mask |= IN_MOVE_SELF; }
+	return (mask);
+}
+static Uint
+GetInotifySinkFlags(Uint32 mask)
+{
+	Uint flags = 0;
+	if (mask & IN_DELETE_SELF) { flags |= AG_FSEVENT_DELETE; }
+	if (mask & IN_MODIFY)      { flags |= AG_FSEVENT_WRITE|AG_FSEVENT_EXTEND; }
+	if (mask & IN_ATTRIB)      { flags |= AG_FSEVENT_ATTRIB|AG_FSEVENT_LINK; }
+	if (mask & IN_MOVE_SELF)   { flags |= AG_FSEVENT_RENAME; }
+	if (mask & IN_UNMOUNT)     { flags |= AG_FSEVENT_REVOKE; }
+	if (mask & INOTIFY_DIRENT_MASK) {
+		flags |= AG_FSEVENT_WRITE;
+		if (mask & IN_ISDIR)
+			flags |= AG_FSEVENT_LINK;
+	}
+	return (flags);
+}
+
+static __inline__ AG_InotifyWatch *
+FindInotifyWatch(AG_EventSourceINOTIFY *in, int wd)
+{
+	AG_InotifyWatch *w;
+
+	TAILQ_FOREACH(w, &in->watches[(Uint)wd % INOTIFY_BUCKETS], watches) {
+		if (w->wd == wd)
+			break;
+	}
+	return (w);
+}
+
+/*
+ * Watch the file referenced by the descriptor of a FSEVENT sink. The path
+ * is obtained through /proc/self/fd, so that the sink API remains based on
+ * file descriptors as with kqueue. If the inode is already watched, the
+ * existing watch is extended (IN_MASK_ADD) and shared. The resolved path
+ * is saved with the watch, since narrowing its mask requires a path and
+ * the descriptor of the sink may be closed by then.
+ */
+static int
+AddInotifyWatch(AG_EventSourceINOTIFY *in, AG_EventSink *es)
+{
+	char fdPath[32], path[AG_PATHNAME_MAX];
+	AG_InotifyWatch *w;
+	AG_EventSink **sinksNew;
+	Uint32 mask;
+	ssize_t len;
+	int wd, newWatch = 0;
+
+	if ((mask = GetInotifyMask(es->flags)) == 0) {
+		AG_SetError("No filesystem events requested");
+		return (-1);
+	}
+	if (in->fd == -1 &&
+	    (in->fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC)) == -1) {
+		AG_SetError("inotify_init1: %s", AG_Strerror(errno));
+		return (-1);
+	}
+	Snprintf(fdPath, sizeof(fdPath), "/proc/self/fd/%d", es->ident);
+	if ((len = readlink(fdPath, path, sizeof(path)-1)) == -1) {
+		AG_SetError("readlink(%d): %s", es->ident, AG_Strerror(errno));
+		return (-1);
+	}
+	path[len] = '\0';
+	if ((wd = inotify_add_watch(in->fd, fdPath, mask|IN_MASK_ADD)) == -1) {
+		AG_SetError("inotify_add_watch(%d): %s", es->ident,
+		    AG_Strerror(errno));
+		return (-1);
+	}
+	if ((w = FindInotifyWatch(in, wd)) == NULL) {
+		if ((w = TryMalloc(sizeof(AG_InotifyWatch))) == NULL) {
+			goto fail;
+		}
+		if ((w->path = TryStrdup(path)) == NULL) {
+			free(w);
+			goto fail;
+		}
+		w->wd = wd;
+		w->removed = 0;
+		w->mask = 0;
+		w->sinks = NULL;
+		w->nSinks = 0;
+		TAILQ_INSERT_TAIL(&in->watches[(Uint)wd % INOTIFY_BUCKETS], w,
+		    watches);
+		newWatch = 1;
+	}
+	if ((sinksNew = TryRealloc(w->sinks,
+	    (w->nSinks+1)*sizeof(AG_EventSink *))) == NULL) {
+		if (newWatch) {
+			TAILQ_REMOVE(&in->watches[(Uint)wd % INOTIFY_BUCKETS],
+			    w, watches);
+			free(w->path);
+			free(w);
+		}
+		goto fail;
+	}
+	w->sinks = sinksNew;
+	w->sinks[w->nSinks++] = es;
+	w->mask |= mask;
+	es->wd = wd;
+	return (0);
+fail:
+	if (FindInotifyWatch(in, wd) == NULL) {	/* Not shared */
+		inotify_rm_watch(in->fd, wd);
+	}
+	return (-1);
+}
+
+/*
+ * Release the watch used by a FSEVENT sink. The kernel watch is removed
+ * with its last sink; otherwise its mask is narrowed to the union of the
+ * remaining sinks (events are filtered per-sink in any case, so the mask
+ * is left as is if the saved path no longer refers to the watched file).
+ */
+static void
+DelInotifyWatch(AG_EventSourceINOTIFY *in, AG_EventSink *es)
+{
+	AG_InotifyWatch *w;
+	Uint32 mask;
+	Uint i;
+	int wd;
+
+	if ((w = FindInotifyWatch(in, es->wd)) == NULL) {
+		return;
+	}
+	for (i = 0; i < w->nSinks; i++) {
+		if (w->sinks[i] == es)
+			break;
+	}
+	if (i == w->nSinks) {
+		return;
+	}
+	if (i < w->nSinks-1) {
+		memmove(&w->sinks[i], &w->sinks[i+1],
+		    (w->nSinks-i-1)*sizeof(AG_EventSink *));
+	}
+	w->nSinks--;
+	es->wd = -1;
+
+	if (w->nSinks == 0) {
+		if (!w->removed) {
+			inotify_rm_watch(in->fd, w->wd);
+		}
+		TAILQ_REMOVE(&in->watches[(Uint)w->wd % INOTIFY_BUCKETS], w,
+		    watches);
+		Free(w->sinks);
+		free(w->path);
+		free(w);
+		return;
+	}
+	for (i = 0, mask = 0; i < w->nSinks; i++) {
+		mask |= GetInotifyMask(w->sinks[i]->flags);
+	}
+	if (mask == w->mask || w->removed) {
+		return;
+	}
+	if ((wd = inotify_add_watch(in->fd, w->path, mask)) == w->wd) {
+		w->mask = mask;
+	} else if (wd != -1 && FindInotifyWatch(in, wd) == NULL) {
+		inotify_rm_watch(in->fd, wd);	/* Path now names another file */
+	}
+}
+
+/*
+ * Read and dispatch pending inotify events. The queue is drained before
+ * any callback is invoked, so a burst of events on the same file results
+ * in a single invocation with the union of the matched flags. If the
+ * kernel queue overflowed, all FSEVENT sinks are reported with
+ * AG_FSEVENT_OVERFLOW, since any of them may have missed events.
+ */
+static void
+ProcessInotifyEvents(AG_EventSourceINOTIFY *in)
+{
+	AG_EventSource *src = (AG_EventSource *)in;
+	union {
+		struct inotify_event ev;
+		char buf[INOTIFY_BUFSIZE];
+	} u;
+	const struct inotify_event *iev;
+	AG_InotifyWatch *w;
+	AG_EventSink *es, *esNext;
+	Uint flags, i;
+	ssize_t len, off;
+	int overflow = 0;
+
+	TAILQ_FOREACH(es, &src->sinks, sinks) {
+		if (es->type == AG_SINK_FSEVENT)
+			es->flagsMatched = 0;
+	}
+	for (;;) {
+		if ((len = read(in->fd, u.buf, sizeof(u.buf))) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;				/* EAGAIN */
+		}
+		if (len == 0) {
+			break;
+		}
+		for (off = 0;
+		     off + (ssize_t)sizeof(struct inotify_event) <= len;
+		     off += sizeof(struct inotify_event) + iev->len) {
+			iev = (const struct inotify_event *)&u.buf[off];
+
+			if (iev->mask & IN_Q_OVERFLOW) {
+				overflow = 1;
+				continue;
+			}
+			if ((w = FindInotifyWatch(in, iev->wd)) == NULL) {
+				continue;
+			}
+			flags = GetInotifySinkFlags(iev->mask);
+			for (i = 0; i < w->nSinks; i++) {
+				es = w->sinks[i];
+				es->flagsMatched |= (flags & es->flags);
+			}
+			if (iev->mask & IN_IGNORED)	/* Removed by kernel */
+				w->removed = 1;
+		}
+	}
+	if (overflow) {
+		Verbose("inotify: event queue overflow\n");
+		TAILQ_FOREACH(es, &src->sinks, sinks) {
+			if (es->type == AG_SINK_FSEVENT)
+				es->flagsMatched |= AG_FSEVENT_OVERFLOW;
+		}
+	}
+	for (es = TAILQ_FIRST(&src->sinks);
+	     es != TAILQ_END(&src->sinks);
+	     es = esNext) {
+		esNext = TAILQ_NEXT(es, sinks);
+		if (es->type == AG_SINK_FSEVENT && es->flagsMatched != 0)
+			es->fn(es, &es->fnArgs);
+	}
+}
+
+/* Add the inotify descriptor to a select(2) read set. */
+static __inline__ void
+SetInotifyFd(fd_set *rdFds, int *nFds)
+{
+	AG_EventSourceINOTIFY *in = (AG_EventSourceINOTIFY *)agEventSource;
+
+	if (in->fd != -1) {
+		FD_SET(in->fd, rdFds);
+		if (in->fd > *nFds) { *nFds = in->fd; }
+	}
+}
+
+/* Process inotify events if select(2) reported the descriptor readable. */
+static __inline__ void
+CheckInotifyFd(fd_set *rdFds)
+{
+	AG_EventSourceINOTIFY *in = (AG_EventSourceINOTIFY *)agEventSource;
+
+	if (in->fd != -1 && FD_ISSET(in->fd, rdFds))
+		ProcessInotifyEvents(in);
+}
+#endif /* HAVE_INOTIFY */
+
 /*
  * Add/remove an event processing prologue. The function will be invoked
  * only once at the beginning of AG_EventLoop().
@@ -977,7 +1358,16 @@ AG_AddEventSink(enum ag_event_sink_type type, int ident, Uint flags,
 	es->type = type;
 	es->ident = ident;
 	es->flags = flags;
+	es->flagsMatched = 0;
+	es->wd = -1;
 
+#ifdef HAVE_INOTIFY
+	if (type == AG_SINK_FSEVENT &&
+	    AddInotifyWatch((AG_EventSourceINOTIFY *)src, es) == -1) {
+		free(es);
+		return (NULL);
+	}
+#endif
 #ifdef HAVE_KQUEUE
 	if (GrowKqChangelist(kq, kq->nChanges+1) == -1) {
 		free(es);
@@ -1045,7 +1435,10 @@ AG_DelEventSink(AG_EventSink *es)
 		break;
 	}
 #endif /* HAVE_KQUEUE */
-
+#ifdef HAVE_INOTIFY
+	if (es->type == AG_SINK_FSEVENT)
+		DelInotifyWatch((AG_EventSourceINOTIFY *)src, es);
+#endif
 	TAILQ_REMOVE(&src->sinks, es, sinks);
 	free(es);
 }
@@ -1065,6 +1458,28 @@ AG_DelEventSinksByIdent(enum ag_event_sink_type type, int ident, Uint flags)
 }
 
 #ifdef HAVE_KQUEUE
+/*
+ * Initialize a one-shot EVFILT_TIMER change. Microsecond timers use
+ * NOTE_USECONDS where supported; otherwise the interval is rounded up
+ * to the next millisecond.
+ */
+static void
+SetTimerKQUEUE(struct kevent *kev, AG_Timer *to, Uint32 ival)
+{
+	Uint fflags = 0;
+
+	to->tDeadline = AG_GetTimeNS() + AG_TimerIvalNS(to, ival);
+	if (to->flags & AG_TIMER_USEC) {
+#ifdef NOTE_USECONDS
+		fflags = NOTE_USECONDS;
+#else
+		ival = (ival + 999)/1000;
+#endif
+	}
+	AG_EV_SET(kev, to->id, EVFILT_TIMER, EV_ADD|EV_ENABLE|EV_ONESHOT,
+	    fflags, (int)ival, to);
+}
+
 /*
  * Standard event sink using kqueue(2), commonly found on modern BSD
  * derived operating systems. 
@@ -1133,8 +1548,7 @@ restart:
 				return (-1);
 			}
 			kev = &kq->changes[kq->nChanges++];
-			AG_EV_SET(kev, to->id, EVFILT_TIMER,
-			    EV_ADD|EV_ENABLE|EV_ONESHOT, 0, (int)rvt, to);
+			SetTimerKQUEUE(kev, to, rvt);
 			to->ival = rvt;
 		} else {				/* Expire */
 #ifdef DEBUG_TIMERS
@@ -1229,8 +1643,7 @@ AG_AddTimerKQUEUE(AG_Timer *to, Uint32 ival, int newTimer)
 			return (-1);
 		}
 		kev = &kq->changes[kq->nChanges++];
-		AG_EV_SET(kev, to->id, EVFILT_TIMER,
-		    EV_ADD|EV_ENABLE|EV_ONESHOT, 0, (int)ival, to);
+		SetTimerKQUEUE(kev, to, ival);
 		to->ival = ival;
 	}
 	return (0);
@@ -1253,6 +1666,19 @@ AG_DelTimerKQUEUE(AG_Timer *to)
 #endif /* HAVE_KQUEUE */
 
 #ifdef HAVE_TIMERFD
+/* Initialize a one-shot timerfd expiration for the given interval. */
+static __inline__ void
+SetTimerTIMERFD(struct itimerspec *its, AG_Timer *to, Uint32 ival)
+{
+	Uint64 ns = AG_TimerIvalNS(to, ival);
+
+	to->tDeadline = AG_GetTimeNS() + ns;
+	its->it_value.tv_sec = (time_t)(ns/1000000000);
+	its->it_value.tv_nsec = (long)(ns % 1000000000);
+	its->it_interval.tv_sec = 0;
+	its->it_interval.tv_nsec = 0L;
+}
+
 /*
  * Standard event sink using select(2) and fd-based timers,
  * usually available on Linux.
@@ -1289,6 +1715,9 @@ restart:
 			if (to->id > nFds) { nFds = to->id; }
 		}
 	}
+#ifdef HAVE_INOTIFY
+	SetInotifyFd(&rdFds, &nFds);
+#endif
 	if (!TAILQ_EMPTY(&agEventSource->spinners)) {
 		timeo.tv_sec = 0;
 		timeo.tv_usec = 0;
@@ -1325,10 +1754,7 @@ restart:
 			}
 			rvt = to->fn(to, &to->fnEvent);
 			if (rvt > 0) {
-				its.it_value.tv_sec = rvt/1000;
-				its.it_value.tv_nsec = (rvt % 1000)*1000000L;
-				its.it_interval.tv_sec = 0;
-				its.it_interval.tv_nsec = 0L;
+				SetTimerTIMERFD(&its, to, rvt);
 				if (timerfd_settime(to->id, 0, &its, NULL) == -1) {
 					Verbose("timerfd_settime: %s\n", AG_Strerror(errno));
 					FD_CLR(to->id, &rdFds);
@@ -1357,7 +1783,10 @@ restart:
 			break;
 		}
 	}
-
+#ifdef HAVE_INOTIFY
+	/* 3. Process filesystem events. */
+	CheckInotifyFd(&rdFds);
+#endif
 	AG_UnlockTiming();
 	return (0);
 }
@@ -1377,10 +1806,7 @@ AG_AddTimerTIMERFD(AG_Timer *to, Uint32 ival, int newTimer)
 			return (-1);
 		}
 	}
-	its.it_value.tv_sec = ival/1000;
-	its.it_value.tv_nsec = (ival % 1000)*1000000L;
-	its.it_interval.tv_sec = 0;
-	its.it_interval.tv_nsec = 0L;
+	SetTimerTIMERFD(&its, to, ival);
 	if (timerfd_settime(to->id, 0, &its, NULL) == -1) {
 		close(to->id);
 		AG_SetError("timerfd_settime: %s", AG_Strerror(errno));
@@ -1399,6 +1825,130 @@ AG_DelTimerTIMERFD(AG_Timer *to)
 }
 #endif /* HAVE_TIMERFD */
 
+/*
+ * Return the earliest timer expiration time, or tMax if no timer expires
+ * before tMax. Software timers are kept ordered by deadline; timers provided
+ * by the event source (kqueue, timerfd) are not, so all of them are checked.
+ */
+static Uint64
+NextTimerDeadline(Uint64 tMax)
+{
+	AG_EventSource *src = AG_GetEventSource();
+	AG_Object *ob;
+	AG_Timer *to;
+	Uint64 t = tMax;
+
+	AG_LockTiming();
+	TAILQ_FOREACH(ob, &agTimerObjQ, tobjs) {
+		TAILQ_FOREACH(to, &ob->timers, timers) {
+			if (to->tDeadline < t) {
+				t = to->tDeadline;
+			}
+			if (!src->caps[AG_SINK_TIMER])
+				break;
+		}
+	}
+	AG_UnlockTiming();
+	return (t);
+}
+
+#ifdef AG_THREADS
+/*
+ * Wake up any thread sleeping in AG_EventSinkSELECT() or in
+ * AG_TimerSleepUntilNS(), so that it recomputes its deadline. This is
+ * called whenever a timer is scheduled, since the timer may have been
+ * added by another thread and expire before the current deadline.
+ */
+void
+AG_TimerWakeup(void)
+{
+	if (AG_AtomicGet(&agTimerSleepers) == 0)
+		return;
+# ifdef HAVE_SELECT
+	if (agTimerWakeFd[1] != -1) {
+		char c = 0;
+
+		(void)write(agTimerWakeFd[1], &c, 1);
+	}
+# endif
+	AG_MutexLock(&agTimerWakeLock);
+	agTimerWakeGen++;
+	AG_CondBroadcast(&agTimerWakeCond);
+	AG_MutexUnlock(&agTimerWakeLock);
+}
+#endif /* AG_THREADS */
+
+/*
+ * Sleep until tMax, or until the earliest timer deadline if it is sooner.
+ * In threaded builds, the sleep is interrupted by AG_TimerWakeup().
+ */
+void
+AG_TimerSleepUntilNS(Uint64 tMax)
+{
+#if defined(AG_THREADS) && \
+    (defined(HAVE_CLOCK_GETTIME) || defined(HAVE_GETTIMEOFDAY))
+	struct timespec ts;
+	Uint64 t, now, tAbs;
+	Uint gen;
+
+	AG_AtomicInc(&agTimerSleepers);
+	AG_MutexLock(&agTimerWakeLock);
+	gen = agTimerWakeGen;
+	AG_MutexUnlock(&agTimerWakeLock);
+
+	/* Read after gen, so that a wakeup in between is not missed. */
+	t = NextTimerDeadline(tMax);
+
+	AG_MutexLock(&agTimerWakeLock);
+	while (gen == agTimerWakeGen && (now = AG_GetTimeNS()) < t) {
+		if (t == ~(Uint64)0) {
+			AG_CondWait(&agTimerWakeCond, &agTimerWakeLock);
+			continue;
+		}
+# ifdef HAVE_CLOCK_GETTIME
+		clock_gettime(CLOCK_REALTIME, &ts);
+		tAbs = (Uint64)ts.tv_sec*1000000000 + ts.tv_nsec;
+# else
+		{
+			struct timeval tv;
+
+			gettimeofday(&tv, NULL);
+			tAbs = (Uint64)tv.tv_sec*1000000000 +
+			       (Uint64)tv.tv_usec*1000;
+		}
+# endif
+		tAbs = (t - now > ~(Uint64)0 - tAbs) ? ~(Uint64)0 :
+		       tAbs + (t - now);		/* Saturate */
+		ts.tv_sec = (time_t)(tAbs/1000000000);
+		ts.tv_nsec = (long)(tAbs % 1000000000);
+		AG_CondTimedWait(&agTimerWakeCond, &agTimerWakeLock, &ts);
+	}
+	AG_MutexUnlock(&agTimerWakeLock);
+	AG_AtomicDec(&agTimerSleepers);
+#else
+	/*
+	 * Nothing can interrupt the delay here, so without a deadline,
+	 * return after AG_SPINNER_POLL_NS.
+	 */
+	if (tMax == ~(Uint64)0) {
+		tMax = AG_GetTimeNS() + AG_SPINNER_POLL_NS;
+	}
+	AG_DelayUntilNS(NextTimerDeadline(tMax));
+#endif
+}
+
+#ifdef HAVE_SELECT
+/* Convert an interval in nanoseconds to a select() timeout. */
+static __inline__ void
+NSToTimeval(struct timeval *tv, Uint64 ns)
+{
+	Uint64 us = (ns + 999)/1000;
+
+	tv->tv_sec = (time_t)(us/1000000);
+	tv->tv_usec = (long)(us % 1000000);
+}
+#endif
+
 #if defined(HAVE_SELECT) && !defined(AG_THREADS)
 /*
  * Standard event sink using select(2) with timers implemented using the
@@ -1410,12 +1960,10 @@ int
 AG_EventSinkTIMEDSELECT(void)
 {
 	fd_set rdFds, wrFds;
-	int i, nFds, rv;
+	int nFds, rv;
 	AG_EventSink *es;
-	AG_Object *ob, *obNext;
-	AG_Timer *to, *toNext;
 	struct timeval timeo, *pTimeo;
-	Uint32 t, tSoonest;
+	Uint64 t, tNext;
 
 restart:
 	nFds = 0;
@@ -1433,25 +1981,23 @@ restart:
 			break;
 		}
 	}
-
+#ifdef HAVE_INOTIFY
+	SetInotifyFd(&rdFds, &nFds);
+#endif
+	pTimeo = &timeo;
 	if (!TAILQ_EMPTY(&agEventSource->spinners)) {
 		timeo.tv_sec = 0;
 		timeo.tv_usec = 0;
 	} else {
-		AG_LockTiming();
-		t = AG_GetTicks();
-		tSoonest = 0xfffffffe;
-		TAILQ_FOREACH(ob, &agTimerObjQ, tobjs) {
-			TAILQ_FOREACH(to, &ob->timers, timers) {
-				if ((to->tSched - t) < tSoonest)
-					tSoonest = (to->tSched - t);
-			}
+		t = AG_GetTimeNS();
+		tNext = NextTimerDeadline(~(Uint64)0);
+		if (tNext == ~(Uint64)0) {
+			pTimeo = NULL;			/* No timers */
+		} else {
+			NSToTimeval(&timeo, (tNext > t) ? (tNext - t) : 0);
 		}
-		timeo.tv_sec = tSoonest/1000;
-		timeo.tv_usec = (tSoonest % 1000)*1000;
-		AG_UnlockTiming();
 	}
-	rv = select(nFds+1, &rdFds, &wrFds, NULL, &timeo);
+	rv = select(nFds+1, &rdFds, &wrFds, NULL, pTimeo);
 	if (rv == -1) {
 		if (errno == EINTR) {
 			goto restart;
@@ -1462,7 +2008,7 @@ restart:
 	
 	AG_LockTiming();
 	/* 1. Process timer expirations. */
-	AG_ProcessTimeouts(t);
+	AG_ProcessTimeoutsNS(AG_GetTimeNS());
 	if (rv > 0) {
 		/* 2. Process I/O events */
 		TAILQ_FOREACH(es, &agEventSource->sinks, sinks) {
@@ -1479,6 +2025,10 @@ restart:
 				break;
 			}
 		}
+#ifdef HAVE_INOTIFY
+		/* 3. Process filesystem events. */
+		CheckInotifyFd(&rdFds);
+#endif
 	}
 	AG_UnlockTiming();
 	return (0);
@@ -1487,9 +2037,9 @@ restart:
 
 #if defined(HAVE_SELECT) && defined(AG_THREADS)
 /*
- * Standard event sink using non-blocking select(2) with timers implemented
- * with a delay loop. This is inefficient, but on some platforms, it is the
- * only thread-safe option.
+ * Standard event sink using select(2) with software timers. The select()
+ * timeout is the soonest timer deadline. Since timers may be added from
+ * other threads, AG_TimerWakeup() interrupts select() through a pipe.
  */
 int
 AG_EventSinkSELECT(void)
@@ -1497,11 +2047,17 @@ AG_EventSinkSELECT(void)
 	fd_set rdFds, wrFds;
 	int nFds, rv;
 	AG_EventSink *es;
-	struct timeval timeo;
+	struct timeval timeo, *pTimeo;
+	Uint64 t, tNext;
 
+restart:
 	nFds = 0;
 	FD_ZERO(&rdFds);
 	FD_ZERO(&wrFds);
+	if (agTimerWakeFd[0] != -1) {
+		FD_SET(agTimerWakeFd[0], &rdFds);
+		nFds = agTimerWakeFd[0];
+	}
 	
 	TAILQ_FOREACH(es, &agEventSource->sinks, sinks) {
 		switch (es->type) {
@@ -1517,11 +2073,25 @@ AG_EventSinkSELECT(void)
 			break;
 		}
 	}
-
-restart:
-	timeo.tv_sec = 0;
-	timeo.tv_usec = 0;
-	rv = select(nFds+1, &rdFds, &wrFds, NULL, &timeo);
+#ifdef HAVE_INOTIFY
+	SetInotifyFd(&rdFds, &nFds);
+#endif
+	AG_AtomicInc(&agTimerSleepers);
+	pTimeo = &timeo;
+	if (!TAILQ_EMPTY(&agEventSource->spinners)) {
+		timeo.tv_sec = 0;
+		timeo.tv_usec = 0;
+	} else {
+		t = AG_GetTimeNS();
+		tNext = NextTimerDeadline(~(Uint64)0);
+		if (tNext == ~(Uint64)0) {
+			pTimeo = NULL;			/* No timers */
+		} else {
+			NSToTimeval(&timeo, (tNext > t) ? (tNext - t) : 0);
+		}
+	}
+	rv = select(nFds+1, &rdFds, &wrFds, NULL, pTimeo);
+	AG_AtomicDec(&agTimerSleepers);
 	if (rv == -1) {
 		if (errno == EINTR) {
 			goto restart;
@@ -1529,10 +2099,16 @@ restart:
 		AG_SetError("select: %s", AG_Strerror(errno));
 		return (-1);
 	}
+	if (agTimerWakeFd[0] != -1 && FD_ISSET(agTimerWakeFd[0], &rdFds)) {
+		char buf[64];
+
+		while (read(agTimerWakeFd[0], buf, sizeof(buf)) > 0)
+			;;
+	}
 	
 	AG_LockTiming();
 	/* 1. Process timer expirations. */
-	AG_ProcessTimeouts(AG_GetTicks());
+	AG_ProcessTimeoutsNS(AG_GetTimeNS());
 	if (rv > 0) {
 		/* 2. Process I/O events. */
 		TAILQ_FOREACH(es, &agEventSource->sinks, sinks) {
@@ -1549,25 +2125,31 @@ restart:
 				break;
 			}
 		}
+#ifdef HAVE_INOTIFY
+		/* 3. Process filesystem events. */
+		CheckInotifyFd(&rdFds);
+#endif
 	}
 	AG_UnlockTiming();
-	
-	if (TAILQ_EMPTY(&agEventSource->spinners)) {
-		AG_Delay(1);
-	}
 	return (0);
 }
 #endif /* HAVE_SELECT and AG_THREADS */
 
 /*
- * Fallback "spinning" event sink using a delay loop. This is inefficient,
- * but is the only option on some platforms.
+ * Fallback "spinning" event sink using a delay loop, for platforms without
+ * select(2). We sleep until the soonest timer deadline (or until a timer is
+ * added from another thread). Spinning sinks cannot be waited on, so while
+ * any are registered, they are polled every AG_SPINNER_POLL_NS.
  */
 int
 AG_EventSinkSPINNER(void)
 {
-	AG_ProcessTimeouts(AG_GetTicks());
-	AG_Delay(1);
+	if (!TAILQ_EMPTY(&agEventSource->spinners)) {
+		AG_TimerSleepUntilNS(AG_GetTimeNS() + AG_SPINNER_POLL_NS);
+	} else {
+		AG_TimerSleepUntilNS(~(Uint64)0);
+	}
+	AG_ProcessTimeoutsNS(AG_GetTimeNS());
 	return (0);
 }
 
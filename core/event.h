@@ -4,6 +4,7 @@
 
 #define AG_EVENT_ARGS_MAX 16
 #define AG_EVENT_NAME_MAX 32
+#define AG_SPINNER_POLL_NS 1000000	/* Polling interval of spinning sinks */
 
 #ifdef AG_DEBUG
 # define AG_PTR(v)	(event->argv[v].type==AG_VARIABLE_POINTER ? event->argv[v].data.p : AG_PtrMismatch())
@@ -83,9 +84,11 @@ typedef struct ag_event_sink {
 #define AG_FSEVENT_LINK		0x0010		/* Link count changed */
 #define AG_FSEVENT_RENAME	0x0020		/* Referenced file renamed */
 #define AG_FSEVENT_REVOKE	0x0040		/* Filesystem unmount / revoke() */
+#define AG_FSEVENT_OVERFLOW	0x0080		/* Events were lost (inotify) */
 #define AG_PROCEVENT_EXIT	0x1000		/* Process exited */
 #define AG_PROCEVENT_FORK	0x2000		/* Process forked */
 #define AG_PROCEVENT_EXEC	0x4000		/* Process exec'd */
+	int wd;					/* Watch descriptor (inotify) */
 	AG_EventSinkFn fn;			/* Sink function */
 	AG_Event fnArgs;			/* Sink function arguments */
 	AG_TAILQ_ENTRY(ag_event_sink) sinks;    /* Epilogue "sinks" */
@@ -313,6 +316,10 @@ int             AG_EventSinkTIMERFD(void);
 int             AG_EventSinkTIMEDSELECT(void);
 int             AG_EventSinkSELECT(void);
 int             AG_EventSinkSPINNER(void);
+void            AG_TimerSleepUntilNS(Uint64);
+#ifdef AG_THREADS
+void            AG_TimerWakeup(void);
+#endif
 
 /* Push arguments onto an Event structure. */
 static __inline__ void AG_EventPushPointer(AG_Event *ev, const char *key, void *val) { AG_EVENT_INS_VAL(ev, AG_VARIABLE_POINTER, key, p, val); }
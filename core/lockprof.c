@@ -0,0 +1,675 @@
+/*
+ * Copyright (c) 2026 Hypertriton, Inc. <http://hypertriton.com/>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Lock contention profiler (--enable-lockprof).
+ *
+ * In this mode, AG_MutexLock() and related calls go through the functions
+ * below. Statistics are kept per call site, or per mutex for mutexes named
+ * with AG_LockProfSetName(). The statistics table has a fixed size and is
+ * only updated with atomic operations, so that the profiler itself takes
+ * no locks. Hold times are measured using a per-thread stack of the
+ * mutexes currently held.
+ */
+
+#include <agar/core/core.h>
+#include <agar/config/ag_lockprof.h>
+
+#if defined(AG_THREADS) && defined(AG_LOCKPROF)
+
+#include <agar/core/lockprof.h>
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+#define AG_LOCKPROF_MAX		1024	/* Statistics entries */
+#define AG_LOCKPROF_NAMED_MAX	256	/* Named mutexes (power of 2) */
+#define AG_LOCKPROF_DEPTH	32	/* Mutexes tracked per thread */
+
+/* Number of Uint64 counters in AG_LockStat (from nAcquired onward). */
+#define AG_LOCKPROF_COUNTERS \
+	((sizeof(AG_LockStat) - offsetof(AG_LockStat,nAcquired)) / sizeof(Uint64))
+
+#if defined(__ATOMIC_ACQUIRE)
+# define LP_LOAD(p)	__atomic_load_n((p), __ATOMIC_ACQUIRE)
+# define LP_STORE(p,v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+# define LP_ADD(p,n)	__atomic_fetch_add((p), (n), __ATOMIC_RELAXED)
+# define LP_CAS(p,o,n)	__sync_bool_compare_and_swap((p),(o),(n))
+#elif defined(__GNUC__)
+# define LP_LOAD(p)	(__sync_synchronize(), *(p))
+# define LP_STORE(p,v)	(__sync_synchronize(), *(p) = (v))
+# define LP_ADD(p,n)	__sync_fetch_and_add((p),(n))
+# define LP_CAS(p,o,n)	__sync_bool_compare_and_swap((p),(o),(n))
+#else
+# define LP_LOAD(p)	(*(p))
+# define LP_STORE(p,v)	(*(p) = (v))
+# define LP_ADD(p,n)	(*(p) += (n))
+# define LP_CAS(p,o,n)	((*(p) == (o)) ? ((*(p) = (n)), 1) : 0)
+#endif
+
+/* Statistics entry */
+typedef struct ag_lockprof_ent {
+	Uint32 state;
+#define AG_LOCKPROF_FREE	0
+#define AG_LOCKPROF_INIT	1		/* Being claimed */
+#define AG_LOCKPROF_READY	2
+	AG_LockStat st;
+} AG_LockProfEnt;
+
+/* Mutex named by AG_LockProfSetName() */
+typedef struct ag_lockprof_named {
+	void *lock;				/* Mutex (slot is never freed) */
+	AG_LockProfEnt *ent;			/* Statistics (or NULL) */
+} AG_LockProfNamed;
+
+/* Mutex held by the current thread */
+typedef struct ag_lockprof_held {
+	AG_Mutex *m;
+	AG_LockProfEnt *ent;			/* NULL = nested acquisition */
+	Uint64 t;				/* Acquired at (ns) */
+} AG_LockProfHeld;
+
+typedef struct ag_lockprof_thread {
+	Uint n;
+	AG_LockProfHeld held[AG_LOCKPROF_DEPTH];
+} AG_LockProfThread;
+
+/* Statistics snapshot with ranking key */
+typedef struct ag_lockprof_snap {
+	Uint64 key;
+	AG_LockStat st;
+} AG_LockProfSnap;
+
+static AG_LockProfEnt    lpEnts[AG_LOCKPROF_MAX];
+static AG_LockProfEnt    lpOverflow = { AG_LOCKPROF_READY, { "(untracked)" } };
+static AG_LockProfNamed  lpNamed[AG_LOCKPROF_NAMED_MAX];
+static int               lpNamedCount = 0;
+static int               lpEnabled = 1;
+static AG_Once           lpThreadOnce = AG_ONCE_INIT;
+static AG_ThreadKey      lpThreadKey;
+static int               lpThreadKeyOK = 0;
+
+static __inline__ Uint64
+Now(void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		return ((Uint64)ts.tv_sec*1000000000 + (Uint64)ts.tv_nsec);
+#endif
+	return ((Uint64)AG_GetTicks()*1000000);
+}
+
+/* Look up (or allocate) the statistics entry for a site or lock name. */
+static AG_LockProfEnt *
+Lookup(const char *name)
+{
+	Uint32 h = 2166136261U;
+	const char *c;
+	Uint i, n;
+
+	for (c = name; *c != '\0'; c++) {
+		h = (h ^ (Uchar)*c) * 16777619U;
+	}
+	for (i = 0, n = h % AG_LOCKPROF_MAX;
+	     i < AG_LOCKPROF_MAX;
+	     i++, n = (n+1) % AG_LOCKPROF_MAX) {
+		AG_LockProfEnt *ent = &lpEnts[n];
+
+		if (LP_LOAD(&ent->state) == AG_LOCKPROF_FREE &&
+		    LP_CAS(&ent->state, AG_LOCKPROF_FREE, AG_LOCKPROF_INIT)) {
+			Strlcpy(ent->st.name, name, sizeof(ent->st.name));
+			LP_STORE(&ent->state, AG_LOCKPROF_READY);
+			return (ent);
+		}
+		while (LP_LOAD(&ent->state) == AG_LOCKPROF_INIT)
+			;				/* Being claimed */
+		if (strcmp(ent->st.name, name) == 0)
+			return (ent);
+	}
+	return (&lpOverflow);
+}
+
+/* Return the statistics entry for a call site. */
+static AG_LockProfEnt *
+LookupSite(const char *file, int line)
+{
+	char key[AG_LOCKPROF_NAME_MAX];
+	size_t len;
+
+	if ((len = strlen(file)) > sizeof(key)-8) {
+		file += len - (sizeof(key)-8);		/* Keep the tail */
+	}
+	Snprintf(key, sizeof(key), "%s:%d", file, line);
+	return Lookup(key);
+}
+
+static __inline__ Uint
+HashLock(const void *lock)
+{
+	return (Uint)(((size_t)lock >> 4) * 2654435761U) &
+	             (AG_LOCKPROF_NAMED_MAX-1);
+}
+
+/* Return the named lock slot for a mutex (or NULL). */
+static AG_LockProfNamed *
+LookupNamed(const void *lock)
+{
+	Uint i, n;
+	void *p;
+
+	for (i = 0, n = HashLock(lock);
+	     i < AG_LOCKPROF_NAMED_MAX;
+	     i++, n = (n+1) & (AG_LOCKPROF_NAMED_MAX-1)) {
+		if ((p = LP_LOAD(&lpNamed[n].lock)) == NULL) {
+			break;
+		}
+		if (p == lock)
+			return (&lpNamed[n]);
+	}
+	return (NULL);
+}
+
+/* Select the statistics entry for an acquisition of m at the given site. */
+static __inline__ AG_LockProfEnt *
+LockEnt(AG_Mutex *m, AG_LockSite *site)
+{
+	AG_LockProfNamed *ln;
+	AG_LockProfEnt *ent;
+
+	if (LP_LOAD(&lpNamedCount) > 0 &&
+	    (ln = LookupNamed(m)) != NULL &&
+	    (ent = LP_LOAD(&ln->ent)) != NULL) {
+		return (ent);
+	}
+	if ((ent = LP_LOAD(&site->ent)) == NULL) {
+		ent = LookupSite(site->file, site->line);
+		LP_STORE(&site->ent, (void *)ent);
+	}
+	return (ent);
+}
+
+/* Record a wait or hold time sample. */
+static void
+Record(Uint64 *hist, Uint64 *total, Uint64 *max, Uint64 ns)
+{
+	Uint64 cur;
+	Uint i;
+
+	for (i = 0; i < AG_LOCKPROF_BUCKETS-1; i++) {
+		if (ns <= ((Uint64)AG_LOCKPROF_BUCKET_MIN << i))
+			break;
+	}
+	LP_ADD(&hist[i], 1);
+	if (ns > 0) {
+		LP_ADD(total, ns);
+	}
+	while (ns > (cur = LP_LOAD(max)) && !LP_CAS(max, cur, ns))
+		;
+}
+
+static void
+InitThreadKey(void)
+{
+	if (pthread_key_create(&lpThreadKey, free) == 0)
+		LP_STORE(&lpThreadKeyOK, 1);
+}
+
+/* Return the held mutex stack of the calling thread. */
+static AG_LockProfThread *
+GetThread(int create)
+{
+	AG_LockProfThread *th;
+
+	if (!LP_LOAD(&lpThreadKeyOK)) {
+		if (!create) {
+			return (NULL);
+		}
+		AG_ThreadOnce(&lpThreadOnce, InitThreadKey);
+		if (!LP_LOAD(&lpThreadKeyOK))
+			return (NULL);
+	}
+	if ((th = pthread_getspecific(lpThreadKey)) == NULL && create) {
+		if ((th = malloc(sizeof(AG_LockProfThread))) == NULL) {
+			return (NULL);
+		}
+		th->n = 0;
+		if (pthread_setspecific(lpThreadKey, th) != 0) {
+			free(th);
+			return (NULL);
+		}
+	}
+	return (th);
+}
+
+/* Note an acquisition of m by the calling thread. */
+static void
+PushHeld(AG_Mutex *m, AG_LockProfEnt *ent, Uint64 t)
+{
+	AG_LockProfThread *th;
+	AG_LockProfHeld *h;
+	Uint i;
+
+	if ((th = GetThread(1)) == NULL || th->n == AG_LOCKPROF_DEPTH) {
+		return;
+	}
+	for (i = 0; i < th->n; i++) {
+		if (th->held[i].m == m) {		/* Recursive */
+			ent = NULL;
+			break;
+		}
+	}
+	h = &th->held[th->n++];
+	h->m = m;
+	h->ent = ent;
+	h->t = t;
+}
+
+/* Return the innermost held entry for m (or NULL). */
+static AG_LockProfHeld *
+FindHeld(AG_LockProfThread *th, AG_Mutex *m)
+{
+	Uint i;
+
+	for (i = th->n; i > 0; i--) {
+		if (th->held[i-1].m == m)
+			return (&th->held[i-1]);
+	}
+	return (NULL);
+}
+
+static void
+RecordHold(AG_LockProfHeld *h)
+{
+	AG_LockStat *st;
+
+	if (h->ent != NULL && h->t != 0) {
+		st = &h->ent->st;
+		Record(st->hold, &st->holdTotal, &st->holdMax, Now() - h->t);
+	}
+}
+
+/* AG_MutexLock() in profiling mode. */
+void
+AG_LockProfLock(AG_Mutex *m, AG_LockSite *site)
+{
+	AG_LockProfEnt *ent;
+	AG_LockStat *st;
+	Uint64 t1, t2;
+	int rv;
+
+	if (!LP_LOAD(&lpEnabled)) {
+		if (pthread_mutex_lock(m) != 0) {
+			AG_FatalError("pthread_mutex_lock");
+		}
+		return;
+	}
+	ent = LockEnt(m, site);
+	st = &ent->st;
+
+	if ((rv = pthread_mutex_trylock(m)) == 0) {
+		t2 = Now();
+		Record(st->wait, &st->waitTotal, &st->waitMax, 0);
+	} else if (rv == EBUSY) {
+		t1 = Now();
+		if (pthread_mutex_lock(m) != 0) {
+			AG_FatalError("pthread_mutex_lock");
+		}
+		t2 = Now();
+		LP_ADD(&st->nContended, 1);
+		Record(st->wait, &st->waitTotal, &st->waitMax, t2-t1);
+	} else {
+		AG_FatalError("pthread_mutex_trylock");
+	}
+	LP_ADD(&st->nAcquired, 1);
+	PushHeld(m, ent, t2);
+}
+
+/* AG_MutexTryLock() in profiling mode. */
+int
+AG_LockProfTryLock(AG_Mutex *m, const char *file, int line)
+{
+	AG_LockSite site;
+	AG_LockProfEnt *ent;
+	AG_LockStat *st;
+	int rv;
+
+	rv = pthread_mutex_trylock(m);
+	if (!LP_LOAD(&lpEnabled)) {
+		return (rv);
+	}
+	site.file = file;
+	site.line = line;
+	site.ent = NULL;
+	ent = LockEnt(m, &site);
+	st = &ent->st;
+	if (rv != 0) {
+		LP_ADD(&st->nTryFailed, 1);
+		return (rv);
+	}
+	LP_ADD(&st->nAcquired, 1);
+	Record(st->wait, &st->waitTotal, &st->waitMax, 0);
+	PushHeld(m, ent, Now());
+	return (0);
+}
+
+/* AG_MutexUnlock() in profiling mode. */
+void
+AG_LockProfUnlock(AG_Mutex *m)
+{
+	AG_LockProfThread *th;
+	AG_LockProfHeld *h;
+
+	if ((th = GetThread(0)) != NULL && th->n > 0 &&
+	    (h = FindHeld(th, m)) != NULL) {
+		RecordHold(h);
+		memmove(h, h+1, (&th->held[th->n] - (h+1)) *
+		                sizeof(AG_LockProfHeld));
+		th->n--;
+	}
+	if (pthread_mutex_unlock(m) != 0)
+		AG_FatalError("pthread_mutex_unlock");
+}
+
+/*
+ * Condition variable waits release the mutex; end the current hold
+ * period before waiting and start a new one after waking up.
+ */
+static AG_LockProfHeld *
+SuspendHold(AG_Mutex *m)
+{
+	AG_LockProfThread *th;
+	AG_LockProfHeld *h;
+
+	if ((th = GetThread(0)) == NULL || (h = FindHeld(th, m)) == NULL) {
+		return (NULL);
+	}
+	RecordHold(h);
+	h->t = 0;
+	return (h);
+}
+
+int
+AG_LockProfCondWait(AG_Cond *cd, AG_Mutex *m)
+{
+	AG_LockProfHeld *h;
+	int rv;
+
+	h = SuspendHold(m);
+	rv = pthread_cond_wait(cd, m);
+	if (h != NULL) {
+		h->t = Now();
+	}
+	return (rv);
+}
+
+int
+AG_LockProfCondTimedWait(AG_Cond *cd, AG_Mutex *m, const struct timespec *ts)
+{
+	AG_LockProfHeld *h;
+	int rv;
+
+	h = SuspendHold(m);
+	rv = pthread_cond_timedwait(cd, m, ts);
+	if (h != NULL) {
+		h->t = Now();
+	}
+	return (rv);
+}
+
+/* Forget the name of a mutex about to be destroyed. */
+void
+AG_LockProfForget(AG_Mutex *m)
+{
+	AG_LockProfNamed *ln;
+
+	if (LP_LOAD(&lpNamedCount) > 0 && (ln = LookupNamed(m)) != NULL)
+		LP_STORE(&ln->ent, NULL);
+}
+
+/* Pause (0) or resume (1) the collection of statistics. */
+void
+AG_LockProfEnable(int enable)
+{
+	LP_STORE(&lpEnabled, enable);
+}
+
+/*
+ * Accumulate the statistics of the given mutex (usually global) under the
+ * given name, rather than per call site. A NULL name reverts to per-site
+ * statistics.
+ */
+int
+AG_LockProfSetName(void *lock, const char *name)
+{
+	AG_LockProfNamed *ln;
+	AG_LockProfEnt *ent;
+	Uint i, n;
+	void *p;
+
+	ent = (name != NULL) ? Lookup(name) : NULL;
+
+	for (i = 0, n = HashLock(lock);
+	     i < AG_LOCKPROF_NAMED_MAX;
+	     i++, n = (n+1) & (AG_LOCKPROF_NAMED_MAX-1)) {
+		ln = &lpNamed[n];
+		if ((p = LP_LOAD(&ln->lock)) == NULL) {
+			if (ent == NULL) {
+				return (0);		/* Not named */
+			}
+			if (LP_CAS(&ln->lock, NULL, lock)) {
+				LP_STORE(&ln->ent, ent);
+				LP_ADD(&lpNamedCount, 1);
+				return (0);
+			}
+			p = LP_LOAD(&ln->lock);
+		}
+		if (p == lock) {
+			LP_STORE(&ln->ent, ent);
+			return (0);
+		}
+	}
+	AG_SetError("Too many named locks");
+	return (-1);
+}
+
+/* Clear all statistics. */
+void
+AG_LockProfReset(void)
+{
+	Uint64 *c;
+	Uint i, j;
+
+	for (i = 0; i <= AG_LOCKPROF_MAX; i++) {
+		AG_LockProfEnt *ent = (i < AG_LOCKPROF_MAX) ? &lpEnts[i] :
+		                                              &lpOverflow;
+
+		if (LP_LOAD(&ent->state) != AG_LOCKPROF_READY) {
+			continue;
+		}
+		for (j = 0, c = &ent->st.nAcquired; j < AG_LOCKPROF_COUNTERS; j++)
+			LP_STORE(&c[j], 0);
+	}
+}
+
+static int
+CompareSnaps(const void *p1, const void *p2)
+{
+	const AG_LockProfSnap *s1 = p1;
+	const AG_LockProfSnap *s2 = p2;
+
+	if (s1->key != s2->key) {
+		return (s1->key < s2->key) ? 1 : -1;
+	}
+	return strcmp(s1->st.name, s2->st.name);
+}
+
+/*
+ * Copy the statistics of up to nMax locks into stats, ranked by the
+ * given criteria (in decreasing order). Return the number of entries
+ * copied. If stats is NULL, return the number of locks with statistics.
+ */
+Uint
+AG_LockProfGetStats(AG_LockStat *stats, Uint nMax,
+    enum ag_lockprof_sort sort)
+{
+	AG_LockProfSnap *snaps;
+	Uint64 *cSrc, *cDst;
+	Uint i, j, n = 0;
+
+	if ((snaps = TryMalloc((AG_LOCKPROF_MAX+1)*sizeof(AG_LockProfSnap)))
+	    == NULL) {
+		return (0);
+	}
+	for (i = 0; i <= AG_LOCKPROF_MAX; i++) {
+		AG_LockProfEnt *ent = (i < AG_LOCKPROF_MAX) ? &lpEnts[i] :
+		                                              &lpOverflow;
+		AG_LockProfSnap *snap = &snaps[n];
+
+		if (LP_LOAD(&ent->state) != AG_LOCKPROF_READY) {
+			continue;
+		}
+		Strlcpy(snap->st.name, ent->st.name, sizeof(snap->st.name));
+		cSrc = &ent->st.nAcquired;
+		cDst = &snap->st.nAcquired;
+		for (j = 0; j < AG_LOCKPROF_COUNTERS; j++) {
+			cDst[j] = LP_LOAD(&cSrc[j]);
+		}
+		if (snap->st.nAcquired == 0 && snap->st.nTryFailed == 0) {
+			continue;
+		}
+		switch (sort) {
+		case AG_LOCKPROF_SORT_WAIT:
+			snap->key = snap->st.waitTotal;
+			break;
+		case AG_LOCKPROF_SORT_CONTENDED:
+			snap->key = snap->st.nContended;
+			break;
+		case AG_LOCKPROF_SORT_HOLD:
+			snap->key = snap->st.holdTotal;
+			break;
+		case AG_LOCKPROF_SORT_ACQUIRED:
+			snap->key = snap->st.nAcquired;
+			break;
+		}
+		n++;
+	}
+	if (stats == NULL) {
+		free(snaps);
+		return (n);
+	}
+	qsort(snaps, n, sizeof(AG_LockProfSnap), CompareSnaps);
+	if (n > nMax) {
+		n = nMax;
+	}
+	for (i = 0; i < n; i++) {
+		memcpy(&stats[i], &snaps[i].st, sizeof(AG_LockStat));
+	}
+	free(snaps);
+	return (n);
+}
+
+/*
+ * Estimate a percentile (0-100) of a wait or hold time histogram. The
+ * result is the upper bound of the bucket containing it, capped to max.
+ */
+Uint64
+AG_LockProfPercentile(const Uint64 *hist, Uint64 max, int pct)
+{
+	Uint64 count = 0, sum = 0, bound;
+	Uint i;
+
+	for (i = 0; i < AG_LOCKPROF_BUCKETS; i++) {
+		count += hist[i];
+	}
+	if (count == 0) {
+		return (0);
+	}
+	for (i = 0; i < AG_LOCKPROF_BUCKETS-1; i++) {
+		sum += hist[i];
+		if (sum*100 >= count*pct)
+			break;
+	}
+	bound = (i < AG_LOCKPROF_BUCKETS-1) ?
+	        ((Uint64)AG_LOCKPROF_BUCKET_MIN << i) : max;
+	return (bound < max) ? bound : max;
+}
+
+/*
+ * Format a report of the nMax (0 = all) highest ranking locks. The
+ * returned string must be freed after use. Lines which would exceed
+ * lineMax are truncated.
+ */
+char *
+AG_LockProfReport(enum ag_lockprof_sort sort, Uint nMax)
+{
+	const Uint lineMax = 256;
+	AG_LockStat *stats;
+	char *s, *c;
+	Uint i, n;
+
+	if (nMax == 0 &&
+	    (nMax = AG_LockProfGetStats(NULL, 0, sort)) == 0) {
+		nMax = 1;
+	}
+	if ((stats = TryMalloc(nMax*sizeof(AG_LockStat))) == NULL) {
+		return (NULL);
+	}
+	n = AG_LockProfGetStats(stats, nMax, sort);
+	if ((s = TryMalloc((n+1)*lineMax)) == NULL) {
+		free(stats);
+		return (NULL);
+	}
+	c = s;
+	Snprintf(c, lineMax,
+	    "%-36s %10s %10s %10s %9s %9s %10s %9s\n",
+	    "Lock", "Acquired", "Contended", "Wait(ms)", "p99(us)",
+	    "Max(us)", "Hold(ms)", "p99(us)");
+	c += strlen(c);
+	for (i = 0; i < n; i++) {
+		AG_LockStat *st = &stats[i];
+
+		Snprintf(c, lineMax,
+		    "%-36.36s %10llu %10llu %10.2f %9llu %9llu %10.2f %9llu\n",
+		    st->name,
+		    (unsigned long long)st->nAcquired,
+		    (unsigned long long)st->nContended,
+		    (double)st->waitTotal/1e6,
+		    (unsigned long long)AG_LockProfPercentile(st->wait,
+		        st->waitMax, 99)/1000,
+		    (unsigned long long)st->waitMax/1000,
+		    (double)st->holdTotal/1e6,
+		    (unsigned long long)AG_LockProfPercentile(st->hold,
+		        st->holdMax, 99)/1000);
+		c += strlen(c);
+	}
+	free(stats);
+	return (s);
+}
+
+#endif /* AG_THREADS and AG_LOCKPROF */
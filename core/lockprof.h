@@ -0,0 +1,46 @@
+/*	Public domain	*/
+
+#ifndef _AGAR_CORE_LOCKPROF_H_
+#define _AGAR_CORE_LOCKPROF_H_
+
+#include <agar/config/ag_lockprof.h>
+
+#if defined(AG_THREADS) && defined(AG_LOCKPROF)
+#include <agar/core/begin.h>
+
+#define AG_LOCKPROF_NAME_MAX	64
+#define AG_LOCKPROF_BUCKETS	16	/* Histogram buckets */
+#define AG_LOCKPROF_BUCKET_MIN	1000	/* Upper bound of first bucket (ns) */
+
+/* Statistics for a lock call site ("file:line") or a named lock. */
+typedef struct ag_lock_stat {
+	char name[AG_LOCKPROF_NAME_MAX];
+	Uint64 nAcquired;			/* Acquisitions */
+	Uint64 nContended;			/* Acquisitions that blocked */
+	Uint64 nTryFailed;			/* Failed AG_MutexTryLock() */
+	Uint64 waitTotal, waitMax;		/* Time spent blocked (ns) */
+	Uint64 holdTotal, holdMax;		/* Time held (ns) */
+	Uint64 wait[AG_LOCKPROF_BUCKETS];	/* Wait times (log2 buckets) */
+	Uint64 hold[AG_LOCKPROF_BUCKETS];	/* Hold times (log2 buckets) */
+} AG_LockStat;
+
+/* Ranking criteria for AG_LockProfGetStats(). */
+enum ag_lockprof_sort {
+	AG_LOCKPROF_SORT_WAIT,			/* Total wait time */
+	AG_LOCKPROF_SORT_CONTENDED,		/* Contended acquisitions */
+	AG_LOCKPROF_SORT_HOLD,			/* Total hold time */
+	AG_LOCKPROF_SORT_ACQUIRED		/* Acquisitions */
+};
+
+__BEGIN_DECLS
+void   AG_LockProfEnable(int);
+void   AG_LockProfReset(void);
+int    AG_LockProfSetName(void *, const char *);
+Uint   AG_LockProfGetStats(AG_LockStat *, Uint, enum ag_lockprof_sort);
+Uint64 AG_LockProfPercentile(const Uint64 *, Uint64, int);
+char  *AG_LockProfReport(enum ag_lockprof_sort, Uint);
+__END_DECLS
+
+#include <agar/core/close.h>
+#endif /* AG_THREADS and AG_LOCKPROF */
+#endif /* _AGAR_CORE_LOCKPROF_H_ */
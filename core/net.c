@@ -66,6 +66,9 @@ AG_NetSocketNew(enum ag_net_addr_family af, enum ag_net_socket_type type,
 	ns->fd = -1;
 	ns->listenBacklog = 10;
 	ns->p = NULL;
+	ns->wrBuf = NULL;
+	ns->wrBufLen = 0;
+	ns->wrBufSize = 0;
 
 	if (agNetOps->initSocket != NULL &&
 	    agNetOps->initSocket(ns) == -1) {
@@ -84,6 +87,7 @@ AG_NetSocketFree(AG_NetSocket *ns)
 	}
 	if (ns->addrLocal != NULL) { AG_NetAddrFree(ns->addrLocal); }
 	if (ns->addrRemote != NULL) { AG_NetAddrFree(ns->addrRemote); }
+	Free(ns->wrBuf);
 	AG_MutexDestroy(&ns->lock);
 	free(ns);
 }
@@ -268,7 +272,10 @@ AG_NetAddrNumerical(AG_NetAddr *na)
 	return agNetOps->getAddrNumerical(na);
 }
 
-/* Resolve the specified hostname and port name/number. */
+/*
+ * Resolve the specified hostname and port name/number. Results are
+ * cached (see AG_NetResolverSetTTL()).
+ */
 AG_NetAddrList *
 AG_NetResolve(const char *host, const char *port, Uint flags)
 {
@@ -277,7 +284,7 @@ AG_NetResolve(const char *host, const char *port, Uint flags)
 	if ((nal = AG_NetAddrListNew()) == NULL) {
 		return (NULL);
 	}
-	if (agNetOps->resolve(nal, host, port, flags) == -1) {
+	if (AG_NetResolverLookup(nal, host, port, flags) == -1) {
 		goto fail;
 	}
 	return (nal);
@@ -448,14 +455,341 @@ AG_NetRead(AG_NetSocket *ns, void *p, size_t size, size_t *nRead)
 	return (rv);
 }
 
-/* Write data to a socket. */
+/*
+ * Gather-write a vector of segments with a single backend call (or
+ * a sequence of writes if the backend has no writev operation).
+ * The socket must be locked.
+ */
+static int
+NetWritevDirect(AG_NetSocket *ns, const AG_NetIOVec *v, Uint n,
+    size_t *nWrote)
+{
+	size_t len, total = 0;
+	Uint i;
+
+	if (agNetOps->writev != NULL) {
+		return agNetOps->writev(ns, v, n, nWrote);
+	}
+	for (i = 0; i < n; i++) {
+		if (agNetOps->write(ns, v[i].p, v[i].len, &len) == -1) {
+			if (total > 0) {
+				break;
+			}
+			return (-1);
+		}
+		total += len;
+		if (len < v[i].len)
+			break;
+	}
+	if (nWrote != NULL) { *nWrote = total; }
+	return (0);
+}
+
+/*
+ * Write out the cork buffer followed by the given segments, retrying
+ * short writes until everything has been transferred. On failure, any
+ * unsent part of the cork buffer is retained. If nSent is not NULL, the
+ * number of bytes of the given segments written (even on failure) is
+ * returned there. The socket must be locked.
+ */
+static int
+NetWriteAll(AG_NetSocket *ns, const AG_NetIOVec *v, Uint n, size_t *nSent)
+{
+	AG_NetIOVec vStack[16], *vw, *vp;
+	Uint i, nw;
+	size_t len, lenBuf, total = 0;
+	int rv = -1, inBuf;
+
+	if (nSent != NULL) {
+		*nSent = 0;
+	}
+	if ((n+1) <= (sizeof(vStack) / sizeof(vStack[0]))) {
+		vw = vStack;
+	} else {
+		if ((vw = TryMalloc((n+1)*sizeof(AG_NetIOVec))) == NULL)
+			return (-1);
+	}
+	nw = 0;
+	lenBuf = ns->wrBufLen;
+	if ((inBuf = (ns->wrBufLen > 0))) {
+		vw[nw].p = ns->wrBuf;
+		vw[nw].len = ns->wrBufLen;
+		nw++;
+	}
+	for (i = 0; i < n; i++) {
+		if (v[i].len > 0)
+			vw[nw++] = v[i];
+	}
+	for (vp = vw; nw > 0; ) {
+		if (NetWritevDirect(ns, vp, nw, &len) == -1) {
+			goto out;
+		}
+		if (len == 0) {
+			AG_SetError(_("Write returned 0 bytes"));
+			goto out;
+		}
+		total += len;
+		while (nw > 0 && len >= vp->len) {
+			len -= vp->len;
+			if (inBuf) {
+				ns->wrBufLen = 0;
+				inBuf = 0;
+			}
+			vp++;
+			nw--;
+		}
+		if (nw > 0) {
+			vp->p = (Uint8 *)vp->p + len;
+			vp->len -= len;
+		}
+	}
+	rv = 0;
+out:
+	if (inBuf) {				/* Retain unsent buffered data */
+		memmove(ns->wrBuf, vp->p, vp->len);
+		ns->wrBufLen = vp->len;
+	}
+	if (nSent != NULL) {
+		*nSent = (total > lenBuf) ? total - lenBuf : 0;
+	}
+	if (vw != vStack) {
+		free(vw);
+	}
+	return (rv);
+}
+
+/*
+ * Write to a corked socket. Data is appended to the cork buffer as long
+ * as it fits; otherwise the buffered data and the new segments are sent
+ * together with a single gather write. If that fails after part of the
+ * new data was sent, return success with the partial count in nWrote
+ * (the error will recur on the next write).
+ */
+static int
+NetWriteCorked(AG_NetSocket *ns, const AG_NetIOVec *v, Uint n, size_t *nWrote)
+{
+	size_t total = 0, nSent;
+	Uint i;
+
+	for (i = 0; i < n; i++) {
+		total += v[i].len;
+	}
+	if (ns->wrBufLen + total <= ns->wrBufSize) {
+		for (i = 0; i < n; i++) {
+			memcpy(&ns->wrBuf[ns->wrBufLen], v[i].p, v[i].len);
+			ns->wrBufLen += v[i].len;
+		}
+	} else {
+		if (NetWriteAll(ns, v, n, &nSent) == -1) {
+			if (nSent == 0) {
+				return (-1);
+			}
+			total = nSent;
+		}
+	}
+	if (nWrote != NULL) { *nWrote = total; }
+	return (0);
+}
+
+/*
+ * Write data to a socket. If the socket is corked, the data is buffered
+ * and nWrote is always set to the full size on success.
+ */
 int
 AG_NetWrite(AG_NetSocket *ns, const void *p, size_t size, size_t *nWrote)
 {
+	AG_NetIOVec v;
 	int rv;
 
 	AG_MutexLock(&ns->lock);
-	rv = agNetOps->write(ns, p, size, nWrote);
+	if (ns->flags & AG_NET_SOCKET_CORKED) {
+		v.p = (void *)p;
+		v.len = size;
+		rv = NetWriteCorked(ns, &v, 1, nWrote);
+	} else {
+		rv = agNetOps->write(ns, p, size, nWrote);
+	}
+	AG_MutexUnlock(&ns->lock);
+	return (rv);
+}
+
+/*
+ * Scatter-read data from a socket into a vector of buffers. As with
+ * AG_NetRead(), fewer bytes than requested may be returned.
+ */
+int
+AG_NetReadv(AG_NetSocket *ns, const AG_NetIOVec *v, Uint n, size_t *nRead)
+{
+	size_t len, total = 0;
+	Uint i;
+	int rv = 0;
+
+	AG_MutexLock(&ns->lock);
+	if (agNetOps->readv != NULL) {
+		rv = agNetOps->readv(ns, v, n, nRead);
+		goto out;
+	}
+	for (i = 0; i < n; i++) {
+		if (agNetOps->read(ns, v[i].p, v[i].len, &len) == -1) {
+			if (total == 0) { rv = -1; }
+			break;
+		}
+		total += len;
+		if (len < v[i].len)
+			break;
+	}
+	if (rv == 0 && nRead != NULL) { *nRead = total; }
+out:
+	AG_MutexUnlock(&ns->lock);
+	return (rv);
+}
+
+/*
+ * Gather-write a vector of buffers to a socket. As with AG_NetWrite(),
+ * the transfer may be short unless the socket is corked.
+ */
+int
+AG_NetWritev(AG_NetSocket *ns, const AG_NetIOVec *v, Uint n, size_t *nWrote)
+{
+	int rv;
+
+	AG_MutexLock(&ns->lock);
+	if (ns->flags & AG_NET_SOCKET_CORKED) {
+		rv = NetWriteCorked(ns, v, n, nWrote);
+	} else {
+		rv = NetWritevDirect(ns, v, n, nWrote);
+	}
+	AG_MutexUnlock(&ns->lock);
+	return (rv);
+}
+
+/*
+ * Receive up to n datagrams with as few system calls as possible. Waits
+ * for the first datagram (unless AG_NET_DGRAM_NOWAIT is set) and returns
+ * whatever else is already queued. The number of datagrams received is
+ * returned in nRecvd. If the addr field of a AG_NetDgram is non-NULL,
+ * the source address is stored there (as with AG_NetSendDgrams(), this
+ * is an error if the backend does not support addresses).
+ */
+int
+AG_NetRecvDgrams(AG_NetSocket *ns, AG_NetDgram *dg, Uint n, Uint flags,
+    Uint *nRecvd)
+{
+	size_t len;
+	int rv = 0;
+
+	AG_MutexLock(&ns->lock);
+	if (agNetOps->recvDgrams != NULL) {
+		rv = agNetOps->recvDgrams(ns, dg, n, flags, nRecvd);
+	} else if (n == 0) {
+		if (nRecvd != NULL) { *nRecvd = 0; }
+	} else if (dg[0].addr != NULL) {
+		AG_SetError(_("Source addresses are not supported"));
+		rv = -1;
+	} else if ((rv = agNetOps->read(ns, dg[0].p, dg[0].size, &len)) == 0) {
+		dg[0].len = len;
+		dg[0].flags = 0;
+		if (nRecvd != NULL) { *nRecvd = 1; }
+	}
+	AG_MutexUnlock(&ns->lock);
+	return (rv);
+}
+
+/*
+ * Send n datagrams with as few system calls as possible. Datagrams with a
+ * non-NULL addr are sent to that address, others to the connected peer.
+ * The number of datagrams sent is returned in nSent.
+ */
+int
+AG_NetSendDgrams(AG_NetSocket *ns, AG_NetDgram *dg, Uint n, Uint *nSent)
+{
+	Uint i;
+	int rv = 0;
+
+	AG_MutexLock(&ns->lock);
+	if (agNetOps->sendDgrams != NULL) {
+		rv = agNetOps->sendDgrams(ns, dg, n, nSent);
+		goto out;
+	}
+	for (i = 0; i < n; i++) {
+		if (dg[i].addr != NULL) {
+			AG_SetError(_("Destination addresses are not supported"));
+			rv = -1;
+			break;
+		}
+		if ((rv = agNetOps->write(ns, dg[i].p, dg[i].len, NULL)) == -1)
+			break;
+	}
+	if (i > 0) {
+		rv = 0;
+	}
+	if (rv == 0 && nSent != NULL) { *nSent = i; }
+out:
+	AG_MutexUnlock(&ns->lock);
+	return (rv);
+}
+
+/*
+ * Enable write coalescing on a socket. Subsequent writes are accumulated
+ * in a buffer of the given size (or AG_NET_CORK_BUFSIZE if 0), and only
+ * sent once the buffer fills or AG_NetFlush() is called.
+ */
+int
+AG_NetCork(AG_NetSocket *ns, size_t bufSize)
+{
+	Uint8 *bufNew;
+
+	if (bufSize == 0) {
+		bufSize = AG_NET_CORK_BUFSIZE;
+	}
+	AG_MutexLock(&ns->lock);
+	if (ns->wrBufLen > bufSize &&
+	    NetWriteAll(ns, NULL, 0, NULL) == -1) {
+		goto fail;
+	}
+	if (bufSize != ns->wrBufSize) {
+		if ((bufNew = TryRealloc(ns->wrBuf, bufSize)) == NULL) {
+			goto fail;
+		}
+		ns->wrBuf = bufNew;
+		ns->wrBufSize = bufSize;
+	}
+	ns->flags |= AG_NET_SOCKET_CORKED;
+	AG_MutexUnlock(&ns->lock);
+	return (0);
+fail:
+	AG_MutexUnlock(&ns->lock);
+	return (-1);
+}
+
+/* Flush any buffered data and disable write coalescing. */
+int
+AG_NetUncork(AG_NetSocket *ns)
+{
+	AG_MutexLock(&ns->lock);
+	if (ns->wrBufLen > 0 &&
+	    NetWriteAll(ns, NULL, 0, NULL) == -1) {
+		AG_MutexUnlock(&ns->lock);
+		return (-1);
+	}
+	Free(ns->wrBuf);
+	ns->wrBuf = NULL;
+	ns->wrBufSize = 0;
+	ns->flags &= ~(AG_NET_SOCKET_CORKED);
+	AG_MutexUnlock(&ns->lock);
+	return (0);
+}
+
+/* Send any data accumulated in the cork buffer. */
+int
+AG_NetFlush(AG_NetSocket *ns)
+{
+	int rv = 0;
+
+	AG_MutexLock(&ns->lock);
+	if (ns->wrBufLen > 0) {
+		rv = NetWriteAll(ns, NULL, 0, NULL);
+	}
 	AG_MutexUnlock(&ns->lock);
 	return (rv);
 }
@@ -469,6 +803,10 @@ AG_NetClose(AG_NetSocket *ns)
 	if ((ns->flags & AG_NET_SOCKET_CONNECTED) == 0) {
 		goto out;
 	}
+	if (ns->wrBufLen > 0) {
+		(void)NetWriteAll(ns, NULL, 0, NULL);
+		ns->wrBufLen = 0;
+	}
 	agNetOps->close(ns);
 
 	if (ns->addrLocal != NULL) {
@@ -494,6 +832,7 @@ AG_InitNetworkSubsystem(const AG_NetOps *ops)
 		agNetOps->destroy();
 	}
 	agNetOps = ops;
+	AG_NetResolverInit();
 	return (ops->init != NULL) ? ops->init() : 0;
 }
 
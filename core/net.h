@@ -91,6 +91,27 @@ typedef struct ag_net_addr {
 /* List of socket addresses. */
 typedef AG_TAILQ_HEAD(ag_net_addr_list, ag_net_addr) AG_NetAddrList;
 
+/* Buffer segment for scatter/gather I/O (AG_NetReadv(), AG_NetWritev()). */
+typedef struct ag_net_iovec {
+	void *p;				/* Segment data */
+	size_t len;				/* Segment length in bytes */
+} AG_NetIOVec;
+
+#define AG_NET_CORK_BUFSIZE	16384		/* Default cork buffer size */
+
+/* Datagram for batched I/O (AG_NetRecvDgrams(), AG_NetSendDgrams()). */
+typedef struct ag_net_dgram {
+	void *p;				/* Datagram data */
+	size_t size;				/* Buffer size (for receive) */
+	size_t len;				/* Datagram length */
+	AG_NetAddr *addr;			/* Peer address (or NULL) */
+	Uint flags;
+#define AG_NET_DGRAM_TRUNCATED	0x01		/* Truncated on receive */
+} AG_NetDgram;
+
+/* Flags for AG_NetRecvDgrams() */
+#define AG_NET_DGRAM_NOWAIT	0x01		/* Don't wait for a datagram */
+
 /* Endpoint for communication */
 typedef struct ag_net_socket {
 	enum ag_net_addr_family family;		/* Address family */
@@ -100,6 +121,7 @@ typedef struct ag_net_socket {
 	Uint flags;
 #define AG_NET_SOCKET_BOUND	0x01		/* Bound to a local address */
 #define AG_NET_SOCKET_CONNECTED	0x02		/* Connection established */
+#define AG_NET_SOCKET_CORKED	0x04		/* Coalesce writes until flush */
 	Uint poll;
 #define AG_NET_POLL_READ	0x01		/* Poll read condition */
 #define AG_NET_POLL_WRITE	0x02		/* Poll write condition */
@@ -110,6 +132,9 @@ typedef struct ag_net_socket {
 	int fd;					/* File descriptor (if any) */
 	int listenBacklog;			/* For AG_NET_BACKLOG */
 	void *p;				/* User pointer */
+	Uint8 *wrBuf;				/* Cork buffer (AG_NetCork()) */
+	size_t wrBufLen;			/* Bytes pending in cork buffer */
+	size_t wrBufSize;			/* Cork buffer size */
 
 	AG_TAILQ_ENTRY(ag_net_socket) sockets;
 	AG_TAILQ_ENTRY(ag_net_socket) read;	/* Poll read results */
@@ -139,6 +164,10 @@ typedef struct ag_net_ops {
 	AG_NetSocket *(*accept)(AG_NetSocket *);
 	int           (*read)(AG_NetSocket *, void *, size_t, size_t *);
 	int           (*write)(AG_NetSocket *, const void *, size_t, size_t *);
+	int           (*readv)(AG_NetSocket *, const AG_NetIOVec *, Uint, size_t *);
+	int           (*writev)(AG_NetSocket *, const AG_NetIOVec *, Uint, size_t *);
+	int           (*recvDgrams)(AG_NetSocket *, AG_NetDgram *, Uint, Uint, Uint *);
+	int           (*sendDgrams)(AG_NetSocket *, AG_NetDgram *, Uint, Uint *);
 	void          (*close)(AG_NetSocket *);
 } AG_NetOps;
 
@@ -173,6 +202,9 @@ void            AG_NetAddrListClear(AG_NetAddrList *);
 void            AG_NetAddrListFree(AG_NetAddrList *);
 
 AG_NetAddrList *AG_NetResolve(const char *, const char *, Uint);
+int             AG_NetResolveAsync(const char *, const char *, Uint,
+                                   AG_EventFn, const char *, ...);
+int             AG_NetResolveProcess(void);
 AG_NetAddrList *AG_NetGetIfConfig(void);
 int             AG_NetConnect(AG_NetSocket *, const AG_NetAddrList *);
 int             AG_NetBind(AG_NetSocket *, const AG_NetAddr *);
@@ -187,7 +219,24 @@ int             AG_NetRead(AG_NetSocket *, void *, size_t , size_t *)
                            BOUNDED_ATTRIBUTE(__buffer__,2,3);
 int             AG_NetWrite(AG_NetSocket *, const void *, size_t , size_t *)
                             BOUNDED_ATTRIBUTE(__buffer__,2,3);
+int             AG_NetReadv(AG_NetSocket *, const AG_NetIOVec *, Uint, size_t *);
+int             AG_NetWritev(AG_NetSocket *, const AG_NetIOVec *, Uint, size_t *);
+int             AG_NetRecvDgrams(AG_NetSocket *, AG_NetDgram *, Uint, Uint, Uint *);
+int             AG_NetSendDgrams(AG_NetSocket *, AG_NetDgram *, Uint, Uint *);
+int             AG_NetCork(AG_NetSocket *, size_t);
+int             AG_NetUncork(AG_NetSocket *);
+int             AG_NetFlush(AG_NetSocket *);
 void            AG_NetClose(AG_NetSocket *);
+
+void            AG_NetResolverInit(void);
+void            AG_NetResolverDestroy(void);
+int             AG_NetResolverLookup(AG_NetAddrList *, const char *,
+                                     const char *, Uint);
+void            AG_NetResolverSetTTL(Uint32, Uint32);
+void            AG_NetResolverSetCacheSize(Uint);
+void            AG_NetResolverClearCache(void);
+void            AG_NetResolverSetLoopback(int);
+int             AG_NetResolverSetHostsFile(const char *);
 __END_DECLS
 
 #include <agar/core/close.h>
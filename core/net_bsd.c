@@ -37,6 +37,11 @@
 # define _NETBSD_SOURCE
 # endif
 #endif
+#ifdef __linux__
+# ifndef _GNU_SOURCE
+# define _GNU_SOURCE			/* For recvmmsg(), sendmmsg() */
+# endif
+#endif
 
 #include <agar/core/core.h>
 #include <agar/core/queue_close.h>	/* Avoid <sys/queue.h> conflicts */
@@ -45,6 +50,7 @@
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -53,6 +59,7 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <errno.h>
+#include <limits.h>
 
 #include <sys/un.h>
 #include <netinet/in.h>
@@ -63,6 +70,25 @@
 #include <agar/core/queue_close.h>	/* Avoid <sys/queue.h> conflicts */
 #include <agar/core/queue.h>
 
+/*
+ * Segments passed to a single readv()/writev() call. Longer vectors are
+ * truncated and reported as a short transfer.
+ */
+#if defined(IOV_MAX) && IOV_MAX < 64
+# define AG_NET_BSD_IOV_MAX IOV_MAX
+#else
+# define AG_NET_BSD_IOV_MAX 64
+#endif
+
+/*
+ * Use recvmmsg() and sendmmsg() where available, with a batch size of
+ * AG_NET_BSD_MMSG_MAX datagrams per call.
+ */
+#if defined(MSG_WAITFORONE)
+# define AG_NET_BSD_MMSG
+#endif
+#define AG_NET_BSD_MMSG_MAX 32
+
 #include <agar/config/have_select.h>
 #include <agar/config/have_siocgifconf.h>
 #include <agar/config/have_setsockopt.h>
@@ -177,6 +203,46 @@ SockAddrToNetAddr(enum ag_net_addr_family af, const void *sa)
 	return (NULL);
 }
 
+/* Store a struct sockaddr into an existing AG_NetAddr. */
+static void
+SockAddrToNetAddrIn(AG_NetAddr *na, const struct sockaddr_storage *sa)
+{
+	if (na->family == AG_NET_LOCAL) {
+		Free(na->na_local.path);
+	}
+	Free(na->sNum);
+	Free(na->sName);
+	na->sNum = NULL;
+	na->sName = NULL;
+
+	switch (sa->ss_family) {
+	case AF_INET:
+		{
+			const struct sockaddr_in *sin = (const struct sockaddr_in *)sa;
+
+			na->family = AG_NET_INET4;
+			na->port = AG_SwapBE16(sin->sin_port);
+			na->na_inet4.addr = sin->sin_addr.s_addr;
+		}
+		break;
+#ifdef AF_INET6
+	case AF_INET6:
+		{
+			const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)sa;
+
+			na->family = AG_NET_INET6;
+			na->port = AG_SwapBE16(sin6->sin6_port);
+			memcpy(na->na_inet6.addr, &sin6->sin6_addr, 16);
+		}
+		break;
+#endif
+	default:
+		na->family = AG_NET_AF_NONE;
+		na->port = 0;
+		break;
+	}
+}
+
 /* Convert a 32-bit millisecond value to a timeval. */
 static void
 GetTimeval(struct timeval *tv, Uint32 ms)
@@ -653,6 +719,216 @@ Write(AG_NetSocket *ns, const void *p, size_t size, size_t *nWrote)
 	return (0);
 }
 
+/* Convert an AG_NetIOVec array to a struct iovec array. */
+static int
+GetIOVec(struct iovec *iov, const AG_NetIOVec *v, Uint n)
+{
+	Uint i;
+
+	if (n > AG_NET_BSD_IOV_MAX) {
+		n = AG_NET_BSD_IOV_MAX;
+	}
+	for (i = 0; i < n; i++) {
+		iov[i].iov_base = v[i].p;
+		iov[i].iov_len = v[i].len;
+	}
+	return ((int)n);
+}
+
+static int
+Readv(AG_NetSocket *ns, const AG_NetIOVec *v, Uint n, size_t *nRead)
+{
+	struct iovec iov[AG_NET_BSD_IOV_MAX];
+	ssize_t rv;
+
+	rv = readv(ns->fd, iov, GetIOVec(iov, v, n));
+	if (rv < 0) {
+		AG_SetError("readv: %s", strerror(errno));
+		return (-1);
+	}
+	if (nRead != NULL) { *nRead = (size_t)rv; }
+	return (0);
+}
+
+static int
+Writev(AG_NetSocket *ns, const AG_NetIOVec *v, Uint n, size_t *nWrote)
+{
+	struct iovec iov[AG_NET_BSD_IOV_MAX];
+	ssize_t rv;
+
+	rv = writev(ns->fd, iov, GetIOVec(iov, v, n));
+	if (rv < 0) {
+		AG_SetError("writev: %s", strerror(errno));
+		return (-1);
+	}
+	if (nWrote != NULL) { *nWrote = (size_t)rv; }
+	return (0);
+}
+
+static int
+RecvDgrams(AG_NetSocket *ns, AG_NetDgram *dg, Uint n, Uint flags, Uint *nRecvd)
+{
+#ifdef AG_NET_BSD_MMSG
+	struct mmsghdr msg[AG_NET_BSD_MMSG_MAX];
+	struct iovec iov[AG_NET_BSD_MMSG_MAX];
+	struct sockaddr_storage sa[AG_NET_BSD_MMSG_MAX];
+	Uint i;
+	int rv;
+
+	if (n > AG_NET_BSD_MMSG_MAX) {
+		n = AG_NET_BSD_MMSG_MAX;
+	}
+	memset(msg, 0, n*sizeof(struct mmsghdr));
+	for (i = 0; i < n; i++) {
+		struct msghdr *hdr = &msg[i].msg_hdr;
+
+		iov[i].iov_base = dg[i].p;
+		iov[i].iov_len = dg[i].size;
+		hdr->msg_iov = &iov[i];
+		hdr->msg_iovlen = 1;
+		if (dg[i].addr != NULL) {
+			hdr->msg_name = &sa[i];
+			hdr->msg_namelen = sizeof(struct sockaddr_storage);
+		}
+	}
+	rv = recvmmsg(ns->fd, msg, n,
+	    (flags & AG_NET_DGRAM_NOWAIT) ? MSG_DONTWAIT : MSG_WAITFORONE,
+	    NULL);
+	if (rv < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			rv = 0;
+			goto out;
+		}
+		AG_SetError("recvmmsg: %s", strerror(errno));
+		return (-1);
+	}
+	for (i = 0; i < (Uint)rv; i++) {
+		dg[i].len = (size_t)msg[i].msg_len;
+		dg[i].flags = (msg[i].msg_hdr.msg_flags & MSG_TRUNC) ?
+		              AG_NET_DGRAM_TRUNCATED : 0;
+		if (dg[i].addr != NULL)
+			SockAddrToNetAddrIn(dg[i].addr, &sa[i]);
+	}
+out:
+	if (nRecvd != NULL) { *nRecvd = (Uint)rv; }
+	return (0);
+#else /* !AG_NET_BSD_MMSG */
+	struct sockaddr_storage sa;
+	struct msghdr hdr;
+	struct iovec iov;
+	ssize_t rv;
+	Uint i;
+	int sockFlags = 0;
+
+# ifdef MSG_DONTWAIT
+	if (flags & AG_NET_DGRAM_NOWAIT)
+		sockFlags |= MSG_DONTWAIT;
+# endif
+	for (i = 0; i < n; i++) {
+		/* Use recvmsg(2) for MSG_TRUNC in msg_flags. */
+		memset(&hdr, 0, sizeof(hdr));
+		iov.iov_base = dg[i].p;
+		iov.iov_len = dg[i].size;
+		hdr.msg_iov = &iov;
+		hdr.msg_iovlen = 1;
+		if (dg[i].addr != NULL) {
+			hdr.msg_name = &sa;
+			hdr.msg_namelen = sizeof(struct sockaddr_storage);
+		}
+		if ((rv = recvmsg(ns->fd, &hdr, sockFlags)) < 0) {
+			if (i > 0 || errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			AG_SetError("recvmsg: %s", strerror(errno));
+			return (-1);
+		}
+		dg[i].len = (size_t)rv;
+		dg[i].flags = (hdr.msg_flags & MSG_TRUNC) ?
+		              AG_NET_DGRAM_TRUNCATED : 0;
+		if (dg[i].addr != NULL) {
+			SockAddrToNetAddrIn(dg[i].addr, &sa);
+		}
+# ifdef MSG_DONTWAIT
+		sockFlags |= MSG_DONTWAIT;	/* Only wait for the first */
+# else
+		i++;
+		break;
+# endif
+	}
+	if (nRecvd != NULL) { *nRecvd = i; }
+	return (0);
+#endif /* AG_NET_BSD_MMSG */
+}
+
+static int
+SendDgrams(AG_NetSocket *ns, AG_NetDgram *dg, Uint n, Uint *nSent)
+{
+#ifdef AG_NET_BSD_MMSG
+	struct mmsghdr msg[AG_NET_BSD_MMSG_MAX];
+	struct iovec iov[AG_NET_BSD_MMSG_MAX];
+	struct sockaddr_storage sa[AG_NET_BSD_MMSG_MAX];
+	Uint i, nBatch, sent = 0;
+	int rv;
+
+	while (sent < n) {
+		nBatch = n - sent;
+		if (nBatch > AG_NET_BSD_MMSG_MAX)
+			nBatch = AG_NET_BSD_MMSG_MAX;
+		memset(msg, 0, nBatch*sizeof(struct mmsghdr));
+		for (i = 0; i < nBatch; i++) {
+			const AG_NetDgram *d = &dg[sent+i];
+			struct msghdr *hdr = &msg[i].msg_hdr;
+
+			iov[i].iov_base = d->p;
+			iov[i].iov_len = d->len;
+			hdr->msg_iov = &iov[i];
+			hdr->msg_iovlen = 1;
+			if (d->addr != NULL) {
+				socklen_t saLen = 0;
+
+				NetAddrToSockAddr(d->addr, &sa[i], &saLen);
+				hdr->msg_name = &sa[i];
+				hdr->msg_namelen = saLen;
+			}
+		}
+		if ((rv = sendmmsg(ns->fd, msg, nBatch, 0)) < 0) {
+			if (sent > 0) {
+				break;
+			}
+			AG_SetError("sendmmsg: %s", strerror(errno));
+			return (-1);
+		}
+		sent += (Uint)rv;
+		if ((Uint)rv < nBatch)
+			break;
+	}
+	if (nSent != NULL) { *nSent = sent; }
+	return (0);
+#else /* !AG_NET_BSD_MMSG */
+	struct sockaddr_storage sa;
+	socklen_t saLen;
+	Uint i;
+
+	for (i = 0; i < n; i++) {
+		saLen = 0;
+		if (dg[i].addr != NULL) {
+			NetAddrToSockAddr(dg[i].addr, &sa, &saLen);
+		}
+		if (sendto(ns->fd, dg[i].p, dg[i].len, 0,
+		    (dg[i].addr != NULL) ? (struct sockaddr *)&sa : NULL,
+		    saLen) < 0) {
+			if (i > 0) {
+				break;
+			}
+			AG_SetError("sendto: %s", strerror(errno));
+			return (-1);
+		}
+	}
+	if (nSent != NULL) { *nSent = i; }
+	return (0);
+#endif /* AG_NET_BSD_MMSG */
+}
+
 static void
 Close(AG_NetSocket *ns)
 {
@@ -775,5 +1051,9 @@ const AG_NetOps agNetOps_bsd = {
 	Accept,
 	Read,
 	Write,
+	Readv,
+	Writev,
+	RecvDgrams,
+	SendDgrams,
 	Close
 };
@@ -129,5 +129,9 @@ const AG_NetOps agNetOps_dummy = {
 	Accept,
 	Read,
 	Write,
+	NULL,			/* readv */
+	NULL,			/* writev */
+	NULL,			/* recvDgrams */
+	NULL,			/* sendDgrams */
 	Close
 };
@@ -0,0 +1,862 @@
+/*
+ * Copyright (c) 2026 Hypertriton, Inc. <http://hypertriton.com/>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Caching resolver for AG_NetResolve() and AG_NetResolveAsync().
+ *
+ * Results from the network backend are kept in a cache for a bounded time
+ * (negative results for a shorter time). Asynchronous requests are serviced
+ * by a small pool of worker threads; concurrent requests for the same name
+ * share a single lookup. Completions are delivered from the event loop by
+ * way of a pipe registered as an AG_SINK_READ event sink.
+ */
+
+#include <agar/core/core.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#ifndef _WIN32
+# include <unistd.h>
+# include <fcntl.h>
+# define AG_NET_RESOLVER_PIPE
+#endif
+
+#define AG_NET_RESOLVER_BUCKETS	64		/* Cache hash buckets */
+#define AG_NET_RESOLVER_THREADS	2		/* Worker threads */
+
+enum ag_net_resolver_ent_state {
+	AG_NET_RESOLVER_PENDING,		/* Lookup in progress */
+	AG_NET_RESOLVER_POSITIVE,		/* Cached addresses */
+	AG_NET_RESOLVER_NEGATIVE		/* Cached failure */
+};
+
+/* Asynchronous request awaiting completion. */
+typedef struct ag_net_resolver_req {
+	AG_EventFn fn;				/* Completion callback */
+	AG_Event ev;				/* Callback arguments */
+	AG_NetAddrList *nal;			/* Result (or NULL) */
+	char *errMsg;				/* Error message */
+	char *host, *port;
+	AG_TAILQ_ENTRY(ag_net_resolver_req) reqs;
+} AG_NetResolverReq;
+
+/* Cache entry. */
+typedef struct ag_net_resolver_ent {
+	char *host;				/* Hostname (or NULL) */
+	char *port;				/* Port (or NULL) */
+	Uint flags;				/* AG_NetResolve() flags */
+	Uint32 hash;
+	enum ag_net_resolver_ent_state state;
+	Uint32 expire;				/* Expiration (ticks) */
+	AG_NetAddrList addrs;			/* Cached addresses */
+	char *errMsg;				/* Cached error message */
+	AG_TAILQ_HEAD_(ag_net_resolver_req) waiters;
+	AG_TAILQ_ENTRY(ag_net_resolver_ent) bucket;
+	AG_TAILQ_ENTRY(ag_net_resolver_ent) lru;
+	AG_TAILQ_ENTRY(ag_net_resolver_ent) jobs;
+} AG_NetResolverEnt;
+
+/* Entry from the hosts file. */
+typedef struct ag_net_resolver_host {
+	char *name;
+	char *addr;
+	AG_TAILQ_ENTRY(ag_net_resolver_host) hosts;
+} AG_NetResolverHost;
+
+static int         rsInited = 0;
+static int         rsDestroyed = 0;		/* AG_NetResolverDestroy() called */
+static AG_Mutex    rsLock;
+static Uint32      rsTTL = 60000;		/* Positive TTL (ms) */
+static Uint32      rsNegTTL = 5000;		/* Negative TTL (ms) */
+static Uint        rsMaxEnts = 256;		/* Cache size limit */
+static Uint        rsNumEnts = 0;
+static int         rsLoopback = 0;		/* Loopback stub mode */
+static AG_TAILQ_HEAD_(ag_net_resolver_ent) rsBuckets[AG_NET_RESOLVER_BUCKETS];
+static AG_TAILQ_HEAD_(ag_net_resolver_ent) rsLRU;
+static AG_TAILQ_HEAD_(ag_net_resolver_ent) rsJobs;
+static AG_TAILQ_HEAD_(ag_net_resolver_req) rsDone;
+static AG_TAILQ_HEAD_(ag_net_resolver_host) rsHosts;
+#ifdef AG_THREADS
+static AG_Cond     rsCond;
+static AG_Thread   rsThreads[AG_NET_RESOLVER_THREADS];
+static int         rsNumThreads = 0;
+static int         rsQuit = 0;
+#endif
+#ifdef AG_NET_RESOLVER_PIPE
+static int         rsPipe[2] = { -1, -1 };
+static AG_EventSink *rsSink = NULL;
+#endif
+
+static Uint32
+HashKey(const char *host, const char *port, Uint flags)
+{
+	Uint32 h = 2166136261U;
+	const char *c;
+
+	for (c = (host != NULL) ? host : ""; *c != '\0'; c++) {
+		h = (h ^ (Uint8)*c) * 16777619U;
+	}
+	h = (h ^ 0xff) * 16777619U;
+	for (c = (port != NULL) ? port : ""; *c != '\0'; c++) {
+		h = (h ^ (Uint8)*c) * 16777619U;
+	}
+	return (h ^ flags);
+}
+
+static __inline__ int
+StrEq(const char *a, const char *b)
+{
+	if (a == NULL || b == NULL) {
+		return (a == b);
+	}
+	return (strcmp(a, b) == 0);
+}
+
+/* Append copies of the addresses in one list to another. */
+static int
+CopyAddrList(AG_NetAddrList *dst, const AG_NetAddrList *src)
+{
+	AG_NetAddr *na, *naDup;
+
+	TAILQ_FOREACH(na, src, addrs) {
+		if ((naDup = AG_NetAddrDup(na)) == NULL) {
+			return (-1);
+		}
+		TAILQ_INSERT_TAIL(dst, naDup, addrs);
+	}
+	return (0);
+}
+
+static void
+FreeEnt(AG_NetResolverEnt *ent)
+{
+	AG_NetAddrListClear(&ent->addrs);
+	Free(ent->errMsg);
+	Free(ent->host);
+	Free(ent->port);
+	free(ent);
+}
+
+/* Remove a (non-pending) entry from the cache. The resolver must be locked. */
+static void
+RemoveEnt(AG_NetResolverEnt *ent)
+{
+	TAILQ_REMOVE(&rsBuckets[ent->hash % AG_NET_RESOLVER_BUCKETS], ent,
+	    bucket);
+	TAILQ_REMOVE(&rsLRU, ent, lru);
+	rsNumEnts--;
+	FreeEnt(ent);
+}
+
+/*
+ * Look up a cache entry, removing it if it has expired. Hits are moved
+ * to the tail of the LRU list. The resolver must be locked.
+ */
+static AG_NetResolverEnt *
+FindEnt(const char *host, const char *port, Uint flags, Uint32 hash)
+{
+	AG_NetResolverEnt *ent;
+
+	TAILQ_FOREACH(ent, &rsBuckets[hash % AG_NET_RESOLVER_BUCKETS], bucket) {
+		if (ent->hash == hash && ent->flags == flags &&
+		    StrEq(ent->host, host) && StrEq(ent->port, port))
+			break;
+	}
+	if (ent == NULL) {
+		return (NULL);
+	}
+	if (ent->state != AG_NET_RESOLVER_PENDING &&
+	    (Sint32)(ent->expire - AG_GetTicks()) <= 0) {
+		RemoveEnt(ent);
+		return (NULL);
+	}
+	TAILQ_REMOVE(&rsLRU, ent, lru);
+	TAILQ_INSERT_TAIL(&rsLRU, ent, lru);
+	return (ent);
+}
+
+/* Create a pending cache entry. The resolver must be locked. */
+static AG_NetResolverEnt *
+CreateEnt(const char *host, const char *port, Uint flags, Uint32 hash)
+{
+	AG_NetResolverEnt *ent, *entOld, *entNext;
+
+	/* Evict least recently used entries beyond the size limit. */
+	for (entOld = TAILQ_FIRST(&rsLRU);
+	     entOld != TAILQ_END(&rsLRU) && rsNumEnts >= rsMaxEnts;
+	     entOld = entNext) {
+		entNext = TAILQ_NEXT(entOld, lru);
+		if (entOld->state != AG_NET_RESOLVER_PENDING)
+			RemoveEnt(entOld);
+	}
+
+	if ((ent = TryMalloc(sizeof(AG_NetResolverEnt))) == NULL) {
+		return (NULL);
+	}
+	ent->host = NULL;
+	ent->port = NULL;
+	if ((host != NULL && (ent->host = TryStrdup(host)) == NULL) ||
+	    (port != NULL && (ent->port = TryStrdup(port)) == NULL)) {
+		Free(ent->host);
+		free(ent);
+		return (NULL);
+	}
+	ent->flags = flags;
+	ent->hash = hash;
+	ent->state = AG_NET_RESOLVER_PENDING;
+	ent->expire = 0;
+	ent->errMsg = NULL;
+	TAILQ_INIT(&ent->addrs);
+	TAILQ_INIT(&ent->waiters);
+
+	TAILQ_INSERT_TAIL(&rsBuckets[hash % AG_NET_RESOLVER_BUCKETS], ent,
+	    bucket);
+	TAILQ_INSERT_TAIL(&rsLRU, ent, lru);
+	rsNumEnts++;
+	return (ent);
+}
+
+/*
+ * Resolve against the hosts file or the loopback stub, if applicable.
+ * Returns 1 if the name was handled, 0 if it was not, -1 on failure.
+ * The resolver must be locked.
+ */
+static int
+ResolveLocal(AG_NetAddrList *nal, const char *host, const char *port)
+{
+	AG_NetResolverHost *rh;
+	int found = 0;
+
+	if (host == NULL) {
+		return (0);
+	}
+	TAILQ_FOREACH(rh, &rsHosts, hosts) {
+		if (AG_Strcasecmp(rh->name, host) != 0) {
+			continue;
+		}
+		if (agNetOps->resolve(nal, rh->addr, port,
+		    AG_NET_NUMERIC_HOST) == -1) {
+			return (-1);
+		}
+		found = 1;
+	}
+	if (!found && rsLoopback) {
+		if (agNetOps->resolve(nal, "127.0.0.1", port,
+		    AG_NET_NUMERIC_HOST) == -1) {
+			return (-1);
+		}
+		found = 1;
+	}
+	return (found);
+}
+
+/* Queue a request for completion. The resolver must be locked. */
+static void
+QueueDone(AG_NetResolverReq *req)
+{
+	TAILQ_INSERT_TAIL(&rsDone, req, reqs);
+#ifdef AG_NET_RESOLVER_PIPE
+	if (rsPipe[1] != -1) {
+		char c = 0;
+		(void)write(rsPipe[1], &c, 1);
+	}
+#endif
+}
+
+/*
+ * Complete the requests waiting on a resolved entry, giving each its
+ * own copy of the result. The resolver must be locked.
+ */
+static void
+CompleteWaiters(AG_NetResolverEnt *ent)
+{
+	AG_NetResolverReq *req;
+
+	while ((req = TAILQ_FIRST(&ent->waiters)) != NULL) {
+		TAILQ_REMOVE(&ent->waiters, req, reqs);
+		if (ent->state == AG_NET_RESOLVER_POSITIVE &&
+		    (req->nal = AG_NetAddrListNew()) != NULL &&
+		    CopyAddrList(req->nal, &ent->addrs) == -1) {
+			AG_NetAddrListFree(req->nal);
+			req->nal = NULL;
+		}
+		if (req->nal == NULL) {
+			req->errMsg = TryStrdup((ent->errMsg != NULL) ?
+			    ent->errMsg : AG_GetError());
+		}
+		QueueDone(req);
+	}
+}
+
+/*
+ * Record the result of a lookup into a pending entry (taking over the
+ * addresses in nal, or caching errMsg if nal is NULL), and complete any
+ * waiting requests. The resolver must be locked.
+ */
+static void
+CompleteEnt(AG_NetResolverEnt *ent, AG_NetAddrList *nal, const char *errMsg)
+{
+	AG_NetAddr *na;
+
+	if (nal != NULL) {
+		ent->state = AG_NET_RESOLVER_POSITIVE;
+		while ((na = TAILQ_FIRST(nal)) != NULL) {
+			TAILQ_REMOVE(nal, na, addrs);
+			TAILQ_INSERT_TAIL(&ent->addrs, na, addrs);
+		}
+		ent->expire = AG_GetTicks() + rsTTL;
+	} else {
+		ent->state = AG_NET_RESOLVER_NEGATIVE;
+		ent->errMsg = TryStrdup(errMsg);
+		ent->expire = AG_GetTicks() + rsNegTTL;
+	}
+	CompleteWaiters(ent);
+}
+
+/* Perform a lookup for a pending entry. The resolver must be locked. */
+static void
+LookupEnt(AG_NetResolverEnt *ent)
+{
+	AG_NetAddrList nal;
+	char *host = ent->host, *port = ent->port;
+	Uint flags = ent->flags;
+	int rv;
+
+	TAILQ_INIT(&nal);
+	if ((rv = ResolveLocal(&nal, host, port)) == 0) {
+		AG_MutexUnlock(&rsLock);
+		rv = agNetOps->resolve(&nal, host, port, flags);
+		AG_MutexLock(&rsLock);
+	}
+	if (rv == -1) {
+		AG_NetAddrListClear(&nal);
+		CompleteEnt(ent, NULL, AG_GetError());
+	} else {
+		CompleteEnt(ent, &nal, NULL);
+	}
+}
+
+#ifdef AG_THREADS
+/* Worker thread servicing asynchronous lookups. */
+static void *
+ResolverThread(void *arg)
+{
+	AG_NetResolverEnt *ent;
+
+	AG_MutexLock(&rsLock);
+	for (;;) {
+		while (!rsQuit && TAILQ_EMPTY(&rsJobs)) {
+			AG_CondWait(&rsCond, &rsLock);
+		}
+		if (rsQuit) {
+			break;
+		}
+		ent = TAILQ_FIRST(&rsJobs);
+		TAILQ_REMOVE(&rsJobs, ent, jobs);
+		LookupEnt(ent);
+	}
+	AG_MutexUnlock(&rsLock);
+	return (NULL);
+}
+#endif /* AG_THREADS */
+
+#ifdef AG_NET_RESOLVER_PIPE
+/* Deliver completions from the event loop. */
+static int
+ResolverSink(AG_EventSink *es, AG_Event *event)
+{
+	char buf[64];
+
+	while (read(rsPipe[0], buf, sizeof(buf)) > 0)
+		;;
+	(void)AG_NetResolveProcess();
+	return (0);
+}
+#endif
+
+/* Initialize the resolver. */
+void
+AG_NetResolverInit(void)
+{
+	Uint i;
+
+	if (rsInited) {
+		return;
+	}
+	AG_MutexInitRecursive(&rsLock);
+	for (i = 0; i < AG_NET_RESOLVER_BUCKETS; i++) {
+		TAILQ_INIT(&rsBuckets[i]);
+	}
+	TAILQ_INIT(&rsLRU);
+	TAILQ_INIT(&rsJobs);
+	TAILQ_INIT(&rsDone);
+	TAILQ_INIT(&rsHosts);
+	rsNumEnts = 0;
+#ifdef AG_THREADS
+	AG_CondInit(&rsCond);
+	rsNumThreads = 0;
+	rsQuit = 0;
+#endif
+	rsInited = 1;
+	rsDestroyed = 0;
+}
+
+static void
+FreeReq(AG_NetResolverReq *req)
+{
+	if (req->nal != NULL) {
+		AG_NetAddrListFree(req->nal);
+	}
+	Free(req->errMsg);
+	Free(req->host);
+	Free(req->port);
+	free(req);
+}
+
+/* Release all resources allocated by the resolver. */
+void
+AG_NetResolverDestroy(void)
+{
+	AG_NetResolverEnt *ent, *entNext;
+	AG_NetResolverReq *req, *reqNext;
+#ifdef AG_THREADS
+	int i;
+#endif
+
+	if (!rsInited) {
+		return;
+	}
+#ifdef AG_THREADS
+	AG_MutexLock(&rsLock);
+	rsQuit = 1;
+	AG_CondBroadcast(&rsCond);
+	AG_MutexUnlock(&rsLock);
+	for (i = 0; i < rsNumThreads; i++) {
+		AG_ThreadJoin(rsThreads[i], NULL);
+	}
+	rsNumThreads = 0;
+	AG_CondDestroy(&rsCond);
+#endif
+#ifdef AG_NET_RESOLVER_PIPE
+	if (rsSink != NULL) {
+		AG_DelEventSink(rsSink);
+		rsSink = NULL;
+	}
+	if (rsPipe[0] != -1) {
+		close(rsPipe[0]);
+		close(rsPipe[1]);
+		rsPipe[0] = rsPipe[1] = -1;
+	}
+#endif
+	for (ent = TAILQ_FIRST(&rsLRU);
+	     ent != TAILQ_END(&rsLRU);
+	     ent = entNext) {
+		entNext = TAILQ_NEXT(ent, lru);
+		for (req = TAILQ_FIRST(&ent->waiters);
+		     req != TAILQ_END(&ent->waiters);
+		     req = reqNext) {
+			reqNext = TAILQ_NEXT(req, reqs);
+			FreeReq(req);
+		}
+		FreeEnt(ent);
+	}
+	for (req = TAILQ_FIRST(&rsDone);
+	     req != TAILQ_END(&rsDone);
+	     req = reqNext) {
+		reqNext = TAILQ_NEXT(req, reqs);
+		FreeReq(req);
+	}
+	(void)AG_NetResolverSetHostsFile(NULL);
+	AG_MutexDestroy(&rsLock);
+	rsInited = 0;
+	rsDestroyed = 1;
+}
+
+/*
+ * Resolve a hostname and port, consulting the cache first.
+ * Called by AG_NetResolve().
+ */
+int
+AG_NetResolverLookup(AG_NetAddrList *nal, const char *host, const char *port,
+    Uint flags)
+{
+	AG_NetResolverEnt *ent;
+	Uint32 hash = HashKey(host, port, flags);
+	int rv;
+
+	AG_MutexLock(&rsLock);
+	if ((rv = ResolveLocal(nal, host, port)) != 0) {
+		AG_MutexUnlock(&rsLock);
+		return (rv == -1 ? -1 : 0);
+	}
+	if ((ent = FindEnt(host, port, flags, hash)) != NULL) {
+		switch (ent->state) {
+		case AG_NET_RESOLVER_POSITIVE:
+			rv = CopyAddrList(nal, &ent->addrs);
+			AG_MutexUnlock(&rsLock);
+			return (rv);
+		case AG_NET_RESOLVER_NEGATIVE:
+			AG_SetErrorS(ent->errMsg != NULL ? ent->errMsg :
+			                                   _("Lookup failed"));
+			AG_MutexUnlock(&rsLock);
+			return (-1);
+		default:
+			break;
+		}
+	}
+	AG_MutexUnlock(&rsLock);
+
+	if (agNetOps->resolve(nal, host, port, flags) == -1) {
+		rv = -1;
+	}
+	if ((rv == 0 && rsTTL == 0) ||
+	    (rv == -1 && rsNegTTL == 0)) {
+		return (rv);
+	}
+
+	AG_MutexLock(&rsLock);
+	if (FindEnt(host, port, flags, hash) == NULL &&
+	    (ent = CreateEnt(host, port, flags, hash)) != NULL) {
+		if (rv == 0) {
+			AG_NetAddrList nalCopy;
+
+			TAILQ_INIT(&nalCopy);
+			if (CopyAddrList(&nalCopy, nal) == 0) {
+				CompleteEnt(ent, &nalCopy, NULL);
+			} else {
+				AG_NetAddrListClear(&nalCopy);
+				RemoveEnt(ent);
+			}
+		} else {
+			CompleteEnt(ent, NULL, AG_GetError());
+		}
+	}
+	AG_MutexUnlock(&rsLock);
+	return (rv);
+}
+
+/*
+ * Resolve the specified hostname and port asynchronously. On completion,
+ * fn is invoked from the event loop with the given arguments, followed by
+ * the named arguments "addrs" (an AG_NetAddrList which fn must free, or
+ * NULL on failure), "error" (error message, or NULL), "host" and "port".
+ */
+int
+AG_NetResolveAsync(const char *host, const char *port, Uint flags,
+    AG_EventFn fn, const char *fmt, ...)
+{
+	AG_NetResolverReq *req;
+	AG_NetResolverEnt *ent;
+	Uint32 hash = HashKey(host, port, flags);
+	int rv;
+
+	if ((req = TryMalloc(sizeof(AG_NetResolverReq))) == NULL) {
+		return (-1);
+	}
+	req->fn = fn;
+	req->nal = NULL;
+	req->errMsg = NULL;
+	req->host = NULL;
+	req->port = NULL;
+	if ((host != NULL && (req->host = TryStrdup(host)) == NULL) ||
+	    (port != NULL && (req->port = TryStrdup(port)) == NULL)) {
+		FreeReq(req);
+		return (-1);
+	}
+	AG_EventInit(&req->ev);
+	AG_EVENT_GET_ARGS(&req->ev, fmt);
+	req->ev.argc0 = req->ev.argc;
+
+	AG_MutexLock(&rsLock);
+#ifdef AG_NET_RESOLVER_PIPE
+	if (rsPipe[0] == -1) {
+		AG_EventSource *src = AG_GetEventSource();
+
+		if (pipe(rsPipe) == -1) {
+			AG_SetError("pipe: %s", strerror(errno));
+			goto fail;
+		}
+		fcntl(rsPipe[0], F_SETFL, O_NONBLOCK);
+		fcntl(rsPipe[1], F_SETFL, O_NONBLOCK);
+		if (src->caps[AG_SINK_READ]) {
+			rsSink = AG_AddEventSink(AG_SINK_READ, rsPipe[0], 0,
+			    ResolverSink, NULL);
+		}
+	}
+#endif
+	/* Names from the hosts file or stub complete immediately. */
+	if ((req->nal = AG_NetAddrListNew()) == NULL) {
+		goto fail;
+	}
+	if ((rv = ResolveLocal(req->nal, host, port)) != 0) {
+		if (rv == -1) {
+			AG_NetAddrListFree(req->nal);
+			req->nal = NULL;
+			req->errMsg = TryStrdup(AG_GetError());
+		}
+		QueueDone(req);
+		goto out;
+	}
+	AG_NetAddrListFree(req->nal);
+	req->nal = NULL;
+
+	if ((ent = FindEnt(host, port, flags, hash)) != NULL) {
+		TAILQ_INSERT_TAIL(&ent->waiters, req, reqs);
+		if (ent->state != AG_NET_RESOLVER_PENDING) {
+			CompleteWaiters(ent);		/* Cache hit */
+		}
+		goto out;
+	}
+	if ((ent = CreateEnt(host, port, flags, hash)) == NULL) {
+		goto fail;
+	}
+	TAILQ_INSERT_TAIL(&ent->waiters, req, reqs);
+#ifdef AG_THREADS
+	TAILQ_INSERT_TAIL(&rsJobs, ent, jobs);
+	if (rsNumThreads < AG_NET_RESOLVER_THREADS) {
+		if (AG_ThreadTryCreate(&rsThreads[rsNumThreads],
+		    ResolverThread, NULL) == 0)
+			rsNumThreads++;
+	}
+	if (rsNumThreads == 0) {
+		TAILQ_REMOVE(&rsJobs, ent, jobs);
+		LookupEnt(ent);
+	} else {
+		AG_CondSignal(&rsCond);
+	}
+#else
+	LookupEnt(ent);
+#endif
+out:
+	AG_MutexUnlock(&rsLock);
+	return (0);
+fail:
+	AG_MutexUnlock(&rsLock);
+	FreeReq(req);
+	return (-1);
+}
+
+/*
+ * Invoke the callbacks of completed asynchronous requests. This is done
+ * automatically by the event loop; applications which do not use
+ * AG_EventLoop(3) may call it periodically. Returns the number of
+ * completions delivered.
+ */
+int
+AG_NetResolveProcess(void)
+{
+	AG_TAILQ_HEAD_(ag_net_resolver_req) done;
+	AG_NetResolverReq *req, *reqNext;
+	int count = 0;
+
+	TAILQ_INIT(&done);
+	AG_MutexLock(&rsLock);
+	while ((req = TAILQ_FIRST(&rsDone)) != NULL) {
+		TAILQ_REMOVE(&rsDone, req, reqs);
+		TAILQ_INSERT_TAIL(&done, req, reqs);
+	}
+	AG_MutexUnlock(&rsLock);
+
+	for (req = TAILQ_FIRST(&done);
+	     req != TAILQ_END(&done);
+	     req = reqNext) {
+		reqNext = TAILQ_NEXT(req, reqs);
+		AG_EventPushPointer(&req->ev, "addrs", req->nal);
+		AG_EventPushString(&req->ev, "error", req->errMsg);
+		AG_EventPushString(&req->ev, "host", req->host);
+		AG_EventPushString(&req->ev, "port", req->port);
+		req->nal = NULL;			/* Handed over to fn */
+		if (req->fn != NULL) {
+			req->fn(&req->ev);
+		}
+		FreeReq(req);
+		count++;
+	}
+	return (count);
+}
+
+/*
+ * Lock the resolver for updating a setting. Settings may be changed before
+ * AG_NetResolverInit() (rsLock does not exist yet, so they are set without
+ * locking); after AG_NetResolverDestroy(), they are ignored.
+ */
+static __inline__ int
+LockSettings(void)
+{
+	if (rsDestroyed) {
+		return (-1);
+	}
+	if (rsInited) {
+		AG_MutexLock(&rsLock);
+	}
+	return (0);
+}
+
+static __inline__ void
+UnlockSettings(void)
+{
+	if (rsInited)
+		AG_MutexUnlock(&rsLock);
+}
+
+/*
+ * Set the time (in milliseconds) for which successful and failed lookups
+ * are cached. A value of 0 disables caching.
+ */
+void
+AG_NetResolverSetTTL(Uint32 ttl, Uint32 negTTL)
+{
+	if (LockSettings() == -1) {
+		return;
+	}
+	rsTTL = ttl;
+	rsNegTTL = negTTL;
+	UnlockSettings();
+}
+
+/* Set the maximum number of cache entries. */
+void
+AG_NetResolverSetCacheSize(Uint maxEnts)
+{
+	if (LockSettings() == -1) {
+		return;
+	}
+	rsMaxEnts = maxEnts;
+	UnlockSettings();
+}
+
+/* Discard all cached results. */
+void
+AG_NetResolverClearCache(void)
+{
+	AG_NetResolverEnt *ent, *entNext;
+
+	if (!rsInited) {			/* Nothing cached */
+		return;
+	}
+	AG_MutexLock(&rsLock);
+	for (ent = TAILQ_FIRST(&rsLRU);
+	     ent != TAILQ_END(&rsLRU);
+	     ent = entNext) {
+		entNext = TAILQ_NEXT(ent, lru);
+		if (ent->state != AG_NET_RESOLVER_PENDING)
+			RemoveEnt(ent);
+	}
+	AG_MutexUnlock(&rsLock);
+}
+
+/*
+ * Enable or disable the loopback stub. In this mode, any name not found
+ * in the hosts file resolves to 127.0.0.1 (intended for testing).
+ */
+void
+AG_NetResolverSetLoopback(int enable)
+{
+	if (LockSettings() == -1) {
+		return;
+	}
+	rsLoopback = enable;
+	UnlockSettings();
+}
+
+/*
+ * Load static name to address mappings from a file in hosts(5) format.
+ * Names found there are resolved without consulting the network backend.
+ * If path is NULL, clear the existing mappings.
+ */
+int
+AG_NetResolverSetHostsFile(const char *path)
+{
+	AG_TAILQ_HEAD_(ag_net_resolver_host) hostsNew;
+	AG_NetResolverHost *rh, *rhNext;
+	char buf[1024], *s, *addr, *name;
+	FILE *f = NULL;
+
+	if (!rsInited) {
+		AG_SetErrorS("Resolver is not initialized");
+		return (-1);
+	}
+	TAILQ_INIT(&hostsNew);
+	if (path != NULL) {
+		if ((f = fopen(path, "r")) == NULL) {
+			AG_SetError("%s: %s", path, strerror(errno));
+			return (-1);
+		}
+		while (fgets(buf, sizeof(buf), f) != NULL) {
+			if ((s = strchr(buf, '#')) != NULL) {
+				*s = '\0';
+			}
+			s = buf;
+			if ((addr = Strsep(&s, " \t\r\n")) == NULL ||
+			    addr[0] == '\0') {
+				continue;
+			}
+			while ((name = Strsep(&s, " \t\r\n")) != NULL) {
+				if (name[0] == '\0') {
+					continue;
+				}
+				if ((rh = TryMalloc(sizeof(AG_NetResolverHost))) == NULL) {
+					goto fail;
+				}
+				rh->name = TryStrdup(name);
+				rh->addr = TryStrdup(addr);
+				TAILQ_INSERT_TAIL(&hostsNew, rh, hosts);
+				if (rh->name == NULL || rh->addr == NULL)
+					goto fail;
+			}
+		}
+		fclose(f);
+		f = NULL;
+	}
+
+	AG_MutexLock(&rsLock);
+	for (rh = TAILQ_FIRST(&rsHosts);
+	     rh != TAILQ_END(&rsHosts);
+	     rh = rhNext) {
+		rhNext = TAILQ_NEXT(rh, hosts);
+		Free(rh->name);
+		Free(rh->addr);
+		free(rh);
+	}
+	TAILQ_INIT(&rsHosts);
+	while ((rh = TAILQ_FIRST(&hostsNew)) != NULL) {
+		TAILQ_REMOVE(&hostsNew, rh, hosts);
+		TAILQ_INSERT_TAIL(&rsHosts, rh, hosts);
+	}
+	AG_MutexUnlock(&rsLock);
+	return (0);
+fail:
+	for (rh = TAILQ_FIRST(&hostsNew);
+	     rh != TAILQ_END(&hostsNew);
+	     rh = rhNext) {
+		rhNext = TAILQ_NEXT(rh, hosts);
+		Free(rh->name);
+		Free(rh->addr);
+		free(rh);
+	}
+	if (f != NULL) { fclose(f); }
+	return (-1);
+}
@@ -591,5 +591,9 @@ const AG_NetOps agNetOps_winsock1 = {
 	Accept,
 	Read,
 	Write,
+	NULL,			/* readv */
+	NULL,			/* writev */
+	NULL,			/* recvDgrams */
+	NULL,			/* sendDgrams */
 	Close
 };
@@ -660,5 +660,9 @@ const AG_NetOps agNetOps_winsock2 = {
 	Accept,
 	Read,
 	Write,
+	NULL,			/* readv */
+	NULL,			/* writev */
+	NULL,			/* recvDgrams */
+	NULL,			/* sendDgrams */
 	Close
 };
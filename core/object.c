@@ -56,6 +56,22 @@ int agObjectIgnoreDataErrors = 0;  /* Don't fail on a data load failure. */
 int agObjectIgnoreUnknownObjs = 0; /* Don't fail on unknown object types. */
 int agObjectBackups = 1;	   /* Backup object save files. */
 
+#ifdef AG_THREADS
+/* VFS lock acquired by a thread, and the object it was acquired through. */
+typedef struct ag_object_vfs_locked {
+	AG_Object *ob;
+	AG_RWLock *rw;
+} AG_ObjectVFSLocked;
+
+/* VFS locks held by a thread, in acquisition order. */
+typedef struct ag_object_vfs_held {
+	AG_ObjectVFSLocked *ents;
+	Uint n, nMax;
+} AG_ObjectVFSHeld;
+
+static AG_ThreadKey agObjectVFSKey;	/* VFS locks held (per thread) */
+#endif
+
 /* Initialize an AG_Object instance. */
 void
 AG_ObjectInit(void *p, void *cl)
@@ -79,6 +95,7 @@ AG_ObjectInit(void *p, void *cl)
 	ob->detachFn = NULL;
 
 	AG_MutexInitRecursive(&ob->lock);
+	ob->lockVFS = NULL;
 	
 	TAILQ_INIT(&ob->vars);
 	TAILQ_INIT(&ob->deps);
@@ -97,6 +114,135 @@ AG_ObjectInit(void *p, void *cl)
 	}
 }
 
+#ifdef AG_THREADS
+/*
+ * Create the VFS lock of a VFS root object. Invoked by AG_LockVFS() on
+ * first use; if another thread races us, its lock is returned.
+ */
+AG_RWLock *
+AG_ObjectNewVFSLock(void *p)
+{
+	AG_Object *root = p;
+	AG_RWLock *rw;
+
+	rw = Malloc(sizeof(AG_RWLock));
+	AG_RWLockInit(rw);
+	if (!AG_AtomicCASPtr(&root->lockVFS, NULL, rw)) {
+		AG_RWLockDestroy(rw);
+		free(rw);
+		rw = AG_AtomicGetPtr(&root->lockVFS);
+	}
+	return (rw);
+}
+
+/* Release the list of VFS locks held by a thread. */
+static void
+FreeVFSHeld(void *p)
+{
+	AG_ObjectVFSHeld *vh = p;
+
+	Free(vh->ents);
+	free(vh);
+}
+
+/*
+ * Acquire the VFS lock of an object, for writing or reading. The lock is
+ * recorded along with the object, so that AG_ObjectUnlockVFS() releases
+ * the same lock even if the object was detached or moved to another VFS
+ * in the meantime (which only the calling thread can do).
+ */
+void
+AG_ObjectLockVFS(void *p, int wr)
+{
+	AG_Object *ob = p;
+	AG_ObjectVFSHeld *vh;
+	AG_RWLock *rw;
+
+	if ((vh = AG_ThreadKeyGet(agObjectVFSKey)) == NULL) {
+		vh = Malloc(sizeof(AG_ObjectVFSHeld));
+		vh->ents = NULL;
+		vh->n = 0;
+		vh->nMax = 0;
+		AG_ThreadKeySet(agObjectVFSKey, vh);
+	}
+	if (vh->n+1 > vh->nMax) {
+		vh->nMax += 8;
+		vh->ents = Realloc(vh->ents, vh->nMax*sizeof(AG_ObjectVFSLocked));
+	}
+	rw = AG_ObjectGetVFSLock(ob);
+	if (wr) {
+		AG_RWLockWrLock(rw);
+	} else {
+		AG_RWLockRdLock(rw);
+	}
+	vh->ents[vh->n].ob = ob;
+	vh->ents[vh->n].rw = rw;
+	vh->n++;
+}
+
+/* Release the VFS lock most recently acquired through an object. */
+void
+AG_ObjectUnlockVFS(void *p)
+{
+	AG_Object *ob = p;
+	AG_ObjectVFSHeld *vh;
+	AG_RWLock *rw;
+	Uint i;
+
+	if ((vh = AG_ThreadKeyGet(agObjectVFSKey)) == NULL) {
+		goto fail;
+	}
+	for (i = vh->n; i > 0; i--) {
+		if (vh->ents[i-1].ob == ob)
+			break;
+	}
+	if (i == 0) {
+		/* Locked through another object of the same VFS. */
+		rw = AG_ObjectGetVFSLock(ob);
+		for (i = vh->n; i > 0; i--) {
+			if (vh->ents[i-1].rw == rw)
+				break;
+		}
+		if (i == 0)
+			goto fail;
+	}
+	rw = vh->ents[i-1].rw;
+	if (i < vh->n) {
+		memmove(&vh->ents[i-1], &vh->ents[i],
+		    (vh->n - i)*sizeof(AG_ObjectVFSLocked));
+	}
+	vh->n--;
+	AG_RWLockUnlock(rw);
+	return;
+fail:
+	AG_FatalError("AG_UnlockVFS: VFS is not locked");
+}
+#endif /* AG_THREADS */
+
+int
+AG_InitObjectSubsystem(void)
+{
+#ifdef AG_THREADS
+	if (AG_ThreadKeyTryCreate(&agObjectVFSKey, FreeVFSHeld) == -1)
+		return (-1);
+#endif
+	return (0);
+}
+
+void
+AG_DestroyObjectSubsystem(void)
+{
+#ifdef AG_THREADS
+	AG_ObjectVFSHeld *vh;
+
+	if ((vh = AG_ThreadKeyGet(agObjectVFSKey)) != NULL) {
+		FreeVFSHeld(vh);
+		AG_ThreadKeySet(agObjectVFSKey, NULL);
+	}
+	AG_ThreadKeyDelete(agObjectVFSKey);
+#endif
+}
+
 /* Initialize an AG_Object instance (name argument variant). */
 void
 AG_ObjectInitNamed(void *obj, void *cl, const char *name)
@@ -247,7 +393,7 @@ AG_ObjectCopyName(void *obj, char *path, size_t path_len)
 	path[0] = AG_PATHSEPCHAR;
 	path[1] = '\0';
 
-	AG_LockVFS(ob);
+	AG_RLockVFS(ob);
 	AG_ObjectLock(ob);
 	if (ob == ob->root) {
 		Strlcat(path, ob->name, path_len);
@@ -271,7 +417,7 @@ AG_ObjectGetName(void *obj)
 	char *path;
 	size_t pathLen = 1;
 	
-	AG_LockVFS(ob);
+	AG_RLockVFS(ob);
 	AG_ObjectLock(ob);
 
 	for (pob = ob;
@@ -329,6 +475,21 @@ used:
 	return (1);
 }
 
+static int
+ObjectInUse(AG_Object *ob, AG_Object *root)
+{
+	AG_Object *cob;
+
+	if (FindObjectInUse(root, ob)) {
+		return (1);
+	}
+	TAILQ_FOREACH(cob, &ob->children, cobjs) {
+		if (ObjectInUse(cob, root))
+			return (1);
+	}
+	return (0);
+}
+
 /*
  * Return 1 if the given object or one of its children is being referenced.
  * Return value is only valid as long as the VFS is locked.
@@ -336,23 +497,13 @@ used:
 int
 AG_ObjectInUse(void *p)
 {
-	AG_Object *ob = p, *cob;
-	AG_Object *root;
+	AG_Object *ob = p;
+	int rv;
 
-	AG_LockVFS(ob);
-	root = AG_ObjectRoot(ob);
-	if (FindObjectInUse(root, ob)) {
-		goto used;
-	}
-	TAILQ_FOREACH(cob, &ob->children, cobjs) {
-		if (AG_ObjectInUse(cob))
-			goto used;
-	}
-	AG_UnlockVFS(ob);
-	return (0);
-used:
+	AG_RLockVFS(ob);
+	rv = ObjectInUse(ob, AG_ObjectRoot(ob));
 	AG_UnlockVFS(ob);
-	return (1);
+	return (rv);
 }
 
 /* Configure a custom "attach" function. */
@@ -593,7 +744,7 @@ AG_ObjectFindS(void *vfsRoot, const char *name)
 	if (name[0] == AG_PATHSEPCHAR && name[1] == '\0')
 		return (vfsRoot);
 	
-	AG_LockVFS(vfsRoot);
+	AG_RLockVFS(vfsRoot);
 	rv = FindObjectByName(vfsRoot, &name[1]);
 	AG_UnlockVFS(vfsRoot);
 
@@ -623,7 +774,7 @@ AG_ObjectFind(void *vfsRoot, const char *fmt, ...)
 		AG_FatalError(NULL);
 	}
 #endif
-	AG_LockVFS(vfsRoot);
+	AG_RLockVFS(vfsRoot);
 	rv = FindObjectByName(vfsRoot, &path[1]);
 	AG_UnlockVFS(vfsRoot);
 
@@ -642,7 +793,7 @@ AG_ObjectFindParent(void *p, const char *name, const char *t)
 {
 	AG_Object *ob = AGOBJECT(p);
 
-	AG_LockVFS(p);
+	AG_RLockVFS(p);
 	while (ob != NULL) {
 		AG_Object *po = AGOBJECT(ob->parent);
 
@@ -735,6 +886,7 @@ AG_ObjectFreeChildren(void *p)
 	AG_Object *pob = p;
 	AG_Object *cob, *ncob;
 
+	AG_LockVFS(pob);
 	AG_ObjectLock(pob);
 	for (cob = TAILQ_FIRST(&pob->children);
 	     cob != TAILQ_END(&pob->children);
@@ -744,6 +896,7 @@ AG_ObjectFreeChildren(void *p)
 	}
 	TAILQ_INIT(&pob->children);
 	AG_ObjectUnlock(pob);
+	AG_UnlockVFS(pob);
 }
 
 /* Destroy the object variables. */
@@ -816,6 +969,12 @@ AG_ObjectDestroy(void *p)
 	AG_ObjectFreeVariables(ob);
 	AG_ObjectFreeEvents(ob);
 	AG_MutexDestroy(&ob->lock);
+#ifdef AG_THREADS
+	if (ob->lockVFS != NULL) {
+		AG_RWLockDestroy(ob->lockVFS);
+		free(ob->lockVFS);
+	}
+#endif
 	Free(ob->archivePath);
 	
 	if ((ob->flags & AG_OBJECT_STATIC) == 0)
@@ -2337,7 +2496,7 @@ tryname:
 	Strlcat(name, " #", len);
 	StrlcatUint(name, i, len);
 	if (pobj != NULL) {
-		AG_LockVFS(pobj);
+		AG_RLockVFS(pobj);
 		TAILQ_FOREACH(ch, &pobj->children, cobjs) {
 			if (strcmp(ch->name, name) == 0)
 				break;
@@ -2362,7 +2521,7 @@ tryname:
 	Strlcpy(name, pfx, len);
 	StrlcatUint(name, i, len);
 	if (pobj != NULL) {
-		AG_LockVFS(pobj);
+		AG_RLockVFS(pobj);
 		TAILQ_FOREACH(ch, &pobj->children, cobjs) {
 			if (strcmp(ch->name, name) == 0)
 				break;
@@ -85,6 +85,7 @@ typedef struct ag_object {
 	AG_Event *attachFn;		/* Attach hook */
 	AG_Event *detachFn;		/* Detach hook */
 	AG_Mutex lock;			/* General object lock */
+	AG_AtomicPtr lockVFS;		/* VFS lock (if VFS root; on demand) */
 } AG_Object;
 
 /* Object archive header information. */
@@ -235,21 +236,48 @@ Uint32        AG_ObjectEncodeName(void *, const void *);
 void         *AG_ObjectEdit(void *);
 void          AG_ObjectGenName(void *, AG_ObjectClass *, char *, size_t);
 void          AG_ObjectGenNamePfx(void *, const char *, char *, size_t);
+int           AG_InitObjectSubsystem(void);
+void          AG_DestroyObjectSubsystem(void);
+#ifdef AG_THREADS
+AG_RWLock    *AG_ObjectNewVFSLock(void *);
+void          AG_ObjectLockVFS(void *, int);
+void          AG_ObjectUnlockVFS(void *);
+#endif
 
 #define AG_OfClass(obj,cspec) AG_ClassIsNamed(AGOBJECT(obj)->cls,(cspec))
 
 #ifdef AG_THREADS
 # define AG_ObjectLock(ob) AG_MutexLock(&AGOBJECT(ob)->lock)
 # define AG_ObjectUnlock(ob) AG_MutexUnlock(&AGOBJECT(ob)->lock)
-# define AG_LockVFS(ob) AG_ObjectLock(AGOBJECT(ob)->root)
-# define AG_UnlockVFS(ob) AG_ObjectUnlock(AGOBJECT(ob)->root)
+# define AG_LockVFS(ob) AG_ObjectLockVFS((ob), 1)
+# define AG_RLockVFS(ob) AG_ObjectLockVFS((ob), 0)
+# define AG_UnlockVFS(ob) AG_ObjectUnlockVFS(ob)
 #else /* !AG_THREADS */
 # define AG_ObjectLock(ob)
 # define AG_ObjectUnlock(ob)
 # define AG_LockVFS(ob)
+# define AG_RLockVFS(ob)
 # define AG_UnlockVFS(ob)
 #endif /* AG_THREADS */
 
+#ifdef AG_THREADS
+/*
+ * Return the lock on the VFS of an object, which is created by the VFS root
+ * on first use.
+ */
+static __inline__ AG_RWLock *
+AG_ObjectGetVFSLock(void *p)
+{
+	AG_Object *root = AGOBJECT(AGOBJECT(p)->root);
+	AG_RWLock *rw;
+
+	if ((rw = AG_AtomicGetPtr(&root->lockVFS)) == NULL) {
+		rw = AG_ObjectNewVFSLock(root);
+	}
+	return (rw);
+}
+#endif
+
 /*
  * Detach and destroy an object.
  */
@@ -274,7 +302,7 @@ AG_ObjectFindChild(void *pParent, const char *name)
 	AG_Object *pObj = AGOBJECT(pParent);
 	AG_Object *cObj;
 
-	AG_LockVFS(pObj);
+	AG_RLockVFS(pObj);
 	AGOBJECT_FOREACH_CHILD(cObj, pObj, ag_object) {
 		if (strcmp(cObj->name, name) == 0)
 			break;
@@ -0,0 +1,543 @@
+/*
+ * Copyright (c) 2026 Hypertriton, Inc. <http://hypertriton.com/>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Task scheduler.
+ *
+ * A fixed pool of worker threads executes tasks from per-worker deques.
+ * A worker pushes and pops the tasks it spawns at the tail of its own deque
+ * (newest first), and when it runs out, steals from the head of the deques
+ * of other workers (oldest first). Tasks submitted from other threads go to
+ * a shared injection deque. Threads waiting on a task group execute queued
+ * tasks while they wait.
+ */
+
+#include <agar/core/core.h>
+#include <agar/core/task.h>
+
+#include <string.h>
+#ifndef _WIN32
+# include <unistd.h>
+#endif
+
+#define AG_TASK_WORKERS_MAX	64
+#define AG_TASK_DEQUE_INIT	64
+
+/* Queued task. A range task with no fn is split further as it executes. */
+typedef struct ag_task {
+	AG_TaskFn fn;
+	AG_TaskRangeFn rangeFn;
+	void *arg;
+	Uint begin, end, grain;
+	AG_TaskGroup *group;
+} AG_Task;
+
+/* Work-stealing deque (ring buffer of tasks). */
+typedef struct ag_task_deque {
+	AG_Mutex lock;
+	AG_Task *tasks;
+	Uint size;			/* Allocated slots (power of 2) */
+	Uint head;			/* Oldest task (stolen first) */
+	Uint n;				/* Queued tasks */
+} AG_TaskDeque;
+
+typedef struct ag_task_worker {
+	AG_TaskDeque dq;
+	Uint32 rand;			/* Victim selection state */
+#ifdef AG_THREADS
+	AG_Thread th;
+#endif
+} AG_TaskWorker;
+
+static int            tkInited = 0;
+static Uint           tkFlags = 0;
+static Uint           tkNumWorkers = 0;
+static AG_TaskWorker *tkWorkers = NULL;	/* Workers and injection deque */
+#ifdef AG_THREADS
+static Uint           tkNumStarted = 0;		/* Worker threads started */
+static AG_ThreadKey   tkWorkerKey;		/* Worker of calling thread */
+static AG_Mutex       tkSleepLock;
+static AG_Cond        tkWake;			/* Signaled on new tasks */
+static AG_AtomicInt   tkNumSleeping = 0;	/* Idle workers */
+static int            tkQuit = 0;
+#endif
+
+/* Return the number of online processors. */
+static Uint
+GetCPUCount(void)
+{
+#if !defined(_WIN32) && defined(_SC_NPROCESSORS_ONLN)
+	long n;
+
+	if ((n = sysconf(_SC_NPROCESSORS_ONLN)) > 0)
+		return ((Uint)n);
+#endif
+	return (1);
+}
+
+static void
+RunTask(AG_Task *t)
+{
+	if (t->fn != NULL) {
+		t->fn(t->arg);
+	} else {
+		t->rangeFn(t->arg, t->begin, t->end);
+	}
+}
+
+static void
+TaskDone(AG_TaskGroup *g)
+{
+	AG_MutexLock(&g->lock);
+	if (--g->nPending == 0) {
+		AG_CondBroadcast(&g->done);
+	}
+	AG_MutexUnlock(&g->lock);
+}
+
+#ifdef AG_THREADS
+
+static int
+DequeInit(AG_TaskDeque *dq)
+{
+	if ((dq->tasks = TryMalloc(AG_TASK_DEQUE_INIT*sizeof(AG_Task))) == NULL) {
+		return (-1);
+	}
+	dq->size = AG_TASK_DEQUE_INIT;
+	dq->head = 0;
+	dq->n = 0;
+	AG_MutexInit(&dq->lock);
+	return (0);
+}
+
+static void
+DequeDestroy(AG_TaskDeque *dq)
+{
+	AG_MutexDestroy(&dq->lock);
+	Free(dq->tasks);
+}
+
+/* Append a task at the tail of a deque. */
+static int
+DequePush(AG_TaskDeque *dq, const AG_Task *t)
+{
+	AG_Task *tasksNew;
+	Uint i;
+
+	AG_MutexLock(&dq->lock);
+	if (dq->n == dq->size) {
+		if ((tasksNew = TryMalloc(dq->size*2*sizeof(AG_Task))) == NULL) {
+			AG_MutexUnlock(&dq->lock);
+			return (-1);
+		}
+		for (i = 0; i < dq->n; i++) {
+			tasksNew[i] = dq->tasks[(dq->head + i) & (dq->size-1)];
+		}
+		Free(dq->tasks);
+		dq->tasks = tasksNew;
+		dq->size *= 2;
+		dq->head = 0;
+	}
+	dq->tasks[(dq->head + dq->n) & (dq->size-1)] = *t;
+	dq->n++;
+	AG_MutexUnlock(&dq->lock);
+	return (0);
+}
+
+/* Remove the newest task (owner side). */
+static int
+DequePop(AG_TaskDeque *dq, AG_Task *t)
+{
+	int rv = 0;
+
+	AG_MutexLock(&dq->lock);
+	if (dq->n > 0) {
+		dq->n--;
+		*t = dq->tasks[(dq->head + dq->n) & (dq->size-1)];
+		rv = 1;
+	}
+	AG_MutexUnlock(&dq->lock);
+	return (rv);
+}
+
+/* Remove the oldest task (thief side). */
+static int
+DequeSteal(AG_TaskDeque *dq, AG_Task *t)
+{
+	int rv = 0;
+
+	AG_MutexLock(&dq->lock);
+	if (dq->n > 0) {
+		*t = dq->tasks[dq->head];
+		dq->head = (dq->head + 1) & (dq->size-1);
+		dq->n--;
+		rv = 1;
+	}
+	AG_MutexUnlock(&dq->lock);
+	return (rv);
+}
+
+/*
+ * Find a task for the given worker (or for a non-worker thread if w is
+ * NULL): its own deque first, then the other deques starting at a random
+ * victim, then the injection deque.
+ */
+static int
+GetTask(AG_TaskWorker *w, AG_Task *t)
+{
+	Uint i, start;
+
+	if (w != NULL) {
+		if (DequePop(&w->dq, t)) {
+			return (1);
+		}
+		w->rand ^= w->rand << 13;
+		w->rand ^= w->rand >> 17;
+		w->rand ^= w->rand << 5;
+		start = w->rand % tkNumWorkers;
+	} else {
+		start = 0;
+	}
+	for (i = 0; i < tkNumWorkers; i++) {
+		AG_TaskWorker *victim = &tkWorkers[(start + i) % tkNumWorkers];
+
+		if (victim != w && DequeSteal(&victim->dq, t))
+			return (1);
+	}
+	return DequeSteal(&tkWorkers[tkNumWorkers].dq, t);
+}
+
+/*
+ * Execute a task. Range tasks are split in halves down to their grain size,
+ * leaving the upper halves to be stolen by idle workers.
+ */
+static void ExecTask(AG_TaskWorker *, AG_Task *);
+static void PushTask(AG_TaskWorker *, AG_Task *);
+
+static void
+ExecTask(AG_TaskWorker *w, AG_Task *t)
+{
+	AG_Task tHalf;
+	Uint mid;
+
+	if (t->fn == NULL) {
+		while (t->end - t->begin > t->grain) {
+			mid = t->begin + (t->end - t->begin)/2;
+			tHalf = *t;
+			tHalf.begin = mid;
+			t->end = mid;
+			AG_MutexLock(&t->group->lock);
+			t->group->nPending++;
+			AG_MutexUnlock(&t->group->lock);
+			PushTask(w, &tHalf);
+		}
+	}
+	RunTask(t);
+	TaskDone(t->group);
+}
+
+/* Queue a task and wake up an idle worker. */
+static void
+PushTask(AG_TaskWorker *w, AG_Task *t)
+{
+	AG_TaskDeque *dq = (w != NULL) ? &w->dq : &tkWorkers[tkNumWorkers].dq;
+
+	if (DequePush(dq, t) == -1) {
+		ExecTask(w, t);			/* Out of memory; run inline */
+		return;
+	}
+	if (AG_AtomicGet(&tkNumSleeping) > 0) {
+		AG_MutexLock(&tkSleepLock);
+		AG_CondSignal(&tkWake);
+		AG_MutexUnlock(&tkSleepLock);
+	}
+}
+
+static void *
+WorkerThread(void *arg)
+{
+	AG_TaskWorker *w = arg;
+	AG_Task t;
+	int found;
+
+	AG_ThreadKeySet(tkWorkerKey, w);
+	for (;;) {
+		if (GetTask(w, &t)) {
+			ExecTask(w, &t);
+			continue;
+		}
+		AG_MutexLock(&tkSleepLock);
+		if (tkQuit) {
+			AG_MutexUnlock(&tkSleepLock);
+			break;
+		}
+		AG_AtomicInc(&tkNumSleeping);
+		if (!(found = GetTask(w, &t))) {	/* Recheck before sleeping */
+			AG_CondWait(&tkWake, &tkSleepLock);
+		}
+		AG_AtomicDec(&tkNumSleeping);
+		AG_MutexUnlock(&tkSleepLock);
+		if (found)
+			ExecTask(w, &t);
+	}
+	return (NULL);
+}
+
+#endif /* AG_THREADS */
+
+/*
+ * Start the task scheduler with nWorkers worker threads (0 = one per
+ * online processor). With AG_TASK_SERIAL, or without thread support,
+ * tasks are executed in the calling thread, in submission order.
+ */
+int
+AG_TaskInit(Uint nWorkers, Uint flags)
+{
+#ifdef AG_THREADS
+	Uint i;
+#endif
+	if (tkInited) {
+		AG_SetError("Task scheduler is already running");
+		return (-1);
+	}
+	if (nWorkers == 0) {
+		nWorkers = GetCPUCount();
+	}
+	if (nWorkers > AG_TASK_WORKERS_MAX) {
+		nWorkers = AG_TASK_WORKERS_MAX;
+	}
+	tkFlags = flags;
+#ifdef AG_THREADS
+	if (flags & AG_TASK_SERIAL) {
+		goto serial;
+	}
+	if ((tkWorkers = TryMalloc((nWorkers+1)*sizeof(AG_TaskWorker))) == NULL) {
+		return (-1);
+	}
+	for (i = 0; i <= nWorkers; i++) {
+		if (DequeInit(&tkWorkers[i].dq) == -1) {
+			while (i-- > 0) {
+				DequeDestroy(&tkWorkers[i].dq);
+			}
+			Free(tkWorkers);
+			tkWorkers = NULL;
+			return (-1);
+		}
+		tkWorkers[i].rand = 2463534242U + i*7919U;
+	}
+	if (AG_ThreadKeyTryCreate(&tkWorkerKey, NULL) == -1) {
+		goto fail;
+	}
+	AG_MutexInit(&tkSleepLock);
+	AG_CondInit(&tkWake);
+	AG_AtomicSet(&tkNumSleeping, 0);
+	tkQuit = 0;
+	tkNumWorkers = nWorkers;
+	tkNumStarted = 0;
+	tkInited = 1;
+
+	for (i = 0; i < nWorkers; i++) {
+		if (AG_ThreadTryCreate(&tkWorkers[i].th, WorkerThread,
+		    &tkWorkers[i]) == -1) {
+			AG_TaskDestroy();	/* Stops the workers started */
+			return (-1);
+		}
+		tkNumStarted++;
+	}
+	return (0);
+fail:
+	for (i = 0; i <= nWorkers; i++) {
+		DequeDestroy(&tkWorkers[i].dq);
+	}
+	Free(tkWorkers);
+	tkWorkers = NULL;
+	return (-1);
+serial:
+#endif /* AG_THREADS */
+	tkFlags |= AG_TASK_SERIAL;
+	tkNumWorkers = 1;
+	tkInited = 1;
+	return (0);
+}
+
+/* Execute any remaining tasks and stop the worker threads. */
+void
+AG_TaskDestroy(void)
+{
+#ifdef AG_THREADS
+	Uint i;
+#endif
+	if (!tkInited) {
+		return;
+	}
+#ifdef AG_THREADS
+	if (!(tkFlags & AG_TASK_SERIAL)) {
+		AG_MutexLock(&tkSleepLock);
+		tkQuit = 1;
+		AG_CondBroadcast(&tkWake);
+		AG_MutexUnlock(&tkSleepLock);
+		for (i = 0; i < tkNumStarted; i++) {
+			AG_ThreadJoin(tkWorkers[i].th, NULL);
+		}
+		for (i = 0; i <= tkNumWorkers; i++) {	/* And injection deque */
+			DequeDestroy(&tkWorkers[i].dq);
+		}
+		Free(tkWorkers);
+		tkWorkers = NULL;
+		AG_CondDestroy(&tkWake);
+		AG_MutexDestroy(&tkSleepLock);
+		AG_ThreadKeyDelete(tkWorkerKey);
+		tkNumStarted = 0;
+	}
+#endif
+	tkNumWorkers = 0;
+	tkFlags = 0;
+	tkInited = 0;
+}
+
+/* Return the number of worker threads (1 in serial mode). */
+Uint
+AG_TaskWorkerCount(void)
+{
+	return (tkInited ? tkNumWorkers : 1);
+}
+
+void
+AG_TaskGroupInit(AG_TaskGroup *g)
+{
+	AG_MutexInit(&g->lock);
+	AG_CondInit(&g->done);
+	g->nPending = 0;
+}
+
+void
+AG_TaskGroupDestroy(AG_TaskGroup *g)
+{
+	AG_CondDestroy(&g->done);
+	AG_MutexDestroy(&g->lock);
+}
+
+/* Queue a task for execution as part of the given group. */
+void
+AG_TaskRun(AG_TaskGroup *g, AG_TaskFn fn, void *arg)
+{
+#ifdef AG_THREADS
+	AG_Task t;
+
+	if (tkInited && !(tkFlags & AG_TASK_SERIAL)) {
+		t.fn = fn;
+		t.rangeFn = NULL;
+		t.arg = arg;
+		t.begin = t.end = t.grain = 0;
+		t.group = g;
+		AG_MutexLock(&g->lock);
+		g->nPending++;
+		AG_MutexUnlock(&g->lock);
+		PushTask(AG_ThreadKeyGet(tkWorkerKey), &t);
+		return;
+	}
+#endif
+	fn(arg);
+}
+
+/*
+ * Wait until all tasks of the given group have completed, executing
+ * queued tasks (of any group) in the meantime.
+ */
+void
+AG_TaskWait(AG_TaskGroup *g)
+{
+#ifdef AG_THREADS
+	AG_TaskWorker *w;
+	AG_Task t;
+
+	if (!tkInited || (tkFlags & AG_TASK_SERIAL)) {
+		return;
+	}
+	w = AG_ThreadKeyGet(tkWorkerKey);
+	for (;;) {
+		AG_MutexLock(&g->lock);
+		if (g->nPending == 0) {
+			AG_MutexUnlock(&g->lock);
+			break;
+		}
+		AG_MutexUnlock(&g->lock);
+
+		if (GetTask(w, &t)) {
+			ExecTask(w, &t);
+			continue;
+		}
+		AG_MutexLock(&g->lock);
+		if (g->nPending > 0) {			/* Running elsewhere */
+			AG_CondWait(&g->done, &g->lock);
+		}
+		AG_MutexUnlock(&g->lock);
+	}
+#endif
+}
+
+/*
+ * Invoke fn(arg, begin, end) over subranges of [0,n) of at most grain
+ * elements (if 0, a grain is chosen from the worker count), in parallel,
+ * and wait for completion. In serial mode, the subranges are processed
+ * in ascending order.
+ */
+void
+AG_TaskParallelFor(Uint n, Uint grain, AG_TaskRangeFn fn, void *arg)
+{
+	Uint i;
+#ifdef AG_THREADS
+	AG_TaskGroup g;
+	AG_Task t;
+#endif
+	if (n == 0) {
+		return;
+	}
+	if (grain == 0) {
+		grain = n / (AG_TaskWorkerCount()*8);
+		if (grain == 0)
+			grain = 1;
+	}
+#ifdef AG_THREADS
+	if (tkInited && !(tkFlags & AG_TASK_SERIAL) && n > grain) {
+		AG_TaskGroupInit(&g);
+		g.nPending = 1;
+		t.fn = NULL;
+		t.rangeFn = fn;
+		t.arg = arg;
+		t.begin = 0;
+		t.end = n;
+		t.grain = grain;
+		t.group = &g;
+		ExecTask(AG_ThreadKeyGet(tkWorkerKey), &t);
+		AG_TaskWait(&g);
+		AG_TaskGroupDestroy(&g);
+		return;
+	}
+#endif
+	for (i = 0; i < n; i += grain) {
+		fn(arg, i, (n - i > grain) ? i+grain : n);
+	}
+}
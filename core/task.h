@@ -0,0 +1,32 @@
+/*	Public domain	*/
+
+#ifndef _AGAR_CORE_TASK_H_
+#define _AGAR_CORE_TASK_H_
+#include <agar/core/begin.h>
+
+typedef void (*AG_TaskFn)(void *);
+typedef void (*AG_TaskRangeFn)(void *, Uint, Uint);
+
+/* Group of tasks which can be waited on. */
+typedef struct ag_task_group {
+	AG_Mutex lock;
+	AG_Cond done;			/* Signaled when nPending drops to 0 */
+	Uint nPending;			/* Tasks queued or running */
+} AG_TaskGroup;
+
+#define AG_TASK_SERIAL	0x01		/* Run tasks in calling thread, in order */
+
+__BEGIN_DECLS
+int  AG_TaskInit(Uint, Uint);
+void AG_TaskDestroy(void);
+Uint AG_TaskWorkerCount(void);
+
+void AG_TaskGroupInit(AG_TaskGroup *);
+void AG_TaskGroupDestroy(AG_TaskGroup *);
+void AG_TaskRun(AG_TaskGroup *, AG_TaskFn, void *);
+void AG_TaskWait(AG_TaskGroup *);
+void AG_TaskParallelFor(Uint, Uint, AG_TaskRangeFn, void *);
+__END_DECLS
+
+#include <agar/core/close.h>
+#endif /* _AGAR_CORE_TASK_H_ */
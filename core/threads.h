@@ -6,6 +6,7 @@
 #ifdef AG_THREADS
 
 #include <agar/config/have_pthreads.h>
+#include <agar/config/ag_lockprof.h>
 #ifdef HAVE_PTHREADS
 #include <pthread.h>
 #include <signal.h>
@@ -20,6 +21,18 @@ typedef pthread_mutexattr_t AG_MutexAttr;
 typedef pthread_t AG_Thread;
 typedef pthread_cond_t AG_Cond;
 typedef pthread_key_t AG_ThreadKey;
+typedef pthread_once_t AG_Once;
+
+#define AG_ONCE_INIT PTHREAD_ONCE_INIT
+
+#ifdef AG_LOCKPROF
+/* Call site of a profiled lock operation. */
+typedef struct ag_lock_site {
+	const char *file;
+	int line;
+	void *ent;			/* Statistics entry (cached) */
+} AG_LockSite;
+#endif
 
 #ifdef _SGI_SOURCE
 #define AG_MUTEX_INITIALIZER {{0}}
@@ -31,6 +44,16 @@ typedef pthread_key_t AG_ThreadKey;
 __BEGIN_DECLS
 extern pthread_mutexattr_t agRecursiveMutexAttr;
 extern AG_Thread           agEventThread;
+extern AG_ThreadKey        agThreadTokenKey;
+void *AG_ThreadTokenNew(void);
+#ifdef AG_LOCKPROF
+void AG_LockProfLock(AG_Mutex *, AG_LockSite *);
+int  AG_LockProfTryLock(AG_Mutex *, const char *, int);
+void AG_LockProfUnlock(AG_Mutex *);
+void AG_LockProfForget(AG_Mutex *);
+int  AG_LockProfCondWait(AG_Cond *, AG_Mutex *);
+int  AG_LockProfCondTimedWait(AG_Cond *, AG_Mutex *, const struct timespec *);
+#endif
 __END_DECLS
 #include <agar/core/close.h>
 
@@ -40,9 +63,15 @@ __END_DECLS
 #define AG_ThreadKeyGet(k)		pthread_getspecific(k)
 #define AG_ThreadSigMask(how,n,o)	pthread_sigmask((how),(n),(o))
 #define AG_ThreadKill(thread,signo)	(void)pthread_kill((thread),(signo))
-#define AG_MutexTryLock(m)		pthread_mutex_trylock(m)
-#define AG_CondWait(cd,m)		pthread_cond_wait(cd,m)
-#define AG_CondTimedWait(cd,m,t)	pthread_cond_timedwait(cd,m,t)
+#ifdef AG_LOCKPROF
+# define AG_MutexTryLock(m)		AG_LockProfTryLock((m),__FILE__,__LINE__)
+# define AG_CondWait(cd,m)		AG_LockProfCondWait((cd),(m))
+# define AG_CondTimedWait(cd,m,t)	AG_LockProfCondTimedWait((cd),(m),(t))
+#else
+# define AG_MutexTryLock(m)		pthread_mutex_trylock(m)
+# define AG_CondWait(cd,m)		pthread_cond_wait(cd,m)
+# define AG_CondTimedWait(cd,m,t)	pthread_cond_timedwait(cd,m,t)
+#endif
 
 /*
  * Thread interface
@@ -132,6 +161,17 @@ AG_MutexTryInitRecursive(AG_Mutex *m)
 	}
 	return (0);
 }
+#ifdef AG_LOCKPROF
+/*
+ * In lock profiling mode, every AG_MutexLock() call site gets its own
+ * statistics entry (unless the mutex was named with AG_LockProfSetName()).
+ */
+# define AG_MutexLock(m) do {						\
+	static AG_LockSite agLockSite = { __FILE__, __LINE__, NULL };	\
+	AG_LockProfLock((m), &agLockSite);				\
+} while (0)
+# define AG_MutexUnlock(m) AG_LockProfUnlock(m)
+#else
 static __inline__ void
 AG_MutexLock(AG_Mutex *m)
 {
@@ -144,9 +184,13 @@ AG_MutexUnlock(AG_Mutex *m)
 	if (pthread_mutex_unlock(m) != 0)
 		AG_FatalError("pthread_mutex_unlock");
 }
+#endif /* AG_LOCKPROF */
 static __inline__ void
 AG_MutexDestroy(AG_Mutex *m)
 {
+#ifdef AG_LOCKPROF
+	AG_LockProfForget(m);
+#endif
 	if (pthread_mutex_destroy(m) != 0)
 		AG_FatalError("pthread_mutex_destroy");
 }
@@ -241,6 +285,16 @@ AG_ThreadKeyTrySet(AG_ThreadKey k, const void *p)
 	return (0);
 }
 
+/*
+ * One-time initialization interface
+ */
+static __inline__ void
+AG_ThreadOnce(AG_Once *once, void (*fn)(void))
+{
+	if (pthread_once(once, fn) != 0)
+		AG_FatalError("pthread_once");
+}
+
 #else /* !AG_THREADS */
 
 typedef void *AG_Mutex;
@@ -248,9 +302,12 @@ typedef void *AG_Thread;
 typedef void *AG_Cond;
 typedef void *AG_MutexAttr;
 typedef int   AG_ThreadKey;
+typedef void *AG_RWLock;
+typedef int   AG_Once;
 
 #define AG_MUTEX_INITIALIZER 0
 #define AG_COND_INITIALIZER 0
+#define AG_ONCE_INIT 0
 
 #define AG_MutexInit(m)
 #define AG_MutexInitRecursive(m)
@@ -263,7 +320,15 @@ typedef int   AG_ThreadKey;
 #define AG_CondSignal(cd)
 #define AG_CondWait(cd,m)
 #define AG_CondTimedWait(cd,m,t)
+#define AG_RWLockInit(rw)
+#define AG_RWLockDestroy(rw)
+#define AG_RWLockRdLock(rw)
+#define AG_RWLockWrLock(rw)
+#define AG_RWLockUnlock(rw)
+#define AG_ThreadOnce(once,fn) \
+	do { if (*(once) == 0) { *(once) = 1; (fn)(); } } while (0)
 
+static __inline__ int AG_RWLockTryInit(AG_RWLock *rw) { return (0); }
 static __inline__ int AG_MutexTryInit(AG_Mutex *mu) { return (0); }
 static __inline__ int AG_MutexTryInitRecursive(AG_Mutex *mu) { return (0); }
 static __inline__ int AG_MutexTryLock(AG_Mutex *mu) { return (0); }
@@ -271,4 +336,232 @@ static __inline__ int AG_MutexTryLock(AG_Mutex *mu) { return (0); }
 #undef HAVE_PTHREADS
 #endif /* AG_THREADS */
 
+/*
+ * Atomic operations on integers and pointers (sequentially consistent).
+ * AG_AtomicAdd() returns the new value; AG_AtomicCAS() and AG_AtomicCASPtr()
+ * return 1 if the value was replaced.
+ */
+#if !defined(AG_THREADS)
+
+typedef int AG_AtomicInt;
+typedef void *AG_AtomicPtr;
+#define AG_AtomicGet(a)		(*(a))
+#define AG_AtomicSet(a,v)	(void)(*(a) = (v))
+#define AG_AtomicAdd(a,v)	(*(a) += (v))
+#define AG_AtomicCAS(a,o,n)	((*(a) == (o)) ? (*(a) = (n), 1) : 0)
+#define AG_AtomicGetPtr(a)	(*(a))
+#define AG_AtomicSetPtr(a,v)	(void)(*(a) = (v))
+#define AG_AtomicCASPtr(a,o,n)	((*(a) == (o)) ? (*(a) = (n), 1) : 0)
+
+#elif defined(__GNUC__) && \
+     (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7))
+
+typedef volatile int AG_AtomicInt;
+typedef void *volatile AG_AtomicPtr;
+#define AG_AtomicGet(a)		__atomic_load_n((a), __ATOMIC_SEQ_CST)
+#define AG_AtomicSet(a,v)	__atomic_store_n((a), (v), __ATOMIC_SEQ_CST)
+#define AG_AtomicAdd(a,v)	__atomic_add_fetch((a), (v), __ATOMIC_SEQ_CST)
+#define AG_AtomicGetPtr(a)	__atomic_load_n((a), __ATOMIC_SEQ_CST)
+#define AG_AtomicSetPtr(a,v)	__atomic_store_n((a), (v), __ATOMIC_SEQ_CST)
+static __inline__ int
+AG_AtomicCAS(AG_AtomicInt *a, int o, int n)
+{
+	return __atomic_compare_exchange_n(a, &o, n, 0, __ATOMIC_SEQ_CST,
+	                                   __ATOMIC_SEQ_CST);
+}
+static __inline__ int
+AG_AtomicCASPtr(AG_AtomicPtr *a, void *o, void *n)
+{
+	return __atomic_compare_exchange_n(a, &o, n, 0, __ATOMIC_SEQ_CST,
+	                                   __ATOMIC_SEQ_CST);
+}
+
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && \
+     !defined(__STDC_NO_ATOMICS__) && !defined(__cplusplus)
+
+#include <stdatomic.h>
+typedef _Atomic int AG_AtomicInt;
+typedef void *_Atomic AG_AtomicPtr;
+#define AG_AtomicGet(a)		atomic_load(a)
+#define AG_AtomicSet(a,v)	atomic_store((a),(v))
+#define AG_AtomicAdd(a,v)	(atomic_fetch_add((a),(v)) + (v))
+#define AG_AtomicGetPtr(a)	atomic_load(a)
+#define AG_AtomicSetPtr(a,v)	atomic_store((a),(v))
+static __inline__ int
+AG_AtomicCAS(AG_AtomicInt *a, int o, int n)
+{
+	return atomic_compare_exchange_strong(a, &o, n);
+}
+static __inline__ int
+AG_AtomicCASPtr(AG_AtomicPtr *a, void *o, void *n)
+{
+	return atomic_compare_exchange_strong(a, &o, n);
+}
+
+#else /* Serialize with a global mutex */
+
+#define AG_ATOMICS_MUTEX
+typedef volatile int AG_AtomicInt;
+typedef void *volatile AG_AtomicPtr;
+#include <agar/core/begin.h>
+__BEGIN_DECLS
+extern AG_Mutex agAtomicLock;
+__END_DECLS
+#include <agar/core/close.h>
+static __inline__ int
+AG_AtomicGet(AG_AtomicInt *a)
+{
+	int v;
+	AG_MutexLock(&agAtomicLock); v = *a; AG_MutexUnlock(&agAtomicLock);
+	return (v);
+}
+static __inline__ void
+AG_AtomicSet(AG_AtomicInt *a, int v)
+{
+	AG_MutexLock(&agAtomicLock); *a = v; AG_MutexUnlock(&agAtomicLock);
+}
+static __inline__ int
+AG_AtomicAdd(AG_AtomicInt *a, int v)
+{
+	AG_MutexLock(&agAtomicLock); v = (*a += v); AG_MutexUnlock(&agAtomicLock);
+	return (v);
+}
+static __inline__ int
+AG_AtomicCAS(AG_AtomicInt *a, int o, int n)
+{
+	int rv;
+	AG_MutexLock(&agAtomicLock);
+	if ((rv = (*a == o))) { *a = n; }
+	AG_MutexUnlock(&agAtomicLock);
+	return (rv);
+}
+static __inline__ void *
+AG_AtomicGetPtr(AG_AtomicPtr *a)
+{
+	void *v;
+	AG_MutexLock(&agAtomicLock); v = *a; AG_MutexUnlock(&agAtomicLock);
+	return (v);
+}
+static __inline__ void
+AG_AtomicSetPtr(AG_AtomicPtr *a, void *v)
+{
+	AG_MutexLock(&agAtomicLock); *a = v; AG_MutexUnlock(&agAtomicLock);
+}
+static __inline__ int
+AG_AtomicCASPtr(AG_AtomicPtr *a, void *o, void *n)
+{
+	int rv;
+	AG_MutexLock(&agAtomicLock);
+	if ((rv = (*a == o))) { *a = n; }
+	AG_MutexUnlock(&agAtomicLock);
+	return (rv);
+}
+
+#endif /* Atomics */
+
+#define AG_AtomicInc(a)		AG_AtomicAdd((a), 1)
+#define AG_AtomicDec(a)		AG_AtomicAdd((a), -1)
+
+#ifdef AG_THREADS
+/*
+ * Return a token which uniquely identifies the calling thread among the
+ * running threads, and which can be compared atomically.
+ */
+static __inline__ void *
+AG_ThreadToken(void)
+{
+	void *tok;
+
+	if ((tok = pthread_getspecific(agThreadTokenKey)) == NULL) {
+		tok = AG_ThreadTokenNew();
+	}
+	return (tok);
+}
+
+/* Reader-writer lock (recursive for the writer). */
+typedef struct ag_rwlock {
+	pthread_rwlock_t rw;
+	AG_AtomicPtr owner;		/* Token of writer thread (or NULL) */
+	unsigned int nWr;		/* Lock depth of writer */
+} AG_RWLock;
+
+/*
+ * Reader-writer lock interface. The thread holding the write lock may
+ * lock it again, for either reading or writing. A thread holding a read
+ * lock must not request the write lock, nor (portably) another read lock.
+ * Readers only load the owner token, so they do not contend with each
+ * other outside of pthread_rwlock_rdlock().
+ */
+static __inline__ void
+AG_RWLockInit(AG_RWLock *rw)
+{
+	if (pthread_rwlock_init(&rw->rw, NULL) != 0)
+		AG_FatalError("pthread_rwlock_init");
+	rw->owner = NULL;
+	rw->nWr = 0;
+}
+static __inline__ int
+AG_RWLockTryInit(AG_RWLock *rw)
+{
+	int rv;
+	if ((rv = pthread_rwlock_init(&rw->rw, NULL)) != 0) {
+		AG_SetError("%s", AG_Strerror(rv));
+		return (-1);
+	}
+	rw->owner = NULL;
+	rw->nWr = 0;
+	return (0);
+}
+static __inline__ void
+AG_RWLockDestroy(AG_RWLock *rw)
+{
+	if (pthread_rwlock_destroy(&rw->rw) != 0)
+		AG_FatalError("pthread_rwlock_destroy");
+}
+static __inline__ void
+AG_RWLockWrLock(AG_RWLock *rw)
+{
+	void *tok = AG_ThreadToken();
+
+	if (AG_AtomicGetPtr(&rw->owner) == tok) {	/* Nested */
+		rw->nWr++;
+		return;
+	}
+	if (pthread_rwlock_wrlock(&rw->rw) != 0) {
+		AG_FatalError("pthread_rwlock_wrlock");
+	}
+	rw->nWr = 1;
+	AG_AtomicSetPtr(&rw->owner, tok);
+}
+static __inline__ void
+AG_RWLockRdLock(AG_RWLock *rw)
+{
+	void *owner;
+
+	/* Only the writer itself can observe its own token here. */
+	if ((owner = AG_AtomicGetPtr(&rw->owner)) != NULL &&
+	    owner == AG_ThreadToken()) {
+		rw->nWr++;
+		return;
+	}
+	if (pthread_rwlock_rdlock(&rw->rw) != 0)
+		AG_FatalError("pthread_rwlock_rdlock");
+}
+static __inline__ void
+AG_RWLockUnlock(AG_RWLock *rw)
+{
+	void *owner;
+
+	if ((owner = AG_AtomicGetPtr(&rw->owner)) != NULL &&
+	    owner == AG_ThreadToken()) {		/* We are the writer */
+		if (--rw->nWr > 0) {
+			return;
+		}
+		AG_AtomicSetPtr(&rw->owner, NULL);
+	}
+	if (pthread_rwlock_unlock(&rw->rw) != 0)
+		AG_FatalError("pthread_rwlock_unlock");
+}
+#endif /* AG_THREADS */
+
 #endif /* _AGAR_CORE_THREADS_H_ */
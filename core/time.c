@@ -43,3 +43,41 @@ AG_SetTimeOps(const AG_TimeOps *timeOps)
 	if (timeOps->init != NULL)
 		timeOps->init();
 }
+
+/*
+ * Return the value of a monotonic clock in nanoseconds (same epoch as
+ * AG_GetTicks()). If the backend provides no nanosecond clock, fall back
+ * to the resolution of getTicks().
+ */
+Uint64
+AG_GetTimeNS(void)
+{
+	if (agTimeOps->getTimeNS != NULL) {
+		return agTimeOps->getTimeNS();
+	}
+	return (Uint64)agTimeOps->getTicks()*1000000;
+}
+
+/* Sleep until the given AG_GetTimeNS() deadline. */
+void
+AG_DelayUntilNS(Uint64 t)
+{
+	Uint64 now, ms;
+
+	if (agTimeOps->delayUntilNS != NULL) {
+		agTimeOps->delayUntilNS(t);
+		return;
+	}
+	if ((now = AG_GetTimeNS()) >= t) {
+		return;
+	}
+	ms = (t - now)/1000000 + ((t - now) % 1000000 != 0);
+	agTimeOps->delay(ms > 0xffffffff ? 0xffffffff : (Uint32)ms);
+}
+
+/* Sleep for the given number of nanoseconds. */
+void
+AG_DelayNS(Uint64 ns)
+{
+	AG_DelayUntilNS(AG_GetTimeNS() + ns);
+}
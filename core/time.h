@@ -12,8 +12,9 @@ typedef struct ag_timer {
 #define AG_TIMER_AUTO_FREE	0x02	/* Free the timer structure on expire */
 #define AG_TIMER_EXECD		0x04	/* Callback was invoked manually */
 #define AG_TIMER_RESTART	0x08	/* Queue timer for restart (driver-specific) */
+#define AG_TIMER_USEC		0x40	/* Interval is in microseconds */
 	Uint32 tSched;			/* Scheduled expiration time (ticks) */
-	Uint32 ival;			/* Timer interval in ticks */
+	Uint32 ival;			/* Timer interval in ticks (or usec) */
 	Uint32 (*fn)(struct ag_timer *, AG_Event *);
 	AG_Event fnEvent;
 	AG_TAILQ_ENTRY(ag_timer) timers;
@@ -23,6 +24,7 @@ typedef struct ag_timer {
 	void   *argLegacy;
 #endif
 	char name[AG_TIMER_NAME_MAX];	/* Name string (optional) */
+	Uint64 tDeadline;		/* Scheduled expiration time (ns) */
 } AG_Timer;
 
 typedef Uint32 (*AG_TimerFn)(AG_Timer *, AG_Event *);
@@ -33,6 +35,8 @@ typedef struct ag_time_ops {
 	void   (*destroy)(void);
 	Uint32 (*getTicks)(void);
 	void   (*delay)(Uint32);
+	Uint64 (*getTimeNS)(void);		/* Optional: Monotonic time (ns) */
+	void   (*delayUntilNS)(Uint64);		/* Optional: Sleep until (ns) */
 } AG_TimeOps;
 
 #define AG_LockTiming()		AG_MutexLock(&agTimerLock)
@@ -58,6 +62,9 @@ extern const AG_TimeOps  agTimeOps_win32;
 extern const AG_TimeOps  agTimeOps_renderer;
 
 void    AG_SetTimeOps(const AG_TimeOps *);
+Uint64  AG_GetTimeNS(void);
+void    AG_DelayNS(Uint64);
+void    AG_DelayUntilNS(Uint64);
 void	AG_InitTimers(void);
 void	AG_DestroyTimers(void);
 
@@ -71,6 +78,15 @@ int	  AG_TimerIsRunning(void *, AG_Timer *);
 int       AG_TimerWait(void *, AG_Timer *, Uint32);
 
 void    AG_ProcessTimeouts(Uint32);
+void    AG_ProcessTimeoutsNS(Uint64);
+
+/* Return a timer interval (in ticks or microseconds) in nanoseconds. */
+static __inline__ Uint64
+AG_TimerIvalNS(const AG_Timer *to, Uint32 ival)
+{
+	return (to->flags & AG_TIMER_USEC) ? (Uint64)ival*1000 :
+	                                     (Uint64)ival*1000000;
+}
 
 /* Execute a timer's associated callback routine. */
 static __inline__ Uint32
@@ -56,10 +56,22 @@ GTOD_Delay(Uint32 ticks)
 	}
 }
 
+static Uint64
+GTOD_GetTimeNS(void)
+{
+	struct timeval t;
+
+	gettimeofday(&t, NULL);
+	return (Uint64)(t.tv_sec - t0.tv_sec)*1000000000 +
+	       (Sint64)(t.tv_usec - t0.tv_usec)*1000;
+}
+
 const AG_TimeOps agTimeOps_gettimeofday = {
 	"gettimeofday",
 	GTOD_Init,
 	NULL,
 	GTOD_GetTicks,
-	GTOD_Delay
+	GTOD_Delay,
+	GTOD_GetTimeNS,
+	NULL
 };
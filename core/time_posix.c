@@ -19,32 +19,60 @@ POSIX_Init(void)
 	clock_gettime(CLOCK_MONOTONIC, &t0);
 }
 
-static Uint32
-POSIX_GetTicks(void)
+static Uint64
+POSIX_GetTimeNS(void)
 {
 	struct timespec t;
 
 	clock_gettime(CLOCK_MONOTONIC, &t);
-	return (Uint32)(t.tv_sec - t0.tv_sec)*1000 +
-	               (t.tv_nsec - t0.tv_nsec)/1000000L;
+	return (Uint64)(t.tv_sec - t0.tv_sec)*1000000000 +
+	       (t.tv_nsec - t0.tv_nsec);
 }
 
+static Uint32
+POSIX_GetTicks(void)
+{
+	return (Uint32)(POSIX_GetTimeNS()/1000000);
+}
+
+/*
+ * Sleep until an absolute deadline. Where available, use clock_nanosleep()
+ * with TIMER_ABSTIME so that signal interruptions and scheduling latency
+ * do not accumulate into the delay.
+ */
 static void
-POSIX_Delay(Uint32 ticks)
+POSIX_DelayUntilNS(Uint64 t)
 {
-	struct timespec tv, tvElapsed;
-
-	tvElapsed.tv_sec = ticks/1000;
-	tvElapsed.tv_nsec = (ticks % 1000)*1000000L;
-	for (;;) {
-		tv.tv_sec = tvElapsed.tv_sec;
-		tv.tv_nsec = tvElapsed.tv_nsec;
-		if (nanosleep(&tv, &tvElapsed) == -1 &&
-		    errno == EINTR) {
+#ifdef TIMER_ABSTIME
+	struct timespec ts;
+	Uint64 tBase, tAbs;
+
+	tBase = (Uint64)t0.tv_sec*1000000000 + t0.tv_nsec;
+	tAbs = (t > ~(Uint64)0 - tBase) ? ~(Uint64)0 : tBase+t; /* Saturate */
+	ts.tv_sec = (time_t)(tAbs/1000000000);
+	ts.tv_nsec = (long)(tAbs % 1000000000);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)
+	    == EINTR)
+		;
+#else
+	struct timespec ts;
+	Uint64 now;
+
+	while ((now = POSIX_GetTimeNS()) < t) {
+		ts.tv_sec = (time_t)((t - now)/1000000000);
+		ts.tv_nsec = (long)((t - now) % 1000000000);
+		if (nanosleep(&ts, NULL) == -1 && errno == EINTR) {
 			continue;
 		}
 		break;
 	}
+#endif
+}
+
+static void
+POSIX_Delay(Uint32 ticks)
+{
+	POSIX_DelayUntilNS(POSIX_GetTimeNS() + (Uint64)ticks*1000000);
 }
 
 const AG_TimeOps agTimeOps_posix = {
@@ -52,5 +80,7 @@ const AG_TimeOps agTimeOps_posix = {
 	POSIX_Init,
 	NULL,
 	POSIX_GetTicks,
-	POSIX_Delay
+	POSIX_Delay,
+	POSIX_GetTimeNS,
+	POSIX_DelayUntilNS
 };
@@ -29,51 +29,66 @@ RENDERER_Init(void)
 		AG_CondInit(&agCondBeginRender);
 		AG_CondInit(&agCondEndRender);
 		AG_MutexInit(&agCondRenderLock);
+#ifdef AG_LOCKPROF
+		AG_LockProfSetName(&agCondRenderLock, "agCondRenderLock");
+#endif
 		inited = 1;
 	}
 	clock_gettime(CLOCK_MONOTONIC, &t0);
 }
 
-static Uint32
-RENDERER_GetTicks(void)
+static Uint64
+RENDERER_GetTimeNS(void)
 {
 	struct timespec t;
 
 	clock_gettime(CLOCK_MONOTONIC, &t);
-	return (Uint32)(t.tv_sec - t0.tv_sec)*1000 +
-	               (t.tv_nsec - t0.tv_nsec)/1000000;
+	return (Uint64)(t.tv_sec - t0.tv_sec)*1000000000 +
+	       (t.tv_nsec - t0.tv_nsec);
+}
+
+static Uint32
+RENDERER_GetTicks(void)
+{
+	return (Uint32)(RENDERER_GetTimeNS()/1000000);
 }
 
+/*
+ * Wait on agCondBeginRender until the given deadline. The condition
+ * variable uses the realtime clock, so the timeout is recomputed from
+ * the monotonic clock on every iteration.
+ */
 static void
-RENDERER_Delay(Uint32 Tdelay)
+RENDERER_DelayUntilNS(Uint64 t)
 {
-	struct timespec ts, tsNow;
-	int rv;
+	struct timespec ts;
+	Uint64 now, tAbs;
 
 	AG_MutexLock(&agCondRenderLock);
-	clock_gettime(CLOCK_MONOTONIC, &ts);
-	ts.tv_sec += (Tdelay/1000);
-	ts.tv_nsec += (Tdelay % 1000)*1000000;
-
-	for (;;) {
-		rv = AG_CondTimedWait(&agCondBeginRender, &agCondRenderLock, &ts);
-		if (rv != 0) {
-			clock_gettime(CLOCK_MONOTONIC, &tsNow);
-			if (tsNow.tv_sec < ts.tv_sec) {
-				continue;
-			}
-			if (tsNow.tv_sec > ts.tv_sec ||
-			    tsNow.tv_nsec >= ts.tv_nsec)
-				break;
-		}
+	while ((now = RENDERER_GetTimeNS()) < t) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		tAbs = (Uint64)ts.tv_sec*1000000000 + ts.tv_nsec;
+		tAbs = (t - now > ~(Uint64)0 - tAbs) ? ~(Uint64)0 :
+		       tAbs + (t - now);		/* Saturate */
+		ts.tv_sec = (time_t)(tAbs/1000000000);
+		ts.tv_nsec = (long)(tAbs % 1000000000);
+		AG_CondTimedWait(&agCondBeginRender, &agCondRenderLock, &ts);
 	}
 	AG_MutexUnlock(&agCondRenderLock);
 }
 
+static void
+RENDERER_Delay(Uint32 Tdelay)
+{
+	RENDERER_DelayUntilNS(RENDERER_GetTimeNS() + (Uint64)Tdelay*1000000);
+}
+
 const AG_TimeOps agTimeOps_renderer = {
 	"renderer",
 	RENDERER_Init,
 	NULL,
 	RENDERER_GetTicks,
-	RENDERER_Delay
+	RENDERER_Delay,
+	RENDERER_GetTimeNS,
+	RENDERER_DelayUntilNS
 };
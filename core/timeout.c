@@ -38,6 +38,9 @@ void
 AG_InitTimers(void)
 {
 	AG_MutexInitRecursive(&agTimerLock);
+#ifdef AG_LOCKPROF
+	AG_LockProfSetName(&agTimerLock, "agTimerLock");
+#endif
 	AG_ObjectInitStatic(&agTimerMgr, NULL);
 }
 
@@ -48,9 +51,21 @@ AG_DestroyTimers(void)
 	AG_MutexDestroy(&agTimerLock);
 }
 
+/*
+ * Compute the expiration time of a timer on the ordered timing wheel.
+ * Ordering uses the nanosecond deadline; tSched is kept for reference.
+ */
+static __inline__ void
+SchedTimer(AG_Timer *to, Uint32 ival)
+{
+	to->tDeadline = AG_GetTimeNS() + AG_TimerIvalNS(to, ival);
+	to->tSched = (Uint32)(to->tDeadline/1000000);
+}
+
 /*
  * Attach a timer to an object (or &agTimerMgr if object argument is NULL),
- * and schedule the execution of a timer callback routine fn, in ival ticks.
+ * and schedule the execution of a timer callback routine fn, in ival ticks
+ * (or microseconds if the timer has the AG_TIMER_USEC flag).
  *
  * The AG_Timer structure should have been previously initialized with
  * AG_InitTimer(). If the timer is already attached/scheduled, this function
@@ -77,6 +92,7 @@ AG_AddTimer(void *p, AG_Timer *to, Uint32 ival, AG_TimerFn fn,
 			newTimer = 1;
 			to->obj = ob;
 			to->tSched = 0;
+			to->tDeadline = 0;
 		} else if (to->obj != ob) {
 			AG_FatalError("to->obj != ob");
 		}
@@ -90,7 +106,7 @@ AG_AddTimer(void *p, AG_Timer *to, Uint32 ival, AG_TimerFn fn,
 		if (TAILQ_EMPTY(&ob->timers)) {
 			TAILQ_INSERT_TAIL(&agTimerObjQ, ob, tobjs);
 		}
-		to->tSched = AG_GetTicks()+ival;
+		SchedTimer(to, ival);
 reinsert:
 		TAILQ_FOREACH(toOther, &ob->timers, timers) {
 			if (toOther == to) {
@@ -98,7 +114,7 @@ reinsert:
 				TAILQ_REMOVE(&ob->timers, to, timers);
 				goto reinsert;
 			}
-			if (to->tSched < toOther->tSched) {
+			if (to->tDeadline < toOther->tDeadline) {
 				TAILQ_INSERT_BEFORE(toOther, to, timers);
 				break;
 			}
@@ -121,6 +137,9 @@ reinsert:
 	    src->addTimerFn(to, ival, newTimer) == -1) {
 		goto fail;
 	}
+#ifdef AG_THREADS
+	AG_TimerWakeup();
+#endif
 	AG_UnlockTimers(ob);
 	return (0);
 fail:
@@ -145,6 +164,7 @@ AG_InitTimer(AG_Timer *to, const char *name, Uint flags)
 	to->flags = flags;
 	to->ival = 0;
 	to->tSched = 0;
+	to->tDeadline = 0;
 	to->fn = NULL;
 }
 
@@ -200,10 +220,10 @@ AG_ResetTimer(void *p, AG_Timer *to, Uint32 ival)
 		goto out;
 	}
 	if (!src->caps[AG_SINK_TIMER]) {	/* Ordered timing wheel */
-		to->tSched = AG_GetTicks()+ival;
+		SchedTimer(to, ival);
 		TAILQ_REMOVE(&ob->timers, to, timers);
 		TAILQ_FOREACH(toOther, &ob->timers, timers) {
-			if (to->tSched < toOther->tSched) {
+			if (to->tDeadline < toOther->tDeadline) {
 				TAILQ_INSERT_BEFORE(toOther, to, timers);
 				break;
 			}
@@ -212,6 +232,9 @@ AG_ResetTimer(void *p, AG_Timer *to, Uint32 ival)
 			TAILQ_INSERT_TAIL(&ob->timers, to, timers);
 	}
 	to->ival = ival;
+#ifdef AG_THREADS
+	AG_TimerWakeup();
+#endif
 out:
 	AG_UnlockTimers(ob);
 	return (rv);
@@ -295,16 +318,23 @@ int
 AG_TimerWait(void *p, AG_Timer *to, Uint32 timeout)
 {
 	AG_Object *ob = (p != NULL) ? p : &agTimerMgr;
-	Uint32 elapsed = 0;
+	Uint64 now, tEnd, tWake;
 
+	now = AG_GetTimeNS();
+	tEnd = now + (Uint64)timeout*1000000;
 	for (;;) {
-		if (timeout > 0 && ++elapsed >= timeout) {
-			return (-1);
-		}
 		if (!AG_TimerIsRunning(ob, to)) {
 			break;
 		}
-		AG_Delay(1);
+		if (timeout > 0 && now >= tEnd) {
+			return (-1);
+		}
+		tWake = now + 1000000;
+		if (timeout > 0 && tWake > tEnd) {
+			tWake = tEnd;
+		}
+		AG_DelayUntilNS(tWake);
+		now = AG_GetTimeNS();
 	}
 	return (0);
 }
@@ -319,6 +349,19 @@ AG_TimerWait(void *p, AG_Timer *to, Uint32 timeout)
  */
 void
 AG_ProcessTimeouts(Uint32 t)
+{
+	Uint64 now = AG_GetTimeNS();
+
+	AG_ProcessTimeoutsNS(now +
+	    (Sint64)(Sint32)(t - (Uint32)(now/1000000))*1000000);
+}
+
+/*
+ * Execute the callback routines of timers expiring at or before the given
+ * AG_GetTimeNS() time.
+ */
+void
+AG_ProcessTimeoutsNS(Uint64 t)
 {
 	AG_Timer *to, *toNext;
 	AG_Object *ob, *obNext;
@@ -337,7 +380,7 @@ rescan:
 		     to = toNext) {
 			toNext = TAILQ_NEXT(to, timers);
 
-			if ((int)(to->tSched - t) > 0) {
+			if (to->tDeadline > t) {
 				continue;
 			}
 			rv = to->fn(to, &to->fnEvent);
@@ -49,7 +49,9 @@
  *   and this is correctly handled by our parser.
  *
  * - Compression. Using zlib, the Worker process conditionally performs
- *   compression (and chunking) of data on its end.
+ *   compression (and chunking) of data on its end. Modules producing large
+ *   or slow output may call WEB_BeginStream() to have it compressed and
+ *   sent incrementally as it is written (see WEB_FlushStream()).
  *
  * - Template engine. Parameters are set with Set() and Cat(). WEB_OutputHTML()
  *   and WEB_PutJSON_HTML() will return the document with substitutions applied.
@@ -81,6 +83,7 @@
 #include <sys/uio.h>
 #include <sys/un.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/wait.h>
 
 #include <assert.h>
@@ -104,6 +107,14 @@
 #ifdef HAVE_ZLIB
 #include <zlib.h>
 #endif
+#if defined(WEB_HAVE_SENDFILE) && defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 WEB_Application *webApp;		/* Application info */
 char webLogFile[FILENAME_MAX];		/* Logfile path */
@@ -281,6 +292,9 @@ WEB_InitFrontQuery(WEB_Query *q, WEB_Method meth, int sock, const char *url)
 	WEB_QueryInit(q, webApp->availLangs[0]);
 	q->method = meth;
 	q->sock = sock;
+#ifdef WEB_METRICS
+	q->tStart = WEB_MetricsNow();
+#endif
 	if (ParseURL(q, url) == -1) {
 		return (-1);
 	}
@@ -292,22 +306,33 @@ WEB_InitFrontQuery(WEB_Query *q, WEB_Method meth, int sock, const char *url)
 	return (0);
 }
 
-/* Parse and preliminarly validate a Range request */
+/*
+ * Parse and preliminarly validate a Range request. We accept a single
+ * "bytes=first-last" or "bytes=first-" range (last is inclusive).
+ */
 static int
 ParseRange(WEB_Query *q, char *s)
 {
 	char *from, *to;
 	const char *err;
 
+	if (strncasecmp(s, "bytes=", 6) == 0) {
+		s += 6;
+	}
 	if (strchr(s, ',') != NULL ||			/* Single range only */
 	    (from = Strsep(&s, "-")) == NULL ||
-	    (to = Strsep(&s, "-")) == NULL) {
+	    (to = Strsep(&s, "-")) == NULL ||
+	    from[0] == '\0') {
 		goto fail_416;
 	}
 	q->rangeFrom = (int)strtonum(from, 0, AG_INT_MAX, &err);
 	if (err) { goto fail_416; }
-	q->rangeTo = (int)strtonum(to, 0, AG_INT_MAX, &err);
-	if (err) { goto fail_416; }
+	if (to[0] == '\0') {
+		q->rangeTo = -1;			/* Up to end of entity */
+	} else {
+		q->rangeTo = (int)strtonum(to, 0, AG_INT_MAX, &err);
+		if (err) { goto fail_416; }
+	}
 	q->flags |= WEB_QUERY_RANGE;
 	return (0);
 fail_416:
@@ -339,6 +364,8 @@ WEB_ParseHeader(WEB_Query *q, char *s)
 		return ParseCookie(q, &s[8]);
 	} else if (strncasecmp(s, "Range: ",7)==0) {
 		return ParseRange(q, &s[7]);
+	} else if (strncasecmp(s, "If-None-Match: ",15)==0) {
+		Strlcpy(q->ifNoneMatch, &s[15], sizeof(q->ifNoneMatch));
 	}
 	return (0);
 }
@@ -777,7 +804,12 @@ WEB_ReadFormData(WEB_Query *q, int sock)
 	if ((buf = TryMalloc(q->contentLength + 1)) == NULL) {
 		return (-1);
 	}
-	if (WEB_SYS_Read(sock, buf, q->contentLength) != 0) {
+	if (q->preReadLen > 0) {		/* Read ahead by Frontend */
+		memcpy(buf, q->preRead, q->preReadLen);
+	}
+	if (q->contentLength > q->preReadLen &&
+	    WEB_SYS_Read(sock, &buf[q->preReadLen],
+	                 q->contentLength - q->preReadLen) != 0) {
 		AG_SetError("stdin: %s", strerror(errno));
 		goto fail;
 	}
@@ -968,6 +1000,10 @@ WEB_QueryInit(WEB_Query *q, const char *lang)
 	q->nCookies = 0;
 	q->contentType[0] = '\0';
 	q->contentLength = 0;
+	q->rangeFrom = 0;
+	q->rangeTo = -1;
+	q->preRead = NULL;
+	q->preReadLen = 0;
 	q->sess = NULL;
 	q->sock = -1;
 	q->nArgs = 0;
@@ -975,6 +1011,9 @@ WEB_QueryInit(WEB_Query *q, const char *lang)
 	q->userIP[0] = '\0';
 	q->userHost[0] = '\0';
 	q->userAgent[0] = '\0';
+	q->ifNoneMatch[0] = '\0';
+	q->jsonDepth = 0;
+	q->jsonNext = 0;
 	q->code[0] = '\0';
 	Strlcpy(q->lang, lang, sizeof(q->lang));
 	TAILQ_INIT(&q->args);
@@ -985,6 +1024,13 @@ WEB_QueryInit(WEB_Query *q, const char *lang)
 	q->data = NULL;
 	q->dataSize = 0;
 	q->dataLen = 0;
+	q->fileFd = -1;
+	q->fileOffs = 0;
+	q->fileLen = 0;
+	q->stream = NULL;
+	q->bytesOut = 0;
+	q->tStart = 0;
+	memset(q->tPhase, 0, sizeof(q->tPhase));
 }
 
 /* Prepare for processing a Frontend or a Worker query. */
@@ -1135,6 +1181,7 @@ WEB_FlushQuery_DEFLATE(WEB_Query *q)
 	char chunkHead[16];
 	int flush=0, rv;
 	z_stream strm;
+	Uint64 t;
 
 /*	WEB_LogDebug("FlushQuery_DEFLATE(method=%s, head=%lu, data=%lu, lvl=%d)",
 	    webMethods[q->method].name, q->headLen, q->dataLen, q->compressLvl); */
@@ -1178,7 +1225,10 @@ WEB_FlushQuery_DEFLATE(WEB_Query *q)
 			    strm.avail_out, flush == Z_FINISH ? "FINISH" :
 			                                        "NO_FLUSH");
 #endif
-			if ((rv = deflate(&strm, flush)) == Z_STREAM_ERROR) {
+			WEB_PHASE_BEGIN(t);
+			rv = deflate(&strm, flush);
+			WEB_PHASE_END(q, WEB_PHASE_COMPRESS, t);
+			if (rv == Z_STREAM_ERROR) {
 				WEB_LogErr("deflate: error %d", rv);
 				AG_FatalError("deflate failed");
 			}
@@ -1214,55 +1264,506 @@ WEB_FlushQuery_DEFLATE(WEB_Query *q)
 
 	if (q->method != WEB_METHOD_HEAD) {
 		WEB_SYS_Write(q->sock, "0\r\n\r\n",5);
+		q->bytesOut += q->headLen + nWrote + 5;
 	} else {
 		WEB_SetHeader(q, "Content-Length", "%lu", nWrote);
 		WEB_WriteHeaders(q->sock, q);
+		q->bytesOut += q->headLen;
 	}
 }
 #endif /* HAVE_ZLIB */
 
-/* Validate and process a Range request. */
+/*
+ * Writev loop. Write all iovecs, resuming after short writes and checking
+ * signals (as in WEB_SYS_Write()). The iovec array is modified.
+ */
+static int
+WEB_SYS_Writev(int fd, struct iovec *iov, int iovcnt)
+{
+	ssize_t rv = 0;
+
+	for (;;) {
+		while (iovcnt > 0 && (size_t)rv >= iov->iov_len) {
+			rv -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt == 0) {
+			break;
+		}
+		if (rv > 0) {
+			iov->iov_base = (char *)iov->iov_base + rv;
+			iov->iov_len -= rv;
+		}
+		if ((rv = writev(fd, iov, iovcnt)) == -1) {
+			if (errno == EINTR || errno == EAGAIN) {
+				WEB_CheckSignals();
+				rv = 0;
+				continue;
+			}
+			AG_SetError("writev: %s", strerror(errno));
+			return (-1);
+		} else if (rv == 0) {
+			AG_SetErrorS("EOF");
+			return (-1);
+		}
+	}
+	return (0);
+}
+
+/*
+ * Write the HTTP response headers and an in-memory entity-body with a single
+ * writev(2). Separate writes would leave the body waiting for the client's
+ * delayed ACK (Nagle), stalling keep-alive requests by up to ~40ms.
+ */
+static int
+WEB_WriteHeadersBody(WEB_Query *q, const void *data, size_t len)
+{
+	struct iovec iov[2];
+
+	q->head[q->headLen  ] = '\r';
+	q->head[q->headLen+1] = '\n';
+	q->head[q->headLen+2] = '\0';
+	iov[0].iov_base = q->head;
+	iov[0].iov_len = q->headLen+2;
+	iov[1].iov_base = (void *)data;
+	iov[1].iov_len = len;
+	return WEB_SYS_Writev(q->sock, iov, 2);
+}
+
+/* Streaming output state. */
+struct web_stream {
+	int deflate;			/* Deflate encoding is active */
+	int error;			/* Write failed (discard output) */
+	size_t nIn, nOut;		/* Statistics */
+#ifdef HAVE_ZLIB
+	z_stream strm;
+	Uint8 out[WEB_DATA_BUFSIZE];	/* Compressed output */
+#endif
+};
+
+/* Write a single chunk in chunked transfer encoding. */
+static int
+WEB_StreamChunk(WEB_Query *q, const void *data, size_t len)
+{
+	struct web_stream *st = q->stream;
+	struct iovec vec[3];
+	char chunkHead[16];
+	size_t chunkHeadLen;
+
+	if (st->error || q->method == WEB_METHOD_HEAD) {
+		return (0);
+	}
+	chunkHeadLen = snprintf(chunkHead, sizeof(chunkHead), "%lx\r\n",
+	    (Ulong)len);
+	vec[0].iov_base = chunkHead;
+	vec[0].iov_len = chunkHeadLen;
+	vec[1].iov_base = (void *)data;
+	vec[1].iov_len = len;
+	vec[2].iov_base = "\r\n";
+	vec[2].iov_len = 2;
+	if (WEB_SYS_Writev(q->sock, vec, 3) == -1) {
+		WEB_LogErr("Stream: %s", AG_GetError());
+		st->error = 1;
+		return (-1);
+	}
+	st->nOut += len;
+	q->bytesOut += chunkHeadLen + len + 2;
+	return (0);
+}
+
+/*
+ * Encode and write a block of streamed data. The flush argument is one of
+ * the zlib flush modes (Z_NO_FLUSH, Z_SYNC_FLUSH or Z_FINISH).
+ */
+static int
+WEB_StreamEncode(WEB_Query *q, const Uint8 *data, size_t len, int flush)
+{
+	struct web_stream *st = q->stream;
+#ifdef HAVE_ZLIB
+	size_t nOut;
+	Uint64 t;
+	int rv;
+#endif
+	st->nIn += len;
+#ifdef HAVE_ZLIB
+	if (st->deflate) {
+		st->strm.next_in = (Uint8 *)data;
+		st->strm.avail_in = len;
+		do {
+			st->strm.next_out = st->out;
+			st->strm.avail_out = sizeof(st->out);
+			WEB_PHASE_BEGIN(t);
+			rv = deflate(&st->strm, flush);
+			WEB_PHASE_END(q, WEB_PHASE_COMPRESS, t);
+			if (rv == Z_STREAM_ERROR) {
+				WEB_LogErr("deflate: error %d", rv);
+				AG_FatalError("deflate failed");
+			}
+			nOut = sizeof(st->out) - st->strm.avail_out;
+			if (nOut > 0 &&
+			    WEB_StreamChunk(q, st->out, nOut) == -1)
+				return (-1);
+		} while (st->strm.avail_out == 0);
+		return (0);
+	}
+#endif
+	return (len > 0) ? WEB_StreamChunk(q, data, len) : 0;
+}
+
+/*
+ * Switch the response to streaming mode. Headers are written immediately
+ * (with chunked transfer encoding, and deflate encoding if the client
+ * accepts it and compression is enabled). Further output is written to the
+ * client whenever WEB_STREAM_BUFSIZE bytes are buffered, at flush points
+ * set by WEB_FlushStream(), and by WEB_FlushQuery() which ends the stream.
+ * Headers can no longer be modified once the stream has begun.
+ */
+int
+WEB_BeginStream(WEB_Query *q)
+{
+	struct web_stream *st;
+#ifdef HAVE_ZLIB
+	int rv;
+#endif
+	if (q->flags & WEB_QUERY_STREAM) {
+		return (0);
+	}
+	if (q->fileFd != -1) {
+		AG_SetErrorS("Cannot stream a file response");
+		return (-1);
+	}
+	if ((st = TryMalloc(sizeof(struct web_stream))) == NULL) {
+		return (-1);
+	}
+	st->deflate = 0;
+	st->error = 0;
+	st->nIn = 0;
+	st->nOut = 0;
+#ifdef HAVE_ZLIB
+	if ((q->flags & WEB_QUERY_DEFLATE) &&
+	   !(q->flags & WEB_QUERY_NOCOMPRESSION)) {
+		st->strm.zalloc = Z_NULL;
+		st->strm.zfree = Z_NULL;
+		st->strm.opaque = Z_NULL;
+		if ((rv = deflateInit(&st->strm, q->compressLvl)) != Z_OK) {
+			WEB_LogErr("deflateInit: error %d", rv);
+		} else {
+			st->deflate = 1;
+			WEB_SetHeaderS(q, "Content-Encoding", "deflate");
+		}
+	}
+#endif
+	q->flags &= ~(WEB_QUERY_RANGE);
+	q->flags |= WEB_QUERY_STREAM;
+	q->stream = st;
+
+	WEB_SetHeaderS(q, "Transfer-Encoding", "chunked");
+	if (WEB_WriteHeaders(q->sock, q) == -1) {
+		WEB_LogErr("Stream headers: %s", AG_GetError());
+		st->error = 1;
+	}
+	q->bytesOut += q->headLen;
+	return (0);
+}
+
+/*
+ * Set a flush point: write any buffered output to the client. With deflate
+ * encoding, a sync flush is performed such that the client can decode all
+ * data written so far (at some cost in compression ratio).
+ */
+int
+WEB_FlushStream(WEB_Query *q)
+{
+	int rv;
+
+	if (!(q->flags & WEB_QUERY_STREAM)) {
+		return (0);
+	}
+#ifdef HAVE_ZLIB
+	rv = WEB_StreamEncode(q, q->data, q->dataLen, Z_SYNC_FLUSH);
+#else
+	rv = WEB_StreamEncode(q, q->data, q->dataLen, 0);
+#endif
+	q->dataLen = 0;
+	return (rv);
+}
+
+/*
+ * Write data in streaming mode (called by WEB_Write() when the bounded
+ * buffer would overflow). Drain the buffer, and either encode large blocks
+ * directly or start buffering again.
+ */
+void
+WEB_StreamWrite(WEB_Query *q, const void *data, size_t len)
+{
+#ifdef HAVE_ZLIB
+	WEB_StreamEncode(q, q->data, q->dataLen, Z_NO_FLUSH);
+#else
+	WEB_StreamEncode(q, q->data, q->dataLen, 0);
+#endif
+	q->dataLen = 0;
+
+	if (len >= WEB_STREAM_BUFSIZE) {
+#ifdef HAVE_ZLIB
+		WEB_StreamEncode(q, data, len, Z_NO_FLUSH);
+#else
+		WEB_StreamEncode(q, data, len, 0);
+#endif
+		return;
+	}
+	if (len > q->dataSize) {
+		q->dataSize = WEB_STREAM_BUFSIZE;
+		q->data = Realloc(q->data, q->dataSize);
+	}
+	memcpy(q->data, data, len);
+	q->dataLen = len;
+}
+
+/* Release streaming state (without writing any output). */
+static void
+WEB_StreamFree(WEB_Query *q)
+{
+#ifdef HAVE_ZLIB
+	if (q->stream->deflate)
+		deflateEnd(&q->stream->strm);
+#endif
+	free(q->stream);
+	q->stream = NULL;
+	q->flags &= ~(WEB_QUERY_STREAM);
+}
+
+/* Write the remaining output and the terminating chunk. */
+static void
+WEB_EndStream(WEB_Query *q)
+{
+	struct web_stream *st = q->stream;
+
+#ifdef HAVE_ZLIB
+	WEB_StreamEncode(q, q->data, q->dataLen, Z_FINISH);
+#else
+	WEB_StreamEncode(q, q->data, q->dataLen, 0);
+#endif
+	if (!st->error && q->method != WEB_METHOD_HEAD) {
+		WEB_SYS_Write(q->sock, "0\r\n\r\n", 5);
+		q->bytesOut += 5;
+	}
+	WEB_LogDebug("STREAM: %lu -> %lu bytes%s", (Ulong)st->nIn,
+	    (Ulong)st->nOut, st->deflate ? " (deflate)" : "");
+	WEB_StreamFree(q);
+}
+
+/*
+ * Wait for a non-blocking socket to become writable, for at most
+ * WEB_HTTP_REQ_TIMEOUT seconds.
+ */
+static int
+WEB_SYS_WaitWritable(int sock)
+{
+	fd_set wrFds;
+	struct timeval tv;
+	int rv;
+
+	for (;;) {
+		FD_ZERO(&wrFds);
+		FD_SET(sock, &wrFds);
+		tv.tv_sec = WEB_HTTP_REQ_TIMEOUT;
+		tv.tv_usec = 0;
+		if ((rv = select(sock+1, NULL, &wrFds, NULL, &tv)) == -1) {
+			if (errno == EINTR) {
+				WEB_CheckSignals();
+				continue;
+			}
+			AG_SetError("select: %s", strerror(errno));
+			return (-1);
+		} else if (rv == 0) {
+			AG_SetErrorS("Write timeout");
+			return (-1);
+		}
+		return (0);
+	}
+}
+
+/*
+ * Write a region of a file to a socket. Use sendfile(2) where available,
+ * otherwise fall back to a pread(2) / write(2) loop.
+ */
+static int
+WEB_SYS_CopyFile(int sock, int fd, off_t offs, size_t len)
+{
+	char buf[WEB_DATA_BUFSIZE];
+	ssize_t rv;
+
+	while (len > 0) {
+		rv = pread(fd, buf, MIN(len, sizeof(buf)), offs);
+		if (rv == -1) {
+			if (errno == EINTR || errno == EAGAIN) {
+				WEB_CheckSignals();
+				continue;
+			}
+			AG_SetError("pread: %s", strerror(errno));
+			return (-1);
+		} else if (rv == 0) {
+			AG_SetErrorS("File truncated");
+			return (-1);
+		}
+		if (WEB_SYS_Write(sock, buf, (size_t)rv) == -1) {
+			return (-1);
+		}
+		offs += rv;
+		len -= rv;
+	}
+	return (0);
+}
+
+static int
+WEB_SYS_SendFile(int sock, int fd, off_t offs, size_t len)
+{
+#if defined(WEB_HAVE_SENDFILE) && defined(__linux__)
+	ssize_t rv;
+
+	while (len > 0) {
+		if ((rv = sendfile(sock, fd, &offs, len)) == -1) {
+			if (errno == EINTR) {
+				WEB_CheckSignals();
+				continue;
+			} else if (errno == EAGAIN) {
+				if (WEB_SYS_WaitWritable(sock) == -1) {
+					return (-1);
+				}
+				continue;
+			} else if (errno == EINVAL || errno == ENOSYS) {
+				return WEB_SYS_CopyFile(sock, fd, offs, len);
+			}
+			AG_SetError("sendfile: %s", strerror(errno));
+			return (-1);
+		} else if (rv == 0) {
+			AG_SetErrorS("File truncated");
+			return (-1);
+		}
+		len -= rv;
+	}
+	return (0);
+#elif defined(WEB_HAVE_SENDFILE)
+	off_t nSent;
+
+	while (len > 0) {
+		nSent = 0;
+		if (sendfile(fd, sock, offs, len, NULL, &nSent, 0) == -1) {
+			if (errno == EINTR || errno == EAGAIN ||
+			    errno == EBUSY) {
+				int waitWr = (errno == EAGAIN && nSent == 0);
+
+				offs += nSent;
+				len -= nSent;
+				WEB_CheckSignals();
+				if (waitWr && WEB_SYS_WaitWritable(sock) == -1) {
+					return (-1);
+				}
+				continue;
+			} else if (errno == EOPNOTSUPP || errno == ENOTSOCK) {
+				return WEB_SYS_CopyFile(sock, fd, offs, len);
+			}
+			AG_SetError("sendfile: %s", strerror(errno));
+			return (-1);
+		} else if (nSent == 0) {
+			AG_SetErrorS("File truncated");
+			return (-1);
+		}
+		offs += nSent;
+		len -= nSent;
+	}
+	return (0);
+#else
+	return WEB_SYS_CopyFile(sock, fd, offs, len);
+#endif
+}
+
+/*
+ * Validate and process a Range request. The entity-body is either the
+ * query's file region (sent directly from the file) or q->data.
+ */
 static void
 WEB_FlushQuery_RANGE(WEB_Query *q)
 {
-	Uint rangeLen;
+	size_t total, last, rangeLen;
 	
+	total = (q->fileFd != -1) ? q->fileLen : q->dataLen;
+
 	WEB_LogDebug("FlushQuery_RANGE(head=%lu, range=%d-%d/%lu)",
-	    q->headLen, q->rangeFrom, q->rangeTo, q->dataLen);
+	    (Ulong)q->headLen, q->rangeFrom, q->rangeTo, (Ulong)total);
 
-	if (q->rangeFrom > q->rangeTo ||
-	    q->rangeTo > q->dataLen ||
-	    (q->rangeFrom + q->rangeTo) > q->dataLen) {
+	if (q->rangeTo == -1 || (size_t)q->rangeTo >= total) {
+		last = total-1;
+	} else {
+		last = (size_t)q->rangeTo;
+	}
+	if (total == 0 || (size_t)q->rangeFrom > last) {
 		goto fail_416;
 	}
-	rangeLen = (q->rangeTo - q->rangeFrom);
+	rangeLen = last - (size_t)q->rangeFrom + 1;
 
 	WEB_SetCode(q, "206 Partial Content");
-	WEB_SetHeader(q, "Content-Range", "bytes %ld-%ld/%lu",
-	    q->rangeFrom, q->rangeTo, q->dataLen);
-	WEB_SetHeader(q, "Content-Length", "%u", rangeLen);
+	WEB_SetHeader(q, "Content-Range", "bytes %d-%lu/%lu",
+	    q->rangeFrom, (Ulong)last, (Ulong)total);
+	WEB_SetHeader(q, "Content-Length", "%lu", (Ulong)rangeLen);
 
 	/* Write HTTP headers and partial content. */
-	WEB_WriteHeaders(q->sock, q);
-	if (q->method != WEB_METHOD_HEAD)
-		WEB_SYS_Write(q->sock, &q->data[q->rangeFrom], rangeLen);
-
+	q->bytesOut += q->headLen;
+	if (q->method == WEB_METHOD_HEAD) {
+		WEB_WriteHeaders(q->sock, q);
+		return;
+	}
+	q->bytesOut += rangeLen;
+	if (q->fileFd != -1) {
+		WEB_WriteHeaders(q->sock, q);
+		if (WEB_SYS_SendFile(q->sock, q->fileFd,
+		    q->fileOffs + q->rangeFrom, rangeLen) == -1)
+			WEB_LogErr("Range SendFile: %s", AG_GetError());
+	} else {
+		WEB_WriteHeadersBody(q, &q->data[q->rangeFrom], rangeLen);
+	}
 	return;
 fail_416:
 	WEB_SetCode(q, "416 Range Not Satisfiable");
+	WEB_SetHeader(q, "Content-Range", "bytes */%lu", (Ulong)total);
 	WEB_SetHeaderS(q, "Content-Language", "en");
+	q->dataLen = 0;
 	WEB_OutputError(q, "Requested range is not satisfiable");
+	WEB_SetHeader(q, "Content-Length", "%lu", (Ulong)q->dataLen);
+	WEB_WriteHeadersBody(q, q->data, q->dataLen);
+	q->bytesOut += q->headLen + q->dataLen;
+}
+
+/* Write a complete file region as the entity-body. */
+static void
+WEB_FlushQuery_FILE(WEB_Query *q)
+{
+	WEB_SetHeader(q, "Content-Length", "%lu", (Ulong)q->fileLen);
 	WEB_WriteHeaders(q->sock, q);
-	WEB_SYS_Write(q->sock, q->data, q->dataLen);
+	q->bytesOut += q->headLen;
+	if (q->method != WEB_METHOD_HEAD) {
+		q->bytesOut += q->fileLen;
+	}
+	if (q->method != WEB_METHOD_HEAD &&
+	    WEB_SYS_SendFile(q->sock, q->fileFd, q->fileOffs, q->fileLen) == -1)
+		WEB_LogErr("SendFile: %s", AG_GetError());
 }
 
 static __inline__ void
 WEB_ClearQuery(WEB_Query *q)
 {
+	if (q->stream != NULL) {
+		WEB_StreamFree(q);
+	}
 	free(q->data);
 	q->data = NULL;
 	q->dataSize = 0;
 	q->dataLen = 0;
+	if (q->fileFd != -1) {
+		close(q->fileFd);
+		q->fileFd = -1;
+	}
 }
 
 /*
@@ -1273,8 +1774,12 @@ WEB_ClearQuery(WEB_Query *q)
 void
 WEB_FlushQuery(WEB_Query *q)
 {
-	if (q->flags & WEB_QUERY_RANGE) {		/* Range request */
+	if (q->flags & WEB_QUERY_STREAM) {		/* Streaming */
+		WEB_EndStream(q);
+	} else if (q->flags & WEB_QUERY_RANGE) {	/* Range request */
 		WEB_FlushQuery_RANGE(q);
+	} else if (q->fileFd != -1) {			/* File region */
+		WEB_FlushQuery_FILE(q);
 #ifdef HAVE_ZLIB
 	} else if ((q->flags & WEB_QUERY_DEFLATE) &&		/* Gzip */
 	          !(q->flags & WEB_QUERY_NOCOMPRESSION) &&
@@ -1288,21 +1793,29 @@ WEB_FlushQuery(WEB_Query *q)
 		if (q->dataLen > 0) {
 			WEB_SetHeader(q, "Content-Length", "%lu", q->dataLen);
 		}
-		WEB_WriteHeaders(q->sock, q);
-		if (q->method != WEB_METHOD_HEAD)
-			WEB_SYS_Write(q->sock, q->data, q->dataLen);
+		q->bytesOut += q->headLen;
+		if (q->method != WEB_METHOD_HEAD) {
+			WEB_WriteHeadersBody(q, q->data, q->dataLen);
+			q->bytesOut += q->dataLen;
+		} else {
+			WEB_WriteHeaders(q->sock, q);
+		}
 	}
 	WEB_ClearQuery(q);
 }
 
-/* Execute a module query (in Worker process). */
-int
-WEB_ExecWorkerQuery(WEB_Query *q, const WEB_SessionOps *Sops)
+/*
+ * Execute a module query. Return the name of the command executed in
+ * opName (or "" if no command matched).
+ */
+static int
+ExecWorkerQuery(WEB_Query *q, const WEB_SessionOps *Sops, char *opName)
 {
 	const char *op, *c;
 	const WEB_Argument *opArg;
 	WEB_Module *mod = NULL;				/* compiler happy */
 	WEB_Command *cmd;
+	Uint64 t;
 	int i;
 
 	if ((opArg = WEB_GetArgument(q, "op")) != NULL) {
@@ -1344,10 +1857,12 @@ WEB_ExecWorkerQuery(WEB_Query *q, const WEB_SessionOps *Sops)
 			}
 		}
 	}
+	t = 0;
 	for (cmd = mod->commands; cmd->name != NULL; cmd++) {
 		if (strcmp(cmd->name, op) != 0) {
 			continue;
 		}
+		Strlcpy(opName, cmd->name, WEB_OPNAME_MAX);
 		WEB_SetHeaderS(q, "Accept-Ranges", "bytes");
 		WEB_SetHeaderS(q, "Vary", "Accept-Language,Accept-Encoding,"
 		                          "User-Agent");
@@ -1356,7 +1871,19 @@ WEB_ExecWorkerQuery(WEB_Query *q, const WEB_SessionOps *Sops)
 		WEB_SetHeaderS(q, "Cache-Control", "no-cache, no-store, "
 		                                   "must-revalidate");
 		WEB_SetHeaderS(q, "Expires", "0");
-
+		if (cmd->compressLvl != 0) {
+			WEB_SetCompression(q, (cmd->compressLvl > 0),
+			    cmd->compressLvl);
+		}
+#ifdef WEB_RESPONSE_CACHE
+		if (cmd->cacheTTL > 0 && (q->method == WEB_METHOD_GET ||
+		                          q->method == WEB_METHOD_HEAD)) {
+			WEB_SetHeaderS(q, "Cache-Control", "no-cache");
+			if (WEB_CacheServe(q, op) == 1)
+				return (0);
+		}
+#endif
+		WEB_PHASE_BEGIN(t);
 		if (cmd->type != NULL && strcmp(cmd->type, "[json-status]")==0) {
 			WEB_SetHeaderS(q, "Content-Type", "application/json; "
 			                                  "charset=utf8");
@@ -1410,6 +1937,14 @@ WEB_ExecWorkerQuery(WEB_Query *q, const WEB_SessionOps *Sops)
 		WEB_SetCode(q, "404 Not Found");
 		goto fail;
 	}
+	WEB_PHASE_END(q, WEB_PHASE_MODULE, t);
+#ifdef WEB_RESPONSE_CACHE
+	if (cmd->cacheTTL > 0 && (q->method == WEB_METHOD_GET ||
+	                          q->method == WEB_METHOD_HEAD)) {
+		WEB_CacheFlush(q, op, cmd->cacheTTL);
+		return (0);
+	}
+#endif
 	WEB_FlushQuery(q);
 	return (0);
 fail:
@@ -1421,9 +1956,33 @@ fail:
 	return (0);
 }
 
-/* Update the value of an existing header (less common case). */
-void
-WEB_EditHeader(WEB_Query *q, char *cLine, const char *value)
+/* Execute a module query (in Worker process). */
+int
+WEB_ExecWorkerQuery(WEB_Query *q, const WEB_SessionOps *Sops)
+{
+	char op[WEB_OPNAME_MAX];
+	int rv;
+
+	op[0] = '\0';
+#ifdef WEB_METRICS
+	if (q->tStart != 0) {
+		q->tPhase[WEB_PHASE_QUEUE] = (Uint32)(WEB_MetricsNow() -
+		                                      q->tStart);
+	} else {
+		q->tStart = WEB_MetricsNow();
+	}
+#endif
+	rv = ExecWorkerQuery(q, Sops, op);
+#ifdef WEB_METRICS
+	q->tPhase[WEB_PHASE_TOTAL] = (Uint32)(WEB_MetricsNow() - q->tStart);
+	WEB_MetricsRecord(q, op);
+#endif
+	return (rv);
+}
+
+/* Update the value of an existing header (less common case). */
+void
+WEB_EditHeader(WEB_Query *q, char *cLine, const char *value)
 {
 	char *cSep, *cEnd;
 	size_t oldLen, newLen;
@@ -1958,6 +2517,420 @@ WEB_PutJSON(WEB_Query *q, const char *key, const char *fmt, ...)
 	free(val);
 }
 
+/*
+ * JSON output. Strings are escaped by scanning for characters which need
+ * escaping in 16 or 32-byte blocks (SSE2 / AVX2) or 8-byte words elsewhere,
+ * copying clean runs at once. Numbers are formatted without printf. Output
+ * is appended directly to the query buffer.
+ */
+
+/* Ensure room for len more bytes in the output buffer. */
+static __inline__ void
+JSON_Reserve(WEB_Query *q, size_t len)
+{
+	if ((q->flags & WEB_QUERY_STREAM) &&
+	    q->dataLen+len > WEB_STREAM_BUFSIZE &&
+	    q->dataLen > 0) {
+		WEB_StreamWrite(q, "", 0);		/* Drain buffer */
+	}
+	if (q->dataLen+len > q->dataSize) {
+		q->dataSize = q->dataLen + len + WEB_DATA_BUFSIZE;
+		q->data = Realloc(q->data, q->dataSize);
+	}
+}
+
+/* Characters needing escape (0 = none, 'u' = \u00XX, else \c). */
+static const char jsonEscapes[256] = {
+	'u','u','u','u','u','u','u','u','b','t','n','u','f','r','u','u',
+	'u','u','u','u','u','u','u','u','u','u','u','u','u','u','u','u',
+	 0,  0, '"', 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 'h', 0, 'h', 0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, '\\',0,  0,  0,
+};
+
+/* Return the length of the leading run of bytes not needing escape. */
+static __inline__ size_t
+JSON_CleanRun(const Uchar *s, size_t len, Uint flags)
+{
+	size_t i = 0;
+#if defined(__AVX2__)
+	const __m256i vQuote = _mm256_set1_epi8('"');
+	const __m256i vBksl = _mm256_set1_epi8('\\');
+	const __m256i vCtrl = _mm256_set1_epi8(0x1f);
+	const __m256i vLt = _mm256_set1_epi8('<');
+	const __m256i vGt = _mm256_set1_epi8('>');
+
+	for (; i+32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)&s[i]);
+		__m256i m = _mm256_or_si256(
+		    _mm256_or_si256(_mm256_cmpeq_epi8(v, vQuote),
+		                    _mm256_cmpeq_epi8(v, vBksl)),
+		    _mm256_cmpeq_epi8(_mm256_max_epu8(v, vCtrl), vCtrl));
+		Uint32 mask;
+
+		if (flags & WEB_JSON_NOHTML) {
+			m = _mm256_or_si256(m, _mm256_or_si256(
+			    _mm256_cmpeq_epi8(v, vLt),
+			    _mm256_cmpeq_epi8(v, vGt)));
+		}
+		if ((mask = (Uint32)_mm256_movemask_epi8(m)) != 0)
+			return (i + __builtin_ctz(mask));
+	}
+#endif
+#if defined(__SSE2__)
+	{
+		const __m128i vQuote = _mm_set1_epi8('"');
+		const __m128i vBksl = _mm_set1_epi8('\\');
+		const __m128i vCtrl = _mm_set1_epi8(0x1f);
+		const __m128i vLt = _mm_set1_epi8('<');
+		const __m128i vGt = _mm_set1_epi8('>');
+
+		for (; i+16 <= len; i += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i *)&s[i]);
+			__m128i m = _mm_or_si128(
+			    _mm_or_si128(_mm_cmpeq_epi8(v, vQuote),
+			                 _mm_cmpeq_epi8(v, vBksl)),
+			    _mm_cmpeq_epi8(_mm_max_epu8(v, vCtrl), vCtrl));
+			Uint mask;
+
+			if (flags & WEB_JSON_NOHTML) {
+				m = _mm_or_si128(m, _mm_or_si128(
+				    _mm_cmpeq_epi8(v, vLt),
+				    _mm_cmpeq_epi8(v, vGt)));
+			}
+			if ((mask = (Uint)_mm_movemask_epi8(m)) != 0)
+				return (i + __builtin_ctz(mask));
+		}
+	}
+#else
+	/* Word at a time ("has zero byte" tests). */
+	{
+		const Uint64 ones = 0x0101010101010101ULL;
+		const Uint64 highs = 0x8080808080808080ULL;
+
+		for (; i+8 <= len; i += 8) {
+			Uint64 w, t;
+
+			memcpy(&w, &s[i], 8);
+			t = ((w ^ (ones*'"')) - ones) & ~(w ^ (ones*'"'));
+			t |= ((w ^ (ones*'\\')) - ones) & ~(w ^ (ones*'\\'));
+			t |= (w - ones*0x20) & ~w;
+			if (flags & WEB_JSON_NOHTML) {
+				t |= ((w ^ (ones*'<')) - ones) & ~(w ^ (ones*'<'));
+				t |= ((w ^ (ones*'>')) - ones) & ~(w ^ (ones*'>'));
+			}
+			if ((t & highs) != 0)
+				break;		/* Locate it below */
+		}
+	}
+#endif
+	for (; i < len; i++) {
+		Uchar c = s[i];
+
+		if (c < 0x60 && jsonEscapes[c] != 0 &&
+		    (jsonEscapes[c] != 'h' || (flags & WEB_JSON_NOHTML)))
+			break;
+	}
+	return (i);
+}
+
+/*
+ * Write the string s of len bytes, escaped for inclusion in a JSON string
+ * (without the surrounding quotes). With WEB_JSON_NOHTML, also replace '<'
+ * and '>' by HTML entities.
+ */
+void
+WEB_PutJSON_Escaped(WEB_Query *q, const char *s, size_t len, Uint flags)
+{
+	static const char hex[] = "0123456789abcdef";
+	const Uchar *p = (const Uchar *)s;
+	size_t run;
+
+	if (!(q->flags & WEB_QUERY_STREAM))
+		JSON_Reserve(q, len);
+
+	while (len > 0) {
+		Uchar c;
+		char *d;
+
+		if ((run = JSON_CleanRun(p, len, flags)) > 0) {
+			WEB_Write(q, p, run);
+			p += run;
+			len -= run;
+			if (len == 0)
+				break;
+		}
+		c = *p++;
+		len--;
+		JSON_Reserve(q, 6);
+		d = (char *)&q->data[q->dataLen];
+		switch (jsonEscapes[c]) {
+		case 'u':
+			d[0] = '\\'; d[1] = 'u'; d[2] = '0'; d[3] = '0';
+			d[4] = hex[c >> 4];
+			d[5] = hex[c & 0xf];
+			q->dataLen += 6;
+			break;
+		case 'h':
+			memcpy(d, (c == '<') ? "&lt;" : "&gt;", 4);
+			q->dataLen += 4;
+			break;
+		default:
+			d[0] = '\\';
+			d[1] = jsonEscapes[c];
+			q->dataLen += 2;
+			break;
+		}
+	}
+}
+
+/* Format an unsigned integer; return the number of digits written. */
+static __inline__ size_t
+JSON_FormatUint(char *dst, Uint64 v)
+{
+	static const char digits2[] =
+	    "00010203040506070809101112131415161718192021222324"
+	    "25262728293031323334353637383940414243444546474849"
+	    "50515253545556575859606162636465666768697071727374"
+	    "75767778798081828384858687888990919293949596979899";
+	char buf[24], *p = &buf[sizeof(buf)];
+	size_t len;
+
+	while (v >= 100) {
+		Uint i = (Uint)(v % 100) * 2;
+
+		v /= 100;
+		*--p = digits2[i+1];
+		*--p = digits2[i];
+	}
+	if (v >= 10) {
+		*--p = digits2[v*2+1];
+		*--p = digits2[v*2];
+	} else {
+		*--p = (char)('0' + v);
+	}
+	len = &buf[sizeof(buf)] - p;
+	memcpy(dst, p, len);
+	return (len);
+}
+
+/* Write a separator and (if given) a key before a new value. */
+static void
+JSON_BeginValue(WEB_Query *q, const char *key)
+{
+	if (q->jsonDepth > 0) {
+		Uint32 bit = 1U << (q->jsonDepth - 1);
+
+		if (q->jsonNext & bit) {
+			WEB_PutC(q, ',');
+		}
+		q->jsonNext |= bit;
+	}
+	if (key != NULL) {
+		WEB_PutC(q, '"');
+		WEB_PutJSON_Escaped(q, key, strlen(key), 0);
+		WEB_PutS(q, "\": ");
+	}
+}
+
+/*
+ * Complete a value. Top-level members are followed by a comma, following
+ * the WEB_PutJSON() convention (as expected by "[json]" commands).
+ */
+static __inline__ void
+JSON_EndValue(WEB_Query *q)
+{
+	if (q->jsonDepth == 0)
+		WEB_PutC(q, ',');
+}
+
+/*
+ * Enter a nested object or array. Fail if the nesting would exceed
+ * WEB_JSON_DEPTH_MAX (one bit of jsonNext is used per level).
+ */
+static int
+JSON_BeginNested(WEB_Query *q, const char *key, char c)
+{
+	if (q->jsonDepth >= WEB_JSON_DEPTH_MAX) {
+		AG_SetError("JSON nesting exceeds %d levels", WEB_JSON_DEPTH_MAX);
+		return (-1);
+	}
+	JSON_BeginValue(q, key);
+	WEB_PutC(q, c);
+	q->jsonDepth++;
+	q->jsonNext &= ~(1U << (q->jsonDepth - 1));
+	return (0);
+}
+
+/*
+ * Begin a JSON object (as a member named key, or a value if key is NULL).
+ * On failure, nothing is written and WEB_JSON_EndObject() must not be called.
+ */
+int
+WEB_JSON_BeginObject(WEB_Query *q, const char *key)
+{
+	return JSON_BeginNested(q, key, '{');
+}
+
+void
+WEB_JSON_EndObject(WEB_Query *q)
+{
+	WEB_PutC(q, '}');
+	if (q->jsonDepth > 0) { q->jsonDepth--; }
+	JSON_EndValue(q);
+}
+
+/*
+ * Begin a JSON array (as a member named key, or a value if key is NULL).
+ * On failure, nothing is written and WEB_JSON_EndArray() must not be called.
+ */
+int
+WEB_JSON_BeginArray(WEB_Query *q, const char *key)
+{
+	return JSON_BeginNested(q, key, '[');
+}
+
+void
+WEB_JSON_EndArray(WEB_Query *q)
+{
+	WEB_PutC(q, ']');
+	if (q->jsonDepth > 0) { q->jsonDepth--; }
+	JSON_EndValue(q);
+}
+
+/* Write a string value (or member if key is not NULL). */
+void
+WEB_JSON_StringN(WEB_Query *q, const char *key, const char *s, size_t len)
+{
+	JSON_BeginValue(q, key);
+	WEB_PutC(q, '"');
+	WEB_PutJSON_Escaped(q, s, len, 0);
+	WEB_PutC(q, '"');
+	JSON_EndValue(q);
+}
+
+void
+WEB_JSON_String(WEB_Query *q, const char *key, const char *s)
+{
+	if (s == NULL) {
+		WEB_JSON_Null(q, key);
+		return;
+	}
+	WEB_JSON_StringN(q, key, s, strlen(s));
+}
+
+/* Write an integer value (or member if key is not NULL). */
+void
+WEB_JSON_Int(WEB_Query *q, const char *key, Sint64 v)
+{
+	char *d;
+
+	JSON_BeginValue(q, key);
+	JSON_Reserve(q, 21);
+	d = (char *)&q->data[q->dataLen];
+	if (v < 0) {
+		*d++ = '-';
+		q->dataLen++;
+		q->dataLen += JSON_FormatUint(d, (Uint64)0 - (Uint64)v);
+	} else {
+		q->dataLen += JSON_FormatUint(d, (Uint64)v);
+	}
+	JSON_EndValue(q);
+}
+
+void
+WEB_JSON_Uint(WEB_Query *q, const char *key, Uint64 v)
+{
+	JSON_BeginValue(q, key);
+	JSON_Reserve(q, 20);
+	q->dataLen += JSON_FormatUint((char *)&q->data[q->dataLen], v);
+	JSON_EndValue(q);
+}
+
+/*
+ * Write a floating-point value (or member if key is not NULL) with up to
+ * prec (at most 9) fractional digits, trailing zeros removed. Values too
+ * large for fixed-point formatting use the exponent form of printf.
+ * NaN and infinities (which JSON lacks) are written as null.
+ */
+void
+WEB_JSON_Double(WEB_Query *q, const char *key, double v, int prec)
+{
+	static const Uint32 pow10[] = {
+		1, 10, 100, 1000, 10000, 100000, 1000000, 10000000,
+		100000000, 1000000000
+	};
+	Uint64 ip, fp;
+	char *d, *dStart;
+	double av, scaled;
+	int i;
+
+	if (v != v || v > 1.7976931348623157e308 ||
+	    v < -1.7976931348623157e308) {
+		WEB_JSON_Null(q, key);
+		return;
+	}
+	JSON_BeginValue(q, key);
+	if (prec < 0) { prec = 0; }
+	if (prec > 9) { prec = 9; }
+	av = (v < 0.0) ? -v : v;
+	if (av >= 1e15 || (av != 0.0 && av < 1e-9)) {
+		char buf[32];
+		int len;
+
+		len = snprintf(buf, sizeof(buf), "%.*g", prec+1, v);
+		WEB_Write(q, buf, len);
+		JSON_EndValue(q);
+		return;
+	}
+	JSON_Reserve(q, 32);
+	d = dStart = (char *)&q->data[q->dataLen];
+	ip = (Uint64)av;
+	scaled = (av - (double)ip) * pow10[prec] + 0.5;
+	fp = (Uint64)scaled;
+	if (fp >= pow10[prec]) {			/* Rounding carry */
+		ip++;
+		fp -= pow10[prec];
+	}
+	if (v < 0.0 && (ip != 0 || fp != 0)) {
+		*d++ = '-';
+	}
+	d += JSON_FormatUint(d, ip);
+	if (fp != 0) {
+		*d++ = '.';
+		for (i = prec-1; i >= 0; i--) {
+			d[i] = (char)('0' + fp % 10);
+			fp /= 10;
+		}
+		d += prec;
+		while (d[-1] == '0')
+			d--;
+	}
+	q->dataLen += (d - dStart);
+	JSON_EndValue(q);
+}
+
+void
+WEB_JSON_Bool(WEB_Query *q, const char *key, int v)
+{
+	JSON_BeginValue(q, key);
+	if (v) {
+		WEB_Write(q, "true", 4);
+	} else {
+		WEB_Write(q, "false", 5);
+	}
+	JSON_EndValue(q);
+}
+
+void
+WEB_JSON_Null(WEB_Query *q, const char *key)
+{
+	JSON_BeginValue(q, key);
+	WEB_Write(q, "null", 4);
+	JSON_EndValue(q);
+}
+
 /* Release the resources allocated by a WEB query and check for signals. */
 void
 WEB_QueryDestroy(WEB_Query *q)
@@ -1979,13 +2952,18 @@ WEB_QueryDestroy(WEB_Query *q)
 		free(arg);
 	}
 	Free(q->data);
+	Free(q->preRead);
+	if (q->fileFd != -1)
+		close(q->fileFd);
 }
 
-/* Write serialized WEB_Query data. Include a 32-bit length. */
-int
-WEB_QuerySave(int fd, const WEB_Query *q)
+/*
+ * Write serialized WEB_Query data (preceded by a 32-bit length). If passFd
+ * is not -1, pass that descriptor along with it (SCM_RIGHTS).
+ */
+static int
+QuerySend(int fd, const WEB_Query *q, int passFd)
 {
-	char buf[WEB_QUERY_MAX];	
 	AG_DataSource *ds;
 	AG_CoreSource *cs;
 	WEB_Argument *arg;
@@ -1993,15 +2971,18 @@ WEB_QuerySave(int fd, const WEB_Query *q)
 	Uint32 length;
 	Uint i;
 
-	if ((ds = AG_OpenCore(&buf[4], sizeof(buf)-4)) == NULL)
+	if ((ds = AG_OpenAutoCore()) == NULL)
 		return (-1);
 
+	AG_WriteUint32(ds, 0);			/* Length (updated below) */
 	AG_WriteUint8(ds, (Uint8)q->method);
 	AG_WriteUint8(ds, (Uint8)q->flags);
 	AG_WriteString(ds, q->date);
 	AG_WriteString(ds, q->userIP);
 	AG_WriteString(ds, q->userHost);
 	AG_WriteString(ds, q->userAgent);
+	AG_WriteString(ds, q->ifNoneMatch);
+	AG_WriteUint64(ds, q->tStart);
 
 	AG_WriteUint8(ds, (Uint8)q->nAcceptLangs);
 	for (i = 0; i < q->nAcceptLangs; i++) {
@@ -2023,25 +3004,132 @@ WEB_QuerySave(int fd, const WEB_Query *q)
 	}
 	AG_WriteString(ds, q->contentType);
 	AG_WriteUint32(ds, (Uint32)q->contentLength);
+	AG_WriteSint32(ds, (Sint32)q->rangeFrom);
+	AG_WriteSint32(ds, (Sint32)q->rangeTo);
+	AG_WriteUint32(ds, (Uint32)q->preReadLen);
+	if (q->preReadLen > 0)
+		AG_Write(ds, q->preRead, q->preReadLen);
 
 	cs = AG_CORE_SOURCE(ds);
-	length = cs->offs;
-	memcpy(&buf[0], &length, sizeof(Uint32));
-	if (WEB_SYS_Write(fd, buf, length+4) == -1) {
-		if (errno == EPIPE) {
-			AG_SetErrorS("EPIPE");
-		} else {
-			AG_SetErrorS(strerror(errno));
-		}
+	if ((size_t)cs->offs - 4 > WEB_QUERY_MAX_ALLOC) {
+		AG_SetError("Query too big (%lu)", (Ulong)cs->offs);
 		goto fail;
 	}
-	AG_CloseCore(ds);
+	length = cs->offs - 4;
+	memcpy(&cs->data[0], &length, sizeof(Uint32));
+
+	if (passFd != -1) {
+		union {
+			struct cmsghdr hdr;
+			char buf[CMSG_SPACE(sizeof(int))];
+		} cmsgBuf;
+		struct cmsghdr *cmsg;
+		struct msghdr msg;
+		struct iovec iov;
+		ssize_t rv;
+
+		/* Pass the descriptor with the first chunk. */
+		iov.iov_base = cs->data;
+		iov.iov_len = cs->offs;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = cmsgBuf.buf;
+		msg.msg_controllen = sizeof(cmsgBuf.buf);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &passFd, sizeof(int));
+try_send:
+		if ((rv = sendmsg(fd, &msg, 0)) == -1) {
+			if (errno == EINTR) {
+				WEB_CheckSignals();
+				goto try_send;
+			}
+			goto fail_write;
+		}
+		if ((size_t)rv < cs->offs &&
+		    WEB_SYS_Write(fd, &cs->data[rv], cs->offs - rv) == -1)
+			goto fail_write;
+	} else {
+		if (WEB_SYS_Write(fd, cs->data, cs->offs) == -1)
+			goto fail_write;
+	}
+	AG_CloseAutoCore(ds);
 	return (0);
+fail_write:
+	if (errno == EPIPE) {
+		AG_SetErrorS("EPIPE");
+	} else {
+		AG_SetErrorS(strerror(errno));
+	}
 fail:
-	AG_CloseCore(ds);
+	AG_CloseAutoCore(ds);
 	return (-1);
 }
 
+/* Write serialized WEB_Query data. Include a 32-bit length. */
+int
+WEB_QuerySave(int fd, const WEB_Query *q)
+{
+	return QuerySend(fd, q, -1);
+}
+
+/*
+ * Read the 32-bit length of serialized WEB_Query data, and any descriptor
+ * passed along with it (or -1).
+ */
+static int
+QueryRecvLength(int fd, Uint32 *length, int *passFd)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} cmsgBuf;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	ssize_t rv;
+
+	*passFd = -1;
+	iov.iov_base = length;
+	iov.iov_len = sizeof(Uint32);
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cmsgBuf.buf;
+	msg.msg_controllen = sizeof(cmsgBuf.buf);
+try_recv:
+	if ((rv = recvmsg(fd, &msg, 0)) == -1) {
+		if (errno == EINTR) {
+			WEB_CheckSignals();
+			goto try_recv;
+		}
+		AG_SetErrorS(strerror(errno));
+		return (-1);
+	} else if (rv == 0) {
+		AG_SetErrorS("EOF");
+		return (-1);
+	}
+	for (cmsg = CMSG_FIRSTHDR(&msg);
+	     cmsg != NULL;
+	     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SCM_RIGHTS)
+			memcpy(passFd, CMSG_DATA(cmsg), sizeof(int));
+	}
+	if ((size_t)rv < sizeof(Uint32) &&
+	    WEB_SYS_Read(fd, (Uint8 *)length + rv, sizeof(Uint32) - rv) == -1) {
+		if (*passFd != -1) {
+			close(*passFd);
+			*passFd = -1;
+		}
+		return (-1);
+	}
+	return (0);
+}
+
 /* Read serialized WEB_Query data. */
 int
 WEB_QueryLoad(WEB_Query *q, const void *data, size_t dataLen)
@@ -2062,6 +3150,8 @@ WEB_QueryLoad(WEB_Query *q, const void *data, size_t dataLen)
 	AG_CopyString(q->userIP, ds, sizeof(q->userIP));
 	AG_CopyString(q->userHost, ds, sizeof(q->userHost));
 	AG_CopyString(q->userAgent, ds, sizeof(q->userAgent));
+	AG_CopyString(q->ifNoneMatch, ds, sizeof(q->ifNoneMatch));
+	q->tStart = AG_ReadUint64(ds);
 
 	/* Note: We don't copy q->lang since Worker overrides it. */
 
@@ -2133,6 +3223,18 @@ WEB_QueryLoad(WEB_Query *q, const void *data, size_t dataLen)
 	/* Client-supplied content */
 	AG_CopyString(q->contentType, ds, sizeof(q->contentType));
 	q->contentLength = (size_t)AG_ReadUint32(ds);
+	q->rangeFrom = (int)AG_ReadSint32(ds);
+	q->rangeTo = (int)AG_ReadSint32(ds);
+	if ((q->preReadLen = (size_t)AG_ReadUint32(ds)) > 0) {
+		if (q->preReadLen > q->contentLength ||
+		    (q->preRead = TryMalloc(q->preReadLen)) == NULL) {
+			AG_SetErrorS("Bad content");
+			q->preReadLen = 0;
+			goto fail;
+		}
+		if (AG_Read(ds, q->preRead, q->preReadLen) == -1)
+			goto fail;
+	}
 
 	AG_CloseConstCore(ds);
 	return (0);
@@ -2313,6 +3415,7 @@ WEB_Exit(int excode, const char *fmt, ...)
 	}
 
 	WEB_Destroy();
+	WEB_LogFlush();
 	AG_Destroy();
 	exit(excode);
 }
@@ -2325,61 +3428,438 @@ WEB_SetProcTitle(const char *fmt, ...)
 }
 #endif /* !HAVE_SETPROCTITLE */
 
-static __inline__ void
-WEB_LogToFile(enum web_loglvl level, const char *s)
+#ifdef WEB_LOG_ASYNC
+/*
+ * Asynchronous logging. Formatted log entries are appended to a per-process
+ * ring buffer and written out in large batches. With threads, a writer
+ * thread drains the ring every WEB_LOG_ASYNC_IVAL ms or as soon as it is
+ * half full. Without threads, the ring is drained by WEB_LogFlush(), which
+ * the Frontend and Worker loops call between queries.
+ *
+ * With threads, any thread may log: producers serialize on webLogProdLock,
+ * which protects the ring contents, webLogHead, webLogTail and the drop
+ * counters. The consumer holds webLogLock while draining, and holds the
+ * producer lock only to take a snapshot of the ring and to advance the
+ * tail (so log entries are never written out under the producer lock).
+ * The lock order is webLogLock, then webLogProdLock.
+ *
+ * The log file is kept open and reopened whenever it is rotated. When the
+ * ring is full, entries of level WEB_LOG_ERR or more urgent are always
+ * written out synchronously; others are either dropped and counted
+ * (WEB_LOG_POLICY_DROP) or also written synchronously (WEB_LOG_POLICY_BLOCK).
+ */
+static char          *webLogRing = NULL;	/* Ring buffer */
+static size_t         webLogRingSize = 0;
+static size_t         webLogHead = 0;		/* Total bytes queued */
+static size_t         webLogTail = 0;		/* Total bytes written */
+static enum web_log_policy webLogPolicy = WEB_LOG_POLICY_DROP;
+static pid_t          webLogPID = -1;		/* Owner of ring state */
+static int            webLogFd = -1;		/* Open log file */
+static Ulong          webLogDropped = 0;	/* Dropped (since last write) */
+static Ulong          webLogDroppedTotal = 0;
+# ifdef AG_THREADS
+static AG_Thread      webLogThread;
+static AG_Mutex       webLogLock;		/* Consumer side lock */
+static AG_Mutex       webLogProdLock;		/* Producer side lock */
+static AG_Cond        webLogCond;
+static int            webLogThreadRunning = 0;
+static int            webLogThreadExit = 0;	/* Writer should exit */
+#  define LOG_PROD_LOCK()   AG_MutexLock(&webLogProdLock)
+#  define LOG_PROD_UNLOCK() AG_MutexUnlock(&webLogProdLock)
+# else
+#  define LOG_PROD_LOCK()
+#  define LOG_PROD_UNLOCK()
+# endif
+
+/* (Re)open the log file if needed, following log rotation. */
+static int
+LogOpenFile(void)
 {
-	char buf[WEB_ERROR_MAX], *p = buf;
-	size_t hlen, alen, slen;
-	char pid[10];
-	const char *c;
-	size_t rem;
-	FILE *f;
-
-	snprintf(pid, sizeof(pid), "%d", getpid());
-	alen = strlen(pid);
-	slen = strlen(s);
-	hlen = 1+webLogLvlNameLength+1+alen+2+1;
+	struct stat sbPath, sbFd;
 
-	if (hlen+slen >= sizeof(buf)) {
-		slen = sizeof(buf) - hlen;		/* Truncate */
-	}
-	*p='[';							p++;
-	memcpy(p, pid, alen);					p += alen;
-	*p = ' ';						p++;
-	memcpy(p, webLogLvlNames[level], webLogLvlNameLength);	p += webLogLvlNameLength;
-	*p = ']';						p++;
-	*p = ' ';						p++;
-	rem = slen;
-	for (c = s; *c != '\0'; c++) {
-		*p = isprint(*c) ? *c : '*';
-		p++;
-		if (--rem == 0)
-			break;
-	}
-	*p = '\n'; p++;
-	
-	if ((f = fopen(webLogFile, "a")) != NULL) {
-		fwrite(buf, hlen+slen, 1, f);
-		fclose(f);
+	if (webLogFd != -1) {
+		if (stat(webLogFile, &sbPath) == 0 &&
+		    fstat(webLogFd, &sbFd) == 0 &&
+		    sbPath.st_ino == sbFd.st_ino &&
+		    sbPath.st_dev == sbFd.st_dev) {
+			return (0);
+		}
+		close(webLogFd);
 	}
+	webLogFd = open(webLogFile, O_WRONLY|O_APPEND|O_CREAT, 0600);
+	return (webLogFd != -1) ? 0 : -1;
 }
 
 /*
- * Emit an error message to the error output. Format the message into a
- * fixed-size buffer in order to limit the size of log entries.
+ * Write out all queued log entries in a single write (two if the data
+ * wraps around the end of the ring). Called by the consumer only.
  */
-void
-WEB_Log(enum web_loglvl level, const char *fmt, ...)
+static void
+LogDrain(void)
 {
-	char msg[WEB_ERROR_MAX];
-	va_list ap;
-
-	va_start(ap, fmt);
-	vsnprintf(msg, sizeof(msg), fmt, ap);
-	va_end(ap);
-	
-	if (webApp->logFn != NULL) {
-		webApp->logFn(level, msg);
+	size_t head, tail, offs, len;
+	struct iovec iov[3];
+	char dropMsg[64];
+	Ulong nDropped;
+	int iovcnt = 0;
+
+	LOG_PROD_LOCK();
+	head = webLogHead;
+	tail = webLogTail;
+	nDropped = webLogDropped;
+	LOG_PROD_UNLOCK();
+	if (head == tail && nDropped == 0) {
+		return;
+	}
+	if (LogOpenFile() == -1) {
+		return;
+	}
+	if (nDropped > 0) {
+		iov[iovcnt].iov_base = dropMsg;
+		iov[iovcnt].iov_len = snprintf(dropMsg, sizeof(dropMsg),
+		    "[%d %s] %lu log entries dropped\n", (int)getpid(),
+		    webLogLvlNames[WEB_LOG_WARNING], nDropped);
+		iovcnt++;
+	}
+	len = head - tail;
+	offs = tail % webLogRingSize;
+	if (len > 0) {
+		iov[iovcnt].iov_base = &webLogRing[offs];
+		iov[iovcnt].iov_len = MIN(len, webLogRingSize - offs);
+		iovcnt++;
+		if (len > webLogRingSize - offs) {
+			iov[iovcnt].iov_base = &webLogRing[0];
+			iov[iovcnt].iov_len = len - (webLogRingSize - offs);
+			iovcnt++;
+		}
+	}
+	if (writev(webLogFd, iov, iovcnt) == -1) {
+		close(webLogFd);
+		webLogFd = -1;
+	}
+	LOG_PROD_LOCK();
+	webLogTail = head;
+	webLogDropped -= nDropped;		/* Keep any new drops */
+	LOG_PROD_UNLOCK();
+}
+
+# ifdef AG_THREADS
+static void *
+LogWriterMain(void *arg)
+{
+	struct timespec ts;
+	struct timeval tv;
+	size_t head, tail;
+
+	for (;;) {
+		AG_MutexLock(&webLogLock);
+		if (webLogThreadExit) {
+			AG_MutexUnlock(&webLogLock);
+			break;
+		}
+		AG_MutexLock(&webLogProdLock);
+		head = webLogHead;
+		tail = webLogTail;
+		AG_MutexUnlock(&webLogProdLock);
+		if (head == tail) {
+			gettimeofday(&tv, NULL);
+			ts.tv_sec = tv.tv_sec;
+			ts.tv_nsec = tv.tv_usec*1000 + WEB_LOG_ASYNC_IVAL*1000000;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			AG_CondTimedWait(&webLogCond, &webLogLock, &ts);
+		}
+		LogDrain();
+		AG_MutexUnlock(&webLogLock);
+	}
+	return (NULL);
+}
+# endif /* AG_THREADS */
+
+/*
+ * Take ownership of the ring in a newly forked process. Entries queued by
+ * the parent are left for the parent to write.
+ */
+static void
+LogAsyncAttach(void)
+{
+	webLogPID = getpid();
+	webLogTail = webLogHead;
+	webLogDropped = 0;
+	if (webLogFd != -1) {
+		close(webLogFd);
+		webLogFd = -1;
+	}
+# ifdef AG_THREADS
+	AG_MutexInit(&webLogLock);
+	AG_MutexInit(&webLogProdLock);
+	AG_CondInit(&webLogCond);
+	webLogThreadRunning = 0;
+	webLogThreadExit = 0;
+	if (AG_ThreadTryCreate(&webLogThread, LogWriterMain, NULL) == 0) {
+		webLogThreadRunning = 1;
+	}
+# endif
+}
+
+/* Write out queued log entries from the calling thread. */
+static void
+LogDrainSync(void)
+{
+# ifdef AG_THREADS
+	AG_MutexLock(&webLogLock);
+	LogDrain();
+	AG_MutexUnlock(&webLogLock);
+# else
+	LogDrain();
+# endif
+}
+
+/* Append a log entry to the ring. Return -1 if it was not queued. */
+static int
+LogEnqueue(enum web_loglvl level, const char *buf, size_t len)
+{
+	size_t head, used, offs, n1;
+	int drain;
+
+	if (webLogPID != getpid()) {
+		LogAsyncAttach();
+	}
+	LOG_PROD_LOCK();
+	if (webLogRing == NULL) {			/* Disabled meanwhile */
+		LOG_PROD_UNLOCK();
+		return (-1);
+	}
+	head = webLogHead;
+	used = head - webLogTail;
+	if (used + len > webLogRingSize) {
+		if (level > WEB_LOG_ERR && webLogPolicy == WEB_LOG_POLICY_DROP) {
+			webLogDropped++;
+			webLogDroppedTotal++;
+			LOG_PROD_UNLOCK();
+#ifdef WEB_METRICS
+			WEB_MetricsLogDropped();
+#endif
+			return (0);
+		}
+		LOG_PROD_UNLOCK();
+		LogDrainSync();			/* Backpressure */
+		LOG_PROD_LOCK();
+		head = webLogHead;
+		used = head - webLogTail;
+		if (webLogRing == NULL || used + len > webLogRingSize) {
+			LOG_PROD_UNLOCK();
+			return (-1);
+		}
+	}
+	offs = head % webLogRingSize;
+	n1 = MIN(len, webLogRingSize - offs);
+	memcpy(&webLogRing[offs], buf, n1);
+	if (n1 < len) {
+		memcpy(&webLogRing[0], &buf[n1], len - n1);
+	}
+	webLogHead = head + len;
+	drain = (used + len > webLogRingSize/2);
+	LOG_PROD_UNLOCK();
+
+	if (drain) {
+# ifdef AG_THREADS
+		if (webLogThreadRunning) {
+			AG_CondSignal(&webLogCond);
+			return (0);
+		}
+# endif
+		LogDrainSync();
+	}
+	return (0);
+}
+
+/*
+ * Stop the writer thread (if any), write out queued entries and release
+ * the ring. Producers arriving later fall back to synchronous writes.
+ */
+static void
+LogAsyncDisable(void)
+{
+	char *ring;
+
+	if (webLogPID == getpid()) {
+# ifdef AG_THREADS
+		if (webLogThreadRunning) {
+			AG_MutexLock(&webLogLock);
+			webLogThreadExit = 1;
+			AG_CondSignal(&webLogCond);
+			AG_MutexUnlock(&webLogLock);
+			AG_ThreadJoin(webLogThread, NULL);
+			webLogThreadRunning = 0;
+		}
+# endif
+		LogDrainSync();
+	}
+	LOG_PROD_LOCK();
+	ring = webLogRing;
+	webLogRing = NULL;
+	webLogRingSize = 0;
+	webLogHead = 0;
+	webLogTail = 0;
+	LOG_PROD_UNLOCK();
+	Free(ring);
+
+	if (webLogFd != -1) {
+		close(webLogFd);
+		webLogFd = -1;
+	}
+	webLogPID = -1;
+}
+#endif /* WEB_LOG_ASYNC */
+
+/*
+ * Enable or disable asynchronous logging (see above). The ring buffer size
+ * is given in bytes (0 = WEB_LOG_ASYNC_SIZE). Should be called before any
+ * process is forked. Disabling writes out queued entries and frees the ring.
+ */
+void
+WEB_SetLogAsync(int enable, size_t size, enum web_log_policy policy)
+{
+#ifdef WEB_LOG_ASYNC
+	if (!enable) {
+		if (webLogRing != NULL) {
+			LogAsyncDisable();
+		}
+		return;
+	}
+	if (webLogRing != NULL) {
+		WEB_LogFlush();
+		webLogPolicy = policy;
+		return;
+	}
+	webLogRingSize = (size > 0) ? size : WEB_LOG_ASYNC_SIZE;
+	webLogRing = Malloc(webLogRingSize);
+	webLogHead = 0;
+	webLogTail = 0;
+	webLogPolicy = policy;
+	LogAsyncAttach();
+#endif
+}
+
+/*
+ * Write out any queued log entries. Called from the Frontend and Worker
+ * loops (and at exit) when asynchronous logging is enabled.
+ */
+void
+WEB_LogFlush(void)
+{
+#ifdef WEB_LOG_ASYNC
+	if (webLogRing == NULL) {
+		return;
+	}
+	if (webLogPID != getpid()) {
+		LogAsyncAttach();
+	}
+	LogDrainSync();
+#endif
+}
+
+/*
+ * Write out queued log entries at an idle point of the Frontend or Worker
+ * loop, unless a writer thread is taking care of it.
+ */
+static __inline__ void
+WEB_LogIdle(void)
+{
+#ifdef WEB_LOG_ASYNC
+	if (webLogRing == NULL) {
+		return;
+	}
+# ifdef AG_THREADS
+	if (webLogThreadRunning && webLogPID == getpid()) {
+		return;
+	}
+# endif
+	WEB_LogFlush();
+#endif
+}
+
+/* Return the number of log entries dropped by this process. */
+Ulong
+WEB_LogDropped(void)
+{
+#ifdef WEB_LOG_ASYNC
+	Ulong n;
+
+	if (webLogRing == NULL || webLogPID != getpid()) {
+		return (webLogDroppedTotal);
+	}
+	LOG_PROD_LOCK();
+	n = webLogDroppedTotal;
+	LOG_PROD_UNLOCK();
+	return (n);
+#else
+	return (0);
+#endif
+}
+
+static __inline__ void
+WEB_LogToFile(enum web_loglvl level, const char *s)
+{
+	char buf[WEB_ERROR_MAX], *p = buf;
+	size_t hlen, alen, slen;
+	char pid[10];
+	const char *c;
+	size_t rem;
+	FILE *f;
+
+	snprintf(pid, sizeof(pid), "%d", getpid());
+	alen = strlen(pid);
+	slen = strlen(s);
+	hlen = 1+webLogLvlNameLength+1+alen+2+1;
+
+	if (hlen+slen >= sizeof(buf)) {
+		slen = sizeof(buf) - hlen;		/* Truncate */
+	}
+	*p='[';							p++;
+	memcpy(p, pid, alen);					p += alen;
+	*p = ' ';						p++;
+	memcpy(p, webLogLvlNames[level], webLogLvlNameLength);	p += webLogLvlNameLength;
+	*p = ']';						p++;
+	*p = ' ';						p++;
+	rem = slen;
+	for (c = s; *c != '\0'; c++) {
+		*p = isprint(*c) ? *c : '*';
+		p++;
+		if (--rem == 0)
+			break;
+	}
+	*p = '\n'; p++;
+#ifdef WEB_LOG_ASYNC
+	if (webLogRing != NULL &&
+	    LogEnqueue(level, buf, hlen+slen) == 0)
+		return;
+#endif
+	if ((f = fopen(webLogFile, "a")) != NULL) {
+		fwrite(buf, hlen+slen, 1, f);
+		fclose(f);
+	}
+}
+
+/*
+ * Emit an error message to the error output. Format the message into a
+ * fixed-size buffer in order to limit the size of log entries.
+ */
+void
+WEB_Log(enum web_loglvl level, const char *fmt, ...)
+{
+	char msg[WEB_ERROR_MAX];
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(msg, sizeof(msg), fmt, ap);
+	va_end(ap);
+	
+	if (webApp->logFn != NULL) {
+		webApp->logFn(level, msg);
 		return;
 	}
 	WEB_LogToFile(level, msg);
@@ -2545,6 +4025,7 @@ WEB_OutputHTML(WEB_Query *q, const char *name)
 	AG_DataSource *ds;
 	char *data;
 	off_t len;
+	Uint64 t;
 
 	/* XXX inefficient */
 	/* TODO: memory cache */
@@ -2572,7 +4053,9 @@ WEB_OutputHTML(WEB_Query *q, const char *name)
 	AG_CloseFile(ds);
 
 	/* Perform variable substitution and translation. Write to q->data. */
+	WEB_PHASE_BEGIN(t);
 	WEB_VAR_FilterDocument(q, data, len);
+	WEB_PHASE_END(q, WEB_PHASE_TEMPLATE, t);
 	free(data);
 	return (0);
 fail:
@@ -2580,6 +4063,59 @@ fail:
 	return (-1);
 }
 
+/*
+ * Respond with a region of an open file. The query takes ownership of fd,
+ * which is closed once the response has been flushed. The entity-body is
+ * written with sendfile(2) (where available) and Range requests are served
+ * directly from the file. Any data previously written to the query output
+ * is discarded.
+ */
+void
+WEB_OutputFileRegion(WEB_Query *q, int fd, off_t offs, size_t len)
+{
+	if (q->fileFd != -1) {
+		close(q->fileFd);
+	}
+	q->fileFd = fd;
+	q->fileOffs = offs;
+	q->fileLen = len;
+	q->dataLen = 0;
+}
+
+/*
+ * Respond with the contents of the given regular file. Set Last-Modified
+ * from the file's modification time.
+ */
+int
+WEB_OutputFile(WEB_Query *q, const char *path)
+{
+	char date[32];
+	struct stat sb;
+	struct tm tm;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) == -1) {
+		AG_SetError("%s: %s", path, strerror(errno));
+		return (-1);
+	}
+	if (fstat(fd, &sb) == -1) {
+		AG_SetError("%s: %s", path, strerror(errno));
+		close(fd);
+		return (-1);
+	}
+	if (!S_ISREG(sb.st_mode)) {
+		AG_SetError("%s: Not a regular file", path);
+		close(fd);
+		return (-1);
+	}
+	if (gmtime_r(&sb.st_mtime, &tm) != NULL) {
+		strftime(date, sizeof(date), "%a, %d %h %Y %T %Z", &tm);
+		WEB_SetHeaderS(q, "Last-Modified", date);
+	}
+	WEB_OutputFileRegion(q, fd, 0, (size_t)sb.st_size);
+	return (0);
+}
+
 /*
  * Write an HTML fragment to query output in [json] mode.
  */
@@ -2591,6 +4127,7 @@ WEB_PutJSON_HTML(WEB_Query *q, const char *key, const char *name)
 	AG_DataSource *ds;
 	char *data;
 	off_t len;
+	Uint64 t;
 
 	WEB_PutC(q, '"');
 	WEB_PutS(q, key);
@@ -2618,7 +4155,9 @@ WEB_PutJSON_HTML(WEB_Query *q, const char *key, const char *name)
 	AG_CloseFile(ds);
 	
 	/* Perform variable substitution and translation. */
+	WEB_PHASE_BEGIN(t);
 	WEB_VAR_FilterFragment(q, data, len);
+	WEB_PHASE_END(q, WEB_PHASE_TEMPLATE, t);
 
 	free(data);
 	WEB_PutS(q, "\",");
@@ -2717,6 +4256,10 @@ ValidSessionID(const char *sessID)
 		if (n+1 >= WEB_SESSID_MAX || !isdigit(*c))
 			goto fail;
 	}
+#ifdef WEB_SESSION_SHM
+	if (WEB_SessionStoreExists(sessID))
+		return (1);
+#endif
 	Strlcpy(path, WEB_PATH_SESSIONS, sizeof(path));
 	Strlcat(path, sessID, sizeof(path));
 	if (stat(path, &sb) != 0) {
@@ -2769,6 +4312,270 @@ fail:
 	return (-1);
 }
 
+/*
+ * Event hub. Each process keeps a persistent connection to every Event
+ * Listener socket it has posted to, and a queue of pending events for
+ * listeners which are not keeping up. The list of listeners is refreshed
+ * from WEB_PATH_EVENTS only when the directory has changed.
+ */
+typedef struct web_event_sub {
+	char name[WEB_SESSID_MAX+1+WEB_USERNAME_MAX+1+WEB_LANG_CODE_MAX];
+	char *sessID, *user, *lang;		/* Pointers into nameParsed */
+	char nameParsed[WEB_SESSID_MAX+1+WEB_USERNAME_MAX+1+WEB_LANG_CODE_MAX];
+	int fd;					/* Connection (or -1) */
+	int seen;				/* Found in last scan */
+	char  *pend;				/* Pending events */
+	size_t pendLen;
+	Uint   nDropped;			/* Events dropped (queue full) */
+	TAILQ_ENTRY(web_event_sub) subs;
+} WEB_EventSub;
+
+static TAILQ_HEAD(web_event_subq, web_event_sub) webEventSubs =
+    TAILQ_HEAD_INITIALIZER(webEventSubs);
+static pid_t  webEventHubPID = -1;		/* Owner of webEventSubs */
+static time_t webEventDirMtime = 0;		/* Mtime at last scan */
+static time_t webEventDirScan = 0;		/* Time of last scan */
+
+static void
+EventSubClose(WEB_EventSub *sub)
+{
+	if (sub->fd != -1) {
+		close(sub->fd);
+		sub->fd = -1;
+	}
+	sub->pendLen = 0;
+}
+
+static void
+EventSubFree(WEB_EventSub *sub)
+{
+	if (sub->fd != -1) {
+		close(sub->fd);
+	}
+	TAILQ_REMOVE(&webEventSubs, sub, subs);
+	free(sub->pend);
+	free(sub);
+}
+
+/* Establish a non-blocking connection to an Event Listener. */
+static int
+EventSubConnect(WEB_EventSub *sub)
+{
+	struct sockaddr_un sun;
+	socklen_t sunLen;
+	int fd;
+#if !defined(MSG_NOSIGNAL) && defined(SO_NOSIGPIPE)
+	int val = 1;
+#endif
+
+	sun.sun_family = AF_UNIX;
+	Strlcpy(sun.sun_path, WEB_PATH_EVENTS, sizeof(sun.sun_path));
+	Strlcat(sun.sun_path, sub->name, sizeof(sun.sun_path));
+	sun.sun_len = strlen(sun.sun_path)+1;
+	sunLen = sun.sun_len + sizeof(sun.sun_family);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		AG_SetError("socket: %s", strerror(errno));
+		return (-1);
+	}
+try_connect:
+	if (connect(fd, (struct sockaddr *)&sun, sunLen) == -1) {
+		if (errno == EINTR || errno == EAGAIN) {
+			WEB_CheckSignals();
+			goto try_connect;
+		} else if (errno == ECONNREFUSED || errno == ENOENT) {
+			WEB_LogWarn("PostEvent: %s; removing %s",
+			    strerror(errno), sun.sun_path);
+			unlink(sun.sun_path);
+		}
+		AG_SetErrorS(strerror(errno));
+		close(fd);
+		return (-1);
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+#if !defined(MSG_NOSIGNAL) && defined(SO_NOSIGPIPE)
+	setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &val, sizeof(val));
+#endif
+	sub->fd = fd;
+	return (0);
+}
+
+/*
+ * Write as much of the pending event queue as possible without blocking.
+ * On a write error (i.e., the Listener has gone away), drop the connection.
+ */
+static int
+EventSubFlush(WEB_EventSub *sub)
+{
+	ssize_t rv;
+
+	while (sub->pendLen > 0) {
+#ifdef MSG_NOSIGNAL
+		rv = send(sub->fd, sub->pend, sub->pendLen, MSG_NOSIGNAL);
+#else
+		rv = write(sub->fd, sub->pend, sub->pendLen);
+#endif
+		if (rv == -1) {
+			if (errno == EINTR) {
+				continue;
+			} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			AG_SetError("%s: %s", sub->name, strerror(errno));
+			EventSubClose(sub);
+			return (-1);
+		}
+		if ((size_t)rv < sub->pendLen) {
+			memmove(sub->pend, &sub->pend[rv], sub->pendLen - rv);
+		}
+		sub->pendLen -= rv;
+	}
+	return (0);
+}
+
+/* Add an event to a subscriber's queue (coalescing duplicate events). */
+static int
+EventSubQueue(WEB_EventSub *sub, const char *msg, size_t msgLen)
+{
+	const char *p = sub->pend, *pEnd = &sub->pend[sub->pendLen];
+
+	while (p < pEnd) {
+		const char *c;
+
+		if ((c = memmem(p, pEnd-p, "\n\n", 2)) == NULL) {
+			break;
+		}
+		if ((size_t)(&c[2] - p) == msgLen &&
+		    memcmp(p, msg, msgLen) == 0) {
+			return (0);			/* Already pending */
+		}
+		p = &c[2];
+	}
+	if (sub->pendLen+msgLen > WEB_EVENT_HUB_BUFSIZE) {
+		if ((sub->nDropped++ % 100) == 0) {
+			WEB_LogWarn("PostEvent: %s is not keeping up; "
+			            "dropped %u events", sub->name, sub->nDropped);
+		}
+		return (-1);
+	}
+	if (sub->pend == NULL &&
+	   (sub->pend = TryMalloc(WEB_EVENT_HUB_BUFSIZE)) == NULL) {
+		return (-1);
+	}
+	memcpy(&sub->pend[sub->pendLen], msg, msgLen);
+	sub->pendLen += msgLen;
+	return (0);
+}
+
+/* Refresh the list of Event Listeners if WEB_PATH_EVENTS has changed. */
+static int
+EventHubScan(void)
+{
+	WEB_EventSub *sub, *subNext;
+	struct dirent *dent;
+	struct stat sb;
+	DIR *dir;
+
+	if (webEventHubPID != getpid()) {
+		/*
+		 * We have been forked; connections and queues belong
+		 * to the parent process.
+		 */
+		while ((sub = TAILQ_FIRST(&webEventSubs)) != NULL) {
+			EventSubFree(sub);
+		}
+		webEventHubPID = getpid();
+		webEventDirMtime = 0;
+		webEventDirScan = 0;
+	}
+	if (stat(WEB_PATH_EVENTS, &sb) == -1) {
+		AG_SetError("%s: %s", WEB_PATH_EVENTS, strerror(errno));
+		return (-1);
+	}
+	if (webEventDirScan != 0 &&
+	    sb.st_mtime == webEventDirMtime &&
+	    webEventDirMtime < webEventDirScan)	/* Mtime is unambiguous */
+		return (0);
+
+	if ((dir = opendir(WEB_PATH_EVENTS)) == NULL) {
+		AG_SetError("%s: %s", WEB_PATH_EVENTS, strerror(errno));
+		return (-1);
+	}
+	webEventDirScan = time(NULL);
+	webEventDirMtime = sb.st_mtime;
+
+	TAILQ_FOREACH(sub, &webEventSubs, subs) {
+		sub->seen = 0;
+	}
+	while ((dent = readdir(dir)) != NULL) {
+		char *pName;
+
+		if (dent->d_name[0] == '.') {
+			continue;
+		}
+		TAILQ_FOREACH(sub, &webEventSubs, subs) {
+			if (strcmp(sub->name, dent->d_name) == 0)
+				break;
+		}
+		if (sub != NULL) {
+			sub->seen = 1;
+			continue;
+		}
+		if ((sub = TryMalloc(sizeof(WEB_EventSub))) == NULL) {
+			closedir(dir);
+			return (-1);
+		}
+		Strlcpy(sub->name, dent->d_name, sizeof(sub->name));
+		Strlcpy(sub->nameParsed, dent->d_name, sizeof(sub->nameParsed));
+		pName = sub->nameParsed;
+		if (!(sub->sessID = Strsep(&pName, ":")) ||
+		    !(sub->user = Strsep(&pName, ":")) ||
+		    !(sub->lang = Strsep(&pName, ":"))) {
+			free(sub);
+			continue;
+		}
+		sub->fd = -1;
+		sub->seen = 1;
+		sub->pend = NULL;
+		sub->pendLen = 0;
+		sub->nDropped = 0;
+		TAILQ_INSERT_TAIL(&webEventSubs, sub, subs);
+	}
+	closedir(dir);
+
+	for (sub = TAILQ_FIRST(&webEventSubs);
+	     sub != TAILQ_END(&webEventSubs);
+	     sub = subNext) {
+		subNext = TAILQ_NEXT(sub, subs);
+		if (!sub->seen)
+			EventSubFree(sub);
+	}
+	return (0);
+}
+
+/*
+ * Write any pending events to their Event Listeners (without blocking).
+ * Return the number of Listeners with events still pending.
+ */
+int
+WEB_EventHubFlush(void)
+{
+	WEB_EventSub *sub;
+	int nPending = 0;
+
+	if (webEventHubPID != getpid()) {
+		return (0);
+	}
+	TAILQ_FOREACH(sub, &webEventSubs, subs) {
+		if (sub->pendLen == 0 || sub->fd == -1) {
+			continue;
+		}
+		if (EventSubFlush(sub) == 0 && sub->pendLen > 0)
+			nPending++;
+	}
+	return (nPending);
+}
+
 /*
  * Post an Event to the specified destination.
  *
@@ -2786,10 +4593,7 @@ WEB_PostEventS(const char *match, WEB_EventFilterFn filterFn,
 {
 	char msgBuf[WEB_EVENT_MAX];
 	size_t msgBufLen;
-	struct sockaddr_un sun;
-	socklen_t sunLen;
-	struct dirent *dent;
-	DIR *dir;
+	WEB_EventSub *sub;
 
 	msgBufLen = snprintf(msgBuf, sizeof(msgBuf),
 	    "type: %s\n"
@@ -2799,72 +4603,46 @@ WEB_PostEventS(const char *match, WEB_EventFilterFn filterFn,
 		AG_SetErrorS("Too big");
 		return (-1);
 	}
+	if (EventHubScan() == -1)
+		return (-1);
 
-	sun.sun_family = AF_UNIX;
+	TAILQ_FOREACH(sub, &webEventSubs, subs) {
+		int retry = 0;
 
-	if ((dir = opendir(WEB_PATH_EVENTS)) == NULL) {
-		AG_SetError("%s: %s", WEB_PATH_EVENTS, strerror(errno));
-		return (-1);
-	}
-	while ((dent = readdir(dir)) != NULL) {
-		char name[WEB_SESSID_MAX+1+WEB_USERNAME_MAX+1];
-		char *pName=name, *pSessID, *pUser, *pLang;
-		int sock;
-
-		Strlcpy(name, dent->d_name, sizeof(name));
-		if (!(pSessID = Strsep(&pName, ":")) ||
-		    !(pUser = Strsep(&pName, ":")) ||
-		    !(pLang = Strsep(&pName, ":"))) {
-			continue;
-		}
 		if (filterFn != NULL &&
-		    filterFn(pSessID, pUser, pLang, filterFnArg) != 0) {
+		    filterFn(sub->sessID, sub->user, sub->lang, filterFnArg) != 0) {
 			continue;
 		} else if (match != NULL) {
 			if (match[0] == 'S' && match[1] == '=') {
-				if (strcmp(&match[2], pSessID) != 0)
+				if (strcmp(&match[2], sub->sessID) != 0)
 					continue;
 			} else if (match[0] == 'L' && match[1] == '=') {
-				if (strcmp(&match[2], pLang) != 0)
+				if (strcmp(&match[2], sub->lang) != 0)
 					continue;
 			} else {
-				if (strcmp(match, pUser) != 0)
+				if (strcmp(match, sub->user) != 0)
 					continue;
 			}
 		}
-
-		Strlcpy(sun.sun_path, WEB_PATH_EVENTS, sizeof(sun.sun_path));
-		Strlcat(sun.sun_path, dent->d_name, sizeof(sun.sun_path));
-		sun.sun_len = strlen(sun.sun_path)+1;
-		sunLen = sun.sun_len + sizeof(sun.sun_family);
-
-		if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
-			AG_SetError("socket: %s", strerror(errno));
-			return (-1);
+		if (EventSubQueue(sub, msgBuf, msgBufLen) == -1)
+			continue;
+try_send:
+		if (sub->fd == -1 && EventSubConnect(sub) == -1) {
+			EventSubClose(sub);
+			continue;
 		}
-try_connect:
-		if (connect(sock, (struct sockaddr *)&sun, sunLen) == -1) {
-			if (errno == EINTR || errno == EAGAIN) {
-				WEB_CheckSignals();
-				goto try_connect;
-			} else if (errno == ECONNREFUSED || errno == ENOENT) {
-				WEB_LogWarn("PostEvent: %s; removing %s",
-				    strerror(errno), sun.sun_path);
-				unlink(sun.sun_path);
-				close(sock);
-				return (0);
-			} else {
-				AG_SetErrorS(strerror(errno));
-				close(sock);
-				return (-1);
+		if (EventSubFlush(sub) == -1) {
+			/*
+			 * The Listener may have been restarted under the same
+			 * name since we last connected; reconnect once.
+			 */
+			if (retry++ == 0 &&
+			    EventSubQueue(sub, msgBuf, msgBufLen) == 0) {
+				goto try_send;
 			}
+			WEB_LogWarn("PostEvent: %s", AG_GetError());
 		}
-		if (WEB_SYS_Write(sock, msgBuf, msgBufLen) == -1) {
-			WEB_LogWarn("PostEvent: [%s]", strerror(errno));
-		}
-		close(sock);
 	}
-	closedir(dir);
 	return (0);
 }
 
@@ -2958,6 +4736,27 @@ try_accept:
 	case WEB_CONTROL_NOOP:
 		WEB_LogNotice("Cmd: NOOP");
 		break;
+	case WEB_CONTROL_METRICS:
+		{
+			char *text;
+			size_t len;
+			Uint32 len32;
+
+			if ((text = WEB_MetricsText(&len)) == NULL) {
+				goto fail;
+			}
+			len32 = (Uint32)len;
+			if (WEB_SYS_Write(sock, &status, sizeof(status)) == -1 ||
+			    WEB_SYS_Write(sock, &len32, sizeof(len32)) == -1 ||
+			    WEB_SYS_Write(sock, text, len) == -1) {
+				free(text);
+				close(sock);
+				return (-1);
+			}
+			free(text);
+			close(sock);
+			return (0);
+		}
 	default:
 		AG_SetError("Cmd: Bad command %d", cmd.type);
 		goto fail;
@@ -2978,6 +4777,82 @@ fail:
 }
 
 
+/* Publisher connection (in Event Listener). */
+typedef struct web_event_pub {
+	int    fd;
+	size_t len;
+	char   buf[WEB_EVENT_MAX];
+} WEB_EventPub;
+
+/* Grow the publisher table of an Event Listener. */
+static int
+EventPubGrow(WEB_EventPub **pubs, Uint *maxPubs)
+{
+	Uint maxNew = (*maxPubs > 0) ? *maxPubs*2 : WEB_EVENT_HUB_PUBS_INIT;
+	WEB_EventPub *pubsNew;
+
+	if ((pubsNew = TryRealloc(*pubs, maxNew*sizeof(WEB_EventPub))) == NULL) {
+		return (-1);
+	}
+	*pubs = pubsNew;
+	*maxPubs = maxNew;
+	return (0);
+}
+
+/*
+ * Relay a series of events (each terminated by an empty line) to the
+ * EventSource client, assigning an ID to each event. Events are written
+ * in batches of up to WEB_EVENT_BATCH_MAX.
+ */
+static int
+EventRelay(WEB_Query *q, WEB_Session *S, char *buf, size_t len)
+{
+	char msgId[WEB_EVENT_BATCH_MAX][32];
+#ifdef WEB_CHUNKED_EVENTS
+	char chunkHead[WEB_EVENT_BATCH_MAX][16];
+	struct iovec msgv[WEB_EVENT_BATCH_MAX*4];
+#else
+	struct iovec msgv[WEB_EVENT_BATCH_MAX*2];
+#endif
+	char *p = buf, *pEnd = &buf[len], *c;
+	int n, iovcnt;
+
+	while (p < pEnd) {
+		for (n = 0, iovcnt = 0;
+		     n < WEB_EVENT_BATCH_MAX &&
+		     (c = memmem(p, pEnd-p, "\n\n", 2)) != NULL;
+		     n++) {
+			size_t msgLen = &c[2] - p;
+			size_t msgIdLen;
+
+			msgIdLen = snprintf(msgId[n], sizeof(msgId[n]),
+			    "id: %u\n", S->nEvents++);
+#ifdef WEB_CHUNKED_EVENTS
+			msgv[iovcnt].iov_base = chunkHead[n];
+			msgv[iovcnt++].iov_len = snprintf(chunkHead[n],
+			    sizeof(chunkHead[n]), "%lx\r\n",
+			    (Ulong)(msgIdLen + msgLen));
+#endif
+			msgv[iovcnt].iov_base = msgId[n];
+			msgv[iovcnt++].iov_len = msgIdLen;
+			msgv[iovcnt].iov_base = p;
+			msgv[iovcnt++].iov_len = msgLen;
+#ifdef WEB_CHUNKED_EVENTS
+			msgv[iovcnt].iov_base = "\r\n";
+			msgv[iovcnt++].iov_len = 2;
+#endif
+			p = &c[2];
+		}
+		if (n == 0) {
+			break;
+		}
+		if (WEB_SYS_Writev(q->sock, msgv, iovcnt) == -1)
+			return (-1);
+	}
+	return (0);
+}
+
+
 /*
  * Listen for Push events from Worker processes and relay them
  * to the client as text/event-stream.
@@ -2986,6 +4861,8 @@ static int
 WEB_EventListener(WEB_Query *q, const WEB_SessionOps *Sops, const char *sessID,
     const char *username)
 {
+	WEB_EventPub *pubs = NULL;
+	Uint maxPubs = 0, nRejected = 0;
 	int evSock, clntSock, status=0;
 	struct sockaddr_un sun;
 	Uint nEventsOrig = 0;
@@ -2993,7 +4870,7 @@ WEB_EventListener(WEB_Query *q, const WEB_SessionOps *Sops, const char *sessID,
 	struct stat sb;
 	WEB_Session *S;
 	ssize_t rv;
-	int try;
+	int try, i, nPubs = 0;
 		
 	if (WEB_GetInt(q, "try", &try) == -1) {
 		try = 0;
@@ -3075,7 +4952,6 @@ WEB_EventListener(WEB_Query *q, const WEB_SessionOps *Sops, const char *sessID,
 	WEB_PostEvent(NULL, NULL, NULL, "message", "logged-in:%s", username);
 	
 	while (!termFlag) {
-		char buf[WEB_EVENT_MAX];
 #ifdef WEB_CHUNKED_EVENTS
 		char   chunkHead[16];
 		size_t chunkHeadLen;
@@ -3084,9 +4960,8 @@ WEB_EventListener(WEB_Query *q, const WEB_SessionOps *Sops, const char *sessID,
 		size_t msgIdLen;
 		struct iovec msgv[4];
 		fd_set rdFds;
-		int maxFd = 0, iovcnt;
+		int maxFd = 0, iovcnt, nReady;
 		struct timeval tv;
-		Uint nRead = 0;
 	
 		tv.tv_usec = 0;
 		tv.tv_sec = WEB_EVENT_PING_IVAL;
@@ -3100,7 +4975,12 @@ WEB_EventListener(WEB_Query *q, const WEB_SessionOps *Sops, const char *sessID,
 		if (q->sock > maxFd) { maxFd = q->sock; }
 		if (webApp->ctrlSock > maxFd) { maxFd = webApp->ctrlSock; }
 
-		if (select(maxFd+1, &rdFds, NULL, NULL, &tv) < -1) {
+		for (i = 0; i < nPubs; i++) {
+			FD_SET(pubs[i].fd, &rdFds);
+			if (pubs[i].fd > maxFd) { maxFd = pubs[i].fd; }
+		}
+
+		if ((nReady = select(maxFd+1, &rdFds, NULL, NULL, &tv)) == -1) {
 			if (errno == EINTR || errno == EAGAIN) {
 				WEB_CheckSignals();
 				continue;
@@ -3133,11 +5013,10 @@ WEB_EventListener(WEB_Query *q, const WEB_SessionOps *Sops, const char *sessID,
 			}
 		}
 		
-		/* Incoming event on Unix socket? */
+		/* New publisher connection? */
 		if (FD_ISSET(evSock, &rdFds)) {
 			struct sockaddr_un paddr;
 			socklen_t paddrLen = sizeof(paddr);
-			char *cEnd = NULL;
 
 			clntSock = accept(evSock, (struct sockaddr *)&paddr, &paddrLen);
 			if (clntSock == -1) {
@@ -3149,82 +5028,84 @@ WEB_EventListener(WEB_Query *q, const WEB_SessionOps *Sops, const char *sessID,
 					goto fail_sess;
 				}
 			}
-			for (nRead=0; nRead < sizeof(buf); ) {
-				/* TODO: WEB_EVENT_READ_TIMEOUT */
-				rv = read(clntSock, &buf[nRead], sizeof(buf)-nRead);
-				WEB_LogEvent("%ld-byte message", rv);
-				if (rv == -1) {
-					if (errno == EINTR || errno == EAGAIN) {
-						WEB_CheckSignals();
-						continue;
-					} else {
-						AG_SetError("Read error: %s",
-						    strerror(errno));
-						close(clntSock);
-						goto fail_sess;
-					}
-				} else if (rv == 0) {
-					WEB_LogEvent("EOF at %u", nRead);
-					close(clntSock);
-					break;
-				}
-				nRead += rv;
-				if ((cEnd = memmem(buf, nRead, "\n\n",2)))
-					break;
-			}
-			if (cEnd == NULL) {
-				WEB_LogEvent("Bad event; ignoring %u bytes", nRead);
+			if (clntSock >= FD_SETSIZE) {
+				AG_SetErrorS("Descriptor exceeds FD_SETSIZE");
 				close(clntSock);
-				continue;
-			}
-			if (strncmp(buf, webKillEvent, strlen(webKillEvent)) == 0) {
-				WEB_LogEvent("Got kill signal");
-				goto killed;
+				clntSock = -1;
 			}
-			msgIdLen = snprintf(msgId, sizeof(msgId),
-			    "id: %u\n", S->nEvents++);
-			if (msgIdLen >= sizeof(msgId)) {
-				WEB_LogErr("Chunk oversize");
-			    	close(clntSock);
-				goto out;
+			if (clntSock == -1 ||
+			    ((Uint)nPubs == maxPubs &&
+			     EventPubGrow(&pubs, &maxPubs) == -1)) {
+				WEB_LogErr("Rejected publisher (%u so far); its "
+				           "events are lost: %s", ++nRejected,
+					   AG_GetError());
+				if (clntSock != -1)
+					close(clntSock);
+			} else {
+				pubs[nPubs].fd = clntSock;
+				pubs[nPubs].len = 0;
+				nPubs++;
 			}
-#ifdef WEB_CHUNKED_EVENTS
-			chunkHeadLen = snprintf(chunkHead, sizeof(chunkHead),
-			    "%lx\r\n", msgIdLen + (&cEnd[2]-buf));
-		    	if (chunkHeadLen >= sizeof(chunkHead)) {
-				WEB_LogErr("Chunk head oversize");
-			    	close(clntSock);
-				goto out;
+		}
+
+		/* Incoming events from publishers? */
+		for (i = 0; i < nPubs; ) {
+			WEB_EventPub *pub = &pubs[i];
+			char *c, *cEnd = NULL;
+
+			if (!FD_ISSET(pub->fd, &rdFds)) {
+				i++;
+				continue;
 			}
-			msgv[0].iov_base = chunkHead;
-			msgv[0].iov_len  = chunkHeadLen;
-			msgv[1].iov_base = msgId;
-			msgv[1].iov_len  = msgIdLen;
-			msgv[2].iov_base = buf;
-			msgv[2].iov_len  = &cEnd[2] - buf;
-			msgv[3].iov_base = "\r\n";
-			msgv[3].iov_len  = 2;
-			iovcnt = 4;
-#else /* !CHUNKED_EVENTS */
-			msgv[0].iov_base = msgId;
-			msgv[0].iov_len  = msgIdLen;
-			msgv[1].iov_base = buf;
-			msgv[1].iov_len  = &cEnd[2] - buf;
-			iovcnt = 2;
-#endif
-try_write:
-			if (writev(q->sock, msgv, iovcnt) == -1) {
+			rv = read(pub->fd, &pub->buf[pub->len],
+			    sizeof(pub->buf) - pub->len);
+			if (rv == -1) {
 				if (errno == EINTR || errno == EAGAIN) {
 					WEB_CheckSignals();
-					goto try_write;
+					i++;
+					continue;
+				}
+				WEB_LogEvent("Publisher: %s", strerror(errno));
+				rv = 0;
+			}
+			if (rv == 0) {			/* Publisher has gone */
+				close(pub->fd);
+				pubs[i] = pubs[--nPubs];
+				continue;
+			}
+			pub->len += rv;
+			WEB_LogEvent("%ld-byte message", (long)rv);
+
+			if (strncmp(pub->buf, webKillEvent,
+			    strlen(webKillEvent)) == 0) {
+				WEB_LogEvent("Got kill signal");
+				clntSock = pub->fd;
+				pubs[i] = pubs[--nPubs];
+				goto killed;
+			}
+			for (c = pub->buf;
+			     (c = memmem(c, &pub->buf[pub->len] - c, "\n\n", 2));
+			     c += 2) {
+				cEnd = &c[2];
+			}
+			if (cEnd == NULL) {
+				if (pub->len == sizeof(pub->buf)) {
+					WEB_LogEvent("Bad event; ignoring %lu bytes",
+					    (Ulong)pub->len);
+					pub->len = 0;
 				}
-				WEB_LogErr("writev: %s", strerror(errno));
-				close(clntSock);
+				i++;
+				continue;
+			}
+			if (EventRelay(q, S, pub->buf, cEnd - pub->buf) == -1) {
+				WEB_LogErr("%s", AG_GetError());
 				goto out;
 			}
-			close(clntSock);
-			buf[nRead] = '\0';
-		} else {
+			pub->len -= (cEnd - pub->buf);
+			memmove(pub->buf, cEnd, pub->len);
+			i++;
+		}
+		if (nReady == 0) {
 			msgIdLen = snprintf(msgId, sizeof(msgId),
 			    "type: ping\n"
 			    "id: %u\n",
@@ -3253,18 +5134,14 @@ try_write:
 			msgv[0].iov_len  = msgIdLen;
 			iovcnt = 1;
 #endif
-try_ping:
-			if (writev(q->sock, msgv, iovcnt) == -1) {
-				if (errno == EINTR || errno == EAGAIN) {
-					WEB_CheckSignals();
-					goto try_ping;
-				}
-				WEB_LogErr("Events: writev: %s", strerror(errno));
+			if (WEB_SYS_Writev(q->sock, msgv, iovcnt) == -1) {
+				WEB_LogErr("Events: %s", AG_GetError());
 				goto out;
 			}
 		}
 		WEB_SetProcTitle("events %s (%u+%u)", username, nEventsOrig,
 		    (S->nEvents - nEventsOrig));
+		WEB_EventHubFlush();
 		WEB_CheckSignals();
 	}
 out:
@@ -3274,6 +5151,8 @@ out:
 #endif
 	WEB_SessionSave(S);
 	WEB_SessionFree(S);
+	for (i = 0; i < nPubs; i++) { close(pubs[i].fd); }
+	Free(pubs);
 	close(evSock);
 	unlink(sun.sun_path);
 	return (0);
@@ -3284,6 +5163,8 @@ killed:
 #endif
 	WEB_SessionSave(S);
 	WEB_SessionFree(S);
+	for (i = 0; i < nPubs; i++) { close(pubs[i].fd); }
+	Free(pubs);
 	close(evSock);
 	unlink(sun.sun_path);
 	status = 0;
@@ -3298,6 +5179,8 @@ fail_sess:
 	WEB_SessionFree(S);
 fail:
 	WEB_LogEvent("EventListener: %s; disconnected", AG_GetError());
+	for (i = 0; i < nPubs; i++) { close(pubs[i].fd); }
+	Free(pubs);
 	close(evSock);
 	unlink(sun.sun_path);
 	return (-1);
@@ -3337,6 +5220,218 @@ fail:
 	return (-1);
 }
 
+/*
+ * Pool of pre-forked Worker processes. Pooled Workers are forked ahead of
+ * time by the Frontend, run the prefork() hook of every module and then
+ * wait on a socketpair for a session assignment (on the first request
+ * of a new session), after which they proceed as regular Workers.
+ */
+typedef struct web_pool_worker {
+	pid_t  pid;				/* Worker PID */
+	int    fd;				/* Frontend end of socketpair */
+	time_t tIdle;				/* Idle since */
+} WEB_PoolWorker;
+
+/* Session assignment sent to a pooled Worker. */
+typedef struct web_pool_assign {
+	char user[WEB_USERNAME_MAX];
+	char pass[WEB_PASSWORD_MAX];
+	char sessID[WEB_SESSID_MAX];
+	char lang[4];
+	char userIP[64];
+	char userHost[256];
+	char userAgent[WEB_USERAGENT_MAX];
+	Uint nRestoreAttempts;
+} WEB_PoolAssign;
+
+static WEB_PoolWorker webPool[WEB_WORKER_POOL_LIMIT];	/* Idle Workers */
+static Uint           webPoolCount = 0;
+static Uint           webPoolMin = WEB_WORKER_POOL_MIN;
+static Uint           webPoolMax = WEB_WORKER_POOL_MAX;
+static Uint           webPoolTarget = WEB_WORKER_POOL_MIN;
+static time_t         webPoolIdleTimeout = WEB_WORKER_POOL_IDLE;
+
+/*
+ * Configure the Worker pool. Keep at least min (and at most max) idle
+ * Workers ready, reaping those idle for more than idleTimeout seconds
+ * (down to min). A max of 0 disables the pool.
+ */
+void
+WEB_SetWorkerPool(Uint min, Uint max, time_t idleTimeout)
+{
+	if (max > WEB_WORKER_POOL_LIMIT) { max = WEB_WORKER_POOL_LIMIT; }
+	if (min > max) { min = max; }
+	webPoolMin = min;
+	webPoolMax = max;
+	webPoolTarget = min;
+	webPoolIdleTimeout = idleTimeout;
+}
+
+/* Body of a pooled Worker (waiting for a session assignment). */
+static void
+PoolWorkerMain(const WEB_SessionOps *Sops, int fd)
+{
+	WEB_PoolAssign pa;
+	WEB_Query qFront;
+	int pp[2], i;
+
+	WEB_SetProcTitle("worker (idle)");
+	for (i = 0; i < webPoolCount; i++) {	/* Siblings' sockets */
+		close(webPool[i].fd);
+	}
+	webPoolCount = 0;
+
+	for (i = 0; i < nWebModules; i++) {
+		if (webModules[i]->prefork != NULL &&
+		    webModules[i]->prefork() != 0) {
+			WEB_LogErr("%s: prefork: %s", webModules[i]->name,
+			    AG_GetError());
+			WEB_Exit(1, NULL);
+		}
+	}
+	if (WEB_SYS_Read(fd, &pa, sizeof(pa)) == -1) {	/* EOF = reaped */
+		WEB_Exit(0, NULL);
+	}
+	pa.user[sizeof(pa.user)-1] = '\0';
+	pa.pass[sizeof(pa.pass)-1] = '\0';
+	pa.sessID[sizeof(pa.sessID)-1] = '\0';
+	pa.lang[sizeof(pa.lang)-1] = '\0';
+	pa.userIP[sizeof(pa.userIP)-1] = '\0';
+	pa.userHost[sizeof(pa.userHost)-1] = '\0';
+	pa.userAgent[sizeof(pa.userAgent)-1] = '\0';
+
+	WEB_QueryInit(&qFront, pa.lang);
+	Strlcpy(qFront.userIP, pa.userIP, sizeof(qFront.userIP));
+	Strlcpy(qFront.userHost, pa.userHost, sizeof(qFront.userHost));
+	Strlcpy(qFront.userAgent, pa.userAgent, sizeof(qFront.userAgent));
+
+	/* Report status over the socketpair instead of a pipe. */
+	pp[0] = -1;
+	pp[1] = fd;
+	if (WEB_WorkerMain(Sops, &qFront, pa.user, pa.pass, pa.sessID, pp,
+	    pa.nRestoreAttempts) != 0) {
+		WEB_LogErr("Worker(%d) Failed: %s", getpid(), AG_GetError());
+	}
+	WEB_Exit(0, NULL);
+}
+
+/* Fork a new pooled Worker. */
+static int
+PoolWorkerSpawn(const WEB_SessionOps *Sops)
+{
+	WEB_PoolWorker *pw;
+	int sp[2];
+	pid_t pid;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sp) == -1) {
+		AG_SetError("socketpair: %s", strerror(errno));
+		return (-1);
+	}
+	if ((pid = fork()) == -1) {
+		AG_SetError("fork: %s", strerror(errno));
+		close(sp[0]);
+		close(sp[1]);
+		return (-1);
+	} else if (pid == 0) {
+		close(sp[0]);
+		PoolWorkerMain(Sops, sp[1]);
+		/* NOTREACHED */
+	}
+	close(sp[1]);
+	pw = &webPool[webPoolCount++];
+	pw->pid = pid;
+	pw->fd = sp[0];
+	pw->tIdle = time(NULL);
+	return (0);
+}
+
+/* Release a pool entry (the Worker exits on EOF). */
+static void
+PoolWorkerRemove(Uint i)
+{
+	close(webPool[i].fd);
+	if (i < webPoolCount-1) {
+		memmove(&webPool[i], &webPool[i+1],
+		    (webPoolCount-i-1)*sizeof(WEB_PoolWorker));
+	}
+	webPoolCount--;
+}
+
+/*
+ * Maintain the Worker pool: reap Workers idle for too long (shrinking the
+ * pool back toward its minimum), and fork Workers up to the target size.
+ */
+void
+WEB_WorkerPoolUpdate(const WEB_SessionOps *Sops)
+{
+	time_t t = time(NULL);
+#ifdef WEB_METRICS
+	WEB_SessionSocket *sock;
+	Uint nWorkers = 0;
+
+	TAILQ_FOREACH(sock, &webApp->workSockets, sockets) {
+		nWorkers++;
+	}
+	WEB_MetricsWorkers(nWorkers, webPoolCount, webPoolTarget);
+#endif
+	if (webApp->eventSource) {
+		return;
+	}
+	while (webPoolCount > webPoolMin &&
+	       t - webPool[0].tIdle > webPoolIdleTimeout) {
+		PoolWorkerRemove(0);			/* Oldest first */
+		if (webPoolTarget > webPoolMin)
+			webPoolTarget--;
+	}
+	while (webPoolCount < webPoolTarget) {
+		if (PoolWorkerSpawn(Sops) == -1) {
+			WEB_LogErr("Worker pool: %s", AG_GetError());
+			break;
+		}
+	}
+}
+
+/*
+ * Assign a session to a pooled Worker. Return the socket on which the
+ * Worker status will be reported, or -1 if no pooled Worker is available.
+ */
+static int
+PoolWorkerAssign(const WEB_SessionOps *Sops, WEB_Query *q, const char *user,
+    const char *pass, const char *sessID, Uint nRestoreAttempts, pid_t *pid)
+{
+	WEB_PoolAssign pa;
+	int fd;
+
+	if (webPoolCount == 0) {
+		/* Pool is exhausted; keep more Workers ready next time. */
+		if (webPoolTarget < webPoolMax) { webPoolTarget++; }
+		return (-1);
+	}
+	memset(&pa, 0, sizeof(pa));
+	Strlcpy(pa.user, user, sizeof(pa.user));
+	Strlcpy(pa.pass, pass, sizeof(pa.pass));
+	Strlcpy(pa.sessID, sessID, sizeof(pa.sessID));
+	Strlcpy(pa.lang, q->lang, sizeof(pa.lang));
+	Strlcpy(pa.userIP, q->userIP, sizeof(pa.userIP));
+	Strlcpy(pa.userHost, q->userHost, sizeof(pa.userHost));
+	Strlcpy(pa.userAgent, q->userAgent, sizeof(pa.userAgent));
+	pa.nRestoreAttempts = nRestoreAttempts;
+
+	while (webPoolCount > 0) {
+		WEB_PoolWorker *pw = &webPool[webPoolCount-1];  /* Newest */
+
+		fd = pw->fd;
+		*pid = pw->pid;
+		webPoolCount--;
+		if (WEB_SYS_Write(fd, &pa, sizeof(pa)) == 0) {
+			return (fd);
+		}
+		WEB_LogWarn("Pooled worker %d: %s", (int)*pid, AG_GetError());
+		close(fd);
+	}
+	return (-1);
+}
+
 /*
  * Spawn a new worker process. Unless pre-fork authentication is used, the
  * worker is expected to perform authentication and return a new session ID
@@ -3350,6 +5445,10 @@ CreateWorker(const WEB_SessionOps *Sops, WEB_Query *q, const char *user,
 	int pp[2];
 	pid_t pidNew;
 
+	if ((pp[0] = PoolWorkerAssign(Sops, q, user, pass, sessID,
+	    nRestoreAttempts, &pidNew)) != -1) {
+		goto read_status;
+	}
 	if (pipe(pp) == -1) {
 		AG_SetError("pipe: %s", strerror(errno));
 		return (-1);
@@ -3367,8 +5466,9 @@ CreateWorker(const WEB_SessionOps *Sops, WEB_Query *q, const char *user,
 		}
 		WEB_Exit(0, NULL);
 	}
-	*pid = pidNew;
 	close(pp[1]);
+read_status:
+	*pid = pidNew;
 
 	/*
 	 * Read status response. Expect a session number on success,
@@ -3496,6 +5596,10 @@ WEB_ProcessQuery(WEB_Query *q, const WEB_SessionOps *Sops, void *rdBuf,
 				break;
 		}
 		if (cp->name != NULL) {
+#ifdef WEB_ADMISSION
+			if (!WEB_Admit(q, WEB_ADMIT_CHEAP))
+				return (0);
+#endif
 			WEB_BeginFrontQuery(q, op, Sops);
 			WEB_SetHeaderS(q, "Accept-Ranges", "none");
 			WEB_SetHeaderS(q, "Vary", "Accept-Language,Accept-Encoding,"
@@ -3516,7 +5620,15 @@ WEB_ProcessQuery(WEB_Query *q, const WEB_SessionOps *Sops, void *rdBuf,
 	}
 
 	if ((sessArg = WEB_GetCookie(q, "sess")) != NULL &&
-	     ValidSessionID(sessArg)) {
+	    !ValidSessionID(sessArg)) {
+		sessArg = NULL;
+	}
+#ifdef WEB_ADMISSION
+	if (!webApp->eventSource &&
+	    !WEB_Admit(q, (sessArg != NULL) ? WEB_ADMIT_AUTH : WEB_ADMIT_ANON))
+		return (0);
+#endif
+	if (sessArg != NULL) {
 		TAILQ_FOREACH(sock, &webApp->workSockets, sockets) {
 			if (strcmp(sock->sessID, sessArg) == 0)
 				break;
@@ -3653,6 +5765,77 @@ try_connect:
 		return (0);				/* Force close */
 	}
 
+#ifdef WEB_PASS_DESCRIPTORS
+	if (strcmp(op, "logout") != 0) {
+		fd_set rdFds;
+		struct timeval tv;
+		int status;
+
+		/*
+		 * Pass the client socket to the Worker along with the
+		 * WEB_Query (and any content we have read ahead), and
+		 * wait for the Worker to hand the connection back.
+		 */
+		if (q->contentLength > 0 && !(q->flags & WEB_QUERY_CONTENT_READ)) {
+			q->preRead = rdBuf;
+			q->preReadLen = MIN(rdBufLen, q->contentLength);
+		}
+		rv = QuerySend(sock->fd, q, q->sock);
+		q->preRead = NULL;
+		q->preReadLen = 0;
+		if (rv == -1) {
+			if (strcmp(AG_GetError(), "EPIPE") == 0) {
+				RESPAWN_WORKER();
+			} else {
+				goto fail_auth;
+			}
+		}
+		/*
+		 * Bound the wait as in the relay path. If the Worker does
+		 * not respond in time, terminate it and remove its socket so
+		 * that the next request respawns it.
+		 */
+		tv.tv_sec = WEB_WORKER_RESP_TIMEOUT;
+		tv.tv_usec = 0;
+wait_status:
+		FD_ZERO(&rdFds);
+		FD_SET(sock->fd, &rdFds);
+		if ((rv = select(sock->fd+1, &rdFds, NULL, NULL, &tv)) == -1) {
+			if (errno == EINTR || errno == EAGAIN) {
+				WEB_CheckSignals();
+				goto wait_status;
+			}
+			AG_SetError("select: %s", strerror(errno));
+		} else if (rv == 0) {
+			AG_SetErrorS("Worker response timeout");
+		}
+		if (rv <= 0) {
+			WEB_LogErr("Worker (%s, pid %d): %s; terminating",
+			    sessID, (int)sock->workerPID, AG_GetError());
+			if (sock->workerPID > 0 &&
+			    kill(sock->workerPID, SIGTERM) == -1) {
+				WEB_LogNotice("Worker TERM: %s", strerror(errno));
+			}
+			Strlcpy(sun.sun_path, WEB_PATH_SOCKETS,
+			    sizeof(sun.sun_path));
+			Strlcat(sun.sun_path, sessID, sizeof(sun.sun_path));
+			Strlcat(sun.sun_path, ".sock", sizeof(sun.sun_path));
+			unlink(sun.sun_path);
+			CloseWorkSocket(sock);
+			q->flags &= ~(WEB_QUERY_KEEPALIVE);
+			return (0);			/* Force close */
+		}
+		if (WEB_SYS_Read(sock->fd, &status, sizeof(status)) == -1) {
+			WEB_LogErr("Worker (%s): %s; closing", sessID,
+			    AG_GetError());
+			CloseWorkSocket(sock);
+			q->flags &= ~(WEB_QUERY_KEEPALIVE);
+			return (0);			/* Force close */
+		}
+		return WEB_KeepAlive(q);
+	}
+#endif /* WEB_PASS_DESCRIPTORS */
+
 	/* Send the serialized WEB_Query data to the Worker. */
 	if (WEB_QuerySave(sock->fd, q) == -1) {
 		if (strcmp(AG_GetError(), "EPIPE") == 0) {
@@ -3988,7 +6171,7 @@ WEB_WorkerMain(const WEB_SessionOps *Sops, WEB_Query *qFront,
 
 	termFlag = 0;
 	chldFlag = 0;
-	close(pp[0]);
+	if (pp[0] != -1) { close(pp[0]); }
 	close(STDIN_FILENO);
 	close(STDOUT_FILENO);
 	close(STDERR_FILENO);
@@ -4149,7 +6332,9 @@ regen_id:
 		fd_set rdFds;
 		WEB_Query q;
 
-		tv.tv_sec = 10;			/* For Worker timeout test */
+		/* Push any queued events; poll more often if some remain. */
+		tv.tv_sec = (WEB_EventHubFlush() > 0) ? 1 : 10;
+		WEB_LogIdle();
 		tv.tv_usec = 0;
 		FD_ZERO(&rdFds);
 		FD_SET(sockUn, &rdFds);
@@ -4210,15 +6395,19 @@ regen_id:
 				break;
 		}
 		if (i < webApp->nFrontSockets) {
-			char queryData[WEB_QUERY_MAX];
+			char queryBuf[WEB_QUERY_MAX], *queryData = queryBuf;
 			Uint32 queryLen;
 			WEB_Cookie *ck;
 			time_t tExpire;
 			struct tm *tmExpire;
+			int clntSock, rvLoad;
 			
-			/* Read serialized Query from front-end. */
-			if (WEB_SYS_Read(webApp->frontSockets[i], &queryLen,
-			    sizeof(Uint32)) == -1) {
+			/*
+			 * Read serialized Query from front-end, along with
+			 * the client socket if the Frontend passed it.
+			 */
+			if (QueryRecvLength(webApp->frontSockets[i], &queryLen,
+			    &clntSock) == -1) {
 				if (strcmp(AG_GetError(), "EOF") == 0) {
 					WEB_LogWorker("EOF before Query; "
 					              "closing sockets[%d]", i);
@@ -4228,12 +6417,18 @@ regen_id:
 					goto fail_close;
 				}
 			}
-			if (queryLen == 0 || queryLen >= WEB_QUERY_MAX) {
+			if (queryLen == 0 || queryLen > WEB_QUERY_MAX_ALLOC) {
 				WEB_LogErr("Query (%u) too big", queryLen);
 				goto fail_close;
 			}
+			if (queryLen > sizeof(queryBuf) &&
+			    (queryData = TryMalloc(queryLen)) == NULL) {
+				goto fail_close;
+			}
 			if (WEB_SYS_Read(webApp->frontSockets[i], queryData,
 			    queryLen) == -1) {
+				if (queryData != queryBuf) { free(queryData); }
+				if (clntSock != -1) { close(clntSock); }
 				if (strcmp(AG_GetError(), "EOF") == 0) {
 					WEB_LogNotice("EOF mid-Query"
 					              "closing sockets[%d]", i);
@@ -4246,10 +6441,21 @@ regen_id:
 
 			/* Deserialize the WEB_Query object. */
 			WEB_QueryInit(&q, lang);
-			if (WEB_QueryLoad(&q, queryData, queryLen) == -1)
+			rvLoad = WEB_QueryLoad(&q, queryData, queryLen);
+			if (queryData != queryBuf) {
+				free(queryData);
+			}
+			if (rvLoad == -1) {
+				if (clntSock != -1) { close(clntSock); }
 				goto fail_close;
+			}
 			
-			q.sock = webApp->frontSockets[i];
+			/*
+			 * If we were passed the client socket, read and write
+			 * the client directly. Otherwise go through Frontend.
+			 */
+			q.sock = (clntSock != -1) ? clntSock :
+			         webApp->frontSockets[i];
 			q.sess = S;
 			tLastQuery = time(NULL);
 			tExpire = tLastQuery + Sops->sessTimeout;
@@ -4276,9 +6482,22 @@ regen_id:
 			if (WEB_ExecWorkerQuery(&q, Sops) == 1) {
 				/* Terminate (e.g., /logout op). */
 				WEB_LogWorker("Terminating by request");
+				if (clntSock != -1) { close(clntSock); }
 				WEB_QueryDestroy(&q);
 				break;
 			}
+			if (clntSock != -1) {
+				int status = 0;
+
+				/* Return the connection to the Frontend. */
+				close(clntSock);
+				if (WEB_SYS_Write(webApp->frontSockets[i], &status,
+				    sizeof(status)) == -1) {
+					WEB_LogWorker("Frontend: %s; closing "
+					              "sockets[%d]", AG_GetError(), i);
+					CloseFrontSocket(i);
+				}
+			}
 			WEB_QueryDestroy(&q);
 			WEB_SetProcTitle("worker %s (%u)", user, nQueries);
 			nQueries++;
@@ -4332,16 +6551,16 @@ fail:
 }
 
 /*
- * Send a control command to a Frontend process.
+ * Connect to the control socket of a Frontend process.
  * Return 0 on success, -1 on failure and 1 if clusterID doesn't exist.
  */
-int
-WEB_ControlCommand(int clusterID, const WEB_ControlCmd *cmd)
+static int
+ControlConnect(int clusterID, int *pFd)
 {
 	struct sockaddr_un sun;
 	socklen_t sunLen;
 	struct stat sb;
-	int fd, status;
+	int fd;
 	
 	snprintf(sun.sun_path, sizeof(sun.sun_path), "%s%d.ctrl",
 	    WEB_PATH_SOCKETS, clusterID);
@@ -4363,9 +6582,26 @@ try_connect:
 			goto try_connect;
 		} else {
 			AG_SetErrorS(strerror(errno));
-			goto fail;
+			close(fd);
+			return (-1);
 		}
 	}
+	*pFd = fd;
+	return (0);
+}
+
+/*
+ * Send a control command to a Frontend process.
+ * Return 0 on success, -1 on failure and 1 if clusterID doesn't exist.
+ */
+int
+WEB_ControlCommand(int clusterID, const WEB_ControlCmd *cmd)
+{
+	int fd, status;
+
+	if ((status = ControlConnect(clusterID, &fd)) != 0) {
+		return (status);
+	}
 	if (WEB_SYS_Write(fd, cmd, sizeof(WEB_ControlCmd)) == -1) {
 		goto fail;
 	}
@@ -4382,6 +6618,51 @@ fail:
 	return (-1);
 }
 
+/*
+ * Retrieve the request metrics of a Frontend process (in text format).
+ * The returned string should be freed after use.
+ */
+char *
+WEB_ControlMetrics(int clusterID)
+{
+	WEB_ControlCmd cmd;
+	Uint32 len;
+	char *text;
+	int fd, status;
+
+	if ((status = ControlConnect(clusterID, &fd)) != 0) {
+		if (status == 1) {
+			AG_SetError("No such cluster: %d", clusterID);
+		}
+		return (NULL);
+	}
+	bzero(&cmd, sizeof(cmd));
+	cmd.flags |= WEB_CONTROL_CMD_SYNC;
+	cmd.type = WEB_CONTROL_METRICS;
+	if (WEB_SYS_Write(fd, &cmd, sizeof(cmd)) == -1 ||
+	    WEB_SYS_Read(fd, &status, sizeof(status)) == -1) {
+		goto fail;
+	}
+	if (status != 0) {
+		AG_SetErrorS("Metrics command failed");
+		goto fail;
+	}
+	if (WEB_SYS_Read(fd, &len, sizeof(len)) == -1 ||
+	    (text = TryMalloc(len+1)) == NULL) {
+		goto fail;
+	}
+	if (len > 0 && WEB_SYS_Read(fd, text, len) == -1) {
+		free(text);
+		goto fail;
+	}
+	text[len] = '\0';
+	close(fd);
+	return (text);
+fail:
+	close(fd);
+	return (NULL);
+}
+
 /* Send a control command to a Frontend process. */
 int
 WEB_ControlCommandS(int clusterID, const char *s)
@@ -4398,6 +6679,15 @@ WEB_ControlCommandS(int clusterID, const char *s)
 	} else if (strcmp(s, "noop") == 0) {		/* noop */
 		cmd.flags |= WEB_CONTROL_CMD_SYNC;
 		cmd.type = WEB_CONTROL_NOOP;
+	} else if (strcmp(s, "metrics") == 0) {		/* metrics */
+		char *text;
+
+		if ((text = WEB_ControlMetrics(clusterID)) == NULL) {
+			return (-1);
+		}
+		fputs(text, stdout);
+		free(text);
+		return (0);
 	} else {
 		AG_SetError("Bad control command: %s", s);
 		return (-1);
@@ -4405,6 +6695,102 @@ WEB_ControlCommandS(int clusterID, const char *s)
 	return WEB_ControlCommand(clusterID, &cmd);
 }
 
+#ifdef WEB_HAVE_REUSEPORT
+static Uint webFrontends = 1;		/* Frontends (SO_REUSEPORT mode) */
+static int  webFrontendReusePort = 0;	/* Bind with SO_REUSEPORT */
+#endif
+
+/*
+ * Run count Frontend processes in parallel (default 1). Each Frontend binds
+ * its own listening sockets with SO_REUSEPORT and the kernel distributes
+ * incoming connections between them. The Frontends are assigned consecutive
+ * cluster IDs, starting from the one passed to WEB_Init().
+ */
+int
+WEB_SetFrontends(Uint count)
+{
+#ifdef WEB_HAVE_REUSEPORT
+	if (count < 1 || count > WEB_FRONTENDS_MAX) {
+		AG_SetError("Bad Frontend count (1-%d)", WEB_FRONTENDS_MAX);
+		return (-1);
+	}
+	webFrontends = count;
+	return (0);
+#else
+	if (count > 1) {
+		AG_SetErrorS("Multiple Frontends require SO_REUSEPORT");
+		return (-1);
+	}
+	return (0);
+#endif
+}
+
+#ifdef WEB_HAVE_REUSEPORT
+/*
+ * Fork the Frontend processes and supervise them, restarting any Frontend
+ * which exits (at most once per second). Returns 0 in the Frontend
+ * processes. The supervisor itself only returns on failure.
+ */
+static int
+FrontendSupervise(void)
+{
+	pid_t pids[WEB_FRONTENDS_MAX], pid;
+	Uint i, clusterBase = webApp->clusterID;
+	int status;
+
+	memset(pids, 0, sizeof(pids));
+	webFrontendReusePort = 1;
+	WEB_SetProcTitle("supervisor (%u frontends)", webFrontends);
+
+	for (;;) {
+		for (i = 0; i < webFrontends; i++) {
+			if (pids[i] != 0) {
+				continue;
+			}
+			if ((pid = fork()) == -1) {
+				WEB_LogErr("Frontend fork: %s", strerror(errno));
+				break;
+			} else if (pid == 0) {
+				webApp->clusterID = clusterBase + i;
+				webFrontends = 1;
+				return (0);
+			}
+			pids[i] = pid;
+			WEB_LogNotice("Frontend #%u: started (pid %d)",
+			    clusterBase+i, (int)pid);
+		}
+
+		sleep(1);			/* Interrupted by signals */
+
+		if (termFlag) {
+			for (i = 0; i < webFrontends; i++) {
+				if (pids[i] != 0)
+					kill(pids[i], SIGTERM);
+			}
+			while (wait(&status) > 0 || errno == EINTR)
+				;
+			WEB_Exit(0, "SIGTERM (supervisor)");
+		}
+		if (chldFlag) {
+			chldFlag = 0;
+			while ((pid = waitpid(WAIT_ANY, &status, WNOHANG)) > 0) {
+				for (i = 0; i < webFrontends; i++) {
+					if (pids[i] == pid)
+						break;
+				}
+				if (i < webFrontends) {
+					WEB_LogErr("Frontend #%u (pid %d) exited "
+					           "(status %d); restarting",
+						   clusterBase+i, (int)pid, status);
+					pids[i] = 0;
+				}
+			}
+		}
+	}
+	return (-1);
+}
+#endif /* WEB_HAVE_REUSEPORT */
+
 /* Standard loop for a web application server. */
 void
 WEB_QueryLoop(const char *hostname, const char *port, const WEB_SessionOps *Sops)
@@ -4421,6 +6807,9 @@ WEB_QueryLoop(const char *hostname, const char *port, const WEB_SessionOps *Sops
 	ssize_t rvLen;
 	char *c, *cEnd, *uriEnd;
 	struct stat sb;
+#ifdef WEB_SESSION_SHM
+	time_t tSync = time(NULL);
+#endif
 
 	WEB_LogNotice("Starting %s #%d%s (%s; agar %s) on %s:%s", webApp->name,
 	    webApp->clusterID,
@@ -4439,6 +6828,28 @@ WEB_QueryLoop(const char *hostname, const char *port, const WEB_SessionOps *Sops
 		WEB_LogErr("%s: %s", WEB_PATH_EVENTS, strerror(errno));
 		return;
 	}
+#ifdef WEB_RESPONSE_CACHE
+	if (stat(WEB_PATH_CACHE,&sb) != 0 && mkdir(WEB_PATH_CACHE, 0700) != 0) {
+		WEB_LogErr("%s: %s", WEB_PATH_CACHE, strerror(errno));
+		return;
+	}
+#endif
+#ifdef WEB_ADMISSION
+	if (!webApp->eventSource && WEB_AdmissionInit() == -1)
+		WEB_LogErr("Admission: %s", AG_GetError());
+#endif
+#ifdef WEB_HAVE_REUSEPORT
+	/* Become the supervisor of multiple SO_REUSEPORT Frontends. */
+	if (webFrontends > 1 && !webApp->eventSource &&
+	    FrontendSupervise() == -1) {
+		WEB_LogErr("WEB_QueryLoop: %s; exiting", AG_GetError());
+		return;
+	}
+#endif
+#ifdef WEB_METRICS
+	if (WEB_MetricsInit() == -1)
+		WEB_LogErr("Metrics: %s", AG_GetError());
+#endif
 
 	/* Listen on HTTP sockets */
 	memset(&hints, 0, sizeof(hints));
@@ -4460,12 +6871,27 @@ WEB_QueryLoop(const char *hostname, const char *port, const WEB_SessionOps *Sops
 		}
 		val = 1;
 		setsockopt(rv, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+#ifdef WEB_HAVE_REUSEPORT
+		if (webFrontendReusePort) {
+# ifdef SO_REUSEPORT_LB
+			setsockopt(rv, SOL_SOCKET, SO_REUSEPORT_LB, &val,
+			    sizeof(val));
+# else
+			setsockopt(rv, SOL_SOCKET, SO_REUSEPORT, &val,
+			    sizeof(val));
+# endif
+		}
+#endif
 		if (bind(rv, res->ai_addr, res->ai_addrlen) == -1) {
 			cause = "bind";
 			close(rv);
 			continue;
 		}
+#ifdef WEB_ADMISSION
+		if (listen(rv, WEB_AdmissionBacklog()) == -1) {
+#else
 		if (listen(rv, 20) == -1) {
+#endif
 			cause = "listen";
 			close(rv);
 			continue;
@@ -4510,11 +6936,18 @@ WEB_QueryLoop(const char *hostname, const char *port, const WEB_SessionOps *Sops
 		size_t headerLen, rdBufLen;
 		WEB_Method meth;
 		fd_set readFds = httpSockFDs;
+		struct timeval tv;
 
 		FD_SET(webApp->ctrlSock, &readFds);
 		if (webApp->ctrlSock > maxFd) { maxFd = webApp->ctrlSock; }
 
-		rv = select(maxFd+1, &readFds, NULL, NULL, NULL);
+		/* Refill the Worker pool and reap idle pooled Workers. */
+		WEB_WorkerPoolUpdate(Sops);
+		WEB_LogIdle();
+
+		tv.tv_sec = WEB_FRONTEND_TICK;
+		tv.tv_usec = 0;
+		rv = select(maxFd+1, &readFds, NULL, NULL, &tv);
 		if (rv == -1) {
 			if (errno == EINTR || errno == EAGAIN) {
 				WEB_CheckSignals();
@@ -4524,6 +6957,15 @@ WEB_QueryLoop(const char *hostname, const char *port, const WEB_SessionOps *Sops
 				goto fail;
 			}
 		}
+#ifdef WEB_SESSION_SHM
+		/* Write modified sessions back to disk periodically. */
+		if (time(NULL) - tSync >= WEB_SESSION_SHM_SYNC_IVAL) {
+			WEB_SessionStoreSync();
+			tSync = time(NULL);
+		}
+#endif
+		if (rv == 0)
+			continue;
 		if (FD_ISSET(webApp->ctrlSock, &readFds)) {
 			if (WEB_HandleControlCmd(webApp->ctrlSock) == -1)
 				WEB_LogErr("Control socket (in main): %s",
@@ -4547,6 +6989,12 @@ try_accept:
 		if (i == nHttpSocks) {
 			continue;
 		}
+#ifdef WEB_METRICS
+		WEB_MetricsConnection();
+#endif
+#ifdef WEB_ADMISSION
+		WEB_AdmissionQueueCheck(&httpSockFDs, maxFd);
+#endif
 		if (getnameinfo(&paddr, paddrLen, webApp->paddr,
 		    sizeof(webApp->paddr), NULL, 0, NI_NUMERICHOST) != 0)
 			webApp->paddr[0] = '\0';
@@ -4623,6 +7071,9 @@ read_header:
 			goto finish;
 		}
 		c = uriEnd;
+#ifdef WEB_METRICS
+		WEB_MetricsRequest();
+#endif
 		if (webMethods[meth].fn(sock, uri, c, rdBuf, rdBufLen, Sops)==1) {
 			webApp->queryCount++;
 			WEB_CheckSignals();
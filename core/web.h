@@ -17,12 +17,21 @@
 #define WEB_COMPAT_APACHE		/* Behind Apache 2.4 mod_proxy */
 /* #define WEB_COMPAT_NGINX */		/* Behind nginx */
 /* #define WEB_CHUNKED_EVENTS */	/* Chunked event streams */
+#define WEB_PASS_DESCRIPTORS		/* Pass client sockets to Workers */
 #define HAVE_SETPROCTITLE
 
+#if defined(__linux__) || defined(__FreeBSD__) || defined(__DragonFly__)
+#define WEB_HAVE_SENDFILE		/* Zero-copy file responses */
+#endif
+#if defined(__linux__) || defined(__FreeBSD__) || defined(__DragonFly__)
+#define WEB_HAVE_REUSEPORT		/* Kernel-balanced SO_REUSEPORT */
+#endif
+
 #define WEB_FRONTEND_RDBUFSIZE	16384	/* Frontend I/O buffer (must fit header) */
 #define WEB_DATA_BUFSIZE	65536	/* Data buffer size */
 #define WEB_DATA_COMPRESS_MIN	8192	/* Compression threshold */
 #define WEB_DATA_COMPRESS_LVL	6	/* Default compression level */
+#define WEB_STREAM_BUFSIZE	16384	/* Streamed output buffer (bounded) */
 
 #define WEB_FORMDATA_MAX (8*1024*1024)	/* Accepted multipart/form-data size */
 
@@ -32,15 +41,26 @@
 #define WEB_EVENT_INACT_TIMEOUT	 3600	/* Event source inactivity timeout */
 #define WEB_EVENT_MAXRETRY	 10	/* Max Redirect/Retry attempts */
 #define WEB_EVENT_PING_IVAL	 15	/* Event source ping interval */
+#define WEB_EVENT_HUB_BUFSIZE	 65536	/* Pending events (per listener) */
+#define WEB_EVENT_HUB_PUBS_INIT	 16	/* Publisher table size (grows) */
+#define WEB_EVENT_BATCH_MAX	 16	/* Events relayed per write */
+#define WEB_JSON_DEPTH_MAX	 32	/* JSON builder nesting (<= 32) */
 
 #define WEB_HTTP_HEADER_MIN	14	/* Min HTTP header size */
 #define WEB_HTTP_PER_HEADER_MAX	256	/* Max HTTP header size (per header) */
 #define WEB_HTTP_HEADER_MAX	1024	/* HTTP header size (total) */
 #define WEB_HTTP_MAXHEADERS	32	/* Max HTTP response headers */
-#define WEB_QUERY_MAX		4096	/* Max serialized WEB_Query size */
+#define WEB_QUERY_MAX		4096	/* Serialized WEB_Query (no malloc) */
+#define WEB_QUERY_MAX_ALLOC	(WEB_FORMDATA_MAX+65536) /* (with malloc) */
 
 #define WEB_MAXHTTPSOCKETS	5	/* Max listening sockets */
 #define WEB_MAXWORKERSOCKETS	30	/* Max Worker->Frontend sockets */
+#define WEB_WORKER_POOL_MIN	2	/* Pre-forked Workers (minimum) */
+#define WEB_WORKER_POOL_MAX	8	/* Pre-forked Workers (maximum) */
+#define WEB_WORKER_POOL_IDLE	300	/* Pre-forked Worker idle timeout (s) */
+#define WEB_WORKER_POOL_LIMIT	64	/* Pre-forked Workers (upper bound) */
+#define WEB_FRONTEND_TICK	10	/* Frontend housekeeping interval (s) */
+#define WEB_FRONTENDS_MAX	64	/* Max. SO_REUSEPORT Frontends */
 
 #define WEB_MAX_ARGS		256	/* URL-encoded argument count */
 #define WEB_MAX_COOKIES		32	/* Number of cookies */
@@ -71,6 +91,32 @@
 #define WEB_SESSION_DATA_MAX	  4096	/* Session data total (bytes) */
 #define WEB_SESSION_DATA_MAGIC	  0x50657243
 
+#define WEB_SESSION_SHM				/* Shared-memory session store */
+#define WEB_SESSION_SHM_SLOTS	  1024		/* Suggested store capacity */
+#define WEB_SESSION_SHM_BUCKETS	  128		/* Variable hash buckets (2^n) */
+#define WEB_SESSION_SHM_HEAP	  16384		/* Variable data per session */
+#define WEB_SESSION_SHM_EXTRA	  2048		/* Session manager data */
+#define WEB_SESSION_SHM_SYNC_IVAL 30		/* Persistence interval (s) */
+
+#define WEB_RESPONSE_CACHE			/* Enable opt-in response cache */
+#define WEB_CACHE_ENTRY_MAX	(4*1024*1024)	/* Largest cacheable response */
+#define WEB_CACHE_ETAG_MAX	128		/* If-None-Match buffer */
+
+#define WEB_METRICS				/* Enable request metrics */
+#define WEB_METRICS_ROUTES	128		/* Distinct routes tracked */
+#define WEB_METRICS_BUCKETS	16		/* Latency histogram buckets */
+#define WEB_METRICS_BUCKET_MIN	50		/* First bucket bound (usec) */
+
+#define WEB_ADMISSION				/* Frontend admission control */
+#define WEB_ADMIT_CLIENTS	4096		/* Client rate buckets */
+#define WEB_ADMIT_WAYS		4		/* Buckets searched per client */
+#define WEB_ADMIT_AUTH_SLACK	4		/* Queue delay tolerated for
+						   sessions (x target) */
+
+#define WEB_LOG_ASYNC				/* Allow asynchronous logging */
+#define WEB_LOG_ASYNC_SIZE	(256*1024)	/* Default log ring size */
+#define WEB_LOG_ASYNC_IVAL	100		/* Writer interval (ms) */
+
 #define WEB_COOKIE_NAME_MAX	48	/* Cookie name */
 #define WEB_COOKIE_VALUE_MAX	3807	/* Cookie value */
 #define WEB_COOKIE_EXPIRE_MAX	64	/* Cookie expiration field */
@@ -98,6 +144,12 @@
 #ifndef WEB_PATH_EVENTS
 #define WEB_PATH_EVENTS "events/"
 #endif
+#ifndef WEB_PATH_SESSION_STORE
+#define WEB_PATH_SESSION_STORE "sessions.shm"
+#endif
+#ifndef WEB_PATH_CACHE
+#define WEB_PATH_CACHE "cache/"
+#endif
 
 typedef enum web_method {
 	WEB_METHOD_GET,
@@ -156,6 +208,26 @@ typedef struct web_range_req {
 	Uint nRanges;
 } WEB_RangeReq;
 
+struct web_stream;
+
+/* Request processing phases (for latency metrics) */
+enum web_phase {
+	WEB_PHASE_QUEUE,			/* Frontend to Worker execution */
+	WEB_PHASE_MODULE,			/* Module command */
+	WEB_PHASE_TEMPLATE,			/* Template rendering (in module) */
+	WEB_PHASE_COMPRESS,			/* Compression */
+	WEB_PHASE_TOTAL,			/* Complete request */
+	WEB_PHASE_LAST
+};
+
+#ifdef WEB_METRICS
+# define WEB_PHASE_BEGIN(t)	 (t) = WEB_MetricsNow()
+# define WEB_PHASE_END(q,ph,t)	 (q)->tPhase[ph] += (Uint32)(WEB_MetricsNow()-(t))
+#else
+# define WEB_PHASE_BEGIN(t)	 (t) = 0
+# define WEB_PHASE_END(q,ph,t)
+#endif
+
 /* Query from web server */
 typedef struct web_query {
 	WEB_Method method;			/* HTTP method */
@@ -166,6 +238,7 @@ typedef struct web_query {
 #define WEB_QUERY_NOCOMPRESSION	0x08		/* Disable compression */
 #define WEB_QUERY_RANGE		0x10		/* Range request */
 #define WEB_QUERY_PROXIED	0x20		/* Behind proxy */
+#define WEB_QUERY_STREAM	0x40		/* Streaming (chunked) response */
 
 	int  compressLvl;			/* Compression level */
 	char  acceptLangs[WEB_LANGS_MAX]	/* Accept-Language list */
@@ -178,11 +251,14 @@ typedef struct web_query {
 
 	char   contentType[128];		/* Client Content-Type (+attrs) */
 	size_t contentLength;			/* Client Content-Length */
-	int    rangeFrom, rangeTo;		/* Range request */
+	int    rangeFrom, rangeTo;		/* Range request (-1 = to end) */
+	Uchar *preRead;				/* Content read by Frontend */
+	size_t preReadLen;
 
 	char userIP[64];			/* Client IP address */
 	char userHost[256];			/* Client hostname */
 	char userAgent[WEB_USERAGENT_MAX];	/* Client User-Agent */
+	char ifNoneMatch[WEB_CACHE_ETAG_MAX];	/* Client If-None-Match */
 
 	char code[64];			  	/* HTTP/1.0 code */
 	char   head[WEB_HTTP_HEADER_MAX];	/* HTTP response headers */
@@ -191,6 +267,16 @@ typedef struct web_query {
 	size_t headLen;
 	Uchar *data;			  	/* Raw response entity-body */
 	size_t dataSize, dataLen;
+	int    fileFd;				/* File entity-body (or -1) */
+	off_t  fileOffs;			/* File region offset */
+	size_t fileLen;				/* File region length */
+	struct web_stream *stream;		/* Streaming output state */
+	Uint64 bytesOut;			/* Response bytes written */
+	Uint64 tStart;				/* Request start (usec) */
+	Uint32 tPhase[WEB_PHASE_LAST];		/* Phase latencies (usec) */
+
+	Uint   jsonDepth;			/* JSON builder nesting depth */
+	Uint32 jsonNext;			/* JSON builder: non-first (bit/level) */
 
 	char lang[4];				/* Negotiated language */
 	void *sess;				/* Session object (or NULL) */
@@ -206,6 +292,7 @@ typedef struct web_control_cmd {
 		WEB_CONTROL_NOOP,
 		WEB_CONTROL_SHUTDOWN,		/* Perform graceful exit */
 		WEB_CONTROL_WORKER_CHLD,	/* Report Worker process exit */
+		WEB_CONTROL_METRICS,		/* Return metrics (text) */
 	} type;
 	union {
 		struct {
@@ -242,6 +329,25 @@ enum web_loglvl {
 	WEB_LOG_EVENT
 };
 
+/* Admission control: query classes (by cost) and reasons for refusal */
+enum web_admit_class {
+	WEB_ADMIT_CHEAP,		/* Pre-auth, answered by the Frontend */
+	WEB_ADMIT_AUTH,			/* Has a session */
+	WEB_ADMIT_ANON			/* Needs authentication (new Worker) */
+};
+enum web_admit_reason {
+	WEB_ADMIT_REFUSED_CLIENT,	/* Client rate exceeded (429) */
+	WEB_ADMIT_REFUSED_GLOBAL,	/* Global rate exceeded (503) */
+	WEB_ADMIT_REFUSED_QUEUE,	/* Queue delay over target (503) */
+	WEB_ADMIT_REFUSED_LAST
+};
+
+/* Asynchronous logging policy (when the ring buffer is full) */
+enum web_log_policy {
+	WEB_LOG_POLICY_DROP,		/* Drop entries (except errors) */
+	WEB_LOG_POLICY_BLOCK		/* Write out synchronously */
+};
+
 /* Global application server data */
 typedef struct web_application {
 	const char *name;			/* Description */
@@ -272,6 +378,10 @@ typedef struct web_command {
 	char *name;				/* Command name */
 	WEB_CommandFn fn;			/* Function */
 	const char *type;			/* MIME type (or NULL) */
+	int compressLvl;			/* Compression level
+						   (0 = default, -1 = none) */
+	int cacheTTL;				/* Cache responses for this
+						   many seconds (0 = never) */
 } WEB_Command;
 
 /* Map URL to operation (pre-auth) */
@@ -301,6 +411,7 @@ typedef struct web_module {
 	             WEB_Variable *V);
 	WEB_Command *commands;		/* Command map */
 	WEB_Section *sections;		/* Menu sections */
+	int  (*prefork)(void);		/* Warm-up (in pooled Worker) */
 } WEB_Module;
 
 /* Session manager interface */
@@ -395,6 +506,9 @@ void  WEB_Destroy(void);
 void  WEB_CheckSignals(void);
 void  WEB_RegisterModule(WEB_Module *);
 void  WEB_SetLogFile(const char *);
+void  WEB_SetLogAsync(int, size_t, enum web_log_policy);
+void  WEB_LogFlush(void);
+Ulong WEB_LogDropped(void);
 void  WEB_Exit(int, const char *, ...);
 void  WEB_SetLanguageFn(WEB_LanguageFn, void *);
 void  WEB_SetMenuFn(WEB_MenuFn, void *);
@@ -403,8 +517,12 @@ void  WEB_SetMenuFn(WEB_MenuFn, void *);
 int   WEB_WorkerMain(const WEB_SessionOps *, WEB_Query *, const char *,
                      const char *, const char *, int [2], int);
 void  WEB_QueryLoop(const char *, const char *, const WEB_SessionOps *);
+void  WEB_SetWorkerPool(Uint, Uint, time_t);
+int   WEB_SetFrontends(Uint);
+void  WEB_WorkerPoolUpdate(const WEB_SessionOps *);
 int   WEB_ControlCommand(int, const WEB_ControlCmd *);
 int   WEB_ControlCommandS(int, const char *);
+char *WEB_ControlMetrics(int);
 void  WEB_QueryInit(WEB_Query *, const char *);
 void  WEB_QueryDestroy(WEB_Query *);
 int   WEB_QueryLoad(WEB_Query *, const void *, size_t);
@@ -414,6 +532,9 @@ void  WEB_BeginFrontQuery(WEB_Query *, const char *, const WEB_SessionOps *);
 void  WEB_BeginWorkerQuery(WEB_Query *);
 int   WEB_ExecWorkerQuery(WEB_Query *, const WEB_SessionOps *);
 void  WEB_FlushQuery(WEB_Query *);
+int   WEB_BeginStream(WEB_Query *);
+int   WEB_FlushStream(WEB_Query *);
+void  WEB_StreamWrite(WEB_Query *, const void *, size_t);
 int   WEB_ProcessQuery(WEB_Query *, const WEB_SessionOps *, void *, size_t);
 
 /* Headers */
@@ -459,6 +580,19 @@ void	 WEB_LogEvent(const char *, ...) FORMAT_ATTRIBUTE(__printf__,1,2) NONNULL_A
 void          WEB_Printf(WEB_Query *, const char *, ...) FORMAT_ATTRIBUTE(__printf__,2,3) NONNULL_ATTRIBUTE(2);
 void          WEB_PutJSON(WEB_Query *, const char *, const char *, ...) FORMAT_ATTRIBUTE(__printf__, 3, 4) NONNULL_ATTRIBUTE(3);
 int           WEB_PutJSON_HTML(WEB_Query *, const char *, const char *) NONNULL_ATTRIBUTE(2) NONNULL_ATTRIBUTE(3);
+void          WEB_PutJSON_Escaped(WEB_Query *, const char *, size_t, Uint);
+#define       WEB_JSON_NOHTML 0x01	/* Replace '<' and '>' by entities */
+int           WEB_JSON_BeginObject(WEB_Query *, const char *);
+void          WEB_JSON_EndObject(WEB_Query *);
+int           WEB_JSON_BeginArray(WEB_Query *, const char *);
+void          WEB_JSON_EndArray(WEB_Query *);
+void          WEB_JSON_String(WEB_Query *, const char *, const char *);
+void          WEB_JSON_StringN(WEB_Query *, const char *, const char *, size_t);
+void          WEB_JSON_Int(WEB_Query *, const char *, Sint64);
+void          WEB_JSON_Uint(WEB_Query *, const char *, Uint64);
+void          WEB_JSON_Double(WEB_Query *, const char *, double, int);
+void          WEB_JSON_Bool(WEB_Query *, const char *, int);
+void          WEB_JSON_Null(WEB_Query *, const char *);
 void          WEB_VAR_FilterDocument(WEB_Query *, const char *, size_t);
 void          WEB_VAR_FilterFragment(WEB_Query *, const char *, size_t);
 WEB_Variable *WEB_VAR_Set(const char *, const char *, ...) FORMAT_ATTRIBUTE(__printf__, 2, 3);
@@ -477,6 +611,8 @@ static __inline__ void WEB_VAR_CatS_NoHTML(WEB_Variable *, const char *) NONNULL
 static __inline__ void WEB_VAR_CatS_NODUP(WEB_Variable *, char *) NONNULL_ATTRIBUTE(2);
 
 int	WEB_OutputHTML(WEB_Query *, const char *);
+int	WEB_OutputFile(WEB_Query *, const char *);
+void	WEB_OutputFileRegion(WEB_Query *, int, off_t, size_t);
 void	WEB_OutputError(WEB_Query *, const char *);
 void	WEB_SetError(const char *, ...) FORMAT_ATTRIBUTE(__printf__,1,2) NONNULL_ATTRIBUTE(1);
 void	WEB_SetErrorS(const char *) NONNULL_ATTRIBUTE(1);
@@ -495,6 +631,21 @@ int     WEB_SetSV_ALL(const WEB_SessionOps *, const char *, const char *, const
 void    WEB_SetSV(void *, const char *, const char *, ...);
 void    WEB_SetSV_S(void *, const char *, const char *);
 
+/* Shared-memory session store */
+void    WEB_SetSessionStore(Uint);
+Uint    WEB_GetSessionStore(void);
+int     WEB_SessionStoreOpen(const char *, Uint);
+void    WEB_SessionStoreClose(void);
+int     WEB_SessionStoreIsOpen(void);
+int     WEB_SessionStoreExists(const char *);
+int     WEB_SessionStoreLoad(void *, const char *);
+int     WEB_SessionStoreSave(void *, int);
+void    WEB_SessionStoreDel(const char *);
+int     WEB_SessionStoreGetSV(const char *, const char *, char *, size_t);
+int     WEB_SessionStoreSetSV(const char *, const char *, const char *);
+int     WEB_SessionStoreSetSV_ALL(const char *, const char *, const char *);
+int     WEB_SessionStoreSync(void);
+
 #ifdef HAVE_SETPROCTITLE
 #define WEB_SetProcTitle setproctitle
 #else
@@ -507,6 +658,29 @@ int     WEB_PostEventS(const char *, WEB_EventFilterFn, const void *,
 int     WEB_PostEvent(const char *, WEB_EventFilterFn, const void *,
 	              const char *, const char *, ...)
 		      FORMAT_ATTRIBUTE(__printf__,5,6);
+int     WEB_EventHubFlush(void);
+
+int     WEB_CacheServe(WEB_Query *, const char *);
+int     WEB_CacheFlush(WEB_Query *, const char *, int);
+void    WEB_CacheInvalidate(const char *);
+
+int     WEB_MetricsInit(void);
+Uint64  WEB_MetricsNow(void);
+void    WEB_MetricsRecord(const WEB_Query *, const char *);
+void    WEB_MetricsConnection(void);
+void    WEB_MetricsRequest(void);
+void    WEB_MetricsWorkers(Uint, Uint, Uint);
+void    WEB_MetricsLogDropped(void);
+void    WEB_MetricsRejected(int);
+char   *WEB_MetricsText(size_t *);
+int     WEB_MetricsOutput(WEB_Query *);
+
+void    WEB_SetRateLimit(Uint, Uint, Uint, Uint);
+void    WEB_SetAdmission(Uint, Uint, Uint, Uint);
+int     WEB_AdmissionInit(void);
+int     WEB_AdmissionBacklog(void);
+void    WEB_AdmissionQueueCheck(const fd_set *, int);
+int     WEB_Admit(WEB_Query *, enum web_admit_class);
 
 static __inline__ void
 WEB_SessionFree(WEB_Session *S)
@@ -785,10 +959,18 @@ WEB_WriteHeaders(int fd, WEB_Query *q)
 
 #define WEB_Read(q,data,len)  WEB_SYS_Read((q)->sock,(data),(len))
 
-/* Add data to the query response buffer. */
+/*
+ * Add data to the query response buffer. In streaming mode, the buffer
+ * is bounded by WEB_STREAM_BUFSIZE and drained to the client as it fills.
+ */
 static __inline__ void
 WEB_Write(WEB_Query *q, const void *data, size_t len)
 {
+	if ((q->flags & WEB_QUERY_STREAM) &&
+	    q->dataLen+len > WEB_STREAM_BUFSIZE) {
+		WEB_StreamWrite(q, data, len);
+		return;
+	}
 	if (q->dataLen+len > q->dataSize) {
 		q->dataSize += len+WEB_DATA_BUFSIZE;
 		q->data = Realloc(q->data, q->dataSize);
@@ -936,42 +1118,25 @@ WEB_PutS(WEB_Query *q, const char *s)
 {
 	WEB_Write(q, s, strlen(s));
 }
+/* Write a "key": "value" pair (value escaped), followed by a comma. */
 static __inline__ void
 WEB_PutJSON_S(WEB_Query *q, const char *key, const char *val)
 {
-	const char *c;
-
 	WEB_PutC(q, '"');
 	WEB_PutS(q, key);
-	WEB_PutS(q, "\": \"");
-	for (c = &val[0]; *c != '\0'; c++) {
-		if     (*c == '\\') { WEB_PutS(q, "\\\\"); }
-		else if (*c == '"') { WEB_PutS(q, "\\\""); }
-		else if (*c == '\r') { WEB_PutS(q, "\\r"); }
-		else if (*c == '\n') { WEB_PutS(q, "\\n"); }
-		else if (*c == '\t') { WEB_PutS(q, "\\t"); }
-		else { WEB_PutC(q, *c); }
-	}
-	WEB_PutS(q, "\",");
+	WEB_Write(q, "\": \"", 4);
+	WEB_PutJSON_Escaped(q, val, strlen(val), 0);
+	WEB_Write(q, "\",", 2);
 }
+/* Variant of WEB_PutJSON_S() which also replaces '<' and '>' by entities. */
 static __inline__ void
 WEB_PutJSON_NoHTML_S(WEB_Query *q, const char *key, const char *val)
 {
-	const char *c;
-
 	WEB_PutC(q, '"');
 	WEB_PutS(q, key);
-	WEB_PutS(q, "\": \"");
-	for (c = &val[0]; *c != '\0'; c++) {
-		if     (*c == '\\') { WEB_PutS(q, "\\\\"); }
-		else if (*c == '"') { WEB_PutS(q, "\\\""); }
-		else if (*c == '\n') { WEB_PutS(q, "\\n"); }
-		else if (*c == '\t') { WEB_PutS(q, "\\t"); }
-		else if (*c == '<') { WEB_PutS(q, "&lt;"); }
-		else if (*c == '>') { WEB_PutS(q, "&gt;"); }
-		else { WEB_PutC(q, *c); }
-	}
-	WEB_PutS(q, "\",");
+	WEB_Write(q, "\": \"", 4);
+	WEB_PutJSON_Escaped(q, val, strlen(val), WEB_JSON_NOHTML);
+	WEB_Write(q, "\",", 2);
 }
 
 /* Lookup a cookie by name. */
@@ -0,0 +1,321 @@
+/*
+ * Copyright (c) 2026 Hypertriton, Inc. <http://hypertriton.com/>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Admission control for the Frontend. Requests are classified as cheap
+ * (pre-auth operations answered by the Frontend itself), authenticated
+ * (with a session cookie) or anonymous (which require a new Worker).
+ *
+ * Per-client and global request rates are limited by token buckets kept
+ * in an anonymous shared mapping, so the limits hold across all Frontends
+ * of a WEB_SetFrontends() cluster. Clients are identified by address
+ * (or X-Forwarded-For when behind a proxy). Requests exceeding the client
+ * rate are refused with 429, those exceeding the global rate with 503.
+ * Cheap requests are only subject to the client rate, and anonymous
+ * requests may not use the fraction of global tokens reserved to sessions.
+ *
+ * Pending requests wait in the listen queue (whose length is bounded by
+ * the backlog argument of WEB_SetAdmission()). After each accept(), the
+ * Frontend checks whether more connections are waiting. When the queue
+ * has remained non-empty for longer than the target delay, anonymous
+ * requests are refused with 503 (and authenticated requests once it
+ * exceeds WEB_ADMIT_AUTH_SLACK times the target), and keep-alive is
+ * disabled so that waiting clients get their turn.
+ */
+
+#include <agar/core/core.h>
+#include <agar/core/web.h>
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef WEB_ADMISSION
+
+#if defined(__GNUC__) || defined(__clang__)
+# define ADMIT_LOCK(p)		while (__sync_lock_test_and_set((p),1)) { ; }
+# define ADMIT_UNLOCK(p)	__sync_lock_release(p)
+#else
+# define ADMIT_LOCK(p)
+# define ADMIT_UNLOCK(p)
+#endif
+
+#define ADMIT_UNIT 1000000		/* Token fixed-point scale */
+
+/* Token bucket */
+typedef struct web_token_bucket {
+	volatile Uint32 lock;
+	Uint32 key;			/* Client address hash (0 = unused) */
+	Uint64 tokens;			/* Available tokens (x ADMIT_UNIT) */
+	Uint64 tLast;			/* Last refill (usec) */
+} WEB_TokenBucket;
+
+/* Shared admission state */
+typedef struct web_admission {
+	WEB_TokenBucket global;
+	WEB_TokenBucket clients[WEB_ADMIT_CLIENTS];
+} WEB_Admission;
+
+static WEB_Admission *webAdmission = NULL;
+
+static Uint webClientRate = 0;		/* Per-client requests/s (0 = off) */
+static Uint webClientBurst = 0;
+static Uint webGlobalRate = 0;		/* Overall requests/s (0 = off) */
+static Uint webGlobalBurst = 0;
+static Uint webBacklog = 20;		/* Listen queue length */
+static Uint webQueueTarget = 0;		/* Target queue delay (ms, 0 = off) */
+static Uint webReserve = 0;		/* % of global tokens for sessions */
+static Uint webRetryAfter = 1;		/* Retry-After (s) */
+static Uint64 webQueueSince = 0;	/* Queue non-empty since (usec) */
+
+static Uint64
+AdmitNow(void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		return ((Uint64)ts.tv_sec*1000000 + (Uint64)ts.tv_nsec/1000);
+#endif
+	return ((Uint64)time(NULL)*1000000);
+}
+
+/*
+ * Limit requests per client (and overall) to rate per second, with bursts
+ * of up to burst requests. A rate of 0 disables the limit.
+ */
+void
+WEB_SetRateLimit(Uint clientRate, Uint clientBurst, Uint globalRate,
+    Uint globalBurst)
+{
+	webClientRate = clientRate;
+	webClientBurst = (clientBurst > 0) ? clientBurst : clientRate;
+	webGlobalRate = globalRate;
+	webGlobalBurst = (globalBurst > 0) ? globalBurst : globalRate;
+}
+
+/*
+ * Set the listen queue length (backlog, 0 = default), the target queueing
+ * delay in milliseconds beyond which requests are shed (0 = never), the
+ * percentage of the global rate reserved to authenticated sessions and
+ * the Retry-After value of refusals.
+ */
+void
+WEB_SetAdmission(Uint backlog, Uint queueTarget, Uint reserve,
+    Uint retryAfter)
+{
+	webBacklog = (backlog > 0) ? backlog : 20;
+	webQueueTarget = queueTarget;
+	webReserve = (reserve > 100) ? 100 : reserve;
+	webRetryAfter = retryAfter;
+}
+
+/* Return the listen queue length to use for HTTP sockets. */
+int
+WEB_AdmissionBacklog(void)
+{
+	return (int)webBacklog;
+}
+
+/*
+ * Create the shared admission state. Must be called before the Frontends
+ * are forked.
+ */
+int
+WEB_AdmissionInit(void)
+{
+	void *p;
+
+	if (webAdmission != NULL ||
+	    (webClientRate == 0 && webGlobalRate == 0)) {
+		return (0);
+	}
+	p = mmap(NULL, sizeof(WEB_Admission), PROT_READ|PROT_WRITE,
+	    MAP_SHARED|MAP_ANON, -1, 0);
+	if (p == MAP_FAILED) {
+		AG_SetError("mmap: %s", strerror(errno));
+		return (-1);
+	}
+	memset(p, 0, sizeof(WEB_Admission));
+	webAdmission = p;
+	return (0);
+}
+
+/*
+ * Take a token from a bucket, leaving at least reserve tokens (in units).
+ * Return 1 on success.
+ */
+static int
+TakeToken(WEB_TokenBucket *tb, Uint rate, Uint burst, Uint64 reserve,
+    Uint64 now)
+{
+	Uint64 max = (Uint64)burst*ADMIT_UNIT;
+	int rv = 0;
+
+	ADMIT_LOCK(&tb->lock);
+	if (now > tb->tLast) {
+		tb->tokens += (now - tb->tLast) * rate;	/* usec*rate/1e6 */
+		if (tb->tokens > max) { tb->tokens = max; }
+		tb->tLast = now;
+	}
+	if (tb->tokens >= ADMIT_UNIT + reserve) {
+		tb->tokens -= ADMIT_UNIT;
+		rv = 1;
+	}
+	ADMIT_UNLOCK(&tb->lock);
+	return (rv);
+}
+
+/*
+ * Return the bucket of a client. We look at WEB_ADMIT_WAYS consecutive
+ * slots and recycle the least recently used one if the client is new.
+ */
+static WEB_TokenBucket *
+ClientBucket(const char *addr, Uint64 now)
+{
+	WEB_TokenBucket *tb, *tbOld = NULL;
+	Uint32 h = 2166136261U;
+	const char *c;
+	Uint i, n;
+
+	for (c = addr; *c != '\0'; c++) {
+		h = (h ^ (Uchar)*c) * 16777619U;
+	}
+	if (h == 0) { h = 1; }
+	n = (h % (WEB_ADMIT_CLIENTS / WEB_ADMIT_WAYS)) * WEB_ADMIT_WAYS;
+	for (i = 0; i < WEB_ADMIT_WAYS; i++) {
+		tb = &webAdmission->clients[n+i];
+		if (tb->key == h) {
+			return (tb);
+		}
+		if (tbOld == NULL || tb->tLast < tbOld->tLast)
+			tbOld = tb;
+	}
+	ADMIT_LOCK(&tbOld->lock);
+	tbOld->key = h;
+	tbOld->tokens = (Uint64)webClientBurst*ADMIT_UNIT;
+	tbOld->tLast = now;
+	ADMIT_UNLOCK(&tbOld->lock);
+	return (tbOld);
+}
+
+/*
+ * Check whether more connections are waiting on the listening sockets
+ * (called by the Frontend after accept()) and track how long the queue
+ * has been non-empty.
+ */
+void
+WEB_AdmissionQueueCheck(const fd_set *httpSockFDs, int maxFd)
+{
+	fd_set readFds;
+	struct timeval tv;
+
+	if (webQueueTarget == 0) {
+		return;
+	}
+	readFds = *httpSockFDs;
+	tv.tv_sec = 0;
+	tv.tv_usec = 0;
+	if (select(maxFd+1, &readFds, NULL, NULL, &tv) > 0) {
+		if (webQueueSince == 0)
+			webQueueSince = AdmitNow();
+	} else {
+		webQueueSince = 0;
+	}
+}
+
+/* Refuse a query with the given status; force close of the connection. */
+static int
+Refuse(WEB_Query *q, const char *code, int reason)
+{
+#ifdef WEB_METRICS
+	WEB_MetricsRejected(reason);
+#endif
+	WEB_SetCode(q, code);
+	WEB_SetHeader(q, "Retry-After", "%u", webRetryAfter);
+	WEB_SetHeaderS(q, "Content-Type", "text/plain");
+	WEB_SetHeaderS(q, "Cache-Control", "no-cache, no-store");
+	WEB_SetHeaderS(q, "Connection", "close");
+	q->flags &= ~(WEB_QUERY_KEEPALIVE);
+	WEB_PutS(q, code);
+	WEB_PutC(q, '\n');
+	WEB_FlushQuery(q);
+	return (0);
+}
+
+/*
+ * Decide whether to process a query of the given class. Return 1 if the
+ * query is admitted, or write a 429 or 503 response and return 0.
+ */
+int
+WEB_Admit(WEB_Query *q, enum web_admit_class cls)
+{
+	Uint64 now, queued, reserve;
+
+	if (webAdmission == NULL && webQueueTarget == 0) {
+		return (1);
+	}
+	now = AdmitNow();
+	if (webQueueTarget > 0 && webQueueSince != 0 && now > webQueueSince) {
+		queued = (now - webQueueSince) / 1000;
+		q->flags &= ~(WEB_QUERY_KEEPALIVE);	/* Let others in */
+	} else {
+		queued = 0;
+	}
+
+	if (webAdmission != NULL && webClientRate > 0 &&
+	    !TakeToken(ClientBucket((q->flags & WEB_QUERY_PROXIED) ?
+	                            q->userIP : webApp->paddr, now),
+	        webClientRate, webClientBurst, 0, now)) {
+		return Refuse(q, "429 Too Many Requests",
+		    WEB_ADMIT_REFUSED_CLIENT);
+	}
+	if (cls == WEB_ADMIT_CHEAP)
+		return (1);
+
+	if (webAdmission != NULL && webGlobalRate > 0) {
+		reserve = (cls == WEB_ADMIT_ANON) ?
+		    (Uint64)webGlobalBurst*ADMIT_UNIT/100 * webReserve : 0;
+		if (!TakeToken(&webAdmission->global, webGlobalRate,
+		    webGlobalBurst, reserve, now)) {
+			return Refuse(q, "503 Service Unavailable",
+			    WEB_ADMIT_REFUSED_GLOBAL);
+		}
+	}
+	if (queued > webQueueTarget &&
+	    (cls == WEB_ADMIT_ANON ||
+	     queued > (Uint64)webQueueTarget*WEB_ADMIT_AUTH_SLACK)) {
+		return Refuse(q, "503 Service Unavailable",
+		    WEB_ADMIT_REFUSED_QUEUE);
+	}
+	return (1);
+}
+
+#endif /* WEB_ADMISSION */
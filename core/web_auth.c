@@ -53,6 +53,12 @@ WEB_SessionMgrInit(void)
 		WEB_Log(WEB_LOG_EMERG, "%s: %s", WEB_PATH_SESSIONS, AG_GetError());
 		return (-1);
 	}
+#ifdef WEB_SESSION_SHM
+	if (WEB_GetSessionStore() > 0 &&
+	    WEB_SessionStoreOpen(WEB_PATH_SESSION_STORE,
+	    WEB_GetSessionStore()) == -1)
+		WEB_LogWarn("Session store: %s; using files", AG_GetError());
+#endif
 	return (0);
 }
 
@@ -93,7 +99,12 @@ WEB_SessionDestroy(WEB_Session *S)
 void
 WEB_SessionMgrDestroy(void)
 {
-	/* Nothing to do */
+#ifdef WEB_SESSION_SHM
+	if (WEB_SessionStoreIsOpen()) {
+		WEB_SessionStoreSync();
+		WEB_SessionStoreClose();
+	}
+#endif
 }
 
 /* Terminate a session gracefully. */
@@ -111,7 +122,9 @@ WEB_CloseSession(WEB_Session *S)
 		if (mod->sessClose != NULL)
 			mod->sessClose(S);
 	}
-
+#ifdef WEB_SESSION_SHM
+	WEB_SessionStoreDel(S->id);
+#endif
 	Strlcpy(path, WEB_PATH_SESSIONS, sizeof(path));
 	Strlcat(path, S->id, sizeof(path));
 	unlink(path);
@@ -127,7 +140,10 @@ WEB_CloseSession(WEB_Session *S)
 	unlink(path);
 }
 
-/* Load session instance data from disk. */
+/*
+ * Load session instance data from the session store, or from disk if
+ * the session is not in the store (in which case it is added to it).
+ */
 int
 WEB_SessionLoad(void *pSess, const char *id)
 {
@@ -138,6 +154,14 @@ WEB_SessionLoad(void *pSess, const char *id)
 	Uint32 i, count;
 
 	Strlcpy(S->id, id, sizeof(S->id));
+#ifdef WEB_SESSION_SHM
+	switch (WEB_SessionStoreLoad(S, id)) {
+	case 0:
+		return (0);
+	case -1:
+		return (-1);
+	}
+#endif
 
 	Strlcpy(path, WEB_PATH_SESSIONS, sizeof(path));
 	Strlcat(path, id, sizeof(path));
@@ -171,13 +195,21 @@ WEB_SessionLoad(void *pSess, const char *id)
 		goto fail;
 
 	AG_CloseFile(ds);
+#ifdef WEB_SESSION_SHM
+	if (WEB_SessionStoreIsOpen() && WEB_SessionStoreSave(S, 0) == -1)
+		WEB_LogWarn("Session store: %s", AG_GetError());
+#endif
 	return (0);
 fail:
 	AG_CloseFile(ds);
 	return (-1);
 }
 
-/* Save session information to disk. */
+/*
+ * Save session information. If fd is -1, update the session store (the
+ * session file is written on the next sync) or write the session file
+ * if the store is unavailable. Otherwise write to fd.
+ */
 int
 WEB_SessionSaveToFD(void *pSess, int fd)
 {
@@ -186,6 +218,15 @@ WEB_SessionSaveToFD(void *pSess, int fd)
 	AG_DataSource *ds;
 	FILE *f;
 	
+#ifdef WEB_SESSION_SHM
+	if (fd == -1 && WEB_SessionStoreIsOpen()) {
+		if (WEB_SessionStoreSave(S, 1) == 0) {
+			return (0);
+		}
+		WEB_LogWarn("Session store: %s; writing %s", AG_GetError(),
+		    S->id);
+	}
+#endif
 	if (fd != -1) {
 		if (!(f = fdopen(fd, "w"))) {
 			AG_SetError("fdopen");
@@ -219,6 +260,10 @@ WEB_SessionSaveToFD(void *pSess, int fd)
 	
 	if (fd != -1) {
 		AG_CloseFileHandle(ds);
+#ifdef WEB_SESSION_SHM
+		if (WEB_SessionStoreIsOpen() && WEB_SessionStoreSave(S, 0) == -1)
+			WEB_LogWarn("Session store: %s", AG_GetError());
+#endif
 	} else {
 		AG_CloseFile(ds);
 	}
@@ -236,11 +281,27 @@ WEB_SetSV_ALL(const WEB_SessionOps *sessOps, const char *user, const char *key,
 	const char *s;
 	DIR *dir;
 
+#ifdef WEB_SESSION_SHM
+	if (WEB_SessionStoreIsOpen()) {
+		/*
+		 * Update the stored sessions in place. Only scan the session
+		 * files if the store overflowed at some point.
+		 */
+		switch (WEB_SessionStoreSetSV_ALL(user, key, val)) {
+		case 0:
+			return (0);
+		case -1:
+			WEB_LogErr("SetSV_ALL: %s", AG_GetError());
+			break;
+		}
+	}
+#endif
 	if ((S = TryMalloc(sessOps->size)) == NULL)
 		return (-1);
 
 	if ((dir = opendir(WEB_PATH_SESSIONS)) == NULL) {
 		AG_SetError("%s: %s", WEB_PATH_SESSIONS, strerror(errno));
+		free(S);
 		return (-1);
 	}
 	while ((dent = readdir(dir)) != NULL) {
@@ -0,0 +1,418 @@
+/*
+ * Copyright (c) 2026 Hypertriton, Inc. <http://hypertriton.com/>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Response cache. Commands with a non-zero cacheTTL (see WEB_Command) have
+ * their output cached, keyed by operation, arguments and negotiated language.
+ * Since the key does not include the session, only commands whose output is
+ * the same for all users should enable caching.
+ *
+ * Entries are files in WEB_PATH_CACHE shared by all Worker processes. Each
+ * entry holds the identity entity-body and, if large enough, a deflate
+ * compressed copy, so cached responses are never compressed twice. A strong
+ * ETag is derived from the SHA1 of the identity body; requests bearing a
+ * matching If-None-Match are answered with 304 without running the command.
+ *
+ * Entries expire after cacheTTL seconds. Applications should also call
+ * WEB_CacheInvalidate() whenever the underlying data is updated.
+ */
+
+#include <agar/core/core.h>
+#include <agar/core/web.h>
+#include <agar/core/sha1.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include <agar/config/have_zlib.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#define WEB_CACHE_MAGIC   0x57434348	/* "WCCH" */
+#define WEB_CACHE_VERSION 1
+
+/* Cache entry header (followed by the identity and deflate bodies). */
+typedef struct web_cache_hdr {
+	Uint32 magic;
+	Uint32 version;
+	Uint64 expire;				/* Expiration time */
+	Uint32 len;				/* Identity body length */
+	Uint32 lenDeflate;			/* Deflate body length (or 0) */
+	char   etag[AG_SHA1_DIGEST_STRING_LENGTH]; /* SHA1 of identity body */
+	char   contentType[128];		/* Content-Type */
+} WEB_CacheHdr;
+
+/* Compare arguments by key (for qsort). */
+static int
+CompareArgs(const void *p1, const void *p2)
+{
+	const WEB_Argument *a1 = *(const WEB_Argument **)p1;
+	const WEB_Argument *a2 = *(const WEB_Argument **)p2;
+
+	return strcmp(a1->key, a2->key);
+}
+
+/*
+ * Compute the path to the cache entry for a query. The file name is the
+ * operation name followed by the SHA1 of the language and (sorted) query
+ * arguments, so entries for one operation can be found by prefix.
+ */
+static int
+CachePath(const WEB_Query *q, const char *op, char *path, size_t len)
+{
+	WEB_Argument *args[WEB_MAX_ARGS], *arg;
+	char key[AG_SHA1_DIGEST_STRING_LENGTH];
+	AG_SHA1_CTX ctx;
+	Uint i, nArgs = 0;
+
+	TAILQ_FOREACH(arg, &q->args, args) {
+		if (strcmp(arg->key, "op") == 0) {
+			continue;
+		}
+		if (nArgs == WEB_MAX_ARGS) {
+			AG_SetErrorS("Too many args");
+			return (-1);
+		}
+		args[nArgs++] = arg;
+	}
+	qsort(args, nArgs, sizeof(WEB_Argument *), CompareArgs);
+
+	AG_SHA1Init(&ctx);
+	AG_SHA1Update(&ctx, (const Uint8 *)q->lang, strlen(q->lang)+1);
+	for (i = 0; i < nArgs; i++) {
+		arg = args[i];
+		AG_SHA1Update(&ctx, (const Uint8 *)arg->key, strlen(arg->key)+1);
+		AG_SHA1Update(&ctx, (const Uint8 *)arg->value, arg->len);
+		AG_SHA1Update(&ctx, (const Uint8 *)"", 1);
+	}
+	AG_SHA1End(&ctx, key);
+
+	if (Snprintf(path, len, WEB_PATH_CACHE "%s=%s", op, key) >= len) {
+		AG_SetErrorS("Cache path too long");
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Return 1 if the client's If-None-Match matches the ETag of the selected
+ * representation (the content hash, plus a "-z" suffix for deflate). The
+ * header is parsed as a list of entity-tags, each compared in full using
+ * the weak comparison of RFC 7232.
+ */
+static int
+CacheMatch(const WEB_Query *q, const char *etag, int deflate)
+{
+	const char *c = q->ifNoneMatch, *cEnd;
+	size_t etagLen = strlen(etag);
+	size_t tagLen = etagLen + (deflate ? 2 : 0);
+
+	for (;;) {
+		while (*c == ' ' || *c == '\t' || *c == ',') {
+			c++;
+		}
+		if (*c == '\0') {
+			break;
+		}
+		if (*c == '*') {
+			return (1);
+		}
+		if (c[0] == 'W' && c[1] == '/') {
+			c += 2;
+		}
+		if (*c != '"' || (cEnd = strchr(&c[1], '"')) == NULL) {
+			break;				/* Malformed */
+		}
+		c++;
+		if ((size_t)(cEnd - c) == tagLen &&
+		    strncmp(c, etag, etagLen) == 0 &&
+		    (!deflate || strncmp(&c[etagLen], "-z", 2) == 0)) {
+			return (1);
+		}
+		c = &cEnd[1];
+	}
+	return (0);
+}
+
+/* Return 1 if the deflate body should be sent to the client. */
+static __inline__ int
+CacheUseDeflate(const WEB_Query *q, Uint32 lenDeflate)
+{
+	return (lenDeflate > 0 &&
+	        (q->flags & WEB_QUERY_DEFLATE) &&
+	       !(q->flags & WEB_QUERY_NOCOMPRESSION) &&
+	       !(q->flags & WEB_QUERY_RANGE));
+}
+
+/* Set the ETag header for the selected representation. */
+static void
+CacheSetETag(WEB_Query *q, const char *etag, int deflate)
+{
+	WEB_SetHeader(q, "ETag", "\"%s%s\"", etag, deflate ? "-z" : "");
+}
+
+/* Respond with 304 Not Modified. */
+static void
+CacheNotModified(WEB_Query *q)
+{
+	WEB_SetCode(q, "304 Not Modified");
+	q->dataLen = 0;
+	WEB_FlushQuery(q);
+}
+
+/* Return the value of a response header previously set in a query. */
+static int
+GetResponseHeader(const WEB_Query *q, const char *key, char *dst, size_t len)
+{
+	size_t keyLen = strlen(key);
+	const char *cLine, *cEnd;
+	Uint i;
+
+	for (i = 0; i < q->headLineCount; i++) {
+		cLine = &q->head[q->headLine[i]];
+		if (strncasecmp(cLine, key, keyLen) == 0 &&
+		    cLine[keyLen  ] == ':' &&
+		    cLine[keyLen+1] == ' ') {
+			cLine += keyLen+2;
+			if ((cEnd = strchr(cLine, '\r')) == NULL ||
+			    (size_t)(cEnd-cLine) >= len) {
+				return (-1);
+			}
+			memcpy(dst, cLine, cEnd-cLine);
+			dst[cEnd-cLine] = '\0';
+			return (0);
+		}
+	}
+	return (-1);
+}
+
+/*
+ * Look up the response to a query in the cache. If a valid entry exists,
+ * write the response (or 304 Not Modified) and return 1. Return 0 if the
+ * response is not cached.
+ */
+int
+WEB_CacheServe(WEB_Query *q, const char *op)
+{
+	char path[FILENAME_MAX];
+	WEB_CacheHdr hdr;
+	struct stat sb;
+	int fd, deflate;
+
+	if (CachePath(q, op, path, sizeof(path)) == -1) {
+		return (0);
+	}
+	if ((fd = open(path, O_RDONLY)) == -1) {
+		return (0);
+	}
+	if (WEB_SYS_Read(fd, &hdr, sizeof(hdr)) == -1 ||
+	    hdr.magic != WEB_CACHE_MAGIC ||
+	    hdr.version != WEB_CACHE_VERSION ||
+	    fstat(fd, &sb) == -1 ||
+	    (Uint64)sb.st_size != sizeof(hdr) + hdr.len + hdr.lenDeflate) {
+		WEB_LogErr("%s: Bad cache entry", path);
+		goto invalidate;
+	}
+	if (hdr.expire <= (Uint64)time(NULL)) {
+		goto invalidate;
+	}
+	hdr.etag[sizeof(hdr.etag)-1] = '\0';
+	hdr.contentType[sizeof(hdr.contentType)-1] = '\0';
+
+	deflate = CacheUseDeflate(q, hdr.lenDeflate);
+	CacheSetETag(q, hdr.etag, deflate);
+	if (CacheMatch(q, hdr.etag, deflate)) {
+		close(fd);
+		CacheNotModified(q);
+		return (1);
+	}
+	if (hdr.contentType[0] != '\0') {
+		WEB_SetHeaderS(q, "Content-Type", hdr.contentType);
+	}
+	if (deflate) {
+		WEB_SetHeaderS(q, "Content-Encoding", "deflate");
+		WEB_OutputFileRegion(q, fd, sizeof(hdr) + hdr.len,
+		    hdr.lenDeflate);
+	} else {
+		WEB_OutputFileRegion(q, fd, sizeof(hdr), hdr.len);
+	}
+	WEB_FlushQuery(q);
+	return (1);
+invalidate:
+	close(fd);
+	unlink(path);
+	return (0);
+}
+
+/* Write a new cache entry (atomically). */
+static int
+CacheWrite(const char *path, const WEB_CacheHdr *hdr, const void *data,
+    const void *dataDeflate)
+{
+	char pathTmp[FILENAME_MAX];
+	int fd;
+
+	Snprintf(pathTmp, sizeof(pathTmp), "%s.%d", path, (int)getpid());
+	if ((fd = open(pathTmp, O_WRONLY|O_CREAT|O_TRUNC, 0600)) == -1) {
+		AG_SetError("%s: %s", pathTmp, strerror(errno));
+		return (-1);
+	}
+	if (WEB_SYS_Write(fd, hdr, sizeof(WEB_CacheHdr)) == -1 ||
+	    WEB_SYS_Write(fd, data, hdr->len) == -1 ||
+	    (hdr->lenDeflate > 0 &&
+	     WEB_SYS_Write(fd, dataDeflate, hdr->lenDeflate) == -1)) {
+		close(fd);
+		unlink(pathTmp);
+		return (-1);
+	}
+	close(fd);
+	if (rename(pathTmp, path) == -1) {
+		AG_SetError("%s: %s", path, strerror(errno));
+		unlink(pathTmp);
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Flush a query response, storing it in the cache (with an expiration of
+ * ttl seconds) if it is cacheable. Only complete 200 responses from q->data
+ * are cached; only the entity-body and Content-Type are stored (headers
+ * such as the session Set-Cookie are generated per query). If the client's
+ * If-None-Match matches the new ETag, respond with 304 instead.
+ */
+int
+WEB_CacheFlush(WEB_Query *q, const char *op, int ttl)
+{
+	char path[FILENAME_MAX];
+	WEB_CacheHdr hdr;
+	Uint8 *dataDeflate = NULL;
+	int deflate;
+
+	if ((q->flags & WEB_QUERY_STREAM) || q->fileFd != -1 ||
+	    strncmp(q->head, "HTTP/1.0 200 ", 13) != 0 ||
+	    q->dataLen > WEB_CACHE_ENTRY_MAX ||
+	    CachePath(q, op, path, sizeof(path)) == -1) {
+		WEB_FlushQuery(q);
+		return (-1);
+	}
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = WEB_CACHE_MAGIC;
+	hdr.version = WEB_CACHE_VERSION;
+	hdr.expire = (Uint64)(time(NULL) + ttl);
+	hdr.len = (Uint32)q->dataLen;
+	hdr.lenDeflate = 0;
+	AG_SHA1Data(q->data, q->dataLen, hdr.etag);
+	if (GetResponseHeader(q, "Content-Type", hdr.contentType,
+	    sizeof(hdr.contentType)) == -1)
+		hdr.contentType[0] = '\0';
+#ifdef HAVE_ZLIB
+	if (q->dataLen >= WEB_DATA_COMPRESS_MIN) {
+		uLongf lenDeflate = compressBound(q->dataLen);
+
+		if ((dataDeflate = TryMalloc(lenDeflate)) != NULL) {
+			Uint64 t;
+			int rv;
+
+			WEB_PHASE_BEGIN(t);
+			rv = compress2(dataDeflate, &lenDeflate, q->data,
+			    q->dataLen, Z_BEST_COMPRESSION);
+			WEB_PHASE_END(q, WEB_PHASE_COMPRESS, t);
+			if (rv == Z_OK && lenDeflate < q->dataLen) {
+				hdr.lenDeflate = (Uint32)lenDeflate;
+			} else {
+				Free(dataDeflate);
+				dataDeflate = NULL;
+			}
+		}
+	}
+#endif
+	if (CacheWrite(path, &hdr, q->data, dataDeflate) == -1)
+		WEB_LogErr("Cache: %s", AG_GetError());
+
+	deflate = CacheUseDeflate(q, hdr.lenDeflate);
+	CacheSetETag(q, hdr.etag, deflate);
+	if (CacheMatch(q, hdr.etag, deflate)) {
+		Free(dataDeflate);
+		CacheNotModified(q);
+		return (0);
+	}
+	if (deflate) {
+		/* Send the precompressed body as-is. */
+		WEB_SetHeaderS(q, "Content-Encoding", "deflate");
+		WEB_SetCompression(q, 0, 0);
+		Free(q->data);
+		q->data = dataDeflate;
+		q->dataSize = hdr.lenDeflate;
+		q->dataLen = hdr.lenDeflate;
+	} else {
+		Free(dataDeflate);
+	}
+	WEB_FlushQuery(q);
+	return (0);
+}
+
+/*
+ * Remove all cache entries for the given operation, or all entries if op
+ * is NULL. Should be called when data affecting cached output changes.
+ */
+void
+WEB_CacheInvalidate(const char *op)
+{
+	char path[FILENAME_MAX];
+	struct dirent *dent;
+	size_t opLen = (op != NULL) ? strlen(op) : 0;
+	DIR *dir;
+
+	if ((dir = opendir(WEB_PATH_CACHE)) == NULL) {
+		WEB_LogErr("%s: %s", WEB_PATH_CACHE, strerror(errno));
+		return;
+	}
+	while ((dent = readdir(dir)) != NULL) {
+		if (dent->d_name[0] == '.' ||
+		    strchr(dent->d_name, '=') == NULL) {
+			continue;
+		}
+		if (op != NULL &&
+		    (strncmp(dent->d_name, op, opLen) != 0 ||
+		     dent->d_name[opLen] != '='))
+			continue;
+
+		Strlcpy(path, WEB_PATH_CACHE, sizeof(path));
+		Strlcat(path, dent->d_name, sizeof(path));
+		if (unlink(path) == -1 && errno != ENOENT)
+			WEB_LogErr("%s: %s", path, strerror(errno));
+	}
+	closedir(dir);
+}
@@ -0,0 +1,413 @@
+/*
+ * Copyright (c) 2026 Hypertriton, Inc. <http://hypertriton.com/>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Request metrics. Counters live in an anonymous shared mapping created by
+ * WEB_MetricsInit() in the Frontend before any Worker is forked, so the
+ * Frontend and all of its Workers update the same counters. Updates use
+ * atomic increments where the compiler provides them (otherwise counts are
+ * approximate under concurrency).
+ *
+ * For each route (operation), we record request counts by status class,
+ * bytes in and out, and latency histograms for the request phases listed
+ * in enum web_phase. The Frontend maintains connection counts and Worker
+ * pool occupancy.
+ *
+ * The metrics are available in a plain text format (one "name{labels}
+ * value" per line) from the "metrics" control command and optionally from
+ * an application command mapped to WEB_MetricsOutput().
+ */
+
+#include <agar/core/core.h>
+#include <agar/core/web.h>
+
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+# define METRIC_ADD(p,n)	__sync_fetch_and_add((p),(n))
+# define METRIC_CAS(p,o,n)	__sync_bool_compare_and_swap((p),(o),(n))
+#else
+# define METRIC_ADD(p,n)	(*(p) += (n))
+# define METRIC_CAS(p,o,n)	((*(p) == (o)) ? ((*(p) = (n)), 1) : 0)
+#endif
+
+/* Latency histogram */
+typedef struct web_histogram {
+	Uint64 count;
+	Uint64 sum;				/* Total (usec) */
+	Uint64 buckets[WEB_METRICS_BUCKETS];	/* Counts (non-cumulative) */
+} WEB_Histogram;
+
+/* Per-route metrics */
+typedef struct web_route_metrics {
+	volatile Uint32 state;
+#define WEB_ROUTE_FREE	0
+#define WEB_ROUTE_INIT	1			/* Being claimed */
+#define WEB_ROUTE_READY	2
+	Uint32 _pad;
+	char   name[WEB_OPNAME_MAX];		/* Operation name */
+	Uint64 nStatus[6];			/* By status class (1xx-5xx, ?) */
+	Uint64 bytesIn, bytesOut;
+	WEB_Histogram latency[WEB_PHASE_LAST];
+} WEB_RouteMetrics;
+
+/* Shared metrics area */
+typedef struct web_metrics {
+	Uint64 nConnections;			/* HTTP connections accepted */
+	Uint64 nRequests;			/* HTTP requests (Frontend) */
+	Uint64 nUntracked;			/* Requests for overflow routes */
+	Uint64 nLogDropped;			/* Dropped log entries */
+	Uint64 nRejected[WEB_ADMIT_REFUSED_LAST]; /* Refused by admission */
+	Uint32 nWorkers;			/* Worker connections (gauge) */
+	Uint32 nPoolIdle;			/* Idle pooled Workers (gauge) */
+	Uint32 nPoolTarget;			/* Pool target size (gauge) */
+	Uint32 _pad;
+	WEB_RouteMetrics routes[WEB_METRICS_ROUTES];
+} WEB_Metrics;
+
+/* Output buffer for the text format. */
+typedef struct web_metrics_buf {
+	char  *s;
+	size_t len, size;
+} WEB_MetricsBuf;
+
+static WEB_Metrics *webMetrics = NULL;
+
+static const char *webPhaseNames[] = {
+	"queue",
+	"module",
+	"template",
+	"compress",
+	"total"
+};
+static const char *webStatusNames[] = {
+	"1xx", "2xx", "3xx", "4xx", "5xx", "other"
+};
+
+/*
+ * Create the shared metrics area. Must be called by the Frontend before
+ * any Worker processes are created.
+ */
+int
+WEB_MetricsInit(void)
+{
+	void *p;
+
+	if (webMetrics != NULL) {
+		return (0);
+	}
+	p = mmap(NULL, sizeof(WEB_Metrics), PROT_READ|PROT_WRITE,
+	    MAP_SHARED|MAP_ANON, -1, 0);
+	if (p == MAP_FAILED) {
+		AG_SetError("mmap: %s", strerror(errno));
+		return (-1);
+	}
+	memset(p, 0, sizeof(WEB_Metrics));
+	webMetrics = p;
+	return (0);
+}
+
+/* Return the value of a monotonic clock in microseconds. */
+Uint64
+WEB_MetricsNow(void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		return ((Uint64)ts.tv_sec*1000000 + (Uint64)ts.tv_nsec/1000);
+#endif
+	return ((Uint64)time(NULL)*1000000);
+}
+
+/* Look up (or allocate) the metrics entry for a route. */
+static WEB_RouteMetrics *
+LookupRoute(const char *name)
+{
+	Uint32 h = 2166136261U;
+	const char *c;
+	Uint i, n;
+
+	for (c = name; *c != '\0'; c++) {
+		h = (h ^ (Uchar)*c) * 16777619U;
+	}
+	for (i = 0, n = h % WEB_METRICS_ROUTES;
+	     i < WEB_METRICS_ROUTES;
+	     i++, n = (n+1) % WEB_METRICS_ROUTES) {
+		WEB_RouteMetrics *rm = &webMetrics->routes[n];
+
+		if (rm->state == WEB_ROUTE_FREE &&
+		    METRIC_CAS(&rm->state, WEB_ROUTE_FREE, WEB_ROUTE_INIT)) {
+			Strlcpy(rm->name, name, sizeof(rm->name));
+			rm->state = WEB_ROUTE_READY;
+			return (rm);
+		}
+		while (rm->state == WEB_ROUTE_INIT)
+			;				/* Being claimed */
+		if (strcmp(rm->name, name) == 0)
+			return (rm);
+	}
+	return (NULL);
+}
+
+/* Record a latency sample. */
+static void
+HistogramAdd(WEB_Histogram *h, Uint32 usec)
+{
+	Uint i;
+
+	for (i = 0; i < WEB_METRICS_BUCKETS-1; i++) {
+		if (usec <= ((Uint32)WEB_METRICS_BUCKET_MIN << i))
+			break;
+	}
+	METRIC_ADD(&h->buckets[i], 1);
+	METRIC_ADD(&h->count, 1);
+	METRIC_ADD(&h->sum, usec);
+}
+
+/*
+ * Record a completed query under the given route (called by the Worker).
+ * The phase latencies are taken from q->tPhase[].
+ */
+void
+WEB_MetricsRecord(const WEB_Query *q, const char *op)
+{
+	WEB_RouteMetrics *rm;
+	int code, i;
+
+	if (webMetrics == NULL) {
+		return;
+	}
+	if ((rm = LookupRoute((op[0] != '\0') ? op : "-")) == NULL) {
+		METRIC_ADD(&webMetrics->nUntracked, 1);
+		return;
+	}
+	code = atoi(&q->head[9]);			/* "HTTP/1.0 NNN" */
+	METRIC_ADD(&rm->nStatus[(code >= 100 && code < 600) ? code/100-1 : 5],
+	    1);
+	METRIC_ADD(&rm->bytesIn, q->contentLength);
+	METRIC_ADD(&rm->bytesOut, q->bytesOut);
+	for (i = 0; i < WEB_PHASE_LAST; i++) {
+		if (i == WEB_PHASE_TEMPLATE && q->tPhase[i] == 0) {
+			continue;
+		}
+		if (i == WEB_PHASE_COMPRESS && q->tPhase[i] == 0) {
+			continue;
+		}
+		HistogramAdd(&rm->latency[i], q->tPhase[i]);
+	}
+}
+
+/* Count an accepted HTTP connection (Frontend). */
+void
+WEB_MetricsConnection(void)
+{
+	if (webMetrics != NULL)
+		METRIC_ADD(&webMetrics->nConnections, 1);
+}
+
+/* Count an HTTP request read by the Frontend. */
+void
+WEB_MetricsRequest(void)
+{
+	if (webMetrics != NULL)
+		METRIC_ADD(&webMetrics->nRequests, 1);
+}
+
+/* Count a log entry dropped by asynchronous logging. */
+void
+WEB_MetricsLogDropped(void)
+{
+	if (webMetrics != NULL)
+		METRIC_ADD(&webMetrics->nLogDropped, 1);
+}
+
+/* Count a query refused by admission control (Frontend). */
+void
+WEB_MetricsRejected(int reason)
+{
+	if (webMetrics != NULL && reason >= 0 && reason < WEB_ADMIT_REFUSED_LAST)
+		METRIC_ADD(&webMetrics->nRejected[reason], 1);
+}
+
+/* Update the Worker occupancy gauges (Frontend). */
+void
+WEB_MetricsWorkers(Uint nWorkers, Uint nPoolIdle, Uint nPoolTarget)
+{
+	if (webMetrics == NULL) {
+		return;
+	}
+	webMetrics->nWorkers = nWorkers;
+	webMetrics->nPoolIdle = nPoolIdle;
+	webMetrics->nPoolTarget = nPoolTarget;
+}
+
+static void
+MetricsPrintf(WEB_MetricsBuf *mb, const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	for (;;) {
+		va_start(ap, fmt);
+		len = vsnprintf(&mb->s[mb->len], mb->size - mb->len, fmt, ap);
+		va_end(ap);
+		if (len < 0) {
+			return;
+		}
+		if (mb->len + len < mb->size) {
+			break;
+		}
+		mb->size += len + 4096;
+		mb->s = Realloc(mb->s, mb->size);
+	}
+	mb->len += len;
+}
+
+/*
+ * Return the current metrics in text format, in a newly allocated,
+ * NUL-terminated buffer.
+ */
+char *
+WEB_MetricsText(size_t *len)
+{
+	WEB_MetricsBuf mb;
+	WEB_Metrics *m = webMetrics;
+	Uint i, j, k;
+
+	mb.size = 4096;
+	mb.len = 0;
+	if ((mb.s = TryMalloc(mb.size)) == NULL) {
+		return (NULL);
+	}
+	mb.s[0] = '\0';
+	if (m == NULL) {
+		if (len != NULL) { *len = 0; }
+		return (mb.s);
+	}
+	MetricsPrintf(&mb,
+	    "web_connections_total %llu\n"
+	    "web_requests_total %llu\n"
+	    "web_requests_untracked_total %llu\n"
+	    "web_log_dropped_total %llu\n"
+	    "web_requests_rejected_total{reason=\"client_rate\"} %llu\n"
+	    "web_requests_rejected_total{reason=\"global_rate\"} %llu\n"
+	    "web_requests_rejected_total{reason=\"queue\"} %llu\n"
+	    "web_workers %u\n"
+	    "web_pool_idle %u\n"
+	    "web_pool_target %u\n",
+	    (unsigned long long)m->nConnections,
+	    (unsigned long long)m->nRequests,
+	    (unsigned long long)m->nUntracked,
+	    (unsigned long long)m->nLogDropped,
+	    (unsigned long long)m->nRejected[0],
+	    (unsigned long long)m->nRejected[1],
+	    (unsigned long long)m->nRejected[2],
+	    m->nWorkers, m->nPoolIdle, m->nPoolTarget);
+
+	for (i = 0; i < WEB_METRICS_ROUTES; i++) {
+		WEB_RouteMetrics *rm = &m->routes[i];
+
+		if (rm->state != WEB_ROUTE_READY) {
+			continue;
+		}
+		for (j = 0; j < 6; j++) {
+			if (rm->nStatus[j] == 0) {
+				continue;
+			}
+			MetricsPrintf(&mb,
+			    "web_route_requests_total{route=\"%s\",code=\"%s\"} "
+			    "%llu\n", rm->name, webStatusNames[j],
+			    (unsigned long long)rm->nStatus[j]);
+		}
+		MetricsPrintf(&mb,
+		    "web_route_bytes_in_total{route=\"%s\"} %llu\n"
+		    "web_route_bytes_out_total{route=\"%s\"} %llu\n",
+		    rm->name, (unsigned long long)rm->bytesIn,
+		    rm->name, (unsigned long long)rm->bytesOut);
+
+		for (j = 0; j < WEB_PHASE_LAST; j++) {
+			WEB_Histogram *h = &rm->latency[j];
+			Uint64 cum = 0;
+
+			if (h->count == 0) {
+				continue;
+			}
+			for (k = 0; k < WEB_METRICS_BUCKETS-1; k++) {
+				cum += h->buckets[k];
+				MetricsPrintf(&mb,
+				    "web_route_latency_usec_bucket{route=\"%s\","
+				    "phase=\"%s\",le=\"%u\"} %llu\n",
+				    rm->name, webPhaseNames[j],
+				    (Uint)WEB_METRICS_BUCKET_MIN << k,
+				    (unsigned long long)cum);
+			}
+			MetricsPrintf(&mb,
+			    "web_route_latency_usec_bucket{route=\"%s\","
+			    "phase=\"%s\",le=\"+Inf\"} %llu\n"
+			    "web_route_latency_usec_sum{route=\"%s\","
+			    "phase=\"%s\"} %llu\n"
+			    "web_route_latency_usec_count{route=\"%s\","
+			    "phase=\"%s\"} %llu\n",
+			    rm->name, webPhaseNames[j],
+			    (unsigned long long)h->count,
+			    rm->name, webPhaseNames[j],
+			    (unsigned long long)h->sum,
+			    rm->name, webPhaseNames[j],
+			    (unsigned long long)h->count);
+		}
+	}
+	if (len != NULL) {
+		*len = mb.len;
+	}
+	return (mb.s);
+}
+
+/*
+ * Write the current metrics in text format as the query response.
+ * May be mapped to an application command (with a NULL or text/plain type).
+ */
+int
+WEB_MetricsOutput(WEB_Query *q)
+{
+	char *s;
+	size_t len;
+
+	if ((s = WEB_MetricsText(&len)) == NULL) {
+		return (-1);
+	}
+	WEB_SetHeaderS(q, "Content-Type", "text/plain; version=0.0.4");
+	WEB_Write(q, s, len);
+	free(s);
+	return (0);
+}
@@ -0,0 +1,925 @@
+/*
+ * Copyright (c) 2026 Hypertriton, Inc. <http://hypertriton.com/>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Shared-memory session store. Sessions live in a hash table of fixed-size
+ * slots inside a memory-mapped file, which is shared by the Frontend and all
+ * Worker processes (the mapping is inherited across fork()).
+ *
+ * Each slot holds the session variables in a small open-addressed hash
+ * table, the event counter and any session-manager specific data (as
+ * written by the save() operation of WEB_SessionOps).
+ *
+ * Locking uses fcntl(2) record locks, so locks held by a crashed process
+ * are released by the kernel. The header record protects the slot index
+ * (allocation and deletion of slots); each slot record protects the slot
+ * contents. A slot's state is changed only with both locks held, so it
+ * can be tested under either one. Locks are always acquired in
+ * header-then-slot order; operations on existing sessions hold the header
+ * (read) lock only long enough to find and lock the slot.
+ *
+ * Persistence is lazy: modified slots are flagged dirty and written back
+ * to the per-session files in WEB_PATH_SESSIONS by WEB_SessionStoreSync(),
+ * which the Frontend calls every WEB_SESSION_SHM_SYNC_IVAL seconds.
+ *
+ * The store is disabled by default (session files are used directly); it
+ * is enabled by calling WEB_SetSessionStore() before WEB_SessionMgrInit().
+ */
+
+#include <agar/core/core.h>
+#include <agar/core/web.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#if WEB_SESSION_SHM_BUCKETS <= WEB_SESSION_VARIABLES_MAX
+#error "WEB_SESSION_SHM_BUCKETS must exceed WEB_SESSION_VARIABLES_MAX"
+#endif
+
+#define WEB_STORE_MAGIC   0x53455353	/* "SESS" */
+#define WEB_STORE_VERSION 1
+
+/* Store header */
+typedef struct web_store_hdr {
+	Uint32 magic;
+	Uint32 version;
+	Uint32 nSlots;				/* Slot count */
+	Uint32 slotSize;			/* Slot size (bytes) */
+	Uint32 nUsed;				/* Slots in use */
+	Uint32 flags;
+#define WEB_STORE_OVERFLOW 0x01			/* Some sessions are file-only */
+	Uint8  _pad[40];
+} WEB_StoreHdr;
+
+/* Session variable entry */
+typedef struct web_store_var {
+	Uint32 hash;				/* Key hash (0 = unused) */
+	Uint32 valOffs;				/* Offset of value in heap */
+	Uint32 valLen;				/* Value length (w/o NUL) */
+	char   key[WEB_SESSION_VAR_KEY_MAX];	/* Variable name */
+} WEB_StoreVar;
+
+/* Session slot */
+typedef struct web_store_slot {
+	Uint32 state;				/* Slot state (both locks) */
+#define WEB_STORE_EMPTY   0
+#define WEB_STORE_USED    1
+#define WEB_STORE_DELETED 2
+	Uint32 flags;				/* Slot flags (slot lock) */
+#define WEB_STORE_DIRTY	  0x01			/* Not yet written to disk */
+	char   id[WEB_SESSID_MAX];		/* Session ID */
+	Uint32 nVars;				/* Variable count */
+	Uint32 nEvents;				/* Event counter */
+	Uint32 heapLen;				/* Heap space used */
+	Uint32 extraLen;			/* Session manager data */
+	Uint32 order[WEB_SESSION_VARIABLES_MAX]; /* Insertion order */
+	WEB_StoreVar vars[WEB_SESSION_SHM_BUCKETS];
+	char   heap[WEB_SESSION_SHM_HEAP];	/* Variable values */
+	Uint8  extra[WEB_SESSION_SHM_EXTRA];	/* Session manager data */
+} WEB_StoreSlot;
+
+static int    storeFd = -1;			/* Store file */
+static Uint8 *storeMap = NULL;			/* Mapping of store file */
+static size_t storeSize = 0;			/* Size of mapping */
+static Uint   storeSlotsCfg = 0;		/* Configured capacity */
+
+#define STORE_HDR()	    ((WEB_StoreHdr *)storeMap)
+#define STORE_SLOT_OFFS(i)  (sizeof(WEB_StoreHdr) + (i)*sizeof(WEB_StoreSlot))
+#define STORE_SLOT(i)	    ((WEB_StoreSlot *)&storeMap[STORE_SLOT_OFFS(i)])
+
+/* Acquire or release an fcntl(2) lock on a region of the store file. */
+static int
+StoreLock(off_t offs, off_t len, short type)
+{
+	struct flock fl;
+
+	fl.l_type = type;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = offs;
+	fl.l_len = len;
+	while (fcntl(storeFd, (type == F_UNLCK) ? F_SETLK : F_SETLKW,
+	    &fl) == -1) {
+		if (errno != EINTR) {
+			AG_SetError("Session store lock: %s", strerror(errno));
+			return (-1);
+		}
+	}
+	return (0);
+}
+#define LockHeader(t)	StoreLock(0, sizeof(WEB_StoreHdr), (t))
+#define UnlockHeader()	StoreLock(0, sizeof(WEB_StoreHdr), F_UNLCK)
+#define LockSlot(i,t)	StoreLock(STORE_SLOT_OFFS(i), sizeof(WEB_StoreSlot), (t))
+#define UnlockSlot(i)	StoreLock(STORE_SLOT_OFFS(i), sizeof(WEB_StoreSlot), F_UNLCK)
+
+/* FNV-1a string hash (never returns 0). */
+static __inline__ Uint32
+StoreHash(const char *s)
+{
+	Uint32 h = 2166136261U;
+
+	for (; *s != '\0'; s++) {
+		h ^= (Uint8)*s;
+		h *= 16777619U;
+	}
+	return (h != 0) ? h : 1;
+}
+
+/* Look up a session slot by ID. Header lock must be held. */
+static int
+FindSlot(const char *id, Uint32 h)
+{
+	Uint nSlots = STORE_HDR()->nSlots;
+	Uint i, n;
+
+	for (n = 0, i = h % nSlots; n < nSlots; n++, i = (i+1) % nSlots) {
+		WEB_StoreSlot *sl = STORE_SLOT(i);
+
+		if (sl->state == WEB_STORE_EMPTY) {
+			break;
+		}
+		if (sl->state == WEB_STORE_USED && strcmp(sl->id, id) == 0)
+			return (int)i;
+	}
+	return (-1);
+}
+
+/* Allocate a new session slot. Header write lock must be held. */
+static int
+AllocSlot(const char *id, Uint32 h)
+{
+	WEB_StoreHdr *hdr = STORE_HDR();
+	Uint i, n;
+
+	for (n = 0, i = h % hdr->nSlots;
+	     n < hdr->nSlots;
+	     n++, i = (i+1) % hdr->nSlots) {
+		WEB_StoreSlot *sl = STORE_SLOT(i);
+
+		if (sl->state == WEB_STORE_USED) {
+			continue;
+		}
+		if (LockSlot(i, F_WRLCK) == -1) {
+			return (-1);
+		}
+		sl->state = WEB_STORE_USED;
+		sl->flags = 0;
+		Strlcpy(sl->id, id, sizeof(sl->id));
+		sl->nVars = 0;
+		sl->nEvents = 0;
+		sl->heapLen = 0;
+		sl->extraLen = 0;
+		memset(sl->vars, 0, sizeof(sl->vars));
+		UnlockSlot(i);
+		hdr->nUsed++;
+		return (int)i;
+	}
+	hdr->flags |= WEB_STORE_OVERFLOW;
+	AG_SetError("Session store is full (%u)", hdr->nSlots);
+	return (-1);
+}
+
+/* Release a slot. Header write lock and slot write lock must be held. */
+static void
+FreeSlot(Uint i)
+{
+	WEB_StoreHdr *hdr = STORE_HDR();
+	WEB_StoreSlot *sl = STORE_SLOT(i);
+
+	/*
+	 * If the next slot in the probe sequence is empty, no chain runs
+	 * through this slot and it can be marked empty (not deleted).
+	 */
+	if (STORE_SLOT((i+1) % hdr->nSlots)->state == WEB_STORE_EMPTY) {
+		sl->state = WEB_STORE_EMPTY;
+	} else {
+		sl->state = WEB_STORE_DELETED;
+	}
+	sl->flags = 0;
+	sl->id[0] = '\0';
+	hdr->nUsed--;
+}
+
+/* Look up a session variable entry. Slot lock must be held. */
+static WEB_StoreVar *
+SlotLookupVar(WEB_StoreSlot *sl, const char *key, Uint32 h)
+{
+	Uint i, n;
+
+	for (n = 0, i = h & (WEB_SESSION_SHM_BUCKETS-1);
+	     n < WEB_SESSION_SHM_BUCKETS;
+	     n++, i = (i+1) & (WEB_SESSION_SHM_BUCKETS-1)) {
+		WEB_StoreVar *v = &sl->vars[i];
+
+		if (v->hash == 0) {
+			break;
+		}
+		if (v->hash == h && strcmp(v->key, key) == 0)
+			return (v);
+	}
+	return (NULL);
+}
+
+/*
+ * Pack variable values at the start of the heap, dropping the value of
+ * the given variable (if not NULL). Slot lock must be held.
+ */
+static void
+SlotCompact(WEB_StoreSlot *sl, const WEB_StoreVar *vSkip)
+{
+	char heap[WEB_SESSION_SHM_HEAP];
+	Uint32 i, len = 0;
+
+	for (i = 0; i < sl->nVars; i++) {
+		WEB_StoreVar *v = &sl->vars[sl->order[i]];
+
+		if (v == vSkip) {
+			continue;
+		}
+		memcpy(&heap[len], &sl->heap[v->valOffs], v->valLen+1);
+		v->valOffs = len;
+		len += v->valLen+1;
+	}
+	memcpy(sl->heap, heap, len);
+	sl->heapLen = len;
+}
+
+/* Set the value of a session variable. Slot write lock must be held. */
+static int
+SlotSetVar(WEB_StoreSlot *sl, const char *key, const char *val)
+{
+	Uint32 h = StoreHash(key);
+	size_t len = strlen(val);
+	WEB_StoreVar *v;
+	Uint i;
+
+	if (len >= WEB_SESSION_VAR_VALUE_MAX)
+		len = WEB_SESSION_VAR_VALUE_MAX-1;
+
+	if ((v = SlotLookupVar(sl, key, h)) != NULL) {
+		if (len <= v->valLen) {			/* Overwrite in place */
+			memcpy(&sl->heap[v->valOffs], val, len);
+			sl->heap[v->valOffs+len] = '\0';
+			v->valLen = len;
+			return (0);
+		}
+	} else if (sl->nVars >= WEB_SESSION_VARIABLES_MAX) {
+		AG_SetError("Too many session variables (%s)", sl->id);
+		return (-1);
+	}
+	if (sl->heapLen+len+1 > sizeof(sl->heap)) {
+		SlotCompact(sl, v);
+		if (sl->heapLen+len+1 > sizeof(sl->heap)) {
+			if (v != NULL) {		/* Old value was dropped */
+				v->valOffs = sl->heapLen;
+				v->valLen = 0;
+				sl->heap[sl->heapLen++] = '\0';
+			}
+			AG_SetError("Session data too large (%s)", sl->id);
+			return (-1);
+		}
+	}
+	if (v == NULL) {
+		for (i = h & (WEB_SESSION_SHM_BUCKETS-1);
+		     sl->vars[i].hash != 0;
+		     i = (i+1) & (WEB_SESSION_SHM_BUCKETS-1))
+			;;
+		v = &sl->vars[i];
+		v->hash = h;
+		Strlcpy(v->key, key, sizeof(v->key));
+		sl->order[sl->nVars++] = i;
+	}
+	v->valOffs = sl->heapLen;
+	v->valLen = len;
+	memcpy(&sl->heap[v->valOffs], val, len);
+	sl->heap[v->valOffs+len] = '\0';
+	sl->heapLen += len+1;
+	return (0);
+}
+
+/*
+ * Write a slot back to its session file (in the format expected by
+ * WEB_SessionLoad()). Slot lock must be held.
+ */
+static int
+SlotWriteFile(WEB_StoreSlot *sl)
+{
+	char path[FILENAME_MAX], pathTmp[FILENAME_MAX];
+	AG_DataSource *ds;
+	Uint32 i;
+
+	Strlcpy(path, WEB_PATH_SESSIONS, sizeof(path));
+	Strlcat(path, sl->id, sizeof(path));
+	Strlcpy(pathTmp, path, sizeof(pathTmp));
+	Strlcat(pathTmp, ".tmp", sizeof(pathTmp));
+
+	if ((ds = AG_OpenFile(pathTmp, "w")) == NULL) {
+		return (-1);
+	}
+	AG_WriteUint32(ds, WEB_SESSION_DATA_MAGIC);
+	AG_WriteUint32(ds, sl->nVars);
+	for (i = 0; i < sl->nVars; i++) {
+		WEB_StoreVar *v = &sl->vars[sl->order[i]];
+
+		AG_WriteString(ds, v->key);
+		AG_WriteString(ds, &sl->heap[v->valOffs]);
+	}
+	AG_WriteUint32(ds, sl->nEvents);
+	if (sl->extraLen > 0 &&
+	    AG_Write(ds, sl->extra, sl->extraLen) == -1) {
+		AG_CloseFile(ds);
+		unlink(pathTmp);
+		return (-1);
+	}
+	AG_CloseFile(ds);
+
+	if (rename(pathTmp, path) == -1) {
+		AG_SetError("%s: %s", path, strerror(errno));
+		unlink(pathTmp);
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Import an existing session file into a newly allocated slot.
+ * Header write lock must be held.
+ */
+static int
+ImportFile(const char *id)
+{
+	char path[FILENAME_MAX];
+	char key[WEB_SESSION_VAR_KEY_MAX];
+	char val[WEB_SESSION_VAR_VALUE_MAX];
+	WEB_StoreSlot *sl;
+	AG_DataSource *ds;
+	struct stat sb;
+	Uint32 i, count;
+	off_t offs;
+	int slot;
+
+	Strlcpy(path, WEB_PATH_SESSIONS, sizeof(path));
+	Strlcat(path, id, sizeof(path));
+	if (stat(path, &sb) == -1 ||
+	    (ds = AG_OpenFile(path, "r")) == NULL) {
+		return (-1);
+	}
+	if (AG_ReadUint32(ds) != WEB_SESSION_DATA_MAGIC ||
+	    (count = AG_ReadUint32(ds)) > WEB_SESSION_VARIABLES_MAX) {
+		AG_SetError("%s: Bad session data", path);
+		goto fail;
+	}
+	if ((slot = AllocSlot(id, StoreHash(id))) == -1) {
+		goto fail;
+	}
+	sl = STORE_SLOT(slot);
+	if (LockSlot(slot, F_WRLCK) == -1) {
+		FreeSlot(slot);
+		goto fail;
+	}
+	for (i = 0; i < count; i++) {
+		if (AG_CopyString(key, ds, sizeof(key)) == -1 ||
+		    AG_CopyString(val, ds, sizeof(val)) == -1 ||
+		    SlotSetVar(sl, key, val) == -1)
+			goto fail_slot;
+	}
+	sl->nEvents = AG_ReadUint32(ds);
+	if ((offs = AG_Tell(ds)) < sb.st_size) {
+		if (sb.st_size - offs > sizeof(sl->extra)) {
+			AG_SetError("%s: Session data too large", path);
+			goto fail_slot;
+		}
+		sl->extraLen = (Uint32)(sb.st_size - offs);
+		if (AG_Read(ds, sl->extra, sl->extraLen) == -1)
+			goto fail_slot;
+	}
+	UnlockSlot(slot);
+	AG_CloseFile(ds);
+	return (0);
+fail_slot:
+	FreeSlot(slot);
+	UnlockSlot(slot);
+fail:
+	AG_CloseFile(ds);
+	return (-1);
+}
+
+/* Import all existing session files. Header write lock must be held. */
+static void
+ImportSessions(void)
+{
+	struct dirent *dent;
+	DIR *dir;
+	Uint nImported = 0;
+
+	if ((dir = opendir(WEB_PATH_SESSIONS)) == NULL) {
+		return;
+	}
+	while ((dent = readdir(dir)) != NULL) {
+		const char *c;
+
+		for (c = dent->d_name; *c != '\0'; c++) {
+			if (!isdigit(*c))
+				break;
+		}
+		if (*c != '\0' || dent->d_name[0] == '\0' ||
+		    strlen(dent->d_name) >= WEB_SESSID_MAX) {
+			continue;
+		}
+		if (ImportFile(dent->d_name) == -1) {
+			WEB_LogWarn("Session store: %s", AG_GetError());
+			if (STORE_HDR()->flags & WEB_STORE_OVERFLOW)
+				break;
+			continue;
+		}
+		nImported++;
+	}
+	closedir(dir);
+	if (nImported > 0)
+		WEB_LogInfo("Session store: Imported %u sessions", nImported);
+}
+
+/*
+ * Enable the session store with a capacity of nSlots sessions (the mapping
+ * size is about nSlots * 20K). A value of 0 disables the store. Must be
+ * called before WEB_SessionMgrInit().
+ */
+void
+WEB_SetSessionStore(Uint nSlots)
+{
+	storeSlotsCfg = nSlots;
+}
+
+/* Return the configured session store capacity (0 = disabled). */
+Uint
+WEB_GetSessionStore(void)
+{
+	return (storeSlotsCfg);
+}
+
+/*
+ * Open (and create if necessary) the session store at the given path.
+ * A newly created store is populated from existing session files.
+ */
+int
+WEB_SessionStoreOpen(const char *path, Uint nSlots)
+{
+	WEB_StoreHdr *hdr;
+	struct stat sb;
+	size_t size;
+	int isNew = 0;
+
+	if (storeMap != NULL) {
+		AG_SetErrorS("Session store is already open");
+		return (-1);
+	}
+	if (nSlots == 0) {
+		AG_SetErrorS("Bad slot count");
+		return (-1);
+	}
+	size = STORE_SLOT_OFFS(nSlots);
+
+	if ((storeFd = open(path, O_RDWR|O_CREAT, 0600)) == -1) {
+		AG_SetError("%s: %s", path, strerror(errno));
+		return (-1);
+	}
+	if (LockHeader(F_WRLCK) == -1) {
+		goto fail;
+	}
+	if (fstat(storeFd, &sb) == -1) {
+		AG_SetError("%s: %s", path, strerror(errno));
+		goto fail_unlock;
+	}
+	if (sb.st_size == 0) {
+		if (ftruncate(storeFd, (off_t)size) == -1) {
+			AG_SetError("%s: %s", path, strerror(errno));
+			goto fail_unlock;
+		}
+		isNew = 1;
+	} else if ((size_t)sb.st_size != size) {
+		AG_SetError("%s: Incompatible store size (%lu != %lu)", path,
+		    (Ulong)sb.st_size, (Ulong)size);
+		goto fail_unlock;
+	}
+	storeMap = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED,
+	    storeFd, 0);
+	if (storeMap == MAP_FAILED) {
+		AG_SetError("mmap(%s): %s", path, strerror(errno));
+		storeMap = NULL;
+		goto fail_unlock;
+	}
+	storeSize = size;
+	hdr = STORE_HDR();
+
+	if (isNew) {
+		hdr->magic = WEB_STORE_MAGIC;
+		hdr->version = WEB_STORE_VERSION;
+		hdr->nSlots = nSlots;
+		hdr->slotSize = sizeof(WEB_StoreSlot);
+		hdr->nUsed = 0;
+		hdr->flags = 0;
+		ImportSessions();
+	} else if (hdr->magic != WEB_STORE_MAGIC ||
+	           hdr->version != WEB_STORE_VERSION ||
+	           hdr->nSlots != nSlots ||
+	           hdr->slotSize != sizeof(WEB_StoreSlot)) {
+		AG_SetError("%s: Incompatible session store", path);
+		munmap(storeMap, storeSize);
+		storeMap = NULL;
+		goto fail_unlock;
+	}
+	UnlockHeader();
+	return (0);
+fail_unlock:
+	UnlockHeader();
+fail:
+	close(storeFd);
+	storeFd = -1;
+	return (-1);
+}
+
+/* Unmap the session store (dirty sessions are not written back). */
+void
+WEB_SessionStoreClose(void)
+{
+	if (storeMap == NULL) {
+		return;
+	}
+	munmap(storeMap, storeSize);
+	storeMap = NULL;
+	storeSize = 0;
+	close(storeFd);
+	storeFd = -1;
+}
+
+int
+WEB_SessionStoreIsOpen(void)
+{
+	return (storeMap != NULL);
+}
+
+/* Return 1 if the given session exists in the store. */
+int
+WEB_SessionStoreExists(const char *id)
+{
+	int slot;
+
+	if (storeMap == NULL || LockHeader(F_RDLCK) == -1) {
+		return (0);
+	}
+	slot = FindSlot(id, StoreHash(id));
+	UnlockHeader();
+	return (slot != -1);
+}
+
+/*
+ * Load session variables and session manager data from the store into
+ * an initialized WEB_Session. Return 0 on success, 1 if the session is
+ * not in the store and -1 on failure.
+ */
+int
+WEB_SessionStoreLoad(void *pSess, const char *id)
+{
+	WEB_Session *S = pSess;
+	WEB_StoreSlot *sl;
+	WEB_SessionVar *SV;
+	Uint32 i;
+	int slot, rv = 0;
+
+	if (storeMap == NULL) {
+		return (1);
+	}
+	if (LockHeader(F_RDLCK) == -1) {
+		return (-1);
+	}
+	if ((slot = FindSlot(id, StoreHash(id))) == -1) {
+		UnlockHeader();
+		return (1);
+	}
+	if (LockSlot(slot, F_RDLCK) == -1) {
+		UnlockHeader();
+		return (-1);
+	}
+	UnlockHeader();
+	sl = STORE_SLOT(slot);
+
+	Strlcpy(S->id, id, sizeof(S->id));
+	for (i = 0; i < sl->nVars; i++) {
+		WEB_StoreVar *v = &sl->vars[sl->order[i]];
+
+		if ((SV = TryMalloc(sizeof(WEB_SessionVar))) == NULL) {
+			rv = -1;
+			goto out;
+		}
+		Strlcpy(SV->key, v->key, sizeof(SV->key));
+		Strlcpy(SV->value, &sl->heap[v->valOffs], sizeof(SV->value));
+		TAILQ_INSERT_TAIL(&S->vars, SV, vars);
+		S->nVars++;
+	}
+	S->nEvents = (Uint)sl->nEvents;
+
+	if (S->ops->load != NULL) {
+		AG_DataSource *ds;
+
+		if ((ds = AG_OpenConstCore(sl->extra, sl->extraLen)) == NULL) {
+			rv = -1;
+			goto out;
+		}
+		if (S->ops->load(S, ds) == -1) {
+			rv = -1;
+		}
+		AG_CloseConstCore(ds);
+	}
+out:
+	UnlockSlot(slot);
+	return (rv);
+}
+
+/*
+ * Save a WEB_Session into the store, allocating a slot if needed. If dirty
+ * is set, flag the session to be written to disk on the next sync.
+ * On failure, the session is removed from the store.
+ */
+int
+WEB_SessionStoreSave(void *pSess, int dirty)
+{
+	WEB_Session *S = pSess;
+	Uint32 h = StoreHash(S->id);
+	AG_DataSource *ds = NULL;
+	AG_CoreSource *cs = NULL;
+	WEB_SessionVar *SV;
+	WEB_StoreSlot *sl;
+	int slot;
+
+	if (storeMap == NULL) {
+		AG_SetErrorS("Session store is not open");
+		return (-1);
+	}
+	if (S->ops->save != NULL) {			/* Serialize first */
+		if ((ds = AG_OpenAutoCore()) == NULL) {
+			return (-1);
+		}
+		S->ops->save(S, ds);
+		cs = AG_CORE_SOURCE(ds);
+		if ((size_t)cs->offs > WEB_SESSION_SHM_EXTRA) {
+			AG_SetError("Session manager data too large (%lu)",
+			    (Ulong)cs->offs);
+			goto fail;
+		}
+	}
+	/*
+	 * Existing sessions only need the header read lock (to find the
+	 * slot); the write lock is taken only to allocate a new slot.
+	 */
+	if (LockHeader(F_RDLCK) == -1) {
+		goto fail;
+	}
+	if ((slot = FindSlot(S->id, h)) == -1) {
+		UnlockHeader();
+		if (LockHeader(F_WRLCK) == -1) {
+			goto fail;
+		}
+		if ((slot = FindSlot(S->id, h)) == -1 &&
+		    (slot = AllocSlot(S->id, h)) == -1) {
+			UnlockHeader();
+			goto fail;
+		}
+	}
+	if (LockSlot(slot, F_WRLCK) == -1) {
+		UnlockHeader();
+		goto fail;
+	}
+	UnlockHeader();
+
+	sl = STORE_SLOT(slot);
+	memset(sl->vars, 0, sizeof(sl->vars));
+	sl->nVars = 0;
+	sl->heapLen = 0;
+	TAILQ_FOREACH(SV, &S->vars, vars) {
+		if (SlotSetVar(sl, SV->key, SV->value) == -1) {
+			UnlockSlot(slot);
+			WEB_SessionStoreDel(S->id);
+			goto fail;
+		}
+	}
+	sl->nEvents = (Uint32)S->nEvents;
+	if (cs != NULL) {
+		memcpy(sl->extra, cs->data, cs->offs);
+		sl->extraLen = (Uint32)cs->offs;
+	} else {
+		sl->extraLen = 0;
+	}
+	if (dirty) {
+		sl->flags |= WEB_STORE_DIRTY;
+	}
+	UnlockSlot(slot);
+
+	if (ds != NULL) { AG_CloseAutoCore(ds); }
+	return (0);
+fail:
+	if (ds != NULL) { AG_CloseAutoCore(ds); }
+	return (-1);
+}
+
+/* Remove a session from the store (if it exists). */
+void
+WEB_SessionStoreDel(const char *id)
+{
+	int slot;
+
+	if (storeMap == NULL || LockHeader(F_WRLCK) == -1) {
+		return;
+	}
+	if ((slot = FindSlot(id, StoreHash(id))) != -1 &&
+	    LockSlot(slot, F_WRLCK) == 0) {
+		FreeSlot(slot);
+		UnlockSlot(slot);
+	}
+	UnlockHeader();
+}
+
+/*
+ * Copy the value of a session variable into a fixed-size buffer.
+ * Return 0 on success or -1 if the session or variable does not exist.
+ */
+int
+WEB_SessionStoreGetSV(const char *id, const char *key, char *dst,
+    size_t dstSize)
+{
+	WEB_StoreSlot *sl;
+	WEB_StoreVar *v;
+	int slot;
+
+	if (storeMap == NULL) {
+		AG_SetErrorS("Session store is not open");
+		return (-1);
+	}
+	if (LockHeader(F_RDLCK) == -1) {
+		return (-1);
+	}
+	if ((slot = FindSlot(id, StoreHash(id))) == -1) {
+		UnlockHeader();
+		AG_SetError("No such session: %s", id);
+		return (-1);
+	}
+	if (LockSlot(slot, F_RDLCK) == -1) {
+		UnlockHeader();
+		return (-1);
+	}
+	UnlockHeader();
+	sl = STORE_SLOT(slot);
+	if ((v = SlotLookupVar(sl, key, StoreHash(key))) == NULL) {
+		UnlockSlot(slot);
+		AG_SetError("%s: No such variable: %s", id, key);
+		return (-1);
+	}
+	Strlcpy(dst, &sl->heap[v->valOffs], dstSize);
+	UnlockSlot(slot);
+	return (0);
+}
+
+/* Update the value of a variable in a stored session. */
+int
+WEB_SessionStoreSetSV(const char *id, const char *key, const char *val)
+{
+	WEB_StoreSlot *sl;
+	int slot, rv;
+
+	if (storeMap == NULL) {
+		AG_SetErrorS("Session store is not open");
+		return (-1);
+	}
+	if (LockHeader(F_RDLCK) == -1) {
+		return (-1);
+	}
+	if ((slot = FindSlot(id, StoreHash(id))) == -1) {
+		UnlockHeader();
+		AG_SetError("No such session: %s", id);
+		return (-1);
+	}
+	if (LockSlot(slot, F_WRLCK) == -1) {
+		UnlockHeader();
+		return (-1);
+	}
+	UnlockHeader();
+	sl = STORE_SLOT(slot);
+	if ((rv = SlotSetVar(sl, key, val)) == 0) {
+		sl->flags |= WEB_STORE_DIRTY;
+	}
+	UnlockSlot(slot);
+	return (rv);
+}
+
+/*
+ * Update a variable in every stored session opened by the given user.
+ * Return 0 on success, -1 on failure, or 1 if some sessions may only
+ * exist on disk (and must be updated by the caller).
+ */
+int
+WEB_SessionStoreSetSV_ALL(const char *user, const char *key, const char *val)
+{
+	Uint32 hUser = StoreHash("user");
+	WEB_StoreHdr *hdr;
+	Uint i;
+	int rv = 0;
+
+	if (storeMap == NULL) {
+		AG_SetErrorS("Session store is not open");
+		return (-1);
+	}
+	hdr = STORE_HDR();				/* nSlots is constant */
+	for (i = 0; i < hdr->nSlots; i++) {
+		WEB_StoreSlot *sl = STORE_SLOT(i);
+		WEB_StoreVar *v;
+
+		if (sl->state != WEB_STORE_USED ||	/* Unlocked peek */
+		    LockSlot(i, F_WRLCK) == -1) {
+			continue;
+		}
+		if (sl->state == WEB_STORE_USED &&
+		    (v = SlotLookupVar(sl, "user", hUser)) != NULL &&
+		    strcmp(&sl->heap[v->valOffs], user) == 0) {
+			if (SlotSetVar(sl, key, val) == 0) {
+				sl->flags |= WEB_STORE_DIRTY;
+			} else {
+				WEB_LogErr("SetSV_ALL: %s", AG_GetError());
+				rv = -1;
+			}
+		}
+		UnlockSlot(i);
+	}
+	if (rv == 0 && (hdr->flags & WEB_STORE_OVERFLOW)) {
+		rv = 1;
+	}
+	return (rv);
+}
+
+/*
+ * Write all dirty sessions back to their session files. Only the lock of
+ * the slot being written is held, so other sessions remain accessible.
+ * Return the number of sessions written, or -1 on failure.
+ */
+int
+WEB_SessionStoreSync(void)
+{
+	WEB_StoreHdr *hdr;
+	Uint i;
+	int nSynced = 0;
+
+	if (storeMap == NULL) {
+		return (0);
+	}
+	hdr = STORE_HDR();				/* nSlots is constant */
+	for (i = 0; i < hdr->nSlots; i++) {
+		WEB_StoreSlot *sl = STORE_SLOT(i);
+
+		if (sl->state != WEB_STORE_USED ||	/* Unlocked peek */
+		    !(sl->flags & WEB_STORE_DIRTY) ||
+		    LockSlot(i, F_WRLCK) == -1) {
+			continue;
+		}
+		if (sl->state == WEB_STORE_USED &&
+		    (sl->flags & WEB_STORE_DIRTY)) {
+			if (SlotWriteFile(sl) == 0) {
+				sl->flags &= ~(WEB_STORE_DIRTY);
+				nSynced++;
+			} else {
+				WEB_LogErr("Session store sync: %s",
+				    AG_GetError());
+			}
+		}
+		UnlockSlot(i);
+	}
+	return (nSynced);
+}
@@ -43,6 +43,9 @@ static const struct dev_tool_ent {
 	{ N_("Display Settings"),	DEV_DisplaySettings },
 	{ N_("Timer Inspector"),	DEV_TimerInspector },
 	{ N_("Unicode Browser"),	DEV_UnicodeBrowser },
+#if defined(AG_LOCKPROF)
+	{ N_("Lock Profiler"),		DEV_LockProfiler },
+#endif
 #if defined(AG_DEBUG)
 	{ N_("CPU Information"),	DEV_CPUInfo },
 #endif
@@ -4,6 +4,7 @@
 #define _AGAR_DEV_DEV_H_
 
 #include <agar/config/ag_threads.h>
+#include <agar/config/ag_lockprof.h>
 #include <agar/config/have_jpeg.h>
 
 #include <agar/dev/begin.h>
@@ -19,6 +20,9 @@ AG_Window *DEV_TimerInspector(void);
 AG_Window *DEV_UnicodeBrowser(void);
 AG_Window *DEV_DisplaySettings(void);
 AG_Window *DEV_CPUInfo(void);
+#ifdef AG_LOCKPROF
+AG_Window *DEV_LockProfiler(void);
+#endif
 
 AG_Window *DEV_Browser(void *);
 void	   DEV_BrowserInit(void *);
@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2026 Hypertriton, Inc. <http://hypertriton.com/>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Lock profiler tool. This displays the statistics collected by the lock
+ * contention profiler (available if Agar was built with --enable-lockprof).
+ */
+
+#include <agar/core/core.h>
+
+#ifdef AG_LOCKPROF
+
+#include <agar/gui/window.h>
+#include <agar/gui/box.h>
+#include <agar/gui/table.h>
+#include <agar/gui/radio.h>
+#include <agar/gui/button.h>
+#include <agar/gui/checkbox.h>
+#include <agar/dev/dev.h>
+
+#define DEV_LOCKPROF_ROWS 200
+
+static int devLockProfSort = AG_LOCKPROF_SORT_WAIT;
+static int devLockProfCollect = 1;
+
+static void
+PollLocks(AG_Event *event)
+{
+	AG_Table *tbl = AG_SELF();
+	AG_LockStat *stats;
+	Uint i, n;
+
+	if ((stats = TryMalloc(DEV_LOCKPROF_ROWS*sizeof(AG_LockStat))) == NULL) {
+		return;
+	}
+	n = AG_LockProfGetStats(stats, DEV_LOCKPROF_ROWS,
+	    (enum ag_lockprof_sort)devLockProfSort);
+
+	AG_TableBegin(tbl);
+	for (i = 0; i < n; i++) {
+		AG_LockStat *st = &stats[i];
+
+		AG_TableAddRow(tbl, "%s:%lu:%lu:%.02f:%lu:%lu:%.02f:%lu",
+		    st->name,
+		    (Ulong)st->nAcquired,
+		    (Ulong)st->nContended,
+		    (double)st->waitTotal/1e6,
+		    (Ulong)(AG_LockProfPercentile(st->wait, st->waitMax, 99)/1000),
+		    (Ulong)(st->waitMax/1000),
+		    (double)st->holdTotal/1e6,
+		    (Ulong)(AG_LockProfPercentile(st->hold, st->holdMax, 99)/1000));
+	}
+	AG_TableEnd(tbl);
+	Free(stats);
+}
+
+static void
+ToggleCollect(AG_Event *event)
+{
+	AG_LockProfEnable(AG_INT(1));
+}
+
+static void
+ResetStats(AG_Event *event)
+{
+	AG_LockProfReset();
+}
+
+AG_Window *
+DEV_LockProfiler(void)
+{
+	const char *sortNames[] = {
+		N_("Wait time"),
+		N_("Contention"),
+		N_("Hold time"),
+		N_("Acquisitions"),
+		NULL
+	};
+	AG_Window *win;
+	AG_Table *tbl;
+	AG_Box *hb;
+	AG_Checkbox *cb;
+
+	if ((win = AG_WindowNewNamedS(0, "DEV_LockProfiler")) == NULL) {
+		return (NULL);
+	}
+	AG_WindowSetCaptionS(win, _("Lock Profiler"));
+
+	hb = AG_BoxNewHoriz(win, AG_BOX_HFILL);
+	AG_RadioNewInt(hb, 0, sortNames, &devLockProfSort);
+	cb = AG_CheckboxNewInt(hb, 0, _("Collect statistics"),
+	    &devLockProfCollect);
+	AG_SetEvent(cb, "checkbox-changed", ToggleCollect, NULL);
+	AG_ButtonNewFn(hb, 0, _("Reset"), ResetStats, NULL);
+
+	tbl = AG_TableNewPolled(win, AG_TABLE_EXPAND, PollLocks, NULL);
+	AG_TableSetPollInterval(tbl, 1000);
+	AG_TableAddCol(tbl, _("Lock"), "<XXXXXXXXXXXXXXXXXXXX>", NULL);
+	AG_TableAddCol(tbl, _("Acquired"), "<XXXXXXXX>", NULL);
+	AG_TableAddCol(tbl, _("Contended"), "<XXXXXXXX>", NULL);
+	AG_TableAddCol(tbl, _("Wait (ms)"), "<XXXXXXXX>", NULL);
+	AG_TableAddCol(tbl, _("p99 wait (us)"), "<XXXXXXXX>", NULL);
+	AG_TableAddCol(tbl, _("Max wait (us)"), "<XXXXXXXX>", NULL);
+	AG_TableAddCol(tbl, _("Hold (ms)"), "<XXXXXXXX>", NULL);
+	AG_TableAddCol(tbl, _("p99 hold (us)"), "<XXXXXXXX>", NULL);
+
+	AG_WindowSetGeometryAlignedPct(win, AG_WINDOW_MC, 70, 50);
+	return (win);
+}
+
+#endif /* AG_LOCKPROF */
@@ -485,6 +485,7 @@ AG_SDL_SetRefreshRate(void *obj, int fps)
 		return (-1);
 	}
 	dsw->rNom = 1000/fps;
+	dsw->rNomNS = 1000000000/(Uint64)fps;
 	return (0);
 }
 
@@ -622,8 +623,10 @@ AG_SDL_GetPrefDisplaySettings(void *obj, Uint *w, Uint *h, int *depth)
 
 		AG_GetString(drv, "fpsMax", buf, sizeof(buf));
 		v = (float)strtod(buf, &ep);
-		if (*ep == '\0')
+		if (*ep == '\0') {
 			dsw->rNom = (Uint)(1000.0/v);
+			dsw->rNomNS = (Uint64)(1e9/v);
+		}
 	}
 	if (AG_Defined(drv, "bgColor")) {
 		dsw->bgColor = AG_ColorFromString(AG_GetStringP(drv,"bgColor"), NULL);
@@ -935,13 +938,24 @@ AG_SDL_EventSink(AG_EventSink *es, AG_Event *event)
 {
 	AG_DriverEvent dev;
 	AG_Driver *drv = AG_PTR(1);
+	Uint64 t, tWake;
 	int rv = 0;
 
 	if (SDL_PollEvent(NULL) != 0) {
 		while (AG_SDL_GetNextEvent(drv, &dev) == 1)
 			rv = AG_SDL_ProcessEvent(drv, &dev);
 	} else {
-		AG_Delay(1);
+		/*
+		 * Poll for input every AG_SPINNER_POLL_NS, waking up early
+		 * for the next frame or timer deadline.
+		 */
+		t = AG_GetTimeNS();
+		tWake = t + AG_SPINNER_POLL_NS;
+		if (AGDRIVER_SINGLE(drv) && AGDRIVER_SW(drv)->tFrame < tWake) {
+			tWake = AGDRIVER_SW(drv)->tFrame;
+		}
+		if (tWake > t)
+			AG_TimerSleepUntilNS(tWake);
 	}
 	return (0);
 }
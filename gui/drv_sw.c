@@ -54,6 +54,8 @@ Init(void *obj)
 	dsw->rNom = 1000/60;
 	dsw->rCur = 0;
 	dsw->rLast = 0;
+	dsw->rNomNS = 1000000000/60;
+	dsw->tFrame = 0;
 	dsw->windowXOutLimit = 32;
 	dsw->windowBotOutLimit = 32;
 	dsw->windowIconWidth = 32;
@@ -71,6 +71,8 @@ typedef struct ag_driver_sw {
 	int rCur;			/* Effective refresh rate (ms) */
 	AG_Color bgColor;		/* "bgColor" setting */
 	Uint rLast;			/* Refresh rate timestamp */
+	Uint64 rNomNS;			/* Nominal frame period (ns) */
+	Uint64 tFrame;			/* Next frame deadline (ns) */
 } AG_DriverSw;
 
 #define AGDRIVER_SW(obj) ((AG_DriverSw *)(obj))
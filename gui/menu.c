@@ -41,6 +41,9 @@ void
 AG_InitAppMenu(void)
 {
 	AG_MutexInitRecursive(&agAppMenuLock);
+#ifdef AG_LOCKPROF
+	AG_LockProfSetName(&agAppMenuLock, "agAppMenuLock");
+#endif
 	agAppMenu = NULL;
 	agAppMenuWin = NULL;
 }
@@ -506,6 +506,9 @@ AG_InitTextSubsystem(void)
 		return (0);
 
 	AG_MutexInitRecursive(&agTextLock);
+#ifdef AG_LOCKPROF
+	AG_LockProfSetName(&agTextLock, "agTextLock");
+#endif
 	TAILQ_INIT(&fonts);
 
 	/* Set the default font search path. */
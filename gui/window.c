@@ -1020,14 +1020,22 @@ AG_WindowDrawQueued(void)
 		case AG_WM_SINGLE:
 			{
 				AG_DriverSw *dsw = (AG_DriverSw *)drv;
-				Uint32 t;
-
-				t = AG_GetTicks();
-				if ((t - dsw->rLast) < dsw->rNom) {
-					AG_Delay(1);
-					goto out;
+				Uint64 t;
+
+				/*
+				 * Skip this driver until its next frame is
+				 * due. The event sink paces the loop (see
+				 * AG_SDL_EventSink()).
+				 */
+				t = AG_GetTimeNS();
+				if (t < dsw->tFrame) {
+					break;
 				}
-				dsw->rLast = t;
+				dsw->tFrame += dsw->rNomNS;
+				if (dsw->tFrame < t) {		/* Fell behind */
+					dsw->tFrame = t + dsw->rNomNS;
+				}
+				dsw->rLast = (Uint)(t/1000000);
 				
 				AG_FOREACH_WINDOW(win, drv) {
 					if (win->visible && win->dirty)
@@ -1048,7 +1056,6 @@ AG_WindowDrawQueued(void)
 			break;
 		}
 	}
-out:
 	AG_UnlockVFS(&agDrivers);
 }
 
@@ -16,6 +16,7 @@ extern const AG_TestCase compositingTest;
 extern const AG_TestCase configSettingsTest;
 extern const AG_TestCase consoleTest;
 extern const AG_TestCase customWidgetTest;
+extern const AG_TestCase dbTest;
 extern const AG_TestCase fixedResTest;
 extern const AG_TestCase focusingTest;
 extern const AG_TestCase fontSelectorTest;
@@ -36,11 +37,13 @@ extern const AG_TestCase paletteTest;
 extern const AG_TestCase paneTest;
 extern const AG_TestCase plottingTest;
 extern const AG_TestCase renderToSurfaceTest;
+extern const AG_TestCase rwlockTest;
 extern const AG_TestCase scrollbarTest;
 extern const AG_TestCase scrollviewTest;
 extern const AG_TestCase socketsTest;
 extern const AG_TestCase stringTest;
 extern const AG_TestCase tableTest;
+extern const AG_TestCase taskTest;
 extern const AG_TestCase textboxTest;
 extern const AG_TestCase textDlgTest;
 extern const AG_TestCase threadsTest;
@@ -55,6 +58,7 @@ const AG_TestCase *testCases[] = {
 	&configSettingsTest,
 	&consoleTest,
 	&customWidgetTest,
+	&dbTest,
 	&fixedResTest,
 	&focusingTest,
 	&fontSelectorTest,
@@ -77,11 +81,13 @@ const AG_TestCase *testCases[] = {
 	&paneTest,
 	&plottingTest,
 	&renderToSurfaceTest,
+	&rwlockTest,
 	&scrollbarTest,
 	&scrollviewTest,
 	&socketsTest,
 	&stringTest,
 	&tableTest,
+	&taskTest,
 	&textboxTest,
 	&textDlgTest,
 	&threadsTest,
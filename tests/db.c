@@ -0,0 +1,934 @@
+/*	Public domain	*/
+
+/*
+ * This program tests the batched and transactional operations of AG_Db,
+ * against the "log" backend (native transactions) and against a minimal
+ * in-memory backend which relies on the emulation in the generic layer.
+ * It also tests recovery and compaction of the "log" backend, the
+ * AG_DbObject cache and (if AGAR_TEST_MYSQL_DB is set in the environment)
+ * connection pooling in the "mysql" backend.
+ */
+
+#include "agartest.h"
+
+#include <agar/config/ag_threads.h>
+#include <agar/config/have_mysql.h>
+#include <agar/config/have_sys_mman_h.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define NKEYS		300		/* More than AG_DB_BATCH_MAX */
+#define MEMDB_MAX	(NKEYS+16)
+
+/* In-memory backend without native transactions. */
+typedef struct {
+	AG_Db _inherit;
+	Uint nEnts;
+	struct {
+		char key[32];
+		size_t keyLen;
+		char val[512];
+		size_t valLen;
+	} ents[MEMDB_MAX];
+	Uint nPutBatch;				/* Calls to putBatch() */
+	int failPuts;				/* Simulate write errors */
+} MemDb;
+
+static MemDb mdb;
+
+static int
+MemFind(MemDb *mdb, const AG_Dbt *key)
+{
+	Uint i;
+
+	for (i = 0; i < mdb->nEnts; i++) {
+		if (mdb->ents[i].keyLen == key->size &&
+		    memcmp(mdb->ents[i].key, key->data, key->size) == 0)
+			return (int)i;
+	}
+	return (-1);
+}
+
+static int
+MemExists(void *obj, const AG_Dbt *key)
+{
+	return (MemFind(obj, key) != -1);
+}
+
+static int
+MemGet(void *obj, const AG_Dbt *key, AG_Dbt *val)
+{
+	MemDb *mdb = obj;
+	int i;
+
+	if ((i = MemFind(mdb, key)) == -1) {
+		AG_SetError("No such key");
+		return (-1);
+	}
+	if ((val->data = TryMalloc(mdb->ents[i].valLen)) == NULL) {
+		return (-1);
+	}
+	memcpy(val->data, mdb->ents[i].val, mdb->ents[i].valLen);
+	val->size = mdb->ents[i].valLen;
+	return (0);
+}
+
+static int
+MemPut(void *obj, const AG_Dbt *key, const AG_Dbt *val)
+{
+	MemDb *mdb = obj;
+	int i;
+
+	if (mdb->failPuts) {
+		AG_SetError("Simulated write error");
+		return (-1);
+	}
+	if (key->size > sizeof(mdb->ents[0].key) ||
+	    val->size > sizeof(mdb->ents[0].val)) {
+		AG_SetError("Record too large");
+		return (-1);
+	}
+	if ((i = MemFind(mdb, key)) == -1) {
+		if (mdb->nEnts == MEMDB_MAX) {
+			AG_SetError("Database is full");
+			return (-1);
+		}
+		i = (int)mdb->nEnts++;
+		memcpy(mdb->ents[i].key, key->data, key->size);
+		mdb->ents[i].keyLen = key->size;
+	}
+	memcpy(mdb->ents[i].val, val->data, val->size);
+	mdb->ents[i].valLen = val->size;
+	return (0);
+}
+
+static int
+MemDel(void *obj, const AG_Dbt *key)
+{
+	MemDb *mdb = obj;
+	int i;
+
+	if ((i = MemFind(mdb, key)) == -1) {
+		AG_SetError("No such key");
+		return (-1);
+	}
+	mdb->ents[i] = mdb->ents[--mdb->nEnts];
+	return (0);
+}
+
+static int
+MemPutBatch(void *obj, const AG_Dbt *keys, const AG_Dbt *vals, Uint n)
+{
+	MemDb *mdb = obj;
+	Uint i;
+
+	mdb->nPutBatch++;
+	for (i = 0; i < n; i++) {
+		if (MemPut(mdb, &keys[i], &vals[i]) == -1)
+			return (-1);
+	}
+	return (0);
+}
+
+static void
+MemInit(void *obj)
+{
+	MemDb *mdb = obj;
+
+	mdb->nEnts = 0;
+	mdb->nPutBatch = 0;
+	mdb->failPuts = 0;
+}
+
+static AG_DbClass memDbClass = {
+	{
+		"Agar(Db:AgarTestMemDb)",
+		sizeof(MemDb),
+		{ 0,0 },
+		MemInit,
+		NULL,		/* free */
+		NULL,		/* destroy */
+		NULL,		/* load */
+		NULL,		/* save */
+		NULL		/* edit */
+	},
+	"agartest-mem",
+	"In-memory database for agartest",
+	AG_DB_KEY_DATA,
+	AG_DB_REC_VARIABLE,
+	NULL,		/* open */
+	NULL,		/* close */
+	NULL,		/* sync */
+	MemExists,
+	MemGet,
+	MemPut,
+	MemDel,
+	NULL,		/* iterate */
+	NULL,		/* begin */
+	NULL,		/* commit */
+	NULL,		/* abort */
+	NULL,		/* getBatch */
+	MemPutBatch,
+	NULL		/* delBatch */
+};
+
+static char keyBuf[NKEYS][16], valBuf[NKEYS][16];
+
+/* Initialize keys[] and vals[] with "key-N" and "<pfx>-N". */
+static void
+MakeRecords(AG_Dbt *keys, AG_Dbt *vals, const char *pfx)
+{
+	int i;
+
+	for (i = 0; i < NKEYS; i++) {
+		keys[i].size = Snprintf(keyBuf[i], sizeof(keyBuf[i]), "key-%d", i);
+		keys[i].data = keyBuf[i];
+		vals[i].size = Snprintf(valBuf[i], sizeof(valBuf[i]), "%s-%d",
+		    pfx, i);
+		vals[i].data = valBuf[i];
+	}
+}
+
+/* Check that key holds the string val (or is absent if val is NULL). */
+static int
+CheckValue(AG_TestInstance *ti, AG_Db *db, const char *key, const char *val)
+{
+	AG_Dbt dbtKey, dbtVal;
+	int rv = 0;
+
+	dbtKey.data = (void *)key;
+	dbtKey.size = strlen(key);
+	if (val == NULL) {
+		if (AG_DbExists(db, &dbtKey)) {
+			TestMsg(ti, "%s: should not exist", key);
+			return (-1);
+		}
+		return (0);
+	}
+	if (AG_DbGet(db, &dbtKey, &dbtVal) == -1) {
+		TestMsg(ti, "%s: %s", key, AG_GetError());
+		return (-1);
+	}
+	if (dbtVal.size != strlen(val) ||
+	    memcmp(dbtVal.data, val, dbtVal.size) != 0) {
+		TestMsg(ti, "%s: unexpected value", key);
+		rv = -1;
+	}
+	free(dbtVal.data);
+	return (rv);
+}
+
+static int
+PutString(AG_TestInstance *ti, AG_Db *db, const char *key, const char *val)
+{
+	AG_Dbt dbtKey, dbtVal;
+
+	dbtKey.data = (void *)key;
+	dbtKey.size = strlen(key);
+	dbtVal.data = (void *)val;
+	dbtVal.size = strlen(val);
+	if (AG_DbPut(db, &dbtKey, &dbtVal) == -1) {
+		TestMsg(ti, "Put %s: %s", key, AG_GetError());
+		return (-1);
+	}
+	return (0);
+}
+
+static int
+TestBatches(AG_TestInstance *ti, AG_Db *db)
+{
+	AG_Dbt keys[NKEYS], vals[NKEYS], out[NKEYS+1];
+	AG_Dbt keysGet[NKEYS+1];
+	char buf[16];
+	int i, rv = 0;
+
+	MakeRecords(keys, vals, "val");
+	if (AG_DbPutBatch(db, keys, vals, NKEYS) == -1) {
+		TestMsg(ti, "PutBatch: %s", AG_GetError());
+		return (-1);
+	}
+	memcpy(keysGet, keys, sizeof(keys));
+	keysGet[NKEYS].data = "missing";
+	keysGet[NKEYS].size = 7;
+	if (AG_DbGetBatch(db, keysGet, out, NKEYS+1) == -1) {
+		TestMsg(ti, "GetBatch: %s", AG_GetError());
+		return (-1);
+	}
+	for (i = 0; i < NKEYS; i++) {
+		if (out[i].size != vals[i].size ||
+		    memcmp(out[i].data, vals[i].data, vals[i].size) != 0) {
+			TestMsg(ti, "GetBatch: bad value for key-%d", i);
+			rv = -1;
+		}
+		free(out[i].data);
+	}
+	if (out[NKEYS].data != NULL || out[NKEYS].size != 0) {
+		TestMsgS(ti, "GetBatch: missing key returned data");
+		free(out[NKEYS].data);
+		rv = -1;
+	}
+	if (AG_DbDelBatch(db, keys, NKEYS/2) == -1) {
+		TestMsg(ti, "DelBatch: %s", AG_GetError());
+		return (-1);
+	}
+	for (i = 0; i < NKEYS; i++) {
+		Snprintf(buf, sizeof(buf), "key-%d", i);
+		if (CheckValue(ti, db, buf,
+		    (i < NKEYS/2) ? NULL : valBuf[i]) == -1)
+			rv = -1;
+	}
+	return (rv);
+}
+
+static int
+TestTxn(AG_TestInstance *ti, AG_Db *db)
+{
+	AG_Dbt keys[NKEYS], vals[NKEYS];
+	char buf[16], val[16];
+	int i;
+
+	if (AG_DbCommit(db) == 0 || AG_DbAbort(db) == 0) {
+		TestMsgS(ti, "Commit/Abort succeeded outside a transaction");
+		return (-1);
+	}
+
+	/* Aborted writes and deletes must leave no trace. */
+	MakeRecords(keys, vals, "aborted");
+	if (AG_DbBegin(db) == -1) {
+		TestMsg(ti, "Begin: %s", AG_GetError());
+		return (-1);
+	}
+	if (AG_DbBegin(db) == 0) {
+		TestMsgS(ti, "Nested Begin succeeded");
+		return (-1);
+	}
+	if (AG_DbPutBatch(db, keys, vals, NKEYS) == -1 ||
+	    AG_DbDelBatch(db, &keys[NKEYS-10], 10) == -1) {
+		TestMsg(ti, "Txn write: %s", AG_GetError());
+		return (-1);
+	}
+	if (CheckValue(ti, db, "key-0", "aborted-0") == -1 ||
+	    CheckValue(ti, db, "key-299", NULL) == -1) {
+		TestMsgS(ti, "Transaction does not see its own writes");
+		return (-1);
+	}
+	if (AG_DbAbort(db) == -1) {
+		TestMsg(ti, "Abort: %s", AG_GetError());
+		return (-1);
+	}
+	for (i = 0; i < NKEYS; i++) {
+		Snprintf(buf, sizeof(buf), "key-%d", i);
+		Snprintf(val, sizeof(val), "val-%d", i);
+		if (CheckValue(ti, db, buf, (i < NKEYS/2) ? NULL : val) == -1) {
+			TestMsgS(ti, "Aborted transaction left changes");
+			return (-1);
+		}
+	}
+
+	/* Committed writes and deletes must all be applied. */
+	MakeRecords(keys, vals, "committed");
+	if (AG_DbBegin(db) == -1 ||
+	    AG_DbPutBatch(db, keys, vals, NKEYS) == -1 ||
+	    AG_DbDelBatch(db, keys, 10) == -1 ||
+	    AG_DbCommit(db) == -1) {
+		TestMsg(ti, "Txn: %s", AG_GetError());
+		return (-1);
+	}
+	for (i = 0; i < NKEYS; i++) {
+		Snprintf(buf, sizeof(buf), "key-%d", i);
+		Snprintf(val, sizeof(val), "committed-%d", i);
+		if (CheckValue(ti, db, buf, (i < 10) ? NULL : val) == -1) {
+			TestMsgS(ti, "Committed transaction lost changes");
+			return (-1);
+		}
+	}
+	return (0);
+}
+
+#ifdef HAVE_SYS_MMAN_H
+static AG_Db *
+OpenLog(AG_TestInstance *ti, const char *path, const char *sync)
+{
+	AG_Db *db;
+
+	if ((db = AG_DbNew("log")) == NULL) {
+		TestMsg(ti, "%s: %s", path, AG_GetError());
+		return (NULL);
+	}
+	AG_SetString(db, "sync", sync);
+	AG_SetUint(db, "commit-interval", 1);
+	if (AG_DbOpen(db, path, 0) == -1) {
+		TestMsg(ti, "%s: %s", path, AG_GetError());
+		AG_ObjectDestroy(db);
+		return (NULL);
+	}
+	return (db);
+}
+
+static void
+CloseLog(AG_Db *db)
+{
+	AG_DbClose(db);
+	AG_ObjectDestroy(db);
+}
+
+static off_t
+FileSize(const char *path)
+{
+	struct stat sb;
+
+	return (stat(path, &sb) == 0) ? sb.st_size : -1;
+}
+
+/*
+ * Check that the log is replayed on open, that a torn record at the end
+ * is discarded, and that a batch missing any of its records is discarded
+ * as a whole.
+ */
+static int
+TestLogRecovery(AG_TestInstance *ti, const char *path)
+{
+	AG_Dbt keys[NKEYS], vals[NKEYS], key;
+	off_t size, sizeBatch;
+	AG_Db *db;
+	int i;
+
+	unlink(path);
+	if ((db = OpenLog(ti, path, "group")) == NULL) {
+		return (-1);
+	}
+	if (PutString(ti, db, "a", "1") == -1 ||
+	    PutString(ti, db, "b", "2") == -1 ||
+	    PutString(ti, db, "a", "3") == -1) {
+		goto fail;
+	}
+	key.data = "b";
+	key.size = 1;
+	if (AG_DbDel(db, &key) == -1) {
+		TestMsg(ti, "Del: %s", AG_GetError());
+		goto fail;
+	}
+	CloseLog(db);
+
+	if ((db = OpenLog(ti, path, "group")) == NULL) {
+		return (-1);
+	}
+	if (CheckValue(ti, db, "a", "3") == -1 ||
+	    CheckValue(ti, db, "b", NULL) == -1) {
+		TestMsgS(ti, "Replay failed");
+		goto fail;
+	}
+
+	/* In group mode, a write returns once it is on disk. */
+	size = FileSize(path);
+	if (PutString(ti, db, "c", "4") == -1) {
+		goto fail;
+	}
+	if (FileSize(path) <= size) {
+		TestMsgS(ti, "Put returned before the group sync");
+		goto fail;
+	}
+	if (PutString(ti, db, "d", "5") == -1) {
+		goto fail;
+	}
+	CloseLog(db);
+
+	/* Tear the last record. */
+	if (truncate(path, FileSize(path) - 3) == -1) {
+		TestMsg(ti, "truncate: %s", strerror(errno));
+		return (-1);
+	}
+	if ((db = OpenLog(ti, path, "group")) == NULL) {
+		return (-1);
+	}
+	if (CheckValue(ti, db, "a", "3") == -1 ||
+	    CheckValue(ti, db, "c", "4") == -1 ||
+	    CheckValue(ti, db, "d", NULL) == -1) {
+		TestMsgS(ti, "Recovery from a torn record failed");
+		goto fail;
+	}
+	CloseLog(db);
+
+	/* Cut the last record of a batch. */
+	sizeBatch = FileSize(path);
+	if ((db = OpenLog(ti, path, "group")) == NULL) {
+		return (-1);
+	}
+	MakeRecords(keys, vals, "batch");
+	if (AG_DbPutBatch(db, keys, vals, 10) == -1) {
+		TestMsg(ti, "PutBatch: %s", AG_GetError());
+		goto fail;
+	}
+	CloseLog(db);
+	if (truncate(path, FileSize(path) - 1) == -1) {
+		TestMsg(ti, "truncate: %s", strerror(errno));
+		return (-1);
+	}
+	if ((db = OpenLog(ti, path, "group")) == NULL) {
+		return (-1);
+	}
+	for (i = 0; i < 10; i++) {
+		if (CheckValue(ti, db, keyBuf[i], NULL) == -1) {
+			TestMsgS(ti, "Incomplete batch was replayed");
+			goto fail;
+		}
+	}
+	if (CheckValue(ti, db, "c", "4") == -1) {
+		goto fail;
+	}
+	CloseLog(db);
+	if (FileSize(path) != sizeBatch) {
+		TestMsgS(ti, "Incomplete batch was not truncated");
+		return (-1);
+	}
+	return (0);
+fail:
+	CloseLog(db);
+	return (-1);
+}
+
+#ifdef AG_THREADS
+#define COMPACT_WRITERS	4
+#define COMPACT_KEYS	50
+#define COMPACT_ROUNDS	40
+
+typedef struct {
+	AG_TestInstance *ti;
+	AG_Db *db;
+	int id;
+	off_t nWritten;				/* Bytes of records written */
+	int failed;
+} CompactWriter;
+
+/* Overwrite a set of keys repeatedly, making most of the log stale. */
+static void *
+CompactWriterMain(void *arg)
+{
+	CompactWriter *w = arg;
+	char key[32], val[32];
+	int i, j;
+
+	for (i = 0; i < COMPACT_ROUNDS; i++) {
+		for (j = 0; j < COMPACT_KEYS; j++) {
+			Snprintf(key, sizeof(key), "w%d-k%d", w->id, j);
+			Snprintf(val, sizeof(val), "round-%d", i);
+			if (PutString(w->ti, w->db, key, val) == -1) {
+				w->failed = 1;
+				return (NULL);
+			}
+			w->nWritten += 16 + strlen(key) + strlen(val);
+		}
+	}
+	return (NULL);
+}
+
+static int
+CheckCompacted(AG_TestInstance *ti, AG_Db *db)
+{
+	char key[32], val[32];
+	int i, j;
+
+	Snprintf(val, sizeof(val), "round-%d", COMPACT_ROUNDS-1);
+	for (i = 0; i < COMPACT_WRITERS; i++) {
+		for (j = 0; j < COMPACT_KEYS; j++) {
+			Snprintf(key, sizeof(key), "w%d-k%d", i, j);
+			if (CheckValue(ti, db, key, val) == -1)
+				return (-1);
+		}
+	}
+	return (0);
+}
+
+/* Compact the log in the background while several threads write to it. */
+static int
+TestLogCompaction(AG_TestInstance *ti, const char *path)
+{
+	CompactWriter w[COMPACT_WRITERS];
+	AG_Thread th[COMPACT_WRITERS];
+	off_t nWritten = 0;
+	AG_Db *db;
+	int i, rv = 0;
+
+	unlink(path);
+	if ((db = AG_DbNew("log")) == NULL) {
+		return (-1);
+	}
+	AG_SetString(db, "sync", "none");
+	AG_SetUint(db, "commit-interval", 1);
+	AG_SetUint(db, "compact-ratio", 50);
+	AG_SetUint(db, "compact-min", 0);
+	if (AG_DbOpen(db, path, 0) == -1) {
+		TestMsg(ti, "%s: %s", path, AG_GetError());
+		AG_ObjectDestroy(db);
+		return (-1);
+	}
+	for (i = 0; i < COMPACT_WRITERS; i++) {
+		w[i].ti = ti;
+		w[i].db = db;
+		w[i].id = i;
+		w[i].nWritten = 0;
+		w[i].failed = 0;
+		AG_ThreadCreate(&th[i], CompactWriterMain, &w[i]);
+	}
+	for (i = 0; i < COMPACT_WRITERS; i++) {
+		AG_ThreadJoin(th[i], NULL);
+		nWritten += w[i].nWritten;
+		if (w[i].failed)
+			rv = -1;
+	}
+	if (rv == -1 || AG_DbSync(db) == -1) {
+		TestMsg(ti, "Write failed: %s", AG_GetError());
+		CloseLog(db);
+		return (-1);
+	}
+	if (FileSize(path) >= nWritten/2) {
+		TestMsg(ti, "Log was not compacted (%ld of %ld bytes)",
+		    (long)FileSize(path), (long)nWritten);
+		rv = -1;
+	}
+	if (CheckCompacted(ti, db) == -1) {
+		rv = -1;
+	}
+	CloseLog(db);
+
+	if ((db = OpenLog(ti, path, "none")) == NULL) {
+		return (-1);
+	}
+	if (CheckCompacted(ti, db) == -1) {
+		TestMsgS(ti, "Compacted log does not replay");
+		rv = -1;
+	}
+	CloseLog(db);
+	return (rv);
+}
+#endif /* AG_THREADS */
+#endif /* HAVE_SYS_MMAN_H */
+
+/* Check that a saved AG_DbObject exists in the backend. */
+static int
+ObjectStored(AG_Db *db, const char *name)
+{
+	AG_Dbt key;
+
+	key.data = (void *)name;
+	key.size = strlen(name)+1;
+	return (AGDB_CLASS(db)->exists(db, &key));
+}
+
+static int
+SaveObject(AG_TestInstance *ti, AG_Db *db, const char *name, int value)
+{
+	AG_DbObject *dbo;
+	int rv;
+
+	if ((dbo = AG_DbObjectNew()) == NULL) {
+		return (-1);
+	}
+	AG_ObjectSetNameS(dbo, name);
+	AG_SetInt(dbo, "value", value);
+	if ((rv = AG_DbObjectSave(dbo, db)) == -1) {
+		TestMsg(ti, "Save %s: %s", name, AG_GetError());
+	}
+	AG_ObjectDestroy(dbo);
+	return (rv);
+}
+
+/*
+ * Check that entries fetched into a cache too small to hold them survive
+ * until returned, that flushing is refused within a transaction, and that
+ * a failed write-behind flush leaves the writes queued without failing
+ * the save.
+ */
+static int
+TestObjectCache(AG_TestInstance *ti, AG_Db *db)
+{
+	AG_DbObject *dbo, *dbo2;
+	char name[16];
+	int i;
+
+	if (AG_DbObjectCacheInit(db, 1, 0, 0) == -1) {
+		TestMsg(ti, "CacheInit: %s", AG_GetError());
+		return (-1);
+	}
+	for (i = 0; i < 4; i++) {
+		Snprintf(name, sizeof(name), "obj-%d", i);
+		if (SaveObject(ti, db, name, i) == -1)
+			goto fail;
+	}
+	for (i = 0; i < 4; i++) {
+		Snprintf(name, sizeof(name), "obj-%d", i);
+		if ((dbo = AG_DbObjectGet(db, name, &agDbObjectClass)) == NULL) {
+			TestMsg(ti, "Get %s: %s", name, AG_GetError());
+			goto fail;
+		}
+		dbo2 = AG_DbObjectGet(db, name, &agDbObjectClass);
+		if (AG_GetInt(dbo, "value") != i || dbo2 != dbo) {
+			TestMsg(ti, "Get %s: bad instance", name);
+			goto fail;
+		}
+		AG_DbObjectRelease(dbo2);
+		AG_DbObjectRelease(dbo);
+
+		dbo = AG_DbObjectNew();
+		if (AG_DbObjectLoad(dbo, db, name) == -1 ||
+		    AG_GetInt(dbo, "value") != i) {
+			TestMsg(ti, "Load %s: %s", name, AG_GetError());
+			AG_ObjectDestroy(dbo);
+			goto fail;
+		}
+		AG_ObjectDestroy(dbo);
+	}
+	AG_DbObjectCacheDestroy(db);
+
+	/* Flush on every write. */
+	if (AG_DbObjectCacheInit(db, 65536, 1, 0) == -1) {
+		TestMsg(ti, "CacheInit: %s", AG_GetError());
+		return (-1);
+	}
+	if (AG_DbBegin(db) == -1 ||
+	    SaveObject(ti, db, "obj-txn", 1) == -1) {
+		goto fail;
+	}
+	if (AG_DbObjectFlush(db) == 0 || db->objCache->nPending != 1) {
+		TestMsgS(ti, "Flush within a transaction");
+		goto fail;
+	}
+	if (AG_DbAbort(db) == -1 ||
+	    AG_DbObjectFlush(db) == -1 ||
+	    !ObjectStored(db, "obj-txn")) {
+		TestMsg(ti, "Flush after transaction: %s", AG_GetError());
+		goto fail;
+	}
+
+	mdb.failPuts = 1;
+	if (SaveObject(ti, db, "obj-err", 1) == -1) {
+		mdb.failPuts = 0;
+		goto fail;
+	}
+	mdb.failPuts = 0;
+	if (db->objCache->nPending != 1 || ObjectStored(db, "obj-err")) {
+		TestMsgS(ti, "Failed write was not kept queued");
+		goto fail;
+	}
+	if (AG_DbObjectFlush(db) == -1 || !ObjectStored(db, "obj-err") ||
+	    db->objCache->nPending != 0) {
+		TestMsg(ti, "Retried flush: %s", AG_GetError());
+		goto fail;
+	}
+	AG_DbObjectCacheDestroy(db);
+	return (0);
+fail:
+	AG_DbObjectCacheDestroy(db);
+	return (-1);
+}
+
+#ifdef HAVE_MYSQL
+#define MYSQL_TEST_TABLE "CREATE TEMPORARY TABLE agartest_pool " \
+                         "(k VARBINARY(255) PRIMARY KEY, v BLOB)"
+
+/*
+ * Open the database named by AGAR_TEST_MYSQL_DB (on AGAR_TEST_MYSQL_HOST,
+ * as AGAR_TEST_MYSQL_USER and AGAR_TEST_MYSQL_PASSWORD).
+ */
+static AG_Db *
+OpenMySQL(AG_TestInstance *ti, const char *initCmd, const char *charset)
+{
+	AG_Db *db;
+
+	if ((db = AG_DbNew("mysql")) == NULL) {
+		TestMsg(ti, "mysql: %s", AG_GetError());
+		return (NULL);
+	}
+	AG_SetString(db, "host", getenv("AGAR_TEST_MYSQL_HOST"));
+	AG_SetString(db, "user", getenv("AGAR_TEST_MYSQL_USER"));
+	AG_SetString(db, "password", getenv("AGAR_TEST_MYSQL_PASSWORD"));
+	AG_SetString(db, "table", "agartest_pool");
+	AG_SetString(db, "init-cmd", initCmd);
+	AG_SetString(db, "charset", charset);
+	if (AG_DbOpen(db, getenv("AGAR_TEST_MYSQL_DB"), 0) == -1) {
+		TestMsg(ti, "mysql: %s", AG_GetError());
+		AG_ObjectDestroy(db);
+		return (NULL);
+	}
+	return (db);
+}
+
+static void
+CloseMySQL(AG_Db *db)
+{
+	AG_DbClose(db);
+	AG_ObjectDestroy(db);
+}
+
+/*
+ * Check whether the next open with the given options reuses the pooled
+ * connection, identified by the record in its temporary table.
+ */
+static int
+CheckPooled(AG_TestInstance *ti, const char *initCmd, const char *charset,
+    int reused)
+{
+	AG_Db *db;
+	int rv;
+
+	if ((db = OpenMySQL(ti, initCmd, charset)) == NULL) {
+		return (-1);
+	}
+	rv = CheckValue(ti, db, "k", reused ? "1" : NULL);
+	CloseMySQL(db);
+	return (rv);
+}
+
+# ifdef AG_THREADS
+static void *
+MySQLThreadMain(void *arg)
+{
+	AG_TestInstance *ti = arg;
+
+	return (void *)(long)CheckPooled(ti, MYSQL_TEST_TABLE, NULL, 1);
+}
+# endif
+
+/* Check that pooled connections are only reused with identical options. */
+static int
+TestMySQLPool(AG_TestInstance *ti)
+{
+	AG_Db *db;
+# ifdef AG_THREADS
+	AG_Thread th;
+	void *thRv;
+# endif
+
+	if (getenv("AGAR_TEST_MYSQL_DB") == NULL) {
+		TestMsgS(ti, "AGAR_TEST_MYSQL_DB is not set; skipping");
+		return (0);
+	}
+	AG_DbMySQLDestroy();
+	if ((db = OpenMySQL(ti, MYSQL_TEST_TABLE, NULL)) == NULL) {
+		return (-1);
+	}
+	if (PutString(ti, db, "k", "1") == -1) {
+		CloseMySQL(db);
+		return (-1);
+	}
+	CloseMySQL(db);
+
+	if (CheckPooled(ti, MYSQL_TEST_TABLE, NULL, 1) == -1) {
+		TestMsgS(ti, "Pooled connection was not reused");
+		return (-1);
+	}
+	if (CheckPooled(ti, MYSQL_TEST_TABLE " ENGINE=MEMORY", NULL, 0) == -1 ||
+	    CheckPooled(ti, MYSQL_TEST_TABLE, "utf8", 0) == -1) {
+		TestMsgS(ti, "Pooled connection reused with other options");
+		return (-1);
+	}
+# ifdef AG_THREADS
+	AG_ThreadCreate(&th, MySQLThreadMain, ti);
+	AG_ThreadJoin(th, &thRv);
+	if (thRv != NULL) {
+		TestMsgS(ti, "Pooled connection unusable from another thread");
+		return (-1);
+	}
+# endif
+	AG_DbMySQLDestroy();
+	if (CheckPooled(ti, MYSQL_TEST_TABLE, NULL, 0) == -1) {
+		TestMsgS(ti, "Idle connection survived AG_DbMySQLDestroy()");
+		return (-1);
+	}
+	AG_DbMySQLDestroy();
+	return (0);
+}
+#endif /* HAVE_MYSQL */
+
+static int
+Test(void *obj)
+{
+	AG_TestInstance *ti = obj;
+	int rv = 0;
+#ifdef HAVE_SYS_MMAN_H
+	char path[AG_PATHNAME_MAX];
+	AG_Db *db;
+
+	AG_GetString(agConfig, "tmp-path", path, sizeof(path));
+	if (AG_CreateDataDir() == -1) {
+		TestMsg(ti, "%s: %s", path, AG_GetError());
+		return (-1);
+	}
+	Strlcat(path, AG_PATHSEP "agartest-db.log", sizeof(path));
+	unlink(path);
+
+	TestMsgS(ti, "Testing the log backend");
+	if ((db = AG_DbNew("log")) == NULL ||
+	    AG_DbOpen(db, path, 0) == -1) {
+		TestMsg(ti, "%s: %s", path, AG_GetError());
+		return (-1);
+	}
+	if (TestBatches(ti, db) == -1 || TestTxn(ti, db) == -1) {
+		rv = -1;
+	}
+	CloseLog(db);
+
+	TestMsgS(ti, "Testing log recovery");
+	if (TestLogRecovery(ti, path) == -1) {
+		rv = -1;
+	}
+#ifdef AG_THREADS
+	TestMsgS(ti, "Testing log compaction with concurrent writes");
+	if (TestLogCompaction(ti, path) == -1) {
+		rv = -1;
+	}
+#endif
+	unlink(path);
+#endif /* HAVE_SYS_MMAN_H */
+
+	TestMsgS(ti, "Testing transaction emulation");
+	AG_RegisterClass(&memDbClass);
+	AG_ObjectInitStatic(&mdb, &memDbClass);
+	if (AG_DbOpen(AGDB(&mdb), NULL, 0) == -1) {
+		TestMsg(ti, "Open: %s", AG_GetError());
+		rv = -1;
+		goto out;
+	}
+	if (TestBatches(ti, AGDB(&mdb)) == -1 ||
+	    TestTxn(ti, AGDB(&mdb)) == -1) {
+		rv = -1;
+	} else if (mdb.nPutBatch != 1 + 2) {
+		TestMsg(ti, "Commit made %u batch calls (expected 2)",
+		    mdb.nPutBatch - 1);
+		rv = -1;
+	}
+	TestMsgS(ti, "Testing the AG_DbObject cache");
+	if (TestObjectCache(ti, AGDB(&mdb)) == -1) {
+		rv = -1;
+	}
+	AG_DbClose(AGDB(&mdb));
+out:
+	AG_ObjectDestroy(&mdb);
+	AG_UnregisterClass(&memDbClass);
+#ifdef HAVE_MYSQL
+	TestMsgS(ti, "Testing MySQL connection pooling");
+	if (TestMySQLPool(ti) == -1) {
+		rv = -1;
+	}
+#endif
+	return (rv);
+}
+
+const AG_TestCase dbTest = {
+	"db",
+	N_("Test AG_Db batches and transactions"),
+	"1.6.0",
+	0,
+	sizeof(AG_TestInstance),
+	NULL,		/* init */
+	NULL,		/* destroy */
+	Test,
+	NULL,		/* testGUI */
+	NULL		/* bench */
+};
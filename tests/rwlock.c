@@ -0,0 +1,248 @@
+/*	Public domain	*/
+
+/*
+ * This program tests AG_RWLock(3): writer recursion, concurrent readers,
+ * mutual exclusion of writers, and the VFS lock of AG_Object(3) across
+ * detach operations.
+ */
+
+#include "agartest.h"
+
+#include <agar/config/ag_threads.h>
+
+#ifdef AG_THREADS
+
+#define NTHREADS	8
+#define NITERS		20000
+#define TIMEOUT		5000		/* Give up waiting after (ms) */
+
+typedef struct {
+	AG_RWLock rw;
+	Uint a, b;			/* Invariant: a == b under the lock */
+	AG_AtomicInt nBad;		/* Invariant violations seen */
+	AG_AtomicInt done;		/* Set by helper threads */
+	AG_Object *vfs;			/* For the VFS test */
+} RWState;
+
+/* Wait for a helper thread to set st->done. */
+static int
+WaitDone(RWState *st)
+{
+	int i;
+
+	for (i = 0; i < TIMEOUT; i++) {
+		if (AG_AtomicGet(&st->done))
+			return (0);
+		AG_Delay(1);
+	}
+	return (-1);
+}
+
+static void *
+ReadOnce(void *arg)
+{
+	RWState *st = arg;
+
+	AG_RWLockRdLock(&st->rw);
+	AG_AtomicSet(&st->done, 1);
+	AG_RWLockUnlock(&st->rw);
+	return (NULL);
+}
+
+static void *
+Worker(void *arg)
+{
+	RWState *st = arg;
+	int i, isWriter = (AG_AtomicInc(&st->done) % 2);
+
+	for (i = 0; i < NITERS; i++) {
+		if (isWriter) {
+			AG_RWLockWrLock(&st->rw);
+			st->a++;
+			AG_RWLockRdLock(&st->rw);	/* Nested in write lock */
+			if (st->a != st->b+1) {
+				AG_AtomicInc(&st->nBad);
+			}
+			AG_RWLockUnlock(&st->rw);
+			st->b++;
+			AG_RWLockUnlock(&st->rw);
+		} else {
+			AG_RWLockRdLock(&st->rw);
+			if (st->a != st->b) {
+				AG_AtomicInc(&st->nBad);
+			}
+			AG_RWLockUnlock(&st->rw);
+		}
+	}
+	return (NULL);
+}
+
+static void *
+LockVFSOnce(void *arg)
+{
+	RWState *st = arg;
+
+	AG_LockVFS(st->vfs);
+	AG_AtomicSet(&st->done, 1);
+	AG_UnlockVFS(st->vfs);
+	return (NULL);
+}
+
+/* The writer may lock again for writing or reading. */
+static int
+TestRecursion(AG_TestInstance *ti, RWState *st)
+{
+	AG_Thread th;
+
+	AG_RWLockWrLock(&st->rw);
+	AG_RWLockWrLock(&st->rw);
+	AG_RWLockRdLock(&st->rw);
+	AG_RWLockUnlock(&st->rw);
+	AG_RWLockUnlock(&st->rw);
+	AG_RWLockUnlock(&st->rw);
+
+	AG_AtomicSet(&st->done, 0);
+	AG_ThreadCreate(&th, ReadOnce, st);
+	if (WaitDone(st) == -1) {
+		TestMsgS(ti, "Nested write lock was not released");
+		return (-1);
+	}
+	AG_ThreadJoin(th, NULL);
+	return (0);
+}
+
+/* A reader must not block another reader. */
+static int
+TestSharedReaders(AG_TestInstance *ti, RWState *st)
+{
+	AG_Thread th;
+
+	AG_RWLockRdLock(&st->rw);
+	AG_AtomicSet(&st->done, 0);
+	AG_ThreadCreate(&th, ReadOnce, st);
+	if (WaitDone(st) == -1) {
+		TestMsgS(ti, "Reader blocked by another reader");
+		return (-1);
+	}
+	AG_RWLockUnlock(&st->rw);
+	AG_ThreadJoin(th, NULL);
+	return (0);
+}
+
+/* Readers never observe a writer's intermediate state. */
+static int
+TestExclusion(AG_TestInstance *ti, RWState *st)
+{
+	AG_Thread th[NTHREADS];
+	int i;
+
+	st->a = 0;
+	st->b = 0;
+	AG_AtomicSet(&st->nBad, 0);
+	AG_AtomicSet(&st->done, 0);
+	for (i = 0; i < NTHREADS; i++) {
+		AG_ThreadCreate(&th[i], Worker, st);
+	}
+	for (i = 0; i < NTHREADS; i++) {
+		AG_ThreadJoin(th[i], NULL);
+	}
+	if (AG_AtomicGet(&st->nBad) != 0) {
+		TestMsg(ti, "%d inconsistent states observed",
+		    AG_AtomicGet(&st->nBad));
+		return (-1);
+	}
+	if (st->a != (NTHREADS/2)*NITERS || st->a != st->b) {
+		TestMsg(ti, "Lost updates (%u/%u, expected %u)", st->a, st->b,
+		    (NTHREADS/2)*NITERS);
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Detaching an object while its VFS is locked through it must not cause
+ * AG_UnlockVFS() to release the lock of the object's new VFS.
+ */
+static int
+TestVFSDetach(AG_TestInstance *ti, RWState *st)
+{
+	AG_Object *root, *chld;
+	AG_Thread th;
+
+	root = AG_ObjectNew(NULL, "root", &agObjectClass);
+	chld = AG_ObjectNew(root, "child", &agObjectClass);
+
+	AG_RLockVFS(chld);
+	if (AG_ObjectFindS(root, "/child") != chld) {
+		TestMsgS(ti, "AG_ObjectFind failed");
+	}
+	AG_UnlockVFS(chld);
+
+	AG_LockVFS(chld);
+	AG_ObjectDetach(chld);
+	if (chld->root != chld) {
+		TestMsgS(ti, "Detached object is not its own root");
+	}
+	AG_UnlockVFS(chld);
+
+	st->vfs = root;
+	AG_AtomicSet(&st->done, 0);
+	AG_ThreadCreate(&th, LockVFSOnce, st);
+	if (WaitDone(st) == -1) {
+		TestMsgS(ti, "VFS lock of former root was not released");
+		return (-1);
+	}
+	AG_ThreadJoin(th, NULL);
+
+	st->vfs = chld;
+	AG_AtomicSet(&st->done, 0);
+	AG_ThreadCreate(&th, LockVFSOnce, st);
+	if (WaitDone(st) == -1) {
+		TestMsgS(ti, "VFS lock of detached object is held");
+		return (-1);
+	}
+	AG_ThreadJoin(th, NULL);
+
+	AG_ObjectDestroy(chld);
+	AG_ObjectDestroy(root);
+	return (0);
+}
+
+static int
+Test(void *obj)
+{
+	AG_TestInstance *ti = obj;
+	RWState st;
+
+	AG_RWLockInit(&st.rw);
+	AG_AtomicSet(&st.done, 0);
+	AG_AtomicSet(&st.nBad, 0);
+
+	if (TestRecursion(ti, &st) == -1 ||
+	    TestSharedReaders(ti, &st) == -1 ||
+	    TestExclusion(ti, &st) == -1 ||
+	    TestVFSDetach(ti, &st) == -1)
+		return (-1);
+
+	AG_RWLockDestroy(&st.rw);
+	return (0);
+}
+
+#endif /* AG_THREADS */
+
+const AG_TestCase rwlockTest = {
+	"rwlock",
+	N_("Test AG_RWLock and the VFS lock"),
+	"1.6.0",
+	0,
+	sizeof(AG_TestInstance),
+	NULL,		/* init */
+	NULL,		/* destroy */
+#ifdef AG_THREADS
+	Test,
+#else
+	NULL,		/* test */
+#endif
+	NULL,		/* testGUI */
+	NULL		/* bench */
+};
@@ -0,0 +1,200 @@
+/*	Public domain	*/
+
+/*
+ * This program tests the AG_Task(3) scheduler: task groups, tasks spawning
+ * tasks, parallel loops, serial mode and restarting the scheduler.
+ */
+
+#include "agartest.h"
+
+#include <string.h>
+
+#define NTASKS		64
+#define NSUBTASKS	16
+#define NELEMS		100000
+
+typedef struct {
+	AG_TaskGroup *g;
+	AG_Mutex lock;
+	Uint nRun;
+} TaskState;
+
+static Uint elems[NELEMS];
+
+static void
+CountTask(void *arg)
+{
+	TaskState *ts = arg;
+
+	AG_MutexLock(&ts->lock);
+	ts->nRun++;
+	AG_MutexUnlock(&ts->lock);
+}
+
+/* Task which queues more tasks in the same group. */
+static void
+SpawnTask(void *arg)
+{
+	TaskState *ts = arg;
+	int i;
+
+	for (i = 0; i < NSUBTASKS; i++) {
+		AG_TaskRun(ts->g, CountTask, ts);
+	}
+	CountTask(ts);
+}
+
+static void
+FillRange(void *arg, Uint begin, Uint end)
+{
+	Uint *last = arg, i;
+
+	if (last != NULL) {			/* Serial mode: check order */
+		if (begin != *last) {
+			return;
+		}
+		*last = end;
+	}
+	for (i = begin; i < end; i++)
+		elems[i] = i*2 + 1;
+}
+
+static int
+CheckElems(AG_TestInstance *ti)
+{
+	Uint i;
+
+	for (i = 0; i < NELEMS; i++) {
+		if (elems[i] != i*2 + 1) {
+			TestMsg(ti, "ParallelFor: element %u not processed", i);
+			return (-1);
+		}
+	}
+	return (0);
+}
+
+/* Run tasks, nested tasks and a parallel loop with the running scheduler. */
+static int
+RunTasks(AG_TestInstance *ti)
+{
+	AG_TaskGroup g;
+	TaskState ts;
+	int i, rv = 0;
+
+	AG_TaskGroupInit(&g);
+	AG_MutexInit(&ts.lock);
+	ts.g = &g;
+	ts.nRun = 0;
+
+	for (i = 0; i < NTASKS; i++) {
+		AG_TaskRun(&g, CountTask, &ts);
+	}
+	AG_TaskWait(&g);
+	if (ts.nRun != NTASKS) {
+		TestMsg(ti, "Ran %u of %u tasks", ts.nRun, NTASKS);
+		rv = -1;
+	}
+
+	ts.nRun = 0;
+	for (i = 0; i < NTASKS; i++) {
+		AG_TaskRun(&g, SpawnTask, &ts);
+	}
+	AG_TaskWait(&g);
+	if (ts.nRun != NTASKS*(NSUBTASKS+1)) {
+		TestMsg(ti, "Ran %u of %u nested tasks", ts.nRun,
+		    NTASKS*(NSUBTASKS+1));
+		rv = -1;
+	}
+
+	memset(elems, 0, sizeof(elems));
+	AG_TaskParallelFor(NELEMS, 0, FillRange, NULL);
+	if (CheckElems(ti) == -1) {
+		rv = -1;
+	}
+	memset(elems, 0, sizeof(elems));
+	AG_TaskParallelFor(NELEMS, 1000, FillRange, NULL);
+	if (CheckElems(ti) == -1) {
+		rv = -1;
+	}
+
+	AG_MutexDestroy(&ts.lock);
+	AG_TaskGroupDestroy(&g);
+	return (rv);
+}
+
+static int
+Test(void *obj)
+{
+	AG_TestInstance *ti = obj;
+	AG_TaskGroup g;
+	TaskState ts;
+	Uint last, i;
+	int rv = 0, run;
+
+	for (run = 0; run < 3; run++) {
+		if (AG_TaskInit(run == 0 ? 4 : 0, 0) == -1) {
+			TestMsg(ti, "AG_TaskInit: %s", AG_GetError());
+			return (-1);
+		}
+		if (run == 0) {
+			if (AG_TaskInit(2, 0) == 0) {
+				TestMsgS(ti, "AG_TaskInit succeeded twice");
+				rv = -1;
+			}
+			TestMsg(ti, "Running tasks on %u workers",
+			    AG_TaskWorkerCount());
+		}
+		if (RunTasks(ti) == -1) {
+			rv = -1;
+		}
+		AG_TaskDestroy();
+	}
+
+	TestMsgS(ti, "Running tasks in serial mode");
+	if (AG_TaskInit(4, AG_TASK_SERIAL) == -1) {
+		TestMsg(ti, "AG_TaskInit: %s", AG_GetError());
+		return (-1);
+	}
+	if (AG_TaskWorkerCount() != 1) {
+		TestMsgS(ti, "Serial mode has more than one worker");
+		rv = -1;
+	}
+	AG_TaskGroupInit(&g);
+	AG_MutexInit(&ts.lock);
+	ts.g = &g;
+	ts.nRun = 0;
+	for (i = 0; i < NTASKS; i++) {
+		AG_TaskRun(&g, CountTask, &ts);
+		if (ts.nRun != i+1) {
+			TestMsgS(ti, "Serial task did not run immediately");
+			rv = -1;
+			break;
+		}
+	}
+	AG_TaskWait(&g);
+	AG_MutexDestroy(&ts.lock);
+	AG_TaskGroupDestroy(&g);
+
+	memset(elems, 0, sizeof(elems));
+	last = 0;
+	AG_TaskParallelFor(NELEMS, 1000, FillRange, &last);
+	if (last != NELEMS || CheckElems(ti) == -1) {
+		TestMsgS(ti, "Serial ParallelFor out of order");
+		rv = -1;
+	}
+	AG_TaskDestroy();
+	return (rv);
+}
+
+const AG_TestCase taskTest = {
+	"task",
+	N_("Test the AG_Task scheduler"),
+	"1.6.0",
+	0,
+	sizeof(AG_TestInstance),
+	NULL,		/* init */
+	NULL,		/* destroy */
+	Test,
+	NULL,		/* testGUI */
+	NULL		/* bench */
+};
@@ -0,0 +1,1188 @@
+/*	Public domain	*/
+
+/*
+ * Load generator for the Agar web application server (WEB_QueryLoop(3)).
+ *
+ * webbench drives a server over loopback with a configurable number of
+ * concurrent connections, keep-alive, request mix, request body sizes and
+ * session counts, and reports throughput and latency percentiles as JSON.
+ *
+ * The server may be an existing one (-h, -p), a local child process started
+ * by webbench (-x), or a built-in application server (-S) which runs in a
+ * child of the benchmark process and provides the operations:
+ *
+ *	ping		Sessionless (answered by the Frontend itself).
+ *	bench_text	Plain text of size=N bytes (in the Worker).
+ *	bench_json	JSON array of n=N objects (in the Worker).
+ *	bench_html	Template rendering with variable substitution.
+ */
+
+#include <agar/core.h>
+#include <agar/core/web.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <errno.h>
+#include <time.h>
+
+#define BENCH_OPS_MAX		32
+#define BENCH_CONNS_MAX		4096
+#define BENCH_SESSIONS_MAX	1024
+#define BENCH_RDBUF_SIZE	65536
+
+/* Request type in the mix. */
+typedef struct bench_op {
+	char spec[128];			/* "op[?arg=val&...]" */
+	Uint weight;			/* Relative weight */
+	char *req;			/* Serialized request */
+	size_t reqLen;
+	Uint64 nReqs, nErrors, nHttpErrors;
+	Uint64 bytes;			/* Response bytes (incl. headers) */
+	Uint32 *lat;			/* Latencies (usec) */
+	size_t  latCount, latMax;
+} BENCH_Op;
+
+/* Response parser state. */
+enum bench_rd_state {
+	BENCH_RD_HEADER,		/* Reading status line and headers */
+	BENCH_RD_BODY,			/* Reading Content-Length bytes */
+	BENCH_RD_CHUNK_SIZE,		/* Reading chunk-size line */
+	BENCH_RD_CHUNK_DATA,		/* Reading chunk data (+CRLF) */
+	BENCH_RD_CHUNK_END,		/* Reading final CRLF */
+	BENCH_RD_EOF			/* Reading until close */
+};
+
+/* Client connection. */
+typedef struct bench_conn {
+	int fd;				/* Socket (or -1) */
+	int sess;			/* Session index (or -1) */
+	BENCH_Op *op;			/* Request in progress (or NULL) */
+	char  *req;			/* Request (including Cookie) */
+	size_t reqLen, reqOffs;
+	int    reqFree;			/* Free req after use */
+	Uint64 tSend;			/* Request start (usec) */
+	enum bench_rd_state rd;
+	char   buf[BENCH_RDBUF_SIZE];	/* Unparsed input */
+	size_t bufLen;
+	size_t remain;			/* Bytes left in body or chunk */
+	size_t respLen;			/* Response length so far */
+	int status;			/* HTTP status code */
+	int close;			/* Server will close connection */
+} BENCH_Conn;
+
+static BENCH_Op ops[BENCH_OPS_MAX];
+static Uint     nOps = 0, opWeightTotal = 0;
+static char     sessIDs[BENCH_SESSIONS_MAX][WEB_SESSID_MAX];
+static Uint     nSessions = 1;
+static Uint     nConns = 1;
+static Uint     duration = 10, warmup = 0;
+static Uint64   maxRequests = 0;
+static Uint     bodySize = 0;
+static int      keepAlive = 1;
+static int      deflateResp = 0;
+static Uint     reqTimeout = 30;
+static const char *host = "127.0.0.1";
+static const char *port = "8080";
+static const char *user = "bench";
+static const char *pass = "bench";
+static const char *loginOp = NULL;
+static struct addrinfo *srvAddr = NULL;
+static Uint64   nConnects = 0, nConnectErrors = 0, nTimeouts = 0;
+static Uint64   nStatus[6];
+static int      recording = 0;
+
+static Uint64
+Now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((Uint64)ts.tv_sec*1000000 + (Uint64)ts.tv_nsec/1000);
+}
+
+static void
+printusage(void)
+{
+	fprintf(stderr,
+	    "Usage: webbench [-CSz] [-b bodysize] [-c conns] [-d secs] "
+	    "[-F frontends]\n"
+	    "                [-h host] [-L loginop] [-n requests] "
+	    "[-o outfile]\n"
+	    "                [-P password] [-p port]\n"
+	    "                [-s sessions] [-t timeout] [-u user] "
+	    "[-w warmup]\n"
+	    "                [-x server-cmd] [op[?args][:weight] ...]\n");
+}
+
+/*
+ * Built-in application server.
+ */
+
+static int
+BenchText(WEB_Query *q)
+{
+	const char *s;
+	char line[64];
+	size_t size = 1024, n;
+
+	if ((s = WEB_Get(q, "size", 16)) != NULL)
+		size = (size_t)strtoul(s, NULL, 10);
+
+	memset(line, 'x', sizeof(line)-1);
+	line[sizeof(line)-1] = '\n';
+	for (n = 0; n < size; n += sizeof(line)) {
+		WEB_Write(q, line, (size-n < sizeof(line)) ? size-n :
+		                   sizeof(line));
+	}
+	return (0);
+}
+
+static int
+BenchJSON(WEB_Query *q)
+{
+	const char *s;
+	char name[32];
+	Uint i, count = 100;
+
+	if ((s = WEB_Get(q, "n", 16)) != NULL)
+		count = (Uint)strtoul(s, NULL, 10);
+
+	WEB_JSON_BeginArray(q, "items");
+	for (i = 0; i < count; i++) {
+		Snprintf(name, sizeof(name), "Item \"%u\"", i);
+		WEB_JSON_BeginObject(q, NULL);
+		WEB_JSON_Uint(q, "id", i);
+		WEB_JSON_String(q, "name", name);
+		WEB_JSON_Double(q, "value", (double)i / 7.0, 4);
+		WEB_JSON_Bool(q, "odd", i & 1);
+		WEB_JSON_EndObject(q);
+	}
+	WEB_JSON_EndArray(q);
+	return (0);
+}
+
+static int
+BenchHTML(WEB_Query *q)
+{
+	WEB_VAR_SetS("benchUser", webWorkerUser);
+	WEB_VAR_Set("benchCount", "%u", webApp->queryCount);
+	return WEB_OutputHTML(q, "bench");
+}
+
+static void
+BenchPing(WEB_Query *q)
+{
+	WEB_PutS(q, "pong\n");
+}
+
+static int
+BenchAuth(void *sess, const char *u, const char *p)
+{
+	return (0);
+}
+
+static void
+BenchLoginPage(WEB_Query *q)
+{
+	WEB_SetCode(q, "403 Forbidden");
+	WEB_PutS(q, "Login required\n");
+}
+
+static WEB_Command benchCommands[] = {
+	{ "bench_text", BenchText, "text/plain",       0, 0 },
+	{ "bench_json", BenchJSON, "[json]",           0, 0 },
+	{ "bench_html", BenchHTML, "text/html",        0, 0 },
+	{ NULL,         NULL,      NULL,               0, 0 }
+};
+
+static WEB_Module benchModule = {
+	"bench",
+	NULL,
+	"Benchmark",
+	"Benchmark operations",
+	NULL,			/* init */
+	NULL,			/* destroy */
+	NULL,			/* sessOpen */
+	NULL,			/* sessClose */
+	BenchText,		/* indexFn */
+	NULL,			/* menu */
+	benchCommands,
+	NULL,			/* sections */
+	NULL			/* prefork */
+};
+
+static WEB_SessionOps benchSessionOps = {
+	"webbench",
+	sizeof(WEB_Session),
+	0,
+	3600,			/* sessTimeout */
+	600,			/* workerTimeout */
+	NULL,			/* init */
+	NULL,			/* destroy */
+	NULL,			/* load */
+	NULL,			/* save */
+	BenchAuth,
+	{
+		{ "ping",	BenchPing,	"text/plain" },
+		{ NULL,		NULL,		NULL }
+	},
+	NULL,			/* sessOpen */
+	NULL,			/* sessRestored */
+	NULL,			/* sessClose */
+	NULL,			/* sessExpired */
+	NULL,			/* beginFrontQuery */
+	BenchLoginPage,
+	NULL,			/* logout */
+	NULL,			/* addSelectFDs */
+	NULL			/* procSelectFDs */
+};
+
+static WEB_Application benchApp = {
+	"webbench",
+	"Public domain",
+	{ "en", NULL },
+	"bench_text",
+	0,
+	NULL,			/* destroyFn */
+	NULL			/* logFn */
+};
+
+static const char benchTemplate[] =
+    "<!DOCTYPE html>\n"
+    "<html><head><title>$_(Benchmark)</title></head><body>\n"
+    "<h1>$_(Hello), $benchUser</h1>\n"
+    "<p>Served by $_progname: $benchCount queries.</p>\n"
+    "<table>\n";
+
+/* Create the working directory of the built-in server. */
+static int
+BenchServerSetup(char *dir, size_t dirLen)
+{
+	char path[FILENAME_MAX];
+	FILE *f;
+	int i;
+
+	Strlcpy(dir, "/tmp/webbench.XXXXXXXX", dirLen);
+	if (mkdtemp(dir) == NULL) {
+		AG_SetError("mkdtemp: %s", strerror(errno));
+		return (-1);
+	}
+	Snprintf(path, sizeof(path), "%s/html", dir);
+	if (mkdir(path, 0700) == -1) {
+		AG_SetError("%s: %s", path, strerror(errno));
+		return (-1);
+	}
+	Snprintf(path, sizeof(path), "%s/html/bench.html.en", dir);
+	if ((f = fopen(path, "w")) == NULL) {
+		AG_SetError("%s: %s", path, strerror(errno));
+		return (-1);
+	}
+	fputs(benchTemplate, f);
+	for (i = 0; i < 100; i++) {
+		fprintf(f, "<tr><td>%d</td><td>$benchUser</td>"
+		           "<td>$_(Row)</td></tr>\n", i);
+	}
+	fputs("</table></body></html>\n", f);
+	fclose(f);
+	return (0);
+}
+
+/* Run the built-in server (in a child process). */
+static void
+BenchServerMain(const char *dir, Uint nFrontends)
+{
+	if (chdir(dir) == -1) {
+		fprintf(stderr, "%s: %s\n", dir, strerror(errno));
+		_exit(1);
+	}
+	WEB_Init(&benchApp, 0, 0);
+	WEB_RegisterModule(&benchModule);
+	if (WEB_SetFrontends(nFrontends) == -1) {
+		fprintf(stderr, "webbench: %s\n", AG_GetError());
+		_exit(1);
+	}
+	WEB_QueryLoop(host, port, &benchSessionOps);
+	_exit(0);
+}
+
+/* Remove the working directory of the built-in server. */
+static void
+BenchServerCleanup(const char *dir)
+{
+	pid_t pid;
+
+	if ((pid = fork()) == 0) {
+		execl("/bin/rm", "rm", "-rf", dir, (char *)NULL);
+		_exit(1);
+	} else if (pid > 0) {
+		waitpid(pid, NULL, 0);
+	}
+}
+
+/* Start a local server with the given shell command. */
+static pid_t
+BenchServerExec(const char *cmd)
+{
+	pid_t pid;
+
+	if ((pid = fork()) == 0) {
+		setpgid(0, 0);
+		execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+		_exit(127);
+	}
+	return (pid);
+}
+
+/*
+ * Client side.
+ */
+
+/* Parse an "op[?args][:weight]" specification. */
+static int
+AddOp(const char *spec)
+{
+	BENCH_Op *op;
+	char *c;
+
+	if (nOps >= BENCH_OPS_MAX) {
+		AG_SetErrorS("Too many operations");
+		return (-1);
+	}
+	op = &ops[nOps];
+	memset(op, 0, sizeof(BENCH_Op));
+	Strlcpy(op->spec, spec, sizeof(op->spec));
+	op->weight = 1;
+	if ((c = strrchr(op->spec, ':')) != NULL) {
+		*c = '\0';
+		if ((op->weight = (Uint)strtoul(&c[1], NULL, 10)) == 0)
+			return (0);
+	}
+	opWeightTotal += op->weight;
+	nOps++;
+	return (0);
+}
+
+/* Serialize the request for an operation (without Cookie header). */
+static void
+InitOpRequest(BENCH_Op *op)
+{
+	char hdr[1024];
+	char *body = NULL;
+	int len;
+
+	if (bodySize > 0) {
+		body = Malloc(bodySize+1);
+		memcpy(body, "data=", (bodySize < 5) ? bodySize : 5);
+		if (bodySize > 5) {
+			memset(&body[5], 'x', bodySize-5);
+		}
+		len = Snprintf(hdr, sizeof(hdr),
+		    "POST /%s HTTP/1.1\r\n"
+		    "Host: %s\r\n"
+		    "User-Agent: webbench\r\n"
+		    "Connection: %s\r\n"
+		    "%s"
+		    "Content-Type: application/x-www-form-urlencoded\r\n"
+		    "Content-Length: %u\r\n",
+		    op->spec, host,
+		    keepAlive ? "keep-alive" : "close",
+		    deflateResp ? "Accept-Encoding: deflate\r\n" : "",
+		    bodySize);
+	} else {
+		len = Snprintf(hdr, sizeof(hdr),
+		    "GET /%s HTTP/1.1\r\n"
+		    "Host: %s\r\n"
+		    "User-Agent: webbench\r\n"
+		    "Connection: %s\r\n"
+		    "%s",
+		    op->spec, host,
+		    keepAlive ? "keep-alive" : "close",
+		    deflateResp ? "Accept-Encoding: deflate\r\n" : "");
+	}
+	op->reqLen = len;
+	op->req = Malloc(len + 1);
+	memcpy(op->req, hdr, len+1);
+	if (body != NULL) {
+		op->req = Realloc(op->req, len + bodySize);
+		memcpy(&op->req[len], body, bodySize);	/* After headers */
+		op->reqLen += bodySize;
+		free(body);
+	}
+}
+
+/* Build the request for a connection (adding Cookie and end of header). */
+static void
+BuildRequest(BENCH_Conn *c, BENCH_Op *op)
+{
+	size_t hdrLen = op->reqLen - bodySize, len;
+	char extra[WEB_SESSID_MAX+32];
+	int extraLen;
+
+	if (c->sess != -1 && sessIDs[c->sess][0] != '\0') {
+		extraLen = Snprintf(extra, sizeof(extra),
+		    "Cookie: sess=%s\r\n\r\n", sessIDs[c->sess]);
+	} else {
+		extraLen = Snprintf(extra, sizeof(extra), "\r\n");
+	}
+	len = op->reqLen + extraLen;
+	if (c->reqFree) { free(c->req); }
+	c->req = Malloc(len);
+	c->reqFree = 1;
+	memcpy(c->req, op->req, hdrLen);
+	memcpy(&c->req[hdrLen], extra, extraLen);
+	memcpy(&c->req[hdrLen+extraLen], &op->req[hdrLen], bodySize);
+	c->reqLen = len;
+	c->reqOffs = 0;
+	c->op = op;
+}
+
+/* Select an operation according to the weights. */
+static BENCH_Op *
+PickOp(void)
+{
+	Uint r = (Uint)(random() % opWeightTotal), i;
+
+	for (i = 0; i < nOps; i++) {
+		if (r < ops[i].weight) {
+			return (&ops[i]);
+		}
+		r -= ops[i].weight;
+	}
+	return (&ops[nOps-1]);
+}
+
+static int
+Connect(BENCH_Conn *c, int blocking)
+{
+	int one = 1;
+
+	if ((c->fd = socket(srvAddr->ai_family, srvAddr->ai_socktype,
+	    srvAddr->ai_protocol)) == -1) {
+		AG_SetError("socket: %s", strerror(errno));
+		return (-1);
+	}
+	setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	if (!blocking) {
+		fcntl(c->fd, F_SETFL, O_NONBLOCK);
+	}
+	if (connect(c->fd, srvAddr->ai_addr, srvAddr->ai_addrlen) == -1 &&
+	    errno != EINPROGRESS) {
+		AG_SetError("connect: %s", strerror(errno));
+		close(c->fd);
+		c->fd = -1;
+		return (-1);
+	}
+	c->bufLen = 0;
+	nConnects++;
+	return (0);
+}
+
+static void
+Disconnect(BENCH_Conn *c)
+{
+	if (c->fd != -1) {
+		close(c->fd);
+		c->fd = -1;
+	}
+	c->bufLen = 0;
+}
+
+/* Process a header line of the response. */
+static void
+ParseHeaderLine(BENCH_Conn *c, char *s)
+{
+	char *v;
+
+	if (strncasecmp(s, "Content-Length:", 15) == 0) {
+		c->remain = (size_t)strtoul(&s[15], NULL, 10);
+		if (c->rd == BENCH_RD_EOF)
+			c->rd = BENCH_RD_BODY;
+	} else if (strncasecmp(s, "Transfer-Encoding:", 18) == 0 &&
+	    strstr(&s[18], "chunked") != NULL) {
+		c->rd = BENCH_RD_CHUNK_SIZE;
+	} else if (strncasecmp(s, "Connection:", 11) == 0 &&
+	    strstr(&s[11], "close") != NULL) {
+		c->close = 1;
+	} else if (strncasecmp(s, "Set-Cookie: sess=", 17) == 0 &&
+	    c->sess != -1) {
+		v = &s[17];
+		v[strcspn(v, ";\r")] = '\0';
+		if (v[0] != '\0')
+			Strlcpy(sessIDs[c->sess], v, WEB_SESSID_MAX);
+	}
+}
+
+/*
+ * Consume input from the connection buffer. Return 1 if the response is
+ * complete, 0 if more input is needed or -1 on parse error.
+ */
+static int
+ParseResponse(BENCH_Conn *c, int eof)
+{
+	char *s, *end, *line, *next;
+	size_t n, used = 0;
+	int rv = 0;
+
+	for (;;) {
+		s = &c->buf[used];
+		n = c->bufLen - used;
+		switch (c->rd) {
+		case BENCH_RD_HEADER:
+			if ((end = memmem(s, n, "\r\n\r\n", 4)) == NULL) {
+				if (n == sizeof(c->buf)) { rv = -1; }
+				goto out;
+			}
+			*end = '\0';
+			if (strncmp(s, "HTTP/1.", 7) != 0 ||
+			    (line = strchr(s, ' ')) == NULL) {
+				rv = -1;
+				goto out;
+			}
+			c->status = atoi(&line[1]);
+			c->rd = BENCH_RD_EOF;
+			c->remain = 0;
+			for (line = strchr(s, '\n'); line != NULL; line = next) {
+				line++;
+				if ((next = strchr(line, '\n')) != NULL) {
+					next[-1] = '\0';	/* CR */
+				}
+				ParseHeaderLine(c, line);
+				if (next != NULL) { next[-1] = '\r'; }
+			}
+			used += (end - s) + 4;
+			if (c->rd == BENCH_RD_BODY && c->remain == 0) {
+				rv = 1;
+				goto out;
+			}
+			break;
+		case BENCH_RD_BODY:
+		case BENCH_RD_CHUNK_DATA:
+			if (n == 0) {
+				goto out;
+			}
+			if (n > c->remain) { n = c->remain; }
+			used += n;
+			c->remain -= n;
+			if (c->remain == 0) {
+				if (c->rd == BENCH_RD_BODY) {
+					rv = 1;
+					goto out;
+				}
+				c->rd = BENCH_RD_CHUNK_SIZE;
+			}
+			break;
+		case BENCH_RD_CHUNK_SIZE:
+			if ((end = memmem(s, n, "\r\n", 2)) == NULL) {
+				goto out;
+			}
+			c->remain = (size_t)strtoul(s, NULL, 16);
+			used += (end - s) + 2;
+			if (c->remain == 0) {
+				c->rd = BENCH_RD_CHUNK_END;
+			} else {
+				c->remain += 2;			/* CRLF */
+				c->rd = BENCH_RD_CHUNK_DATA;
+			}
+			break;
+		case BENCH_RD_CHUNK_END:
+			if (n < 2) {
+				goto out;
+			}
+			used += 2;
+			rv = 1;
+			goto out;
+		case BENCH_RD_EOF:
+			used += n;
+			if (eof) { rv = 1; }
+			goto out;
+		}
+	}
+out:
+	c->respLen += used;
+	if (used > 0 && used < c->bufLen) {
+		memmove(c->buf, &c->buf[used], c->bufLen - used);
+	}
+	c->bufLen -= used;
+	return (rv);
+}
+
+/* Record the completion (or failure) of a request. */
+static void
+Record(BENCH_Conn *c, int ok)
+{
+	BENCH_Op *op = c->op;
+	Uint64 t = Now() - c->tSend;
+
+	c->op = NULL;
+	if (!recording) {
+		return;
+	}
+	op->nReqs++;
+	if (!ok) {
+		op->nErrors++;
+		return;
+	}
+	op->bytes += c->respLen;
+	if (c->status >= 100 && c->status < 600) {
+		nStatus[c->status/100]++;
+	}
+	if (c->status >= 400) {
+		op->nHttpErrors++;
+	}
+	if (op->latCount+1 > op->latMax) {
+		op->latMax = (op->latMax == 0) ? 4096 : op->latMax*2;
+		op->lat = Realloc(op->lat, op->latMax*sizeof(Uint32));
+	}
+	op->lat[op->latCount++] = (t > 0xffffffffULL) ? 0xffffffff : (Uint32)t;
+}
+
+/* Begin a new request on a connection. */
+static int
+StartRequest(BENCH_Conn *c)
+{
+	if (c->fd == -1 && Connect(c, 0) == -1)
+		return (-1);
+
+	BuildRequest(c, PickOp());
+	c->tSend = Now();
+	c->rd = BENCH_RD_HEADER;
+	c->respLen = 0;
+	c->status = 0;
+	c->close = !keepAlive;
+	return (0);
+}
+
+/* Open the sessions by authenticating (one blocking request each). */
+static int
+OpenSessions(void)
+{
+	BENCH_Conn *c;
+	BENCH_Op op;
+	char spec[128];
+	ssize_t rv;
+	Uint i;
+	int done;
+
+	c = Malloc(sizeof(BENCH_Conn));
+	memset(c, 0, sizeof(BENCH_Conn));
+	for (i = 0; i < nSessions; i++) {
+		memset(&op, 0, sizeof(op));
+		Snprintf(spec, sizeof(spec), "%s%cusername=%s%u&password=%s",
+		    loginOp, (strchr(loginOp, '?') != NULL) ? '&' : '?',
+		    user, i, pass);
+		Strlcpy(op.spec, spec, sizeof(op.spec));
+		InitOpRequest(&op);
+
+		sessIDs[i][0] = '\0';
+		c->sess = (int)i;
+		if (Connect(c, 1) == -1) {
+			goto fail;
+		}
+		BuildRequest(c, &op);
+		c->rd = BENCH_RD_HEADER;
+		c->respLen = 0;
+		if (write(c->fd, c->req, c->reqLen) != (ssize_t)c->reqLen) {
+			AG_SetError("write: %s", strerror(errno));
+			goto fail;
+		}
+		for (;;) {
+			rv = read(c->fd, &c->buf[c->bufLen],
+			    sizeof(c->buf) - c->bufLen);
+			if (rv == -1) {
+				if (errno == EINTR) { continue; }
+				AG_SetError("read: %s", strerror(errno));
+				goto fail;
+			}
+			c->bufLen += rv;
+			if ((done = ParseResponse(c, (rv == 0))) == 1) {
+				break;
+			} else if (done == -1 || rv == 0) {
+				AG_SetErrorS("Bad response to login");
+				goto fail;
+			}
+		}
+		Disconnect(c);
+		free(op.req);
+		if (sessIDs[i][0] == '\0') {
+			AG_SetError("Login failed (HTTP %d)", c->status);
+			goto fail_free;
+		}
+	}
+	free(c->req);
+	free(c);
+	return (0);
+fail:
+	Disconnect(c);
+	free(op.req);
+fail_free:
+	free(c->req);
+	free(c);
+	return (-1);
+}
+
+/* Wait for the server to accept connections. */
+static int
+WaitForServer(Uint secs)
+{
+	BENCH_Conn c;
+	Uint64 tEnd = Now() + (Uint64)secs*1000000;
+
+	for (;;) {
+		if (Connect(&c, 1) == 0) {
+			Disconnect(&c);
+			nConnects = 0;
+			return (0);
+		}
+		if (Now() > tEnd) {
+			return (-1);
+		}
+		usleep(50000);
+	}
+}
+
+/* Run the benchmark loop until the duration or request count is reached. */
+static Uint64
+RunLoop(BENCH_Conn *conns)
+{
+	struct pollfd *pfd;
+	Uint64 tStart, tNow, tRecord, tEnd, nStarted = 0;
+	Uint i, nActive;
+	ssize_t rv;
+	int stopping = 0, done;
+
+	pfd = Malloc(nConns*sizeof(struct pollfd));
+	tStart = Now();
+	tRecord = tStart + (Uint64)warmup*1000000;
+	tEnd = tRecord + (Uint64)duration*1000000;
+	recording = (warmup == 0);
+
+	for (;;) {
+		tNow = Now();
+		if (!recording && tNow >= tRecord) {
+			recording = 1;
+			tStart = tNow;
+			nStarted = 0;
+		}
+		if ((maxRequests == 0 && tNow >= tEnd) ||
+		    (maxRequests > 0 && recording && nStarted >= maxRequests))
+			stopping = 1;
+
+		for (i = 0, nActive = 0; i < nConns; i++) {
+			BENCH_Conn *c = &conns[i];
+
+			pfd[i].fd = -1;
+			pfd[i].events = 0;
+			pfd[i].revents = 0;
+			if (c->op == NULL) {
+				if (stopping) {
+					continue;
+				}
+				if (StartRequest(c) == -1) {
+					nConnectErrors++;
+					continue;
+				}
+				nStarted++;
+			} else if (tNow - c->tSend >
+			           (Uint64)reqTimeout*1000000) {
+				nTimeouts++;
+				Record(c, 0);
+				Disconnect(c);
+				continue;
+			}
+			pfd[i].fd = c->fd;
+			pfd[i].events = (c->reqOffs < c->reqLen) ? POLLOUT :
+			                                             POLLIN;
+			nActive++;
+		}
+		if (nActive == 0) {
+			if (stopping) {
+				break;
+			}
+			usleep(10000);			/* Connect failures */
+			continue;
+		}
+		if (poll(pfd, nConns, 100) == -1 && errno != EINTR) {
+			AG_SetError("poll: %s", strerror(errno));
+			break;
+		}
+		for (i = 0; i < nConns; i++) {
+			BENCH_Conn *c = &conns[i];
+
+			if (pfd[i].revents == 0) {
+				continue;
+			}
+			if (c->reqOffs < c->reqLen) {
+				rv = write(c->fd, &c->req[c->reqOffs],
+				    c->reqLen - c->reqOffs);
+				if (rv == -1) {
+					if (errno == EAGAIN || errno == EINTR) {
+						continue;
+					}
+					goto fail;
+				}
+				c->reqOffs += rv;
+				continue;
+			}
+			rv = read(c->fd, &c->buf[c->bufLen],
+			    sizeof(c->buf) - c->bufLen);
+			if (rv == -1) {
+				if (errno == EAGAIN || errno == EINTR) {
+					continue;
+				}
+				goto fail;
+			}
+			c->bufLen += rv;
+			if ((done = ParseResponse(c, (rv == 0))) == -1 ||
+			    (done == 0 && rv == 0)) {
+				goto fail;
+			} else if (done == 0) {
+				continue;
+			}
+			if (c->bufLen > 0) {
+				c->close = 1;		/* Unexpected data */
+			}
+			Record(c, 1);
+			if (c->close || rv == 0) {
+				Disconnect(c);
+			}
+			continue;
+fail:
+			Record(c, 0);
+			Disconnect(c);
+		}
+	}
+	free(pfd);
+	return (Now() - tStart);
+}
+
+static int
+CompareLatency(const void *p1, const void *p2)
+{
+	Uint32 a = *(const Uint32 *)p1, b = *(const Uint32 *)p2;
+
+	return (a < b) ? -1 : (a > b) ? 1 : 0;
+}
+
+/* Print latency statistics for a sorted sample. */
+static void
+PrintLatency(FILE *f, const Uint32 *lat, size_t count)
+{
+	static const struct { const char *name; double p; } pct[] = {
+		{ "p50",  0.50 },
+		{ "p90",  0.90 },
+		{ "p99",  0.99 },
+		{ "p999", 0.999 }
+	};
+	double sum = 0.0;
+	size_t i;
+
+	if (count == 0) {
+		fprintf(f, "{}");
+		return;
+	}
+	for (i = 0; i < count; i++) {
+		sum += lat[i];
+	}
+	fprintf(f, "{\"min\": %u, \"mean\": %.1f", lat[0], sum/count);
+	for (i = 0; i < sizeof(pct)/sizeof(pct[0]); i++) {
+		size_t k = (size_t)(pct[i].p * (count-1) + 0.5);
+
+		fprintf(f, ", \"%s\": %u", pct[i].name, lat[k]);
+	}
+	fprintf(f, ", \"max\": %u}", lat[count-1]);
+}
+
+/* Write a string to a JSON output stream. */
+static void
+PrintString(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for (; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\') {
+			fputc('\\', f);
+			fputc(*s, f);
+		} else if ((Uchar)*s < 0x20) {
+			fprintf(f, "\\u%04x", (Uchar)*s);
+		} else {
+			fputc(*s, f);
+		}
+	}
+	fputc('"', f);
+}
+
+static void
+PrintResults(FILE *f, Uint64 elapsed, const char *server)
+{
+	Uint64 nReqs = 0, nErrors = 0, nHttpErrors = 0, bytes = 0;
+	Uint32 *all;
+	size_t nAll = 0;
+	double secs = (double)elapsed / 1e6;
+	Uint i;
+
+	for (i = 0; i < nOps; i++) {
+		BENCH_Op *op = &ops[i];
+
+		nReqs += op->nReqs;
+		nErrors += op->nErrors;
+		nHttpErrors += op->nHttpErrors;
+		bytes += op->bytes;
+		nAll += op->latCount;
+	}
+	all = Malloc((nAll+1)*sizeof(Uint32));
+	for (i = 0, nAll = 0; i < nOps; i++) {
+		BENCH_Op *op = &ops[i];
+
+		memcpy(&all[nAll], op->lat, op->latCount*sizeof(Uint32));
+		nAll += op->latCount;
+		qsort(op->lat, op->latCount, sizeof(Uint32), CompareLatency);
+	}
+	qsort(all, nAll, sizeof(Uint32), CompareLatency);
+
+	fprintf(f, "{\n  \"server\": ");
+	PrintString(f, server);
+	fprintf(f, ",\n  \"connections\": %u,\n", nConns);
+	fprintf(f, "  \"sessions\": %u,\n", nSessions);
+	fprintf(f, "  \"keepalive\": %s,\n", keepAlive ? "true" : "false");
+	fprintf(f, "  \"deflate\": %s,\n", deflateResp ? "true" : "false");
+	fprintf(f, "  \"body_size\": %u,\n", bodySize);
+	fprintf(f, "  \"duration\": %.3f,\n", secs);
+	fprintf(f, "  \"requests\": %llu,\n", (unsigned long long)nReqs);
+	fprintf(f, "  \"errors\": %llu,\n", (unsigned long long)nErrors);
+	fprintf(f, "  \"timeouts\": %llu,\n", (unsigned long long)nTimeouts);
+	fprintf(f, "  \"http_errors\": %llu,\n",
+	    (unsigned long long)nHttpErrors);
+	fprintf(f, "  \"status\": {\"1xx\": %llu, \"2xx\": %llu, "
+	           "\"3xx\": %llu, \"4xx\": %llu, \"5xx\": %llu},\n",
+	    (unsigned long long)nStatus[1], (unsigned long long)nStatus[2],
+	    (unsigned long long)nStatus[3], (unsigned long long)nStatus[4],
+	    (unsigned long long)nStatus[5]);
+	fprintf(f, "  \"connects\": %llu,\n", (unsigned long long)nConnects);
+	fprintf(f, "  \"connect_errors\": %llu,\n",
+	    (unsigned long long)nConnectErrors);
+	fprintf(f, "  \"bytes\": %llu,\n", (unsigned long long)bytes);
+	fprintf(f, "  \"throughput\": %.1f,\n",
+	    (secs > 0.0) ? (double)(nReqs - nErrors)/secs : 0.0);
+	fprintf(f, "  \"latency_us\": ");
+	PrintLatency(f, all, nAll);
+	fprintf(f, ",\n  \"ops\": [\n");
+	for (i = 0; i < nOps; i++) {
+		BENCH_Op *op = &ops[i];
+
+		fprintf(f, "    {\"op\": ");
+		PrintString(f, op->spec);
+		fprintf(f, ", \"weight\": %u, \"requests\": %llu, "
+		           "\"errors\": %llu, \"http_errors\": %llu, "
+		           "\"throughput\": %.1f,\n     \"latency_us\": ",
+		    op->weight,
+		    (unsigned long long)op->nReqs,
+		    (unsigned long long)op->nErrors,
+		    (unsigned long long)op->nHttpErrors,
+		    (secs > 0.0) ? (double)(op->nReqs - op->nErrors)/secs : 0.0);
+		PrintLatency(f, op->lat, op->latCount);
+		fprintf(f, "}%s\n", (i < nOps-1) ? "," : "");
+	}
+	fprintf(f, "  ]\n}\n");
+	free(all);
+}
+
+int
+main(int argc, char *argv[])
+{
+	char serverDir[FILENAME_MAX], serverName[256];
+	const char *serverCmd = NULL, *outFile = NULL;
+	extern char *optarg;
+	extern int optind;
+	struct addrinfo hints;
+	BENCH_Conn *conns;
+	Uint nFrontends = 1, i;
+	int c, rv, builtin = 0;
+	pid_t serverPID = -1;
+	Uint64 elapsed;
+	FILE *f = stdout;
+
+	if (AG_InitCore("webbench", 0) == -1) {
+		fprintf(stderr, "%s\n", AG_GetError());
+		return (1);
+	}
+	while ((c = getopt(argc, argv, "?b:c:Cd:F:h:L:n:o:p:P:s:St:u:w:x:z"))
+	    != -1) {
+		switch (c) {
+		case 'b':
+			bodySize = (Uint)strtoul(optarg, NULL, 10);
+			break;
+		case 'c':
+			nConns = (Uint)strtoul(optarg, NULL, 10);
+			break;
+		case 'C':
+			keepAlive = 0;
+			break;
+		case 'd':
+			duration = (Uint)strtoul(optarg, NULL, 10);
+			break;
+		case 'F':
+			nFrontends = (Uint)strtoul(optarg, NULL, 10);
+			break;
+		case 'h':
+			host = optarg;
+			break;
+		case 'L':
+			loginOp = optarg;
+			break;
+		case 'n':
+			maxRequests = (Uint64)strtoull(optarg, NULL, 10);
+			break;
+		case 'o':
+			outFile = optarg;
+			break;
+		case 'p':
+			port = optarg;
+			break;
+		case 'P':
+			pass = optarg;
+			break;
+		case 's':
+			nSessions = (Uint)strtoul(optarg, NULL, 10);
+			break;
+		case 'S':
+			builtin = 1;
+			break;
+		case 't':
+			reqTimeout = (Uint)strtoul(optarg, NULL, 10);
+			break;
+		case 'u':
+			user = optarg;
+			break;
+		case 'w':
+			warmup = (Uint)strtoul(optarg, NULL, 10);
+			break;
+		case 'x':
+			serverCmd = optarg;
+			break;
+		case 'z':
+			deflateResp = 1;
+			break;
+		case '?':
+		default:
+			printusage();
+			return (1);
+		}
+	}
+	if (nConns < 1 || nConns > BENCH_CONNS_MAX ||
+	    nSessions > BENCH_SESSIONS_MAX ||
+	    (builtin && serverCmd != NULL)) {
+		printusage();
+		return (1);
+	}
+	for (i = optind; i < (Uint)argc; i++) {
+		if (AddOp(argv[i]) == -1)
+			goto fail;
+	}
+	if (optind == argc && builtin) {
+		AddOp("bench_text:4");
+		AddOp("bench_json:2");
+		AddOp("bench_html:2");
+		AddOp("ping:1");
+	}
+	if (nOps == 0) {
+		printusage();
+		return (1);
+	}
+	if (loginOp == NULL) {
+		loginOp = (builtin) ? "bench_text" : ops[0].spec;
+	}
+	for (i = 0; i < nOps; i++)
+		InitOpRequest(&ops[i]);
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = PF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if ((rv = getaddrinfo(host, port, &hints, &srvAddr)) != 0) {
+		AG_SetError("%s:%s: %s", host, port, gai_strerror(rv));
+		goto fail;
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	if (builtin) {
+		if (BenchServerSetup(serverDir, sizeof(serverDir)) == -1) {
+			goto fail;
+		}
+		if ((serverPID = fork()) == 0) {
+			setpgid(0, 0);
+			BenchServerMain(serverDir, nFrontends);
+		}
+		Snprintf(serverName, sizeof(serverName),
+		    "builtin (%u frontends)", nFrontends);
+	} else if (serverCmd != NULL) {
+		serverPID = BenchServerExec(serverCmd);
+		Strlcpy(serverName, serverCmd, sizeof(serverName));
+	} else {
+		Snprintf(serverName, sizeof(serverName), "%s:%s", host, port);
+	}
+	if (serverPID == -1 && (builtin || serverCmd != NULL)) {
+		AG_SetError("fork: %s", strerror(errno));
+		goto fail;
+	}
+	if (WaitForServer(10) == -1) {
+		AG_SetError("%s:%s: Server not responding", host, port);
+		goto fail_server;
+	}
+	if (nSessions > 0 && OpenSessions() == -1)
+		goto fail_server;
+
+	conns = Malloc(nConns*sizeof(BENCH_Conn));
+	memset(conns, 0, nConns*sizeof(BENCH_Conn));
+	for (i = 0; i < nConns; i++) {
+		conns[i].fd = -1;
+		conns[i].sess = (nSessions > 0) ? (int)(i % nSessions) : -1;
+	}
+	elapsed = RunLoop(conns);
+
+	if (outFile != NULL && (f = fopen(outFile, "w")) == NULL) {
+		AG_SetError("%s: %s", outFile, strerror(errno));
+		goto fail_server;
+	}
+	PrintResults(f, elapsed, serverName);
+	if (f != stdout) { fclose(f); }
+
+	for (i = 0; i < nConns; i++) {
+		Disconnect(&conns[i]);
+		if (conns[i].reqFree) { free(conns[i].req); }
+	}
+	free(conns);
+	if (serverPID > 0) {
+		kill(-serverPID, SIGTERM);
+		waitpid(serverPID, NULL, 0);
+	}
+	if (builtin) {
+		BenchServerCleanup(serverDir);
+	}
+	freeaddrinfo(srvAddr);
+	AG_Destroy();
+	return (0);
+fail_server:
+	if (serverPID > 0) {
+		kill(-serverPID, SIGTERM);
+		waitpid(serverPID, NULL, 0);
+	}
+	if (builtin) {
+		BenchServerCleanup(serverDir);
+	}
+fail:
+	fprintf(stderr, "webbench: %s\n", AG_GetError());
+	AG_Destroy();
+	return (1);
+}